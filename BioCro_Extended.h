@@ -60,6 +60,28 @@ namespace BioCro {
              );
     }
 
+    /**
+     * A Solver_settings object bundles the five solver-related
+     * arguments of the Simulator constructor (and of make_ode_solver)
+     * so that they can be stored and passed around as a unit, for
+     * example when the same system is to be solved with several
+     * different solvers.
+     */
+    struct Solver_settings {
+        std::string ode_solver_name;
+        double output_step_size;
+        double adaptive_rel_error_tol;
+        double adaptive_abs_error_tol;
+        int adaptive_max_steps;
+    };
+
+    inline Solver make_ode_solver(Solver_settings const& settings) {
+        return make_ode_solver(settings.ode_solver_name,
+                               settings.output_step_size,
+                               settings.adaptive_rel_error_tol,
+                               settings.adaptive_abs_error_tol,
+                               settings.adaptive_max_steps);
+    }
 
     ////////////////////////////////////////////////////////////////////////////
     // Some utility functions useful in testing
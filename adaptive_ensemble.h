@@ -0,0 +1,220 @@
+#ifndef ADAPTIVE_ENSEMBLE_H
+#define ADAPTIVE_ENSEMBLE_H
+
+#include <cmath>      // for std::sqrt
+#include <functional> // for std::function
+
+#include "ensemble.h"
+
+namespace BioCro {
+
+// Running_statistics accumulates the mean and variance of a stream of
+// values in a single pass using Welford's algorithm, so the values
+// themselves need not be kept.
+class Running_statistics
+{
+   public:
+    void add(double value)
+    {
+        ++n;
+        double delta = value - running_mean;
+        running_mean += delta / n;
+        sum_of_squared_deviations += delta * (value - running_mean);
+    }
+
+    // Combines the statistics of another stream of values into these,
+    // as if its values had been added here (Chan et al.'s parallel
+    // update).  The result can differ in the last bits from adding the
+    // values one at a time, and depends on the order of combination.
+    void add(Running_statistics const& other)
+    {
+        if (other.n == 0) return;
+        if (n == 0) {
+            *this = other;
+            return;
+        }
+        size_t total = n + other.n;
+        double delta = other.running_mean - running_mean;
+        running_mean += delta * other.n / total;
+        sum_of_squared_deviations += other.sum_of_squared_deviations +
+            delta * delta * n * other.n / total;
+        n = total;
+    }
+
+    size_t count() const { return n; }
+
+    double mean() const { return running_mean; }
+
+    // The (unbiased) sample variance.
+    double variance() const
+    {
+        return n > 1 ? sum_of_squared_deviations / (n - 1) : 0.0;
+    }
+
+    double standard_error() const
+    {
+        return n > 0 ? std::sqrt(variance() / n) : 0.0;
+    }
+
+    // The width of the normal-approximation confidence interval for
+    // the mean, mean ± z * standard_error().  The default z gives a
+    // 95% interval.
+    double confidence_interval_width(double z = 1.96) const
+    {
+        return 2 * z * standard_error();
+    }
+
+   private:
+    size_t n {0};
+    double running_mean {0.0};
+    double sum_of_squared_deviations {0.0};
+};
+
+/**
+ * An Ensemble_statistic extracts a single number from the result of
+ * one ensemble member, for example the final value of some quantity:
+ *
+ *     [](BioCro::Simulation_result const& result) {
+ *         return result.at("position").back();
+ *     }
+ *
+ * An adaptive ensemble estimates the ensemble mean of each requested
+ * statistic.
+ */
+using Ensemble_statistic = std::function<double(Simulation_result const&)>;
+using Ensemble_statistics = std::unordered_map<std::string, Ensemble_statistic>;
+
+/**
+ * A Member_generator supplies the override values for the member with
+ * the given index, in the order of the ensemble's override names.
+ * Typically it draws them from some distribution.
+ */
+using Member_generator = std::function<std::vector<double>(size_t)>;
+
+struct Adaptive_ensemble_settings {
+    // Members are generated and run in waves of this many members.
+    size_t wave_size {50};
+    // Convergence isn't checked until at least this many members
+    // have been run.
+    size_t minimum_members {50};
+    // Stop here even if the statistics haven't converged.
+    size_t maximum_members {10000};
+    // The run is converged once the confidence interval for the mean
+    // of every statistic is no wider than this.
+    double target_width {0.01};
+    // Determines the confidence level; 1.96 gives 95% intervals.
+    double z {1.96};
+    // The members of each wave are run on this many threads, counting
+    // the calling thread.
+    size_t number_of_threads {1};
+};
+
+struct Adaptive_ensemble_result {
+    // The members that were actually run.
+    Ensemble_parameters members;
+    std::unordered_map<std::string, Running_statistics> statistics;
+    bool converged;
+    size_t number_of_waves;
+};
+
+// An Adaptive_ensemble_simulator runs an ensemble in waves until the
+// requested statistics have converged, rather than running a fixed,
+// conservatively chosen number of members.  Member results are
+// discarded once their statistics have been recorded.
+//
+// Each call to run_simulation starts a new ensemble, so its statistics
+// describe only the members it ran; since members are generated from
+// their indices, repeating a call repeats its members.  Members are
+// generated one at a time, but the members of a wave are run on a
+// Thread_pool, and their statistics are recorded in member order, so
+// the results don't depend on the number of threads.  The module
+// creators must be safe to use from several threads at once when more
+// than one is used.
+class Adaptive_ensemble_simulator
+{
+   public:
+    Adaptive_ensemble_simulator(
+        BioCro::State const& initial_state,
+        BioCro::Parameter_set const& base_parameters,
+        BioCro::Variable_names const& override_names,
+        Member_generator generate_member,
+        BioCro::System_drivers const& drivers,
+        BioCro::Module_set const& direct_mcs,
+        BioCro::Module_set const& differential_mcs,
+
+        std::string ode_solver_name,
+        double output_step_size,
+        double adaptive_rel_error_tol,
+        double adaptive_abs_error_tol,
+        int adaptive_max_steps)
+
+        :
+
+        empty_ensemble{
+            initial_state,
+            Ensemble_parameters{base_parameters, override_names},
+            drivers,
+            direct_mcs,
+            differential_mcs,
+            ode_solver_name,
+            output_step_size,
+            adaptive_rel_error_tol,
+            adaptive_abs_error_tol,
+            adaptive_max_steps},
+        generate_member{generate_member} {}
+
+    Adaptive_ensemble_result run_simulation(
+        Ensemble_statistics const& requested_statistics,
+        Adaptive_ensemble_settings const& settings)
+    {
+        if (settings.wave_size == 0) {
+            throw std::invalid_argument("The wave size of an adaptive "
+                                        "ensemble must be positive.");
+        }
+
+        std::unordered_map<std::string, Running_statistics> statistics;
+        for (auto& item : requested_statistics) {
+            statistics[item.first];
+        }
+
+        Ensemble_simulator ensemble {empty_ensemble};
+        Thread_pool pool {std::min(settings.number_of_threads, settings.wave_size)};
+        size_t waves {0};
+        bool converged {false};
+        while (!converged && ensemble.size() < settings.maximum_members) {
+            size_t wave_start = ensemble.size();
+            size_t wave_end = std::min(wave_start + settings.wave_size,
+                                       settings.maximum_members);
+            while (ensemble.size() < wave_end) {
+                ensemble.add_member(generate_member(ensemble.size()));
+            }
+            for (auto& result : ensemble.run_members(wave_start, wave_end, pool)) {
+                for (auto& item : requested_statistics) {
+                    statistics[item.first].add(item.second(result));
+                }
+            }
+            ++waves;
+
+            if (ensemble.size() >= settings.minimum_members) {
+                converged = true;
+                for (auto& item : statistics) {
+                    if (item.second.confidence_interval_width(settings.z) >
+                        settings.target_width) {
+                        converged = false;
+                    }
+                }
+            }
+        }
+
+        return Adaptive_ensemble_result {
+            ensemble.get_parameters(), statistics, converged, waves};
+    }
+
+   private:
+    Ensemble_simulator empty_ensemble;  // copied at the start of each run
+    Member_generator generate_member;
+};
+
+}
+
+#endif
@@ -0,0 +1,260 @@
+#ifndef BATCH_JOURNAL_H
+#define BATCH_JOURNAL_H
+
+#include <fcntl.h>    // for open
+#include <unistd.h>   // for close, fsync, ftruncate, write
+
+#include <cerrno>     // for errno, EINTR
+#include <fstream>
+#include <functional> // for std::function
+#include <limits>     // for std::numeric_limits
+#include <sstream>
+
+#include "scenario.h"
+
+namespace BioCro {
+
+/**
+ * A Checkpoint records how far an interrupted job got: the row at
+ * which the job should resume and the values of the differential
+ * quantities at that row.
+ */
+struct Checkpoint {
+    size_t row;
+    BioCro::State state;
+};
+
+/**
+ * A Batch_journal is an append-only record of progress through a
+ * batch of jobs, kept in a text file.  Each line of the file is one
+ * record, either
+ *
+ *     done <job id>
+ *
+ * marking a finished job, or
+ *
+ *     checkpoint <job id> <row> <n> <name_1> <value_1> ... <name_n> <value_n>
+ *
+ * recording the state of an unfinished job.  Each record is appended
+ * with a single write and synced to disk (with fsync) before the call
+ * returns, so a recorded job survives a reboot of the machine as well
+ * as a crash of the process, and an interruption can at worst leave a
+ * truncated final line.  Such a line (recognizable by its missing
+ * newline) is ignored when the journal is reopened, and cut off by
+ * truncating the file in place, which never touches the complete
+ * records before it.  Any lines that can't be parsed are ignored.
+ * Values are written with enough digits to be read back exactly.
+ *
+ * The journal uses POSIX file calls.  Job ids must be non-empty and
+ * must not contain whitespace.
+ */
+class Batch_journal
+{
+   public:
+    explicit Batch_journal(std::string const& path)
+    {
+        std::string contents;
+        {
+            std::ifstream existing(path, std::ios::binary);
+            std::ostringstream buffer;
+            buffer << existing.rdbuf();
+            contents = buffer.str();
+        }
+
+        // Every record ends with a newline, so anything after the last
+        // one is a record whose write was cut short.
+        size_t complete = contents.rfind('\n') + 1;  // 0 if there is no newline
+        std::istringstream records(contents.substr(0, complete));
+        std::string line;
+        while (std::getline(records, line)) read_record(line);
+
+        descriptor = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (descriptor < 0) {
+            throw std::runtime_error("Unable to open the batch journal " + path + ".");
+        }
+
+        // Drop the partial record, so that new records aren't appended
+        // to it.
+        if (complete < contents.size() &&
+            (::ftruncate(descriptor, complete) != 0 || ::fsync(descriptor) != 0)) {
+            ::close(descriptor);
+            throw std::runtime_error("Unable to repair the batch journal " + path + ".");
+        }
+    }
+
+    Batch_journal(Batch_journal const&) = delete;
+    Batch_journal& operator=(Batch_journal const&) = delete;
+
+    ~Batch_journal() { ::close(descriptor); }
+
+    bool is_finished(std::string const& job_id) const
+    {
+        return finished_jobs.find(job_id) != finished_jobs.end();
+    }
+
+    bool has_checkpoint(std::string const& job_id) const
+    {
+        return checkpoints.find(job_id) != checkpoints.end();
+    }
+
+    // Gets the latest checkpoint of an unfinished job.
+    Checkpoint const& get_checkpoint(std::string const& job_id) const
+    {
+        return checkpoints.at(job_id);
+    }
+
+    void record_checkpoint(std::string const& job_id, size_t row, State const& state)
+    {
+        check_id(job_id);
+        std::ostringstream record;
+        record.precision(std::numeric_limits<double>::max_digits10);
+        record << "checkpoint " << job_id << ' ' << row << ' ' << state.size();
+        for (auto& item : state) {
+            record << ' ' << item.first << ' ' << item.second;
+        }
+        append(record.str());
+        checkpoints[job_id] = Checkpoint{row, state};
+    }
+
+    void record_finished(std::string const& job_id)
+    {
+        check_id(job_id);
+        append("done " + job_id);
+        finished_jobs.insert(job_id);
+        checkpoints.erase(job_id);
+    }
+
+   private:
+    int descriptor;
+    std::set<std::string> finished_jobs;
+    std::unordered_map<std::string, Checkpoint> checkpoints;
+
+    void append(std::string const& record)
+    {
+        std::string line = record + '\n';
+        size_t written {0};
+        while (written < line.size()) {
+            ssize_t n = ::write(descriptor, line.data() + written, line.size() - written);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) throw std::runtime_error("Unable to write to the batch journal.");
+            written += n;
+        }
+        if (::fsync(descriptor) != 0) {
+            throw std::runtime_error("Unable to sync the batch journal to disk.");
+        }
+    }
+
+    static void check_id(std::string const& job_id)
+    {
+        if (job_id.empty() ||
+            job_id.find_first_of(" \t\n\r\f\v") != std::string::npos) {
+            throw std::invalid_argument("\"" + job_id + "\" is not a valid job "
+                                        "id; job ids must be non-empty and "
+                                        "contain no whitespace.");
+        }
+    }
+
+    void read_record(std::string const& line)
+    {
+        std::istringstream fields(line);
+        std::string kind, job_id;
+        if (!(fields >> kind >> job_id)) return;
+
+        if (kind == "done") {
+            finished_jobs.insert(job_id);
+            checkpoints.erase(job_id);
+        } else if (kind == "checkpoint") {
+            Checkpoint checkpoint;
+            size_t n;
+            if (!(fields >> checkpoint.row >> n)) return;
+            for (size_t i = 0; i < n; ++i) {
+                std::string name;
+                double value;
+                if (!(fields >> name >> value)) return; // truncated record
+                checkpoint.state[name] = value;
+            }
+            checkpoints[job_id] = checkpoint;
+        }
+    }
+};
+
+/**
+ * A Batch_job is a Scenario together with an id that identifies it in
+ * a Batch_journal.
+ */
+struct Batch_job {
+    std::string id;
+    Scenario scenario;
+};
+
+/**
+ * A Segment_sink receives the results of a job piece by piece.  The
+ * second argument is the driver row of the first row of the segment.
+ * Segments don't overlap: each one starts where the previous one left
+ * off.  If a batch is interrupted between delivering a segment and
+ * recording the following checkpoint, that segment is delivered again
+ * when the batch is resumed, so sinks that persist results should key
+ * them by row.
+ */
+using Segment_sink =
+    std::function<void(Batch_job const&, size_t, Simulation_result const&)>;
+
+/**
+ * Runs a batch of jobs, keeping track of progress in a journal so that
+ * the batch can be restarted after a crash.  Jobs the journal records
+ * as finished are skipped, and interrupted jobs resume from their
+ * latest checkpoint.  Each job is simulated in segments of
+ * `checkpoint_interval` driver rows; after each segment the results
+ * are passed to `sink` and a checkpoint is recorded.
+ *
+ * Returns the number of jobs that were (re)started.
+ */
+inline size_t run_batch(std::vector<Batch_job> const& jobs,
+                        Batch_journal& journal,
+                        size_t checkpoint_interval,
+                        Segment_sink sink)
+{
+    if (checkpoint_interval == 0) {
+        throw std::invalid_argument("The checkpoint interval must be positive.");
+    }
+
+    size_t jobs_run {0};
+    for (auto& job : jobs) {
+        if (journal.is_finished(job.id)) continue;
+        ++jobs_run;
+
+        size_t last_row = get_number_of_rows(job.scenario) - 1;
+        size_t row {0};
+        State state {job.scenario.initial_state};
+        if (journal.has_checkpoint(job.id)) {
+            row = journal.get_checkpoint(job.id).row;
+            state = journal.get_checkpoint(job.id).state;
+        }
+
+        bool first_segment {row == 0};
+        while (row < last_row || first_segment) {
+            size_t segment_end = std::min(row + checkpoint_interval, last_row);
+            State final_state;
+            Simulation_result segment =
+                run_scenario_rows(job.scenario, state, row, segment_end, final_state);
+            if (first_segment) {
+                sink(job, row, segment);
+            } else {
+                // The first row duplicates the last row of the
+                // previous segment.
+                drop_first_row(segment);
+                sink(job, row + 1, segment);
+            }
+            first_segment = false;
+            row = segment_end;
+            state = final_state;
+            if (row < last_row) journal.record_checkpoint(job.id, row, state);
+        }
+        journal.record_finished(job.id);
+    }
+    return jobs_run;
+}
+
+}
+
+#endif
@@ -0,0 +1,265 @@
+#ifndef BATCH_PLANNER_H
+#define BATCH_PLANNER_H
+
+#include <algorithm>  // for std::min, std::sort
+#include <limits>     // for std::numeric_limits
+#include <map>
+#include <sstream>
+
+#include "batch_journal.h"
+#include "field_composition.h"
+#include "thread_pool.h"
+
+namespace BioCro {
+
+namespace detail {
+
+inline void append_names(std::ostringstream& signature, Variable_names names)
+{
+    std::sort(names.begin(), names.end());
+    for (auto& name : names) signature << ' ' << name;
+    signature << " |";
+}
+
+}  // namespace detail
+
+/**
+ * Gets the signature of the system a scenario compiles to: its module
+ * creators, in order; the names of its differential quantities,
+ * parameters, and drivers; its number of rows and time step; and its
+ * solver settings.  Two scenarios with the same signature differ only
+ * in the values of their quantities, so they form valid dynamical
+ * systems or fail to alike, and they produce results with the same
+ * columns.
+ *
+ * Module creators are identified by name and address, since two
+ * creators can share a name (two expression modules, for example).
+ * A signature is therefore only meaningful within one process.
+ */
+inline std::string get_system_signature(Scenario const& scenario)
+{
+    std::ostringstream signature;
+    signature.precision(std::numeric_limits<double>::max_digits10);
+    for (auto const* set : {&scenario.direct_mcs, &scenario.differential_mcs}) {
+        for (auto creator : *set) signature << ' ' << creator->get_name() << '@' << creator;
+        signature << " |";
+    }
+
+    Variable_names names;
+    for (auto& x : scenario.initial_state) names.push_back(x.first);
+    detail::append_names(signature, names);
+    names.clear();
+    for (auto& x : scenario.parameters) names.push_back(x.first);
+    detail::append_names(signature, names);
+    names.clear();
+    for (auto& x : scenario.drivers) names.push_back(x.first);
+    detail::append_names(signature, names);
+
+    auto timestep = scenario.parameters.find("timestep");
+    signature << ' ' << (scenario.drivers.empty() ? 0 : get_number_of_rows(scenario)) << ' '
+              << (timestep == scenario.parameters.end() ? 0 : timestep->second) << " |";
+
+    Solver_settings const& solver = scenario.solver_settings;
+    signature << ' ' << solver.ode_solver_name << ' ' << solver.output_step_size << ' '
+              << solver.adaptive_rel_error_tol << ' ' << solver.adaptive_abs_error_tol << ' '
+              << solver.adaptive_max_steps;
+    return signature.str();
+}
+
+struct Batch_planner_settings {
+    // The number of threads, counting the calling thread, that run
+    // the planned tasks.
+    size_t number_of_threads {1};
+
+    // The largest number of jobs simulated in lockstep as one system.
+    // Lockstep pays off when building systems and solvers costs more
+    // than the renaming done by the combined system's modules, which
+    // depends on the modules, so it is off (1) by default.
+    size_t lockstep_size {1};
+};
+
+/**
+ * A group of jobs of a batch that share a system signature.  `jobs`
+ * holds their positions in the batch, in order.
+ */
+struct Batch_group {
+    std::string signature;
+    std::vector<size_t> jobs;
+    bool lockstep;
+};
+
+/**
+ * A Batch_planner runs a mixed batch of jobs, which may use several
+ * module sets and solver settings, as efficiently as a batch of
+ * identical ones.  It groups the jobs by system signature (see
+ * get_system_signature) and validates each group once, when the plan
+ * is made, by building a dynamical system from its first job.  Since
+ * the other jobs of the group have the same signature, they are valid
+ * or invalid alike, so an invalid job is reported, together with the
+ * number of jobs like it, before any simulation starts.  This only
+ * moves the error forward: each simulation still builds and checks
+ * its own system when it runs.
+ *
+ * If lockstep_size is more than 1, groups whose solver takes fixed
+ * steps are simulated in lockstep: up to `lockstep_size` jobs at a
+ * time are combined by a Field_composition into a single system, so
+ * one solver steps them all together and the cost of building a
+ * system and a solver is shared among them.  Quantities whose values are the same for every
+ * job of a lockstep group are stored once.  A fixed-step solver takes
+ * the same steps for the combined system as for each job alone, so
+ * the results are those of separate simulations.  Adaptive solvers
+ * would choose their steps for the combined system as a whole, so
+ * groups using them, like groups whose jobs have no driver in common,
+ * are simulated job by job.
+ *
+ * The planner refers to the jobs rather than copying them, so they
+ * must outlive it.  The module creators must be safe to use from
+ * several threads at once, as the creators in BioCro's module
+ * libraries are.
+ */
+class Batch_planner
+{
+   public:
+    Batch_planner(std::vector<Batch_job> const& jobs, Batch_planner_settings const& settings = {})
+        : jobs{jobs}, settings{settings}
+    {
+        std::map<std::string, size_t> group_of_signature;
+        for (size_t j = 0; j < jobs.size(); ++j) {
+            std::string signature = get_system_signature(jobs[j].scenario);
+            auto entry = group_of_signature.emplace(signature, groups.size());
+            if (entry.second) groups.push_back(Batch_group{signature, {}, false});
+            groups[entry.first->second].jobs.push_back(j);
+        }
+
+        for (auto& group : groups) {
+            Scenario const& prototype = jobs[group.jobs[0]].scenario;
+            try {
+                make_dynamical_system(prototype.initial_state, prototype.parameters,
+                                      prototype.drivers, prototype.direct_mcs,
+                                      prototype.differential_mcs);
+            } catch (std::exception const& e) {
+                throw std::invalid_argument("Job \"" + jobs[group.jobs[0]].id + "\" and " +
+                                            std::to_string(group.jobs.size() - 1) +
+                                            " others like it are invalid: " + e.what());
+            }
+            group.lockstep = settings.lockstep_size > 1 && group.jobs.size() > 1 &&
+                             takes_fixed_steps(prototype.solver_settings) &&
+                             !get_common_drivers(group).empty();
+        }
+
+        for (size_t g = 0; g < groups.size(); ++g) {
+            auto& group_jobs = groups[g].jobs;
+            size_t chunk = groups[g].lockstep ? settings.lockstep_size : 1;
+            for (size_t first = 0; first < group_jobs.size(); first += chunk) {
+                tasks.push_back({g, first, std::min(first + chunk, group_jobs.size())});
+            }
+        }
+    }
+
+    // The jobs are not copied, so a temporary vector would dangle.
+    Batch_planner(std::vector<Batch_job>&& jobs, Batch_planner_settings const& settings = {}) = delete;
+
+    std::vector<Batch_group> const& get_groups() const { return groups; }
+
+    // Gets the number of systems the batch is simulated as.
+    size_t get_number_of_tasks() const { return tasks.size(); }
+
+    // Simulates every job and returns the results, indexed like the
+    // jobs.
+    std::vector<Simulation_result> run()
+    {
+        std::vector<Simulation_result> results(jobs.size());
+        Thread_pool pool {std::min(settings.number_of_threads, tasks.size())};
+        pool.run(tasks.size(), [&](size_t t) { run_task(tasks[t], results); });
+        return results;
+    }
+
+    static bool takes_fixed_steps(Solver_settings const& solver)
+    {
+        return solver.ode_solver_name == "homemade_euler" ||
+               solver.ode_solver_name == "boost_euler" ||
+               solver.ode_solver_name == "boost_rk4";
+    }
+
+   private:
+    std::vector<Batch_job> const& jobs;
+    Batch_planner_settings settings;
+    std::vector<Batch_group> groups;
+
+    // Jobs first through last - 1 of a group, simulated as one system.
+    struct Task {
+        size_t group;
+        size_t first;
+        size_t last;
+    };
+    std::vector<Task> tasks;
+
+    // Gets the names of the drivers whose columns are the same for
+    // every job of a group.
+    Variable_names get_common_drivers(Batch_group const& group) const
+    {
+        Variable_names common;
+        System_drivers const& first = jobs[group.jobs[0]].scenario.drivers;
+        for (auto& x : first) {
+            bool same {true};
+            for (size_t j : group.jobs) same = same && jobs[j].scenario.drivers.at(x.first) == x.second;
+            if (same) common.push_back(x.first);
+        }
+        return common;
+    }
+
+    void run_task(Task const& task, std::vector<Simulation_result>& results) const
+    {
+        auto& group_jobs = groups[task.group].jobs;
+        if (task.last - task.first == 1) {
+            size_t j = group_jobs[task.first];
+            results[j] = make_simulator(jobs[j].scenario).run_simulation();
+            return;
+        }
+
+        // Quantities with the same value in every job of the task are
+        // shared; the others belong to the jobs' fields.
+        Scenario const& prototype = jobs[group_jobs[task.first]].scenario;
+        Parameter_set shared_parameters;
+        for (auto& x : prototype.parameters) {
+            bool same {true};
+            for (size_t i = task.first; i < task.last; ++i) {
+                same = same && jobs[group_jobs[i]].scenario.parameters.at(x.first) == x.second;
+            }
+            if (same) shared_parameters.insert(x);
+        }
+        System_drivers shared_drivers;
+        for (auto& x : prototype.drivers) {
+            bool same {true};
+            for (size_t i = task.first; i < task.last; ++i) {
+                same = same && jobs[group_jobs[i]].scenario.drivers.at(x.first) == x.second;
+            }
+            if (same) shared_drivers.insert(x);
+        }
+
+        Field_composition composition {shared_parameters, shared_drivers,
+                                       prototype.solver_settings};
+        for (size_t i = task.first; i < task.last; ++i) {
+            Scenario const& scenario = jobs[group_jobs[i]].scenario;
+            Field field {"job" + std::to_string(i), scenario.initial_state, {}, {},
+                         scenario.direct_mcs, scenario.differential_mcs};
+            for (auto& x : scenario.parameters) {
+                if (!shared_parameters.count(x.first)) field.parameters.insert(x);
+            }
+            for (auto& x : scenario.drivers) {
+                if (!shared_drivers.count(x.first)) field.drivers.insert(x);
+            }
+            composition.add_field(field);
+        }
+
+        Simulation_result combined = composition.run_simulation();
+        for (size_t i = task.first; i < task.last; ++i) {
+            results[group_jobs[i]] =
+                composition.get_field_result(combined, "job" + std::to_string(i));
+        }
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,345 @@
+#ifndef COOPERATIVE_SIMULATION_H
+#define COOPERATIVE_SIMULATION_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>  // for std::function
+#include <memory>      // for std::shared_ptr, std::unique_ptr
+#include <mutex>
+
+#include "scenario.h"
+
+namespace BioCro {
+
+/**
+ * A Wakeup lets producers of drivers and consumers of results tell a
+ * waiting Cooperative_scheduler that something it is waiting for may
+ * have changed.
+ */
+class Wakeup
+{
+   public:
+    void notify()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ++count;
+        }
+        changed.notify_all();
+    }
+
+    unsigned long get_count() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return count;
+    }
+
+    // Waits until notify has been called since get_count returned
+    // `seen`, or until the timeout expires.
+    template <typename Duration>
+    void wait(unsigned long seen, Duration timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait_for(lock, timeout, [&] { return count != seen; });
+    }
+
+   private:
+    mutable std::mutex mutex;
+    std::condition_variable changed;
+    unsigned long count {0};
+};
+
+/**
+ * Streamed_drivers holds driver rows that arrive over time, for
+ * example as they are read from a file or received over a network.
+ * One thread appends rows while others read the rows that have
+ * arrived so far.  Once the last row has been appended, the producer
+ * calls close.
+ */
+class Streamed_drivers
+{
+   public:
+    explicit Streamed_drivers(Variable_names const& driver_names,
+                              Wakeup* wakeup = nullptr)
+        : wakeup{wakeup}
+    {
+        for (auto& name : driver_names) drivers[name];
+    }
+
+    // Makes a closed stream holding a complete set of drivers.
+    explicit Streamed_drivers(System_drivers const& complete_drivers)
+        : drivers{complete_drivers}, closed{true}
+    {
+        rows = drivers.empty() ? 0 : drivers.begin()->second.size();
+    }
+
+    // Appends rows given as columns of equal length, one for every
+    // driver.
+    void append(System_drivers const& new_rows)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (closed) throw std::logic_error("Rows were appended to closed drivers.");
+            if (new_rows.size() != drivers.size()) {
+                throw std::invalid_argument("Appended rows must give a value for every driver.");
+            }
+            if (new_rows.empty()) return;
+            size_t n = new_rows.begin()->second.size();
+            for (auto& column : new_rows) {
+                if (column.second.size() != n) {
+                    throw std::invalid_argument("Appended driver columns must "
+                                                "have the same length.");
+                }
+                auto& values = drivers.at(column.first);
+                values.insert(values.end(), column.second.begin(), column.second.end());
+            }
+            rows += n;
+        }
+        if (wakeup) wakeup->notify();
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        if (wakeup) wakeup->notify();
+    }
+
+    // Gets the number of rows that have arrived, and whether they are
+    // all the rows there will be.
+    size_t get_number_of_rows(bool& is_closed) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        is_closed = closed;
+        return rows;
+    }
+
+    System_drivers get_rows(size_t first_row, size_t last_row) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return get_driver_rows(drivers, first_row, last_row);
+    }
+
+   private:
+    mutable std::mutex mutex;
+    System_drivers drivers;
+    size_t rows {0};
+    bool closed {false};
+    Wakeup* wakeup {nullptr};
+};
+
+/**
+ * A Segment_consumer receives the results of a Cooperative_simulation
+ * one segment at a time, along with the driver row of the segment's
+ * first row.  It returns false if it can't take the segment yet (for
+ * example because an output buffer is full); the segment is then
+ * offered again the next time the simulation is resumed.
+ */
+using Segment_consumer = std::function<bool(size_t, Simulation_result const&)>;
+
+enum class Step_status {
+    advanced,  // a segment was simulated or delivered
+    waiting,   // blocked on drivers that haven't arrived or on the consumer
+    finished
+};
+
+/**
+ * A Cooperative_simulation is a simulation that runs a little at a
+ * time: each call to resume does at most one segment's worth of work
+ * and then returns, so that a single thread can take turns among many
+ * simulations.  All of the simulation's progress is kept in the object
+ * itself (the next row, the current state, and any segment its
+ * consumer has not yet taken), so unlike a thread it needs no stack of
+ * its own while it is suspended.
+ *
+ * A segment is `rows_per_step` output steps long.  Before simulating a
+ * segment the simulation checks that its driver rows have arrived, and
+ * after simulating one it offers the results to its consumer; if
+ * either has to wait, resume returns Step_status::waiting without
+ * blocking.
+ *
+ * Segments after the first don't repeat the boundary row shared with
+ * the previous segment.  Since each segment restarts the solver,
+ * results match an uninterrupted run exactly only for fixed-step
+ * solvers.
+ */
+class Cooperative_simulation
+{
+   public:
+    // Simulates a scenario whose drivers arrive through a stream.  The
+    // scenario's own drivers must be empty.
+    Cooperative_simulation(Scenario const& scenario,
+                           std::shared_ptr<const Streamed_drivers> drivers,
+                           size_t rows_per_step,
+                           Segment_consumer consumer)
+        : scenario{scenario},
+          drivers{drivers},
+          rows_per_step{rows_per_step},
+          consumer{consumer},
+          state{scenario.initial_state}
+    {
+        if (!scenario.drivers.empty()) {
+            throw std::invalid_argument("A scenario with streamed drivers "
+                                        "must not have drivers of its own.");
+        }
+        if (rows_per_step == 0) {
+            throw std::invalid_argument("A simulation step must include at least one row.");
+        }
+    }
+
+    // Simulates a scenario whose drivers are all available already,
+    // so that it waits only on its consumer.
+    Cooperative_simulation(Scenario const& scenario,
+                           size_t rows_per_step,
+                           Segment_consumer consumer)
+        : Cooperative_simulation{
+              without_drivers(scenario),
+              std::make_shared<const Streamed_drivers>(scenario.drivers),
+              rows_per_step,
+              consumer} {}
+
+    Step_status resume()
+    {
+        if (has_pending_segment) {
+            if (!consumer(pending_first_row, pending_segment)) {
+                return Step_status::waiting;
+            }
+            has_pending_segment = false;
+            Simulation_result().swap(pending_segment);
+            return Step_status::advanced;
+        }
+        if (finished) return Step_status::finished;
+
+        bool closed;
+        size_t available = drivers->get_number_of_rows(closed);
+        size_t last_row = row + rows_per_step;
+        if (available <= last_row) {
+            if (!closed) return Step_status::waiting;
+            if (available == 0 || (available - 1 <= row && !first_segment)) {
+                finished = true;
+                return Step_status::finished;
+            }
+            last_row = available - 1;
+        }
+
+        State final_state;
+        pending_segment = run_scenario_segment(
+            scenario, state, drivers->get_rows(row, last_row), final_state);
+        if (first_segment) {
+            pending_first_row = row;
+        } else {
+            drop_first_row(pending_segment);
+            pending_first_row = row + 1;
+        }
+        has_pending_segment = true;
+        first_segment = false;
+        row = last_row;
+        state = final_state;
+        finished = closed && row + 1 == available;
+
+        // Offer the segment at once; it's kept if the consumer can't
+        // take it yet.
+        if (consumer(pending_first_row, pending_segment)) {
+            has_pending_segment = false;
+            Simulation_result().swap(pending_segment);
+        }
+        return Step_status::advanced;
+    }
+
+    bool is_finished() const { return finished && !has_pending_segment; }
+
+    // Gets the values of the differential quantities at the last row
+    // simulated so far.
+    State const& get_state() const { return state; }
+
+   private:
+    Scenario scenario;
+    std::shared_ptr<const Streamed_drivers> drivers;
+    size_t rows_per_step;
+    Segment_consumer consumer;
+
+    // Progress through the simulation.
+    State state;
+    size_t row {0};
+    bool first_segment {true};
+    bool finished {false};
+    bool has_pending_segment {false};
+    size_t pending_first_row {0};
+    Simulation_result pending_segment;
+
+    static Scenario without_drivers(Scenario scenario)
+    {
+        System_drivers().swap(scenario.drivers);
+        return scenario;
+    }
+};
+
+/**
+ * A Cooperative_scheduler interleaves many Cooperative_simulations on
+ * one thread.  It resumes each unfinished simulation in turn; when a
+ * full pass over the simulations makes no progress because they are
+ * all waiting, it sleeps until its Wakeup is notified (or a short
+ * timeout expires, in case a producer or consumer doesn't notify).
+ *
+ * To use several cores, give each thread its own scheduler and share
+ * the simulations out among them.
+ */
+class Cooperative_scheduler
+{
+   public:
+    explicit Cooperative_scheduler(
+        std::chrono::microseconds idle_timeout = std::chrono::milliseconds(1))
+        : idle_timeout{idle_timeout} {}
+
+    // Pass this to Streamed_drivers, and notify it from consumers when
+    // they free space, so that the scheduler wakes up promptly.
+    Wakeup& get_wakeup() { return wakeup; }
+
+    void add(std::unique_ptr<Cooperative_simulation> simulation)
+    {
+        active.push_back(std::move(simulation));
+    }
+
+    size_t get_number_of_active_simulations() const { return active.size(); }
+
+    // Runs until every simulation has finished.  Finished simulations
+    // are passed to `on_finish`, if given, and then destroyed.
+    void run(std::function<void(Cooperative_simulation&)> on_finish = nullptr)
+    {
+        while (!active.empty()) {
+            unsigned long seen = wakeup.get_count();
+            if (!run_pass(on_finish)) wakeup.wait(seen, idle_timeout);
+        }
+    }
+
+    // Resumes each active simulation once.  Returns true if any of
+    // them made progress.
+    bool run_pass(std::function<void(Cooperative_simulation&)> on_finish = nullptr)
+    {
+        bool progress {false};
+        for (size_t i = 0; i < active.size();) {
+            Step_status status = active[i]->resume();
+            if (status == Step_status::advanced) progress = true;
+            if (active[i]->is_finished()) {
+                if (on_finish) on_finish(*active[i]);
+                active[i] = std::move(active.back());
+                active.pop_back();
+                progress = true;
+            } else {
+                ++i;
+            }
+        }
+        return progress;
+    }
+
+   private:
+    std::chrono::microseconds idle_timeout;
+    Wakeup wakeup;
+    std::vector<std::unique_ptr<Cooperative_simulation>> active;
+};
+
+}
+
+#endif
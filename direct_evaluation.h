@@ -0,0 +1,159 @@
+#ifndef DIRECT_EVALUATION_H
+#define DIRECT_EVALUATION_H
+
+#include "parallel_direct_modules.h"  // for get_direct_module_levels
+#include "thread_pool.h"
+
+namespace BioCro {
+
+/**
+ * A Direct_evaluator evaluates a set of direct modules at every row of
+ * a set of drivers, without constructing a Simulator or an ODE solver.
+ * This is all that is needed when a system has no differential
+ * modules, for example to compute solar position or other diagnostics
+ * over a weather series, or to recompute direct quantities from the
+ * columns of a stored simulation result (passed as drivers).
+ *
+ * The modules are created once, in dependency order, on a single map
+ * of quantities; each row then just copies the drivers in, runs the
+ * modules, and copies the outputs out, with no state bookkeeping.
+ * Since rows are independent, they can be divided among several
+ * threads, each with its own copy of the modules.
+ *
+ * The inputs of the modules must be supplied by parameters, drivers,
+ * or the outputs of other modules.
+ */
+class Direct_evaluator
+{
+   public:
+    Direct_evaluator(Parameter_set const& parameters,
+                     Module_set const& direct_mcs,
+                     size_t number_of_threads = 1)
+        : parameters{parameters}, number_of_threads{number_of_threads}
+    {
+        for (auto& level : get_direct_module_levels(direct_mcs, "a direct evaluator")) {
+            modules.insert(modules.end(), level.begin(), level.end());
+        }
+        Variable_set produced;
+        for (auto creator : modules) {
+            for (auto& name : creator->get_outputs()) {
+                if (parameters.count(name)) {
+                    throw std::invalid_argument("The quantity \"" + name + "\" is both "
+                                                "a parameter and a module output.");
+                }
+                produced.insert(name);
+                outputs.push_back(name);
+            }
+        }
+        Variable_set seen;
+        for (auto creator : modules) {
+            for (auto& name : creator->get_inputs()) {
+                if (!produced.count(name) && !parameters.count(name) &&
+                    seen.insert(name).second) {
+                    driver_inputs.push_back(name);
+                }
+            }
+        }
+    }
+
+    // Gets the names of the quantities the drivers must supply.
+    Variable_names const& get_required_drivers() const { return driver_inputs; }
+
+    Variable_names const& get_outputs() const { return outputs; }
+
+    // Gets a column for every driver and every module output.
+    Simulation_result evaluate(System_drivers const& drivers) const
+    {
+        if (drivers.empty()) {
+            throw std::invalid_argument("A direct evaluation needs at least one driver.");
+        }
+        size_t rows = drivers.begin()->second.size();
+        for (auto& column : drivers) {
+            if (column.second.size() != rows) {
+                throw std::invalid_argument("Driver columns must have the same length.");
+            }
+            if (parameters.count(column.first)) {
+                throw std::invalid_argument("The quantity \"" + column.first +
+                                            "\" is both a parameter and a driver.");
+            }
+        }
+        for (auto& name : outputs) {
+            if (drivers.count(name)) {
+                throw std::invalid_argument("The quantity \"" + name +
+                                            "\" is both a driver and a module output.");
+            }
+        }
+        for (auto& name : driver_inputs) {
+            if (!drivers.count(name)) {
+                throw std::invalid_argument("The quantity \"" + name + "\" is required "
+                                            "by a direct module but was not supplied.");
+            }
+        }
+
+        Simulation_result result = drivers;
+        for (auto& name : outputs) result[name].resize(rows);
+
+        // Each block of rows is evaluated by its own copy of the
+        // modules.
+        Thread_pool pool {number_of_threads};
+        size_t number_of_blocks = rows < pool.size() ? rows : pool.size();
+        pool.run(number_of_blocks, [&](size_t block) {
+            evaluate_rows(drivers, block * rows / number_of_blocks,
+                          (block + 1) * rows / number_of_blocks, result);
+        });
+        return result;
+    }
+
+   private:
+    Parameter_set parameters;
+    size_t number_of_threads;
+    Module_set modules;  // in evaluation order
+    Variable_names outputs;
+    Variable_names driver_inputs;
+
+    // Evaluates rows first_row up to (but not including) end_row.  The
+    // columns of `result` must already have their final size, so that
+    // blocks can be filled in concurrently.
+    void evaluate_rows(System_drivers const& drivers,
+                       size_t first_row, size_t end_row,
+                       Simulation_result& result) const
+    {
+        Variable_settings quantities = parameters;
+        for (auto& column : drivers) quantities[column.first] = column.second[first_row];
+        for (auto& name : outputs) quantities[name] = 0.0;
+
+        std::vector<Module> instances;
+        for (auto creator : modules) {
+            instances.push_back(creator->create_module(quantities, &quantities));
+        }
+
+        // Pairs of a column and the quantity it is copied to or from.
+        std::vector<std::pair<double const*, double*>> inputs;
+        for (auto& column : drivers) {
+            inputs.push_back({column.second.data(), &quantities.at(column.first)});
+        }
+        std::vector<std::pair<double const*, double*>> results;
+        for (auto& name : outputs) {
+            results.push_back({&quantities.at(name), result.at(name).data()});
+        }
+
+        for (size_t row = first_row; row < end_row; ++row) {
+            for (auto& input : inputs) *input.second = input.first[row];
+            for (auto& module : instances) module->run();
+            for (auto& output : results) output.second[row] = *output.first;
+        }
+    }
+};
+
+// Evaluates direct modules over drivers once; see Direct_evaluator.
+inline Simulation_result evaluate_direct_modules(Parameter_set const& parameters,
+                                                 System_drivers const& drivers,
+                                                 Module_set const& direct_mcs,
+                                                 size_t number_of_threads = 1)
+{
+    return Direct_evaluator{parameters, direct_mcs, number_of_threads}.evaluate(drivers);
+}
+
+}
+
+#endif
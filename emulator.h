@@ -0,0 +1,376 @@
+#ifndef EMULATOR_H
+#define EMULATOR_H
+
+#include <cmath>   // for std::exp, std::log, std::sqrt
+#include <limits>  // for std::numeric_limits
+
+#include "adaptive_ensemble.h"  // for Ensemble_statistics
+#include "ensemble.h"
+
+namespace BioCro {
+
+/**
+ * A Gaussian_process predicts a scalar function of a few inputs from
+ * its values at some training points, giving both a mean and a
+ * standard deviation for each prediction.  It uses a constant mean
+ * (the mean of the training values) and a squared exponential
+ * covariance with a separate length scale for each input.  The length
+ * scales are chosen by maximizing the marginal likelihood over a grid
+ * of values, one input at a time, and the signal variance is then
+ * given by its maximum likelihood estimate.
+ *
+ * Inputs are expected to be scaled to about [0, 1].  Training costs
+ * O(n^3) time for n training points, and each prediction O(n^2).
+ */
+class Gaussian_process
+{
+   public:
+    // `inputs` holds one row of `dimensions` values per training
+    // point.  `nugget` is added to the diagonal of the correlation
+    // matrix, relative to the signal variance, to keep it well
+    // conditioned.
+    Gaussian_process(std::vector<double> const& inputs,
+                     size_t dimensions,
+                     std::vector<double> const& values,
+                     double nugget = 1e-8)
+        : dimensions{dimensions},
+          inputs{inputs},
+          nugget{nugget},
+          length_scales(dimensions, 0.5)
+    {
+        size_t n = values.size();
+        if (n == 0 || dimensions == 0 || inputs.size() != n * dimensions) {
+            throw std::invalid_argument("A Gaussian process needs one row of inputs "
+                                        "for each of at least one training value.");
+        }
+        for (double y : values) mean += y;
+        mean /= n;
+        centered.resize(n);
+        double spread {0.0};
+        for (size_t i = 0; i < n; ++i) {
+            centered[i] = values[i] - mean;
+            spread += centered[i] * centered[i];
+        }
+
+        if (spread > 0 && n > 1) {
+            const double candidates[] {0.05, 0.1, 0.2, 0.35, 0.5, 0.75, 1.0, 1.5, 2.5, 4.0};
+            for (int sweep = 0; sweep < 3; ++sweep) {
+                for (size_t k = 0; k < dimensions; ++k) {
+                    double best_scale = length_scales[k];
+                    double best = -std::numeric_limits<double>::infinity();
+                    for (double scale : candidates) {
+                        length_scales[k] = scale;
+                        double likelihood = factor();
+                        if (likelihood > best) {
+                            best = likelihood;
+                            best_scale = scale;
+                        }
+                    }
+                    length_scales[k] = best_scale;
+                }
+            }
+        }
+        factor();
+    }
+
+    size_t get_number_of_training_points() const { return centered.size(); }
+
+    std::vector<double> const& get_length_scales() const { return length_scales; }
+
+    // Predicts the value at `x` (of length `dimensions`).
+    void predict(double const* x, double& predicted_mean, double& standard_deviation) const
+    {
+        size_t n = centered.size();
+        std::vector<double> v(n);
+        for (size_t i = 0; i < n; ++i) v[i] = correlation(x, &inputs[i * dimensions]);
+
+        predicted_mean = mean;
+        for (size_t i = 0; i < n; ++i) predicted_mean += v[i] * alpha[i];
+
+        // v = L^-1 k, so that k' K^-1 k = v' v.
+        forward_substitute(v);
+        double explained {0.0};
+        for (double vi : v) explained += vi * vi;
+        double variance = signal_variance * (1 + nugget - explained);
+        standard_deviation = variance > 0 ? std::sqrt(variance) : 0.0;
+    }
+
+   private:
+    size_t dimensions;
+    std::vector<double> inputs;
+    double nugget;
+    std::vector<double> length_scales;
+    double mean {0.0};
+    std::vector<double> centered;
+
+    // Set by factor:
+    std::vector<double> cholesky;  // lower triangle, row by row, of K = L L'
+    std::vector<double> alpha;     // K^-1 (y - mean)
+    double signal_variance {0.0};
+
+    double correlation(double const* a, double const* b) const
+    {
+        double sum {0.0};
+        for (size_t k = 0; k < dimensions; ++k) {
+            double d = (a[k] - b[k]) / length_scales[k];
+            sum += d * d;
+        }
+        return std::exp(-0.5 * sum);
+    }
+
+    // Solves L v = b in place.
+    void forward_substitute(std::vector<double>& b) const
+    {
+        size_t n = b.size();
+        for (size_t i = 0; i < n; ++i) {
+            double const* row = &cholesky[i * n];
+            double sum = b[i];
+            for (size_t j = 0; j < i; ++j) sum -= row[j] * b[j];
+            b[i] = sum / row[i];
+        }
+    }
+
+    // Solves L' v = b in place.
+    void back_substitute(std::vector<double>& b) const
+    {
+        size_t n = b.size();
+        for (size_t i = n; i-- > 0;) {
+            double sum = b[i];
+            for (size_t j = i + 1; j < n; ++j) sum -= cholesky[j * n + i] * b[j];
+            b[i] = sum / cholesky[i * n + i];
+        }
+    }
+
+    // Factors the correlation matrix for the current length scales
+    // and returns the profile log likelihood.
+    double factor()
+    {
+        size_t n = centered.size();
+        cholesky.assign(n * n, 0.0);
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t j = 0; j <= i; ++j) {
+                cholesky[i * n + j] = correlation(&inputs[i * dimensions], &inputs[j * dimensions]);
+            }
+            cholesky[i * n + i] += nugget;
+        }
+
+        double log_determinant {0.0};
+        for (size_t j = 0; j < n; ++j) {
+            double* row_j = &cholesky[j * n];
+            double diagonal = row_j[j];
+            for (size_t k = 0; k < j; ++k) diagonal -= row_j[k] * row_j[k];
+            if (!(diagonal > 0)) return -std::numeric_limits<double>::infinity();
+            row_j[j] = std::sqrt(diagonal);
+            log_determinant += 2 * std::log(row_j[j]);
+            for (size_t i = j + 1; i < n; ++i) {
+                double* row_i = &cholesky[i * n];
+                double sum = row_i[j];
+                for (size_t k = 0; k < j; ++k) sum -= row_i[k] * row_j[k];
+                row_i[j] = sum / row_j[j];
+            }
+        }
+
+        alpha = centered;
+        forward_substitute(alpha);
+        double quadratic {0.0};
+        for (double a : alpha) quadratic += a * a;
+        back_substitute(alpha);
+
+        signal_variance = quadratic / n;
+        if (!(signal_variance > 0)) return -std::numeric_limits<double>::infinity();
+        return -0.5 * (n * std::log(signal_variance) + log_determinant);
+    }
+};
+
+struct Emulator_settings {
+    // The number of threads running the training ensemble.
+    size_t number_of_threads {1};
+
+    // See Gaussian_process.
+    double nugget {1e-8};
+
+    // A query is answered by a real simulation if any prediction has
+    // a larger standard deviation than this.
+    double maximum_standard_deviation {std::numeric_limits<double>::infinity()};
+
+    // Real simulations answering queries are added to the training
+    // data, and the emulator retrained, if this is true.
+    bool learn_from_simulations {false};
+};
+
+/**
+ * One statistic as answered by a Simulation_emulator.  When
+ * `emulated` is false, the value came from a real simulation and the
+ * standard deviation is zero.
+ */
+struct Emulated_statistic {
+    double mean;
+    double standard_deviation;
+    bool emulated;
+};
+
+using Emulated_statistics = std::unordered_map<std::string, Emulated_statistic>;
+
+/**
+ * A Simulation_emulator answers questions of the form "what would this
+ * statistic of a simulation be for these parameter values" without
+ * running the simulation.  It is trained by running an ensemble over
+ * the parameters of interest (its override names) and fitting a
+ * Gaussian_process to each statistic of the results; the ensemble's
+ * members should be spread over the region that will be queried.
+ *
+ * The trained domain is the bounding box of the training members.  A
+ * query outside it, or one whose predictions are too uncertain (see
+ * Emulator_settings::maximum_standard_deviation), is answered by
+ * simulating the member with the ensemble's settings instead.
+ */
+class Simulation_emulator
+{
+   public:
+    Simulation_emulator(Ensemble_simulator const& training_ensemble,
+                        Ensemble_statistics const& statistics,
+                        Emulator_settings const& settings = {})
+        : ensemble{training_ensemble}, statistics{statistics}, settings{settings}
+    {
+        if (ensemble.size() == 0) {
+            throw std::invalid_argument("An emulator needs at least one training member.");
+        }
+        std::vector<Simulation_result> results =
+            ensemble.run_simulation_in_parallel(settings.number_of_threads);
+        for (auto& statistic : statistics) {
+            auto& values = training_values[statistic.first];
+            for (auto& result : results) values.push_back(statistic.second(result));
+        }
+        train();
+    }
+
+    Variable_names const& get_input_names() const
+    {
+        return ensemble.get_parameters().get_override_names();
+    }
+
+    size_t get_number_of_training_members() const { return ensemble.size(); }
+
+    // Checks whether a point (given in the order of the input names)
+    // lies in the trained domain.
+    bool in_domain(std::vector<double> const& overrides) const
+    {
+        check_size(overrides);
+        for (size_t k = 0; k < overrides.size(); ++k) {
+            if (!(overrides[k] >= lower[k] && overrides[k] <= upper[k])) return false;
+        }
+        return true;
+    }
+
+    // Predicts every statistic with the emulator alone, even outside
+    // the trained domain.
+    Emulated_statistics predict(std::vector<double> const& overrides) const
+    {
+        check_size(overrides);
+        std::vector<double> x = scale(overrides);
+        Emulated_statistics predictions;
+        for (auto& process : processes) {
+            Emulated_statistic& p = predictions[process.first];
+            process.second.predict(x.data(), p.mean, p.standard_deviation);
+            p.emulated = true;
+        }
+        return predictions;
+    }
+
+    // Answers a query with the emulator if it can, and otherwise with
+    // a real simulation.
+    Emulated_statistics query(std::vector<double> const& overrides)
+    {
+        if (in_domain(overrides)) {
+            Emulated_statistics predictions = predict(overrides);
+            bool confident {true};
+            for (auto& p : predictions) {
+                if (!(p.second.standard_deviation <= settings.maximum_standard_deviation)) {
+                    confident = false;
+                }
+            }
+            if (confident) return predictions;
+        }
+        return simulate(overrides);
+    }
+
+   private:
+    Ensemble_simulator ensemble;
+    Ensemble_statistics statistics;
+    Emulator_settings settings;
+    std::unordered_map<std::string, std::vector<double>> training_values;
+    std::unordered_map<std::string, Gaussian_process> processes;
+    std::vector<double> lower;
+    std::vector<double> upper;
+
+    void check_size(std::vector<double> const& overrides) const
+    {
+        if (overrides.size() != get_input_names().size()) {
+            throw std::invalid_argument("Expected " + std::to_string(get_input_names().size()) +
+                                        " input values but got " +
+                                        std::to_string(overrides.size()) + ".");
+        }
+    }
+
+    std::vector<double> scale(std::vector<double> const& overrides) const
+    {
+        std::vector<double> x(overrides.size());
+        for (size_t k = 0; k < x.size(); ++k) {
+            double width = upper[k] - lower[k];
+            x[k] = width > 0 ? (overrides[k] - lower[k]) / width : 0.0;
+        }
+        return x;
+    }
+
+    void train()
+    {
+        Ensemble_parameters const& members = ensemble.get_parameters();
+        size_t dimensions = get_input_names().size();
+        lower = upper = members.get_member_overrides(0);
+        for (size_t member = 1; member < members.size(); ++member) {
+            for (size_t k = 0; k < dimensions; ++k) {
+                double value = members.get_override(member, k);
+                if (value < lower[k]) lower[k] = value;
+                if (value > upper[k]) upper[k] = value;
+            }
+        }
+
+        std::vector<double> inputs;
+        for (size_t member = 0; member < members.size(); ++member) {
+            std::vector<double> x = scale(members.get_member_overrides(member));
+            inputs.insert(inputs.end(), x.begin(), x.end());
+        }
+        processes.clear();
+        for (auto& values : training_values) {
+            processes.emplace(values.first, Gaussian_process{
+                                                inputs, dimensions, values.second,
+                                                settings.nugget});
+        }
+    }
+
+    Emulated_statistics simulate(std::vector<double> const& overrides)
+    {
+        Ensemble_simulator single {ensemble};
+        size_t member = single.size();
+        single.add_member(overrides);
+        Simulation_result result = single.run_member(member);
+
+        Emulated_statistics answers;
+        for (auto& statistic : statistics) {
+            double value = statistic.second(result);
+            answers[statistic.first] = Emulated_statistic{value, 0.0, false};
+            if (settings.learn_from_simulations) {
+                training_values[statistic.first].push_back(value);
+            }
+        }
+        if (settings.learn_from_simulations) {
+            ensemble = single;
+            train();
+        }
+        return answers;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,452 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include <cstdint>  // for std::uint64_t
+#include <cstring>  // for std::memcpy, std::memcmp
+
+#include "BioCro_Extended.h"
+#include "result_queue.h"
+#include "thread_pool.h"
+#include "work_stealing.h"
+
+namespace BioCro {
+
+/**
+ * An Ensemble_parameters object represents the parameter sets of all
+ * members of an ensemble without storing a complete Parameter_set for
+ * each member.  It consists of a single base Parameter_set, shared by
+ * all of the members, together with a table of overrides: a list of
+ * the names of the parameters that vary from member to member, and,
+ * for each member, one row of values for those parameters.
+ *
+ * For example, an ensemble of harmonic oscillators that differ only
+ * in mass and spring constant could be specified as
+ *
+ *     BioCro::Ensemble_parameters ensemble_parameters {
+ *         { {"mass", 10}, {"spring_constant", 0.1}, {"timestep", 1} },
+ *         {"mass", "spring_constant"}
+ *     };
+ *     ensemble_parameters.add_member({10, 0.1});
+ *     ensemble_parameters.add_member({20, 0.1});
+ *     ensemble_parameters.add_member({20, 0.4});
+ *
+ * The override values are stored contiguously, one row per member,
+ * so an ensemble of n members that differ in k parameters costs n * k
+ * doubles rather than n hash maps.  Copies of an Ensemble_parameters
+ * object share the base Parameter_set.
+ */
+class Ensemble_parameters
+{
+   public:
+    Ensemble_parameters(
+        Parameter_set const& base,
+        Variable_names const& override_names)
+        :
+        base{std::make_shared<const Parameter_set>(base)},
+        override_names{override_names}
+    {
+        Variable_set unique_names(override_names.begin(), override_names.end());
+        if (unique_names.size() != override_names.size()) {
+            throw std::invalid_argument("The override names of an "
+                                        "Ensemble_parameters object must be "
+                                        "distinct.");
+        }
+    }
+
+    // Adds a member whose override values are given in the same order
+    // as the override names.
+    void add_member(std::vector<double> const& member_overrides)
+    {
+        if (member_overrides.size() != override_names.size()) {
+            throw std::invalid_argument("Expected " +
+                                        std::to_string(override_names.size()) +
+                                        " override values but got " +
+                                        std::to_string(member_overrides.size()) +
+                                        ".");
+        }
+        override_values.insert(override_values.end(),
+                               member_overrides.begin(),
+                               member_overrides.end());
+        ++number_of_members;
+    }
+
+    size_t size() const { return number_of_members; }
+
+    Parameter_set const& get_base() const { return *base; }
+
+    Variable_names const& get_override_names() const { return override_names; }
+
+    // Gets the value of the override named override_names[column] for
+    // the given member.
+    double get_override(size_t member, size_t column) const
+    {
+        check_member(member);
+        if (column >= override_names.size()) {
+            throw std::out_of_range("Override column " + std::to_string(column) +
+                                    " does not exist; the ensemble has " +
+                                    std::to_string(override_names.size()) +
+                                    " override names.");
+        }
+        return override_values[member * override_names.size() + column];
+    }
+
+    std::vector<double> get_member_overrides(size_t member) const
+    {
+        check_member(member);
+        auto first = override_values.begin() + member * override_names.size();
+        return std::vector<double>(first, first + override_names.size());
+    }
+
+    // Writes the overrides for the given member into a parameter set.
+    // If `parameters` was initialized from the base (or was last used
+    // to resolve some other member of this ensemble), it will
+    // afterwards hold exactly the parameters of the given member.
+    // Only the overridden entries are touched, so resolving a member
+    // costs k assignments rather than a copy of the whole base.
+    void resolve(size_t member, Parameter_set& parameters) const
+    {
+        check_member(member);
+        auto row = override_values.data() + member * override_names.size();
+        for (size_t i = 0; i < override_names.size(); ++i) {
+            parameters[override_names[i]] = row[i];
+        }
+    }
+
+    // Gets a complete Parameter_set for a single member.  This is
+    // mainly useful for inspection; Ensemble_simulator uses resolve
+    // instead.
+    Parameter_set get_member_parameters(size_t member) const
+    {
+        Parameter_set parameters {*base};
+        resolve(member, parameters);
+        return parameters;
+    }
+
+    // Finds, for each member, the lowest-numbered member having the
+    // same inputs.  Since all members share the base, two members are
+    // equivalent exactly when their override rows are identical bit
+    // for bit; values such as 0.0 and -0.0, which some modules treat
+    // differently, are kept apart.  Member i is unique if the returned
+    // vector has i at position i.
+    std::vector<size_t> get_representatives() const
+    {
+        std::vector<size_t> representatives(number_of_members);
+        std::unordered_map<size_t, size_t, Row_hash, Row_equal> first_occurrence
+            (number_of_members, Row_hash{this}, Row_equal{this});
+        for (size_t member = 0; member < number_of_members; ++member) {
+            // emplace does nothing if an equivalent row is already present:
+            auto entry = first_occurrence.emplace(member, member).first;
+            representatives[member] = entry->second;
+        }
+        return representatives;
+    }
+
+   private:
+    std::shared_ptr<const Parameter_set> base;
+    Variable_names override_names;
+    std::vector<double> override_values; // row-major, one row per member
+    size_t number_of_members {0};
+
+    // Hashes and compares members by the bit patterns of their
+    // override rows, in place, so that no per-member key needs to be
+    // built.
+    struct Row_hash {
+        Ensemble_parameters const* table;
+        size_t operator()(size_t member) const
+        {
+            size_t k = table->override_names.size();
+            size_t seed = k;
+            for (size_t i = 0; i < k; ++i) {
+                std::uint64_t bits;
+                std::memcpy(&bits, &table->override_values[member * k + i], sizeof bits);
+                seed ^= std::hash<std::uint64_t>{}(bits) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+            }
+            return seed;
+        }
+    };
+    struct Row_equal {
+        Ensemble_parameters const* table;
+        bool operator()(size_t a, size_t b) const
+        {
+            size_t k = table->override_names.size();
+            return k == 0 || std::memcmp(&table->override_values[a * k],
+                                         &table->override_values[b * k],
+                                         k * sizeof(double)) == 0;
+        }
+    };
+
+    void check_member(size_t member) const
+    {
+        if (member >= number_of_members) {
+            throw std::out_of_range("Ensemble member " + std::to_string(member) +
+                                    " does not exist; the ensemble has " +
+                                    std::to_string(number_of_members) +
+                                    " members.");
+        }
+    }
+};
+
+/**
+ * An Ensemble_result holds one simulation result per ensemble member.
+ * Results are held by shared pointer so that members with identical
+ * inputs can share a single result without copying it.
+ */
+using Ensemble_result = std::vector<std::shared_ptr<const Simulation_result>>;
+
+// An Ensemble_simulator runs one simulation for each member of an
+// Ensemble_parameters object.  Like Alternate_idempotent_simulator, it
+// makes a fresh Simulator for every run, so members never see state
+// left over from a previous run.  The member parameter sets are
+// resolved one at a time into a single scratch Parameter_set, which
+// is copied from the base only once.
+class Ensemble_simulator
+{
+   public:
+    Ensemble_simulator(
+        BioCro::State const& initial_state,
+        Ensemble_parameters const& parameters,
+        BioCro::System_drivers const& drivers,
+        BioCro::Module_set const& direct_mcs,
+        BioCro::Module_set const& differential_mcs,
+
+        std::string ode_solver_name,
+        double output_step_size,
+        double adaptive_rel_error_tol,
+        double adaptive_abs_error_tol,
+        int adaptive_max_steps)
+
+        :
+
+        initial_state{initial_state},
+        parameters{parameters},
+        drivers{drivers},
+        direct_mcs{direct_mcs},
+        differential_mcs{differential_mcs},
+
+        solver_settings{
+            ode_solver_name,
+            output_step_size,
+            adaptive_rel_error_tol,
+            adaptive_abs_error_tol,
+            adaptive_max_steps},
+
+        member_parameters{parameters.get_base()} {}
+
+    size_t size() const { return parameters.size(); }
+
+    Ensemble_parameters const& get_parameters() const { return parameters; }
+
+    void add_member(std::vector<double> const& member_overrides)
+    {
+        parameters.add_member(member_overrides);
+    }
+
+    Solver_settings const& get_solver_settings() const { return solver_settings; }
+
+    BioCro::Simulation_result run_member(size_t member)
+    {
+        return run_member(member, solver_settings);
+    }
+
+    // Runs a member using solver settings other than the ensemble's
+    // own, for example to run a cheap, low-fidelity version of it.
+    BioCro::Simulation_result run_member(size_t member, Solver_settings const& settings)
+    {
+        return run_member(member, settings, member_parameters);
+    }
+
+    // Runs every member in order and returns the results, indexed by
+    // member.
+    std::vector<BioCro::Simulation_result> run_simulation()
+    {
+        std::vector<BioCro::Simulation_result> results;
+        results.reserve(size());
+        for (size_t member = 0; member < size(); ++member) {
+            results.push_back(run_member(member));
+        }
+        return results;
+    }
+
+    // Runs members first through last - 1 on the threads of `pool` and
+    // returns their results, in member order.  Each thread takes the
+    // next member not yet started and resolves its parameters into a
+    // scratch Parameter_set of its own.  The module creators must be
+    // safe to use from several threads at once.
+    std::vector<BioCro::Simulation_result> run_members(size_t first, size_t last,
+                                                       Thread_pool& pool) const
+    {
+        std::vector<BioCro::Simulation_result> results(last - first);
+        std::atomic<size_t> next_member {first};
+        pool.run(std::min(pool.size(), last - first), [&](size_t) {
+            BioCro::Parameter_set scratch = parameters.get_base();
+            size_t member;
+            while ((member = next_member++) < last) {
+                results[member - first] = run_member(member, solver_settings, scratch);
+            }
+        });
+        return results;
+    }
+
+    /**
+     * Runs every member on `number_of_threads` threads and returns the
+     * results, indexed by member.  Members are scheduled by a
+     * Work_stealing_executor, longest expected run first, using the
+     * run times recorded by earlier calls (see get_member_timings);
+     * on the first call, members are started in order.
+     *
+     * The module creators must be safe to use from several threads at
+     * once, as the creators in BioCro's module libraries are.
+     */
+    std::vector<BioCro::Simulation_result> run_simulation_in_parallel(size_t number_of_threads)
+    {
+        Work_stealing_executor executor {number_of_threads};
+        std::vector<BioCro::Parameter_set> scratch(
+            executor.get_number_of_threads(), parameters.get_base());
+        std::vector<BioCro::Simulation_result> results(size());
+
+        std::vector<double> expected(size());
+        for (size_t member = 0; member < size(); ++member) {
+            expected[member] = member_timings.get_expected_duration(member);
+        }
+        std::vector<double> durations = executor.run(
+            expected,
+            [&](size_t member, size_t worker) {
+                results[member] = run_member(member, solver_settings, scratch[worker]);
+            });
+        for (size_t member = 0; member < size(); ++member) {
+            member_timings.record(member, durations[member]);
+        }
+        return results;
+    }
+
+    /**
+     * Like run_simulation_in_parallel above, but instead of collecting
+     * the results, hands each one as soon as it is finished to one of
+     * `number_of_writers` writer threads, which pass it to `writer`.
+     * Results travel through a Bounded_mpmc_queue holding at most
+     * `queue_capacity` results (rounded up to a power of two); if the
+     * writers fall behind, simulation threads wait for room rather
+     * than piling up results in memory.
+     *
+     * Results reach the writer in the order they finish, not in member
+     * order.  `writer` may be called from several writer threads at
+     * once.  If it throws, the remaining results are discarded and the
+     * first exception is rethrown once the simulations have finished.
+     */
+    void run_simulation_in_parallel(size_t number_of_threads,
+                                    Result_writer writer,
+                                    size_t number_of_writers = 1,
+                                    size_t queue_capacity = 64)
+    {
+        Bounded_mpmc_queue<Result_chunk> queue {queue_capacity};
+        std::exception_ptr writer_error;
+        std::atomic<bool> writer_failed {false};
+        std::mutex error_mutex;
+
+        std::vector<std::thread> writers;
+        for (size_t w = 0; w < std::max<size_t>(number_of_writers, 1); ++w) {
+            writers.emplace_back([&] {
+                Result_chunk chunk;
+                while (queue.pop(chunk)) {
+                    try {
+                        if (!writer_failed) writer(chunk);
+                    } catch (...) {
+                        std::lock_guard<std::mutex> lock(error_mutex);
+                        if (!writer_failed) writer_error = std::current_exception();
+                        writer_failed = true;
+                    }
+                }
+            });
+        }
+
+        Work_stealing_executor executor {number_of_threads};
+        std::vector<BioCro::Parameter_set> scratch(
+            executor.get_number_of_threads(), parameters.get_base());
+        std::vector<double> expected(size());
+        for (size_t member = 0; member < size(); ++member) {
+            expected[member] = member_timings.get_expected_duration(member);
+        }
+
+        std::vector<double> durations;
+        std::exception_ptr simulation_error;
+        try {
+            durations = executor.run(
+                expected,
+                [&](size_t member, size_t worker) {
+                    queue.push(Result_chunk{
+                        member, run_member(member, solver_settings, scratch[worker])});
+                });
+        } catch (...) {
+            simulation_error = std::current_exception();
+        }
+        queue.close();
+        for (auto& thread : writers) thread.join();
+
+        if (simulation_error) std::rethrow_exception(simulation_error);
+        if (writer_error) std::rethrow_exception(writer_error);
+        for (size_t member = 0; member < size(); ++member) {
+            member_timings.record(member, durations[member]);
+        }
+    }
+
+    Timing_history<size_t> const& get_member_timings() const { return member_timings; }
+
+    // Runs each distinct member only once.  Members with identical
+    // inputs (see Ensemble_parameters::get_representatives) share a
+    // single result object: the returned vector has one pointer per
+    // member, and the pointers for duplicate members are equal.
+    Ensemble_result run_unique_simulations()
+    {
+        std::vector<size_t> representatives = parameters.get_representatives();
+        Ensemble_result results(size());
+        for (size_t member = 0; member < size(); ++member) {
+            size_t representative = representatives[member];
+            if (representative == member) {
+                results[member] = std::make_shared<const BioCro::Simulation_result>(run_member(member));
+            } else {
+                // The representative is always the first member of
+                // its group, so its result already exists.
+                results[member] = results[representative];
+            }
+        }
+        return results;
+    }
+
+   private:
+    BioCro::State initial_state;
+    Ensemble_parameters parameters;
+    BioCro::System_drivers drivers;
+    BioCro::Module_set direct_mcs;
+    BioCro::Module_set differential_mcs;
+    Solver_settings solver_settings;
+
+    // Scratch space into which member parameter sets are resolved.
+    BioCro::Parameter_set member_parameters;
+
+    // How long each member took when last run in parallel.
+    Timing_history<size_t> member_timings;
+
+    BioCro::Simulation_result run_member(size_t member,
+                                         Solver_settings const& settings,
+                                         BioCro::Parameter_set& scratch) const
+    {
+        parameters.resolve(member, scratch);
+        Simulator sim {
+            initial_state,
+            scratch,
+            drivers,
+            direct_mcs,
+            differential_mcs,
+            settings.ode_solver_name,
+            settings.output_step_size,
+            settings.adaptive_rel_error_tol,
+            settings.adaptive_abs_error_tol,
+            settings.adaptive_max_steps
+        };
+        return sim.run_simulation();
+    }
+};
+
+}
+
+#endif
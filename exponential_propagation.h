@@ -0,0 +1,340 @@
+#ifndef EXPONENTIAL_PROPAGATION_H
+#define EXPONENTIAL_PROPAGATION_H
+
+#include <algorithm>  // for std::find, std::max
+#include <cmath>      // for std::fabs, std::frexp, std::ldexp
+#include <map>
+
+#include "direct_evaluation.h"
+#include "scenario.h"
+
+namespace BioCro {
+
+// Computes the exponential of an n x n matrix (stored row by row) by
+// scaling and squaring a Taylor series, which is accurate to about
+// machine precision relative to the norm of the result.
+inline std::vector<double> matrix_exponential(std::vector<double> const& a, size_t n)
+{
+    auto multiply = [n](std::vector<double> const& x, std::vector<double> const& y) {
+        std::vector<double> z(n * n, 0.0);
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t k = 0; k < n; ++k) {
+                double x_ik = x[i * n + k];
+                if (x_ik == 0) continue;
+                for (size_t j = 0; j < n; ++j) z[i * n + j] += x_ik * y[k * n + j];
+            }
+        }
+        return z;
+    };
+
+    // Scale a by 2^-s so that its norm is at most 1/2.
+    double norm {0.0};
+    for (size_t i = 0; i < n; ++i) {
+        double row {0.0};
+        for (size_t j = 0; j < n; ++j) row += std::fabs(a[i * n + j]);
+        if (row > norm) norm = row;
+    }
+    int s {0};
+    if (norm > 0.5) std::frexp(norm / 0.5, &s);
+    std::vector<double> scaled(n * n);
+    for (size_t k = 0; k < n * n; ++k) scaled[k] = std::ldexp(a[k], -s);
+
+    // With a norm of 1/2, eighteen terms leave an error below 1e-20.
+    std::vector<double> result(n * n, 0.0);
+    std::vector<double> term(n * n, 0.0);
+    for (size_t i = 0; i < n; ++i) result[i * n + i] = term[i * n + i] = 1.0;
+    for (int k = 1; k <= 18; ++k) {
+        term = multiply(term, scaled);
+        for (size_t m = 0; m < n * n; ++m) {
+            term[m] /= k;
+            result[m] += term[m];
+        }
+    }
+    for (int k = 0; k < s; ++k) result = multiply(result, result);
+    return result;
+}
+
+/**
+ * A Linear_subsystem is a set of differential quantities x whose rates
+ * of change are dx/dt = A x + b, with A and b constant, and depend on
+ * no other quantities.  (Other quantities may depend on them.)  A is
+ * stored row by row, and both are in units of per row of drivers.
+ */
+struct Linear_subsystem {
+    Variable_names names;
+    std::vector<size_t> indices;  // among the system's differential quantities
+    std::vector<double> matrix;
+    std::vector<double> offset;
+};
+
+/**
+ * Finds the largest linear constant-coefficient subsystem of a
+ * dynamical system by comparing its Jacobian, computed by central
+ * differences, at `samples` different states and driver rows.  A
+ * quantity belongs to the subsystem if its row of the Jacobian and
+ * the constant term of its rate agree at all of the samples to within
+ * `tolerance` (relative to their size), and if it depends only on
+ * other quantities in the subsystem.
+ *
+ * This is a test, not a proof: a module that is linear near the
+ * sample states but not elsewhere will pass it.
+ */
+inline Linear_subsystem find_linear_subsystem(Dynamical_system const& system,
+                                              double tolerance = 1e-8,
+                                              size_t samples = 4)
+{
+    Variable_names names = system->get_differential_quantity_names();
+    size_t n = names.size();
+    size_t rows = system->get_ntimes();
+    samples = std::max<size_t>(samples, 2);
+
+    std::vector<double> x0(n);
+    system->get_differential_quantities(x0);
+
+    // jacobians[s] and offsets[s] are the Jacobian and the constant
+    // term of the rates at sample s.
+    std::vector<std::vector<double>> jacobians(samples, std::vector<double>(n * n));
+    std::vector<std::vector<double>> offsets(samples, std::vector<double>(n));
+    std::vector<double> f(n), f_plus(n), f_minus(n);
+    for (size_t s = 0; s < samples; ++s) {
+        double time = rows > 1 ? double(s * (rows - 1)) / (samples - 1) : 0.0;
+        std::vector<double> x = x0;
+        for (size_t i = 0; i < n; ++i) {
+            double sign = (i + s) % 2 == 0 ? 1.0 : -1.0;
+            x[i] += sign * 0.37 * s * (1 + std::fabs(x0[i]));
+        }
+        system->calculate_derivative(x, f, time);
+        for (size_t j = 0; j < n; ++j) {
+            double delta = 1e-3 * (1 + std::fabs(x[j]));
+            double x_j = x[j];
+            x[j] = x_j + delta;
+            system->calculate_derivative(x, f_plus, time);
+            x[j] = x_j - delta;
+            system->calculate_derivative(x, f_minus, time);
+            x[j] = x_j;
+            for (size_t i = 0; i < n; ++i) {
+                jacobians[s][i * n + j] = (f_plus[i] - f_minus[i]) / (2 * delta);
+            }
+        }
+        for (size_t i = 0; i < n; ++i) {
+            offsets[s][i] = f[i];
+            for (size_t j = 0; j < n; ++j) offsets[s][i] -= jacobians[s][i * n + j] * x[j];
+        }
+    }
+    // Calculating a derivative sets the system's state, so put it back.
+    system->calculate_derivative(x0, f, 0.0);
+
+    auto agree = [tolerance](double a, double b, double scale) {
+        return std::fabs(a - b) <= tolerance * (1 + scale);  // false for NaN
+    };
+    std::vector<bool> linear(n, true);
+    std::vector<double> row_size(n, 0.0);
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+            row_size[i] = std::max(row_size[i], std::fabs(jacobians[0][i * n + j]));
+        }
+        for (size_t s = 1; s < samples; ++s) {
+            for (size_t j = 0; j < n; ++j) {
+                if (!agree(jacobians[s][i * n + j], jacobians[0][i * n + j], row_size[i])) {
+                    linear[i] = false;
+                }
+            }
+            double scale = std::fabs(offsets[0][i]) + row_size[i] * (1 + std::fabs(x0[i]));
+            if (!agree(offsets[s][i], offsets[0][i], scale)) linear[i] = false;
+        }
+    }
+
+    // Remove quantities depending on ones outside the subsystem until
+    // none are left.
+    bool changed {true};
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < n; ++i) {
+            if (!linear[i]) continue;
+            for (size_t j = 0; j < n; ++j) {
+                if (!linear[j] && !agree(jacobians[0][i * n + j], 0, row_size[i])) {
+                    linear[i] = false;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    Linear_subsystem subsystem;
+    for (size_t i = 0; i < n; ++i) {
+        if (!linear[i]) continue;
+        subsystem.names.push_back(names[i]);
+        subsystem.indices.push_back(i);
+        subsystem.offset.push_back(offsets[0][i]);
+    }
+    for (size_t i : subsystem.indices) {
+        for (size_t j : subsystem.indices) subsystem.matrix.push_back(jacobians[0][i * n + j]);
+    }
+    return subsystem;
+}
+
+/**
+ * An Exponential_propagator advances the state of a Linear_subsystem
+ * exactly: over a step h,
+ *
+ *     x(t + h) = exp(A h) x(t) + (integral from 0 to h of exp(A s) ds) b,
+ *
+ * and both terms come from the exponential of the augmented matrix
+ * [[A h, b h], [0, 0]].  That exponential is computed once for each
+ * step size and cached, so each later step costs one small
+ * matrix-vector product.
+ */
+class Exponential_propagator
+{
+   public:
+    explicit Exponential_propagator(Linear_subsystem const& subsystem)
+        : n{subsystem.indices.size()}, matrix{subsystem.matrix}, offset{subsystem.offset} {}
+
+    // Sets result (of length n) to the state a step h after x.
+    void advance(double h, double const* x, double* result)
+    {
+        auto it = cache.find(h);
+        if (it == cache.end()) {
+            size_t m = n + 1;
+            std::vector<double> augmented(m * m, 0.0);
+            for (size_t i = 0; i < n; ++i) {
+                for (size_t j = 0; j < n; ++j) augmented[i * m + j] = matrix[i * n + j] * h;
+                augmented[i * m + n] = offset[i] * h;
+            }
+            it = cache.emplace(h, matrix_exponential(augmented, m)).first;
+        }
+        std::vector<double> const& e = it->second;
+        size_t m = n + 1;
+        for (size_t i = 0; i < n; ++i) {
+            double sum = e[i * m + n];
+            for (size_t j = 0; j < n; ++j) sum += e[i * m + j] * x[j];
+            result[i] = sum;
+        }
+    }
+
+    size_t get_cache_size() const { return cache.size(); }
+
+   private:
+    size_t n;
+    std::vector<double> matrix;
+    std::vector<double> offset;
+    std::map<double, std::vector<double>> cache;
+};
+
+struct Exponential_settings {
+    // The number of fixed steps per driver row.  Quantities in the
+    // linear subsystem are exact at any step size; this sets the
+    // accuracy of the rest, which use the classical Runge-Kutta method.
+    size_t steps_per_row {1};
+
+    // See find_linear_subsystem.
+    double linearity_tolerance {1e-8};
+    size_t samples {4};
+};
+
+/**
+ * An Exponential_integrator solves a scenario by finding its linear
+ * constant-coefficient subsystem (see find_linear_subsystem),
+ * advancing that part exactly with an Exponential_propagator, and
+ * advancing the remaining differential quantities with the classical
+ * fourth-order Runge-Kutta method.  At the Runge-Kutta stages, the
+ * linear quantities are taken from the exact solution rather than from
+ * the stages, so the remaining quantities see them without error.
+ *
+ * A system that is entirely linear, like a harmonic oscillator, is
+ * solved exactly with one matrix-vector product per step.  The
+ * integrator produces results at every driver row, with direct module
+ * outputs computed afterward by a Direct_evaluator, and ignores the
+ * scenario's solver settings.
+ */
+class Exponential_integrator
+{
+   public:
+    explicit Exponential_integrator(Exponential_settings const& settings = {})
+        : settings{settings} {}
+
+    Simulation_result integrate(Scenario const& scenario)
+    {
+        if (settings.steps_per_row == 0) {
+            throw std::invalid_argument("The number of steps per row of an exponential "
+                                        "integrator must be positive.");
+        }
+
+        Dynamical_system system = make_dynamical_system(
+            scenario.initial_state, scenario.parameters, scenario.drivers,
+            scenario.direct_mcs, scenario.differential_mcs);
+        subsystem = find_linear_subsystem(system, settings.linearity_tolerance, settings.samples);
+        Exponential_propagator propagator {subsystem};
+
+        Variable_names names = system->get_differential_quantity_names();
+        size_t n = names.size();
+        std::vector<size_t> const& linear = subsystem.indices;
+        std::vector<size_t> others;
+        for (size_t i = 0; i < n; ++i) {
+            if (std::find(linear.begin(), linear.end(), i) == linear.end()) others.push_back(i);
+        }
+
+        std::vector<double> x(n);
+        system->get_differential_quantities(x);
+        size_t rows = get_number_of_rows(scenario);
+        std::vector<std::vector<double>> states(n, std::vector<double>(rows));
+        for (size_t i = 0; i < n; ++i) states[i][0] = x[i];
+
+        std::vector<double> linear_now(linear.size()), linear_half(linear.size()),
+            linear_next(linear.size());
+        std::vector<double> k1(n), k2(n), k3(n), k4(n), stage(n);
+        double h = 1.0 / settings.steps_per_row;
+        for (size_t row = 1; row < rows; ++row) {
+            for (size_t step = 0; step < settings.steps_per_row; ++step) {
+                double t = row - 1 + step * h;
+                for (size_t k = 0; k < linear.size(); ++k) linear_now[k] = x[linear[k]];
+                propagator.advance(h, linear_now.data(), linear_next.data());
+
+                if (!others.empty()) {
+                    propagator.advance(h / 2, linear_now.data(), linear_half.data());
+                    auto set_stage = [&](std::vector<double> const& linear_values,
+                                         std::vector<double> const& rates, double fraction) {
+                        for (size_t k = 0; k < linear.size(); ++k) {
+                            stage[linear[k]] = linear_values[k];
+                        }
+                        for (size_t i : others) stage[i] = x[i] + fraction * h * rates[i];
+                    };
+                    system->calculate_derivative(x, k1, t);
+                    set_stage(linear_half, k1, 0.5);
+                    system->calculate_derivative(stage, k2, t + h / 2);
+                    set_stage(linear_half, k2, 0.5);
+                    system->calculate_derivative(stage, k3, t + h / 2);
+                    set_stage(linear_next, k3, 1.0);
+                    system->calculate_derivative(stage, k4, t + h);
+                    for (size_t i : others) {
+                        x[i] += h / 6 * (k1[i] + 2 * k2[i] + 2 * k3[i] + k4[i]);
+                    }
+                }
+                for (size_t k = 0; k < linear.size(); ++k) x[linear[k]] = linear_next[k];
+            }
+            for (size_t i = 0; i < n; ++i) states[i][row] = x[i];
+        }
+        cache_size = propagator.get_cache_size();
+
+        System_drivers columns = scenario.drivers;
+        for (size_t i = 0; i < n; ++i) columns[names[i]] = states[i];
+        return Direct_evaluator{scenario.parameters, scenario.direct_mcs}.evaluate(columns);
+    }
+
+    // Gets the linear subsystem found by the last integration.
+    Linear_subsystem const& get_linear_subsystem() const { return subsystem; }
+
+    // Gets the number of matrix exponentials computed by the last
+    // integration.
+    size_t get_cache_size() const { return cache_size; }
+
+   private:
+    Exponential_settings settings;
+    Linear_subsystem subsystem;
+    size_t cache_size {0};
+};
+
+}
+
+#endif
@@ -0,0 +1,518 @@
+#ifndef EXPRESSION_MODULE_H
+#define EXPRESSION_MODULE_H
+
+#include <cctype>   // for std::isalpha, std::isdigit, std::isspace
+#include <cmath>
+#include <cstdint>  // for std::uint16_t
+#include <locale>   // for std::locale::classic
+#include <sstream>  // for std::istringstream
+
+#include "BioCro_Extended.h"
+
+namespace BioCro {
+
+/**
+ * An Expression_program is a small module body written as arithmetic
+ * expressions and compiled to bytecode for a register machine.  The
+ * source text is a sequence of assignments separated by semicolons or
+ * newlines, for example
+ *
+ *     kinetic_energy = 0.5 * mass * velocity^2
+ *     spring_energy = 0.5 * spring_constant * position^2
+ *     total_energy = kinetic_energy + spring_energy
+ *
+ * The names assigned to are the outputs; every other name is an
+ * input.  Expressions may use numbers, names, parentheses, the binary
+ * operators + - * / ^ (with the usual precedence, ^ binding tightest
+ * and associating to the right), unary minus, and the functions sqrt,
+ * exp, log, sin, cos, tan, abs, pow, min, and max.  Names may contain
+ * dots after their first character, as namespaced quantities do (see
+ * field_composition.h).  Lines beginning with # are comments.
+ *
+ * In a direct program, a name that has already been assigned refers
+ * to the value assigned (as total_energy uses kinetic_energy above).
+ * In a differential program the outputs are rates of change, so names
+ * always refer to the inputs: for example,
+ *
+ *     position = velocity
+ *     velocity = -spring_constant * position / mass
+ *
+ * computes the derivatives of position and velocity from their current
+ * values.
+ *
+ * The compiled program runs on blocks of rows at a time: each
+ * instruction is applied to a whole block before the next instruction
+ * is dispatched, so the cost of interpretation is shared among the
+ * rows of the block and the inner loops are simple enough for the
+ * compiler to vectorize.  Use evaluate to run a program over many rows
+ * at once; a module made from a program (see
+ * Expression_module_creator) runs it one row at a time.
+ */
+class Expression_program
+{
+   public:
+    // The number of rows processed per instruction dispatch.
+    static constexpr size_t block_size {64};
+
+    explicit Expression_program(std::string const& source, bool differential = false)
+        : source{source}, differential{differential}
+    {
+        compile();
+    }
+
+    Variable_names const& get_inputs() const { return inputs; }
+    Variable_names const& get_outputs() const { return outputs; }
+    bool is_differential() const { return differential; }
+    size_t get_number_of_instructions() const { return code.size(); }
+    size_t get_number_of_registers() const { return number_of_registers; }
+
+    /**
+     * Evaluates the program on `rows` rows.  input_columns[i] points
+     * to the values of input i (in the order of get_inputs()), and
+     * output_columns[j] points to storage for output j (in the order
+     * of get_outputs()).
+     */
+    void evaluate(double const* const* input_columns,
+                  double* const* output_columns,
+                  size_t rows) const
+    {
+        std::vector<double> registers(number_of_registers * block_size);
+        initialize_constants(registers.data(), block_size);
+        for (size_t first = 0; first < rows; first += block_size) {
+            size_t n = rows - first < block_size ? rows - first : block_size;
+            for (size_t i = 0; i < inputs.size(); ++i) {
+                std::copy(input_columns[i] + first, input_columns[i] + first + n,
+                          registers.data() + i * block_size);
+            }
+            run(registers.data(), block_size, n);
+            for (size_t j = 0; j < outputs.size(); ++j) {
+                double const* result = registers.data() + output_registers[j] * block_size;
+                std::copy(result, result + n, output_columns[j] + first);
+            }
+        }
+    }
+
+    // Evaluates the program on a single row using caller-supplied
+    // registers, which must have been prepared with
+    // initialize_constants(registers, 1).  Inputs are read from, and
+    // outputs left in, the registers given by get_input_register and
+    // get_output_register.
+    void evaluate_row(double* registers) const
+    {
+        run(registers, 1, 1);
+    }
+
+    size_t get_input_register(size_t input) const { return input; }
+    size_t get_output_register(size_t output) const { return output_registers[output]; }
+
+    void initialize_constants(double* registers, size_t stride) const
+    {
+        for (size_t c = 0; c < constants.size(); ++c) {
+            std::fill(registers + (inputs.size() + c) * stride,
+                      registers + (inputs.size() + c + 1) * stride,
+                      constants[c]);
+        }
+    }
+
+   private:
+    enum class Op : std::uint16_t {
+        add, subtract, multiply, divide, power, minimum, maximum,
+        negate, square_root, exponential, logarithm, sine, cosine,
+        tangent, absolute_value
+    };
+
+    // Every instruction computes register dst from registers a and b
+    // (b is unused by unary operations).
+    struct Instruction {
+        Op op;
+        std::uint16_t dst;
+        std::uint16_t a;
+        std::uint16_t b;
+    };
+
+    std::string source;
+    bool differential;
+
+    // Registers are laid out as inputs, then constants, then
+    // temporaries.
+    Variable_names inputs;
+    Variable_names outputs;
+    std::vector<double> constants;
+    std::vector<Instruction> code;
+    std::vector<size_t> output_registers;
+    size_t number_of_registers {0};
+
+    template <typename Operation>
+    static void apply(double* dst, double const* a, double const* b,
+                      size_t n, Operation f)
+    {
+        for (size_t k = 0; k < n; ++k) dst[k] = f(a[k], b[k]);
+    }
+
+    void run(double* r, size_t stride, size_t n) const
+    {
+        for (auto const& instruction : code) {
+            double* d = r + instruction.dst * stride;
+            double const* a = r + instruction.a * stride;
+            double const* b = r + instruction.b * stride;
+            switch (instruction.op) {
+            case Op::add:            apply(d, a, b, n, [](double x, double y) { return x + y; }); break;
+            case Op::subtract:       apply(d, a, b, n, [](double x, double y) { return x - y; }); break;
+            case Op::multiply:       apply(d, a, b, n, [](double x, double y) { return x * y; }); break;
+            case Op::divide:         apply(d, a, b, n, [](double x, double y) { return x / y; }); break;
+            case Op::power:          apply(d, a, b, n, [](double x, double y) { return std::pow(x, y); }); break;
+            case Op::minimum:        apply(d, a, b, n, [](double x, double y) { return std::fmin(x, y); }); break;
+            case Op::maximum:        apply(d, a, b, n, [](double x, double y) { return std::fmax(x, y); }); break;
+            case Op::negate:         apply(d, a, b, n, [](double x, double) { return -x; }); break;
+            case Op::square_root:    apply(d, a, b, n, [](double x, double) { return std::sqrt(x); }); break;
+            case Op::exponential:    apply(d, a, b, n, [](double x, double) { return std::exp(x); }); break;
+            case Op::logarithm:      apply(d, a, b, n, [](double x, double) { return std::log(x); }); break;
+            case Op::sine:           apply(d, a, b, n, [](double x, double) { return std::sin(x); }); break;
+            case Op::cosine:         apply(d, a, b, n, [](double x, double) { return std::cos(x); }); break;
+            case Op::tangent:        apply(d, a, b, n, [](double x, double) { return std::tan(x); }); break;
+            case Op::absolute_value: apply(d, a, b, n, [](double x, double) { return std::fabs(x); }); break;
+            }
+        }
+    }
+
+    ////////////////////////////////////////////////////////////////////////////
+    // Compilation
+    //
+    // The compiler is a recursive-descent parser that emits code as it
+    // goes.  Each parsing function returns the register holding the
+    // value of what it parsed.  Registers for inputs and constants are
+    // numbered only after parsing, once their counts are known, so
+    // while parsing, operands are tagged by kind.
+    ////////////////////////////////////////////////////////////////////////////
+
+    enum class Kind { input, constant, temporary };
+    struct Operand {
+        Kind kind;
+        size_t index;
+    };
+    struct Pending_instruction {
+        Op op;
+        size_t dst;  // a temporary
+        Operand a;
+        Operand b;
+    };
+
+    size_t position {0};
+    std::vector<Pending_instruction> pending;
+    std::unordered_map<std::string, size_t> input_indices;
+    std::unordered_map<std::string, Operand> assigned;  // direct programs only
+    std::vector<Operand> output_operands;
+    size_t number_of_temporaries {0};
+
+    [[noreturn]] void syntax_error(std::string const& problem) const
+    {
+        throw std::invalid_argument("Error in expression module at position " +
+                                    std::to_string(position) + ": " + problem + ".");
+    }
+
+    void skip_blanks()
+    {
+        while (position < source.size()) {
+            char c = source[position];
+            if (c == '#') {
+                while (position < source.size() && source[position] != '\n') ++position;
+            } else if (c == ' ' || c == '\t' || c == '\r') {
+                ++position;
+            } else {
+                break;
+            }
+        }
+    }
+
+    bool at(char c)
+    {
+        skip_blanks();
+        return position < source.size() && source[position] == c;
+    }
+
+    void expect(char c)
+    {
+        if (!at(c)) syntax_error(std::string("expected '") + c + "'");
+        ++position;
+    }
+
+    std::string name()
+    {
+        skip_blanks();
+        size_t start = position;
+        while (position < source.size() &&
+               (std::isalnum(static_cast<unsigned char>(source[position])) ||
+                source[position] == '_' ||
+                (source[position] == '.' && position > start))) {
+            ++position;
+        }
+        return source.substr(start, position - start);
+    }
+
+    Operand emit(Op op, Operand a, Operand b = Operand{Kind::constant, 0})
+    {
+        Operand result {Kind::temporary, number_of_temporaries++};
+        pending.push_back(Pending_instruction{op, result.index, a, b});
+        return result;
+    }
+
+    Operand constant(double value)
+    {
+        constants.push_back(value);
+        return Operand{Kind::constant, constants.size() - 1};
+    }
+
+    void compile()
+    {
+        // Constant 0 doubles as the unused operand of unary operations.
+        constant(0);
+        Variable_set output_set;
+        while (true) {
+            while (at('\n') || at(';')) ++position;
+            skip_blanks();
+            if (position >= source.size()) break;
+
+            std::string output = name();
+            if (output.empty() || std::isdigit(static_cast<unsigned char>(output[0]))) {
+                syntax_error("expected the name of an output");
+            }
+            if (!output_set.insert(output).second) {
+                syntax_error("\"" + output + "\" is assigned more than once");
+            }
+            expect('=');
+            Operand value = expression();
+            if (!at('\n') && !at(';') && position < source.size()) {
+                syntax_error("unexpected character");
+            }
+            outputs.push_back(output);
+            output_operands.push_back(value);
+            if (!differential) assigned[output] = value;
+        }
+        if (outputs.empty()) syntax_error("no outputs are defined");
+        for (auto& output : outputs) {
+            if (!differential && input_indices.count(output)) {
+                throw std::invalid_argument("\"" + output + "\" is used as an "
+                                            "input before it is assigned.");
+            }
+        }
+        assign_registers();
+    }
+
+    void assign_registers()
+    {
+        size_t first_temporary = inputs.size() + constants.size();
+        number_of_registers = first_temporary + number_of_temporaries;
+        if (number_of_registers > 0xffff) {
+            throw std::invalid_argument("Expression module is too large.");
+        }
+        auto reg = [&](Operand operand) -> std::uint16_t {
+            switch (operand.kind) {
+            case Kind::input:    return operand.index;
+            case Kind::constant: return inputs.size() + operand.index;
+            default:             return first_temporary + operand.index;
+            }
+        };
+        for (auto& p : pending) {
+            code.push_back(Instruction{p.op,
+                                       reg(Operand{Kind::temporary, p.dst}),
+                                       reg(p.a), reg(p.b)});
+        }
+        for (auto& operand : output_operands) {
+            output_registers.push_back(reg(operand));
+        }
+    }
+
+    // expression := term (('+' | '-') term)*
+    Operand expression()
+    {
+        Operand left = term();
+        while (true) {
+            if (at('+')) { ++position; left = emit(Op::add, left, term()); }
+            else if (at('-')) { ++position; left = emit(Op::subtract, left, term()); }
+            else return left;
+        }
+    }
+
+    // term := unary (('*' | '/') unary)*
+    Operand term()
+    {
+        Operand left = unary();
+        while (true) {
+            if (at('*')) { ++position; left = emit(Op::multiply, left, unary()); }
+            else if (at('/')) { ++position; left = emit(Op::divide, left, unary()); }
+            else return left;
+        }
+    }
+
+    // unary := '-' unary | power
+    Operand unary()
+    {
+        if (at('-')) {
+            ++position;
+            return emit(Op::negate, unary());
+        }
+        return power();
+    }
+
+    // power := primary ('^' unary)?
+    Operand power()
+    {
+        Operand base = primary();
+        if (at('^')) {
+            ++position;
+            return emit(Op::power, base, unary());
+        }
+        return base;
+    }
+
+    // primary := number | name | function '(' arguments ')' | '(' expression ')'
+    Operand primary()
+    {
+        skip_blanks();
+        if (at('(')) {
+            ++position;
+            Operand value = expression();
+            expect(')');
+            return value;
+        }
+        if (position < source.size() &&
+            (std::isdigit(static_cast<unsigned char>(source[position])) ||
+             source[position] == '.')) {
+            // Numbers are read in the classic locale, so that the
+            // decimal point is always '.' whatever the global locale.
+            std::istringstream number {source.substr(position)};
+            number.imbue(std::locale::classic());
+            double value;
+            if (!(number >> value)) syntax_error("expected a number, a name, or '('");
+            position = number.eof() ? source.size() : position + number.tellg();
+            return constant(value);
+        }
+        std::string identifier = name();
+        if (identifier.empty()) syntax_error("expected a number, a name, or '('");
+        if (at('(')) return function_call(identifier);
+
+        auto previous = assigned.find(identifier);
+        if (previous != assigned.end()) return previous->second;
+        auto entry = input_indices.emplace(identifier, inputs.size());
+        if (entry.second) inputs.push_back(identifier);
+        return Operand{Kind::input, entry.first->second};
+    }
+
+    Operand function_call(std::string const& function)
+    {
+        static const std::unordered_map<std::string, Op> unary_functions {
+            {"sqrt", Op::square_root}, {"exp", Op::exponential},
+            {"log", Op::logarithm}, {"sin", Op::sine}, {"cos", Op::cosine},
+            {"tan", Op::tangent}, {"abs", Op::absolute_value}};
+        static const std::unordered_map<std::string, Op> binary_functions {
+            {"pow", Op::power}, {"min", Op::minimum}, {"max", Op::maximum}};
+
+        expect('(');
+        Operand first = expression();
+        Operand result;
+        if (unary_functions.count(function)) {
+            result = emit(unary_functions.at(function), first);
+        } else if (binary_functions.count(function)) {
+            expect(',');
+            result = emit(binary_functions.at(function), first, expression());
+        } else {
+            syntax_error("unknown function \"" + function + "\"");
+        }
+        expect(')');
+        return result;
+    }
+};
+
+// A module that runs an Expression_program on the quantities it was
+// created with.  Base is either direct_module or differential_module.
+template <typename Base>
+class Expression_module : public Base
+{
+   public:
+    Expression_module(std::shared_ptr<const Expression_program> program,
+                      Variable_settings const& input_quantities,
+                      Variable_settings* output_quantities)
+        : Base{},
+          program{program},
+          registers(program->get_number_of_registers())
+    {
+        for (auto& name : program->get_inputs()) {
+            input_ptrs.push_back(&input_quantities.at(name));
+        }
+        for (auto& name : program->get_outputs()) {
+            output_ptrs.push_back(&output_quantities->at(name));
+        }
+        program->initialize_constants(registers.data(), 1);
+    }
+
+   private:
+    std::shared_ptr<const Expression_program> program;
+    std::vector<double const*> input_ptrs;
+    std::vector<double*> output_ptrs;
+    // Mutable because modules are run through a const member function.
+    mutable std::vector<double> registers;
+
+    void do_operation() const override
+    {
+        for (size_t i = 0; i < input_ptrs.size(); ++i) {
+            registers[program->get_input_register(i)] = *input_ptrs[i];
+        }
+        program->evaluate_row(registers.data());
+        for (size_t j = 0; j < output_ptrs.size(); ++j) {
+            this->update(output_ptrs[j], registers[program->get_output_register(j)]);
+        }
+    }
+};
+
+/**
+ * An Expression_module_creator makes modules defined by an
+ * Expression_program, so that simple modules can be defined at run
+ * time rather than written in C++ and compiled into a module library.
+ * Since it is a module creator, it can go in a Module_set alongside
+ * creators retrieved from a module factory.  For example,
+ *
+ *     BioCro::Expression_module_creator oscillator {
+ *         "expression_oscillator",
+ *         "position = velocity\n"
+ *         "velocity = -spring_constant * position / mass",
+ *         true  // differential
+ *     };
+ *     BioCro::Module_set differential_modules {&oscillator};
+ *
+ * The creator must outlive any Module_set (and any simulator) using
+ * it.
+ */
+class Expression_module_creator : public ::module_creator
+{
+   public:
+    Expression_module_creator(std::string const& name,
+                              std::string const& source,
+                              bool differential = false)
+        : name{name},
+          program{std::make_shared<const Expression_program>(source, differential)} {}
+
+    Module create_module(Variable_settings const& input_quantities,
+                         Variable_settings* output_quantities) override
+    {
+        if (program->is_differential()) {
+            return Module(new Expression_module<::differential_module>(
+                program, input_quantities, output_quantities));
+        }
+        return Module(new Expression_module<::direct_module>(
+            program, input_quantities, output_quantities));
+    }
+
+    Variable_names get_inputs() override { return program->get_inputs(); }
+    Variable_names get_outputs() override { return program->get_outputs(); }
+    std::string get_name() override { return name; }
+
+    Expression_program const& get_program() const { return *program; }
+
+   private:
+    std::string name;
+    std::shared_ptr<const Expression_program> program;
+};
+
+}
+
+#endif
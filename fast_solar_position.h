@@ -0,0 +1,304 @@
+#ifndef FAST_SOLAR_POSITION_H
+#define FAST_SOLAR_POSITION_H
+
+#include <algorithm>  // for std::sort
+#include <cmath>      // for std::floor, std::sqrt, std::fabs
+#include <limits>     // for std::numeric_limits
+
+#include "BioCro_Extended.h"
+
+namespace BioCro {
+
+/*
+ * Fast approximations of the trigonometric functions needed for solar
+ * position.  Angles are in degrees, as in Michalsky's algorithm, which
+ * makes range reduction exact for the arguments that occur: the
+ * argument is reduced by a multiple of 90 degrees, a subtraction that
+ * is exact for any |x| below 2^44 degrees, and only the small
+ * remainder is converted to radians.
+ *
+ * The polynomials are the minimax polynomials used by the Cephes
+ * library for |x| <= pi/4; their error there is within a few units in
+ * the last place.  atan2_degrees reduces its argument to |t| <= tan(15°)
+ * and uses an odd polynomial of degree 13, whose error is below
+ * 2e-10 radians (about 1e-8 degrees).
+ */
+namespace fast_trig {
+
+    constexpr double radians_per_degree {3.14159265358979323846 / 180};
+
+    // Sine and cosine of a reduced argument r, |r| <= pi/4 radians.
+    inline double sin_reduced(double r)
+    {
+        double z = r * r;
+        return r + r * z * (((((1.58962301576546568060e-10 * z
+                                - 2.50507477628578072866e-8) * z
+                               + 2.75573136213857245213e-6) * z
+                              - 1.98412698295895385996e-4) * z
+                             + 8.33333333332211858878e-3) * z
+                            - 1.66666666666666307295e-1);
+    }
+
+    inline double cos_reduced(double r)
+    {
+        double z = r * r;
+        return 1.0 - 0.5 * z + z * z * (((((-1.13585365213876817300e-11 * z
+                                            + 2.08757008419747316778e-9) * z
+                                           - 2.75573141792967388112e-7) * z
+                                          + 2.48015872888517045348e-5) * z
+                                         - 1.38888888888730564116e-3) * z
+                                        + 4.16666666666665929218e-2);
+    }
+
+    // Computes the sine and cosine of an angle in degrees with one
+    // range reduction.  The quadrant is applied by selection rather
+    // than branching, since it varies unpredictably from call to call.
+    inline void sin_cos_degrees(double x, double& s, double& c)
+    {
+        double quadrant = std::floor(x * (1.0 / 90) + 0.5);
+        double r = (x - 90 * quadrant) * radians_per_degree;
+        double sr = sin_reduced(r);
+        double cr = cos_reduced(r);
+        long long q = static_cast<long long>(quadrant);
+        bool odd = q & 1;
+        double s_magnitude = odd ? cr : sr;
+        double c_magnitude = odd ? sr : cr;
+        s = (q & 2) ? -s_magnitude : s_magnitude;
+        c = ((q + 1) & 2) ? -c_magnitude : c_magnitude;
+    }
+
+    inline double sin_degrees(double x)
+    {
+        double s, c;
+        sin_cos_degrees(x, s, c);
+        return s;
+    }
+
+    // The arctangent of y/x in degrees, in (-180, 180].
+    inline double atan2_degrees(double y, double x)
+    {
+        constexpr double tan_15 {0.26794919243112270};  // 2 - sqrt(3)
+        constexpr double sqrt_3 {1.73205080756887729};
+
+        double ay = std::fabs(y), ax = std::fabs(x);
+        bool swapped = ay > ax;
+        double t = swapped ? ax / ay : (ax > 0 ? ay / ax : 0.0);  // 0 <= t <= 1
+        double offset {0.0};
+        if (t > tan_15) {
+            // atan(t) = 30° + atan((t√3 - 1) / (t + √3))
+            t = (t * sqrt_3 - 1) / (t + sqrt_3);
+            offset = 30;
+        }
+        double z = t * t;
+        double a = t * (1 + z * (-1.0 / 3 + z * (1.0 / 5 + z * (-1.0 / 7 + z * (1.0 / 9
+                   + z * (-1.0 / 11 + z * (1.0 / 13)))))));
+        double angle = offset + a / radians_per_degree;
+        if (swapped) angle = 90 - angle;
+        if (x < 0) angle = 180 - angle;
+        return y < 0 ? -angle : angle;
+    }
+
+    // x modulo 360, in [0, 360).
+    inline double wrap_360(double x)
+    {
+        return x - 360 * std::floor(x * (1.0 / 360));
+    }
+}
+
+/*
+ * Computes solar position by Michalsky's algorithm using the
+ * approximations in fast_trig, given the sine and cosine of the
+ * latitude.  This is the calculation done by Fast_solar_position; it
+ * is exposed separately so that whole series can be computed at once
+ * (see solar_table.h).
+ */
+inline void compute_fast_solar_position(double time, double time_zone_offset,
+                                        double year, double longitude,
+                                        double sin_lat, double cos_lat,
+                                        double& cosine_zenith_angle,
+                                        double& solar_declination,
+                                        double& hour_angle)
+{
+    using namespace fast_trig;
+
+    // Time since the J2000.0 epoch, in days.
+    double doy = std::floor(time);
+    double hour = (time - doy) * 24 - time_zone_offset;
+    double delta = year - 1949;
+    double leap = std::floor(delta * 0.25);
+    double n = 2432916.5 + delta * 365 + leap + doy + hour * (1.0 / 24) - 2451545.0;
+
+    // Ecliptic coordinates (degrees).
+    double L = wrap_360(280.460 + 0.9856474 * n);
+    double g = wrap_360(357.528 + 0.9856003 * n);
+    double sin_g, cos_g;
+    sin_cos_degrees(g, sin_g, cos_g);
+    double sin_2g = 2 * sin_g * cos_g;
+    double lambda = L + 1.915 * sin_g + 0.020 * sin_2g;
+    double epsilon = 23.439 - 0.0000004 * n;
+
+    double sin_lambda, cos_lambda, sin_epsilon, cos_epsilon;
+    sin_cos_degrees(lambda, sin_lambda, cos_lambda);
+    sin_cos_degrees(epsilon, sin_epsilon, cos_epsilon);
+
+    // Right ascension and declination, as sines and cosines.
+    double ra_y = cos_epsilon * sin_lambda;
+    double ra_x = cos_lambda;
+    double sin_dec = sin_epsilon * sin_lambda;
+    double cos_dec = std::sqrt(ra_x * ra_x + ra_y * ra_y);
+    double cos_ra = ra_x / cos_dec;
+    double sin_ra = ra_y / cos_dec;
+
+    // Local mean sidereal time, as an angle (degrees).
+    double gmst = 6.697375 + 0.0657098242 * n + hour;
+    double lmst = wrap_360(gmst * 15 + longitude);
+
+    // The hour angle is lmst - ra; get its cosine and sine without
+    // forming ra itself.
+    double sin_lmst, cos_lmst;
+    sin_cos_degrees(lmst, sin_lmst, cos_lmst);
+    double cos_ha = cos_lmst * cos_ra + sin_lmst * sin_ra;
+    double sin_ha = sin_lmst * cos_ra - cos_lmst * sin_ra;
+
+    cosine_zenith_angle = sin_dec * sin_lat + cos_dec * cos_lat * cos_ha;
+    solar_declination = atan2_degrees(sin_dec, cos_dec);
+    hour_angle = atan2_degrees(sin_ha, cos_ha);
+}
+
+/**
+ * A module computing solar position by Michalsky's algorithm, as the
+ * solar_position_michalsky module of the standard module library does,
+ * but using the fast approximations in fast_trig in place of calls to
+ * the standard library's transcendental functions.  In addition, the
+ * cosine of the zenith angle is computed without forming the
+ * declination and hour angle at all (using the identities
+ * sin(dec) = sin(eps) sin(lambda) and cos(dec) = |(cos lambda,
+ * cos eps sin lambda)|), so its accuracy depends only on the sine and
+ * cosine approximations; the error in cosine_zenith_angle is of order
+ * 1e-14.  solar_declination and hour_angle (both in degrees) are
+ * accurate to about 1e-8 degrees.
+ *
+ * These errors are far below the accuracy of the algorithm itself
+ * (about 0.01 degree), so for most purposes results match those of the
+ * library module.
+ */
+class Fast_solar_position : public ::direct_module
+{
+   public:
+    Fast_solar_position(Variable_settings const& input_quantities,
+                        Variable_settings* output_quantities)
+        : ::direct_module{},
+          lat{input_quantities.at("lat")},
+          longitude{input_quantities.at("longitude")},
+          time{input_quantities.at("time")},
+          time_zone_offset{input_quantities.at("time_zone_offset")},
+          year{input_quantities.at("year")},
+          cosine_zenith_angle_op{&output_quantities->at("cosine_zenith_angle")},
+          solar_declination_op{&output_quantities->at("solar_declination")},
+          hour_angle_op{&output_quantities->at("hour_angle")} {}
+
+    static Variable_names get_inputs()
+    {
+        return {"lat", "longitude", "time", "time_zone_offset", "year"};
+    }
+
+    static Variable_names get_outputs()
+    {
+        return {"cosine_zenith_angle", "solar_declination", "hour_angle"};
+    }
+
+   private:
+    double const& lat;
+    double const& longitude;
+    double const& time;
+    double const& time_zone_offset;
+    double const& year;
+    double* cosine_zenith_angle_op;
+    double* solar_declination_op;
+    double* hour_angle_op;
+
+    mutable double cached_lat {std::numeric_limits<double>::quiet_NaN()};
+    mutable double sin_lat {0.0};
+    mutable double cos_lat {0.0};
+
+    void do_operation() const override
+    {
+        // The latitude rarely changes, so its sine and cosine are
+        // kept from one evaluation to the next.
+        if (lat != cached_lat) {
+            fast_trig::sin_cos_degrees(lat, sin_lat, cos_lat);
+            cached_lat = lat;
+        }
+
+        double cosine_zenith_angle, solar_declination, hour_angle;
+        compute_fast_solar_position(time, time_zone_offset, year, longitude,
+                                    sin_lat, cos_lat,
+                                    cosine_zenith_angle, solar_declination, hour_angle);
+        update(cosine_zenith_angle_op, cosine_zenith_angle);
+        update(solar_declination_op, solar_declination);
+        update(hour_angle_op, hour_angle);
+    }
+};
+
+/**
+ * Creates Fast_solar_position modules.  To use the fast evaluation in
+ * one simulation, put this creator in its direct module set in place
+ * of the library's solar_position_michalsky creator, or use
+ * use_fast_solar_position to do the substitution.
+ */
+class Fast_solar_position_module_creator : public ::module_creator
+{
+   public:
+    Module create_module(Variable_settings const& input_quantities,
+                         Variable_settings* output_quantities) override
+    {
+        return Module(new Fast_solar_position(input_quantities, output_quantities));
+    }
+
+    Variable_names get_inputs() override { return Fast_solar_position::get_inputs(); }
+    Variable_names get_outputs() override { return Fast_solar_position::get_outputs(); }
+    std::string get_name() override { return "fast_solar_position_michalsky"; }
+};
+
+inline Module_creator get_fast_solar_position_creator()
+{
+    static Fast_solar_position_module_creator creator;
+    return &creator;
+}
+
+// Throws unless a creator has the same inputs and outputs as
+// Fast_solar_position, in any order, so that one can stand in for the
+// other without adding or dropping quantities.
+inline void check_solar_position_interface(Module_creator creator)
+{
+    Variable_names inputs = creator->get_inputs();
+    Variable_names outputs = creator->get_outputs();
+    Variable_names expected_inputs = Fast_solar_position::get_inputs();
+    Variable_names expected_outputs = Fast_solar_position::get_outputs();
+    for (auto* names : {&inputs, &outputs, &expected_inputs, &expected_outputs}) {
+        std::sort(names->begin(), names->end());
+    }
+    if (inputs != expected_inputs || outputs != expected_outputs) {
+        throw std::invalid_argument("The module \"" + creator->get_name() + "\" doesn't have "
+                                    "the inputs and outputs of the fast solar position module, "
+                                    "so it can't be replaced by it.");
+    }
+}
+
+// Returns a copy of a module set in which any solar_position_michalsky
+// creator is replaced by the fast version.  Throws if such a creator's
+// inputs and outputs differ from those of the fast version.
+inline Module_set use_fast_solar_position(Module_set modules)
+{
+    for (auto& creator : modules) {
+        if (creator->get_name() == "solar_position_michalsky") {
+            check_solar_position_interface(creator);
+            creator = get_fast_solar_position_creator();
+        }
+    }
+    return modules;
+}
+
+}
+
+#endif
@@ -0,0 +1,253 @@
+#ifndef FIELD_COMPOSITION_H
+#define FIELD_COMPOSITION_H
+
+#include <memory>  // for std::unique_ptr
+
+#include "scenario.h"
+
+namespace BioCro {
+
+/**
+ * The inner module of a Namespaced_module, together with the maps of
+ * quantities it was created on.  They live together on the heap so
+ * that the module's references into the maps stay valid.
+ */
+struct Namespace_storage {
+    Variable_settings inputs;
+    Variable_settings outputs;
+    Module module;
+};
+
+/**
+ * A module that runs another module under different quantity names:
+ * each run copies its inputs into the inner module's own maps, runs
+ * it, and copies the outputs back out.  It is a direct or
+ * differential module according to the inner module.
+ */
+class Namespaced_module : public ::module
+{
+   public:
+    Namespaced_module(std::unique_ptr<Namespace_storage> storage,
+                      Variable_names const& inner_inputs,
+                      Variable_names const& outer_inputs,
+                      Variable_names const& inner_outputs,
+                      Variable_names const& outer_outputs,
+                      Variable_settings const& input_quantities,
+                      Variable_settings* output_quantities)
+        : ::module{storage->module->is_deriv(), storage->module->is_adaptive_compatible()},
+          storage{std::move(storage)}
+    {
+        for (size_t i = 0; i < inner_inputs.size(); ++i) {
+            inputs.push_back({&input_quantities.at(outer_inputs[i]),
+                              &this->storage->inputs.at(inner_inputs[i])});
+        }
+        for (size_t i = 0; i < inner_outputs.size(); ++i) {
+            outputs.push_back({&this->storage->outputs.at(inner_outputs[i]),
+                               &output_quantities->at(outer_outputs[i])});
+        }
+    }
+
+   private:
+    std::unique_ptr<Namespace_storage> storage;
+    std::vector<std::pair<double const*, double*>> inputs;  // outer to inner
+    std::vector<std::pair<double*, double*>> outputs;       // inner to outer
+
+    void do_operation() const override
+    {
+        for (auto& input : inputs) *input.second = *input.first;
+        if (is_deriv()) {
+            // Differential modules add to their outputs.
+            for (auto& output : outputs) *output.first = 0;
+        }
+        storage->module->run();
+        for (auto& output : outputs) update(output.second, *output.first);
+    }
+};
+
+/**
+ * A Namespaced_module_creator puts a module into a namespace: every
+ * quantity it uses is renamed to prefix + "." + name, except for the
+ * `shared` quantities, which keep their names.
+ */
+class Namespaced_module_creator : public ::module_creator
+{
+   public:
+    Namespaced_module_creator(Module_creator original,
+                              std::string const& prefix,
+                              Variable_set const& shared = {})
+        : original{original},
+          prefix{prefix},
+          inner_inputs{original->get_inputs()},
+          inner_outputs{original->get_outputs()}
+    {
+        for (auto& name : inner_inputs) {
+            outer_inputs.push_back(shared.count(name) ? name : prefix + "." + name);
+        }
+        for (auto& name : inner_outputs) {
+            outer_outputs.push_back(shared.count(name) ? name : prefix + "." + name);
+        }
+    }
+
+    Module create_module(Variable_settings const& input_quantities,
+                         Variable_settings* output_quantities) override
+    {
+        std::unique_ptr<Namespace_storage> storage {new Namespace_storage};
+        for (auto& name : inner_inputs) storage->inputs[name] = 0;
+        for (auto& name : inner_outputs) storage->outputs[name] = 0;
+        storage->module = original->create_module(storage->inputs, &storage->outputs);
+        return Module(new Namespaced_module(std::move(storage), inner_inputs, outer_inputs,
+                                            inner_outputs, outer_outputs, input_quantities,
+                                            output_quantities));
+    }
+
+    Variable_names get_inputs() override { return outer_inputs; }
+    Variable_names get_outputs() override { return outer_outputs; }
+    std::string get_name() override { return prefix + "." + original->get_name(); }
+
+   private:
+    Module_creator original;
+    std::string prefix;
+    Variable_names inner_inputs;
+    Variable_names outer_inputs;
+    Variable_names inner_outputs;
+    Variable_names outer_outputs;
+};
+
+/**
+ * One of the systems in a Field_composition: the five system-related
+ * arguments of a Simulator, where `drivers` holds only the drivers
+ * specific to this field.
+ */
+struct Field {
+    std::string name;
+    State initial_state;
+    Parameter_set parameters;
+    System_drivers drivers;
+    Module_set direct_mcs;
+    Module_set differential_mcs;
+};
+
+/**
+ * A Field_composition combines several systems, such as neighboring
+ * fields, into one scenario that is simulated with one solver.  Each
+ * field's quantities are namespaced by the field name, so the
+ * quantity "Leaf" of the field "north" becomes "north.Leaf" in the
+ * combined system and its results.
+ *
+ * The shared parameters and drivers (typically the time step and the
+ * weather) are stored once and used by every field under their own
+ * names, unless a field defines a quantity of the same name itself.
+ * Fields can exchange quantities through exchange modules, which work
+ * on the namespaced names directly; for example, a differential
+ * Expression_module_creator with the program
+ *
+ *     north.water = 0.01 * (south.water - north.water)
+ *     south.water = 0.01 * (north.water - south.water)
+ *
+ * moves water between two fields.
+ *
+ * The composition owns the namespaced module creators in its
+ * scenario, so it must outlive any use of the scenario.
+ */
+class Field_composition
+{
+   public:
+    Field_composition(Parameter_set const& shared_parameters,
+                      System_drivers const& shared_drivers,
+                      Solver_settings const& solver_settings)
+        : scenario{{}, shared_parameters, shared_drivers, {}, {}, solver_settings} {}
+
+    Field_composition(Field_composition const&) = delete;
+    Field_composition& operator=(Field_composition const&) = delete;
+
+    void add_field(Field const& field)
+    {
+        if (field.name.empty() || field.name.find('.') != std::string::npos) {
+            throw std::invalid_argument("A field name must be nonempty and contain no dots.");
+        }
+        for (auto& name : field_names) {
+            if (name == field.name) {
+                throw std::invalid_argument("There is already a field named \"" + name + "\".");
+            }
+        }
+
+        // Quantities the field defines itself are namespaced even if
+        // they are also shared.
+        Variable_set own;
+        for (auto& x : field.initial_state) own.insert(x.first);
+        for (auto& x : field.parameters) own.insert(x.first);
+        for (auto& x : field.drivers) own.insert(x.first);
+        for (auto const* set : {&field.direct_mcs, &field.differential_mcs}) {
+            for (auto creator : *set) {
+                for (auto& name : creator->get_outputs()) own.insert(name);
+            }
+        }
+        Variable_set shared;
+        for (auto& x : scenario.parameters) {
+            if (!own.count(x.first)) shared.insert(x.first);
+        }
+        for (auto& x : scenario.drivers) {
+            if (!own.count(x.first)) shared.insert(x.first);
+        }
+
+        std::string prefix = field.name + ".";
+        for (auto& x : field.initial_state) scenario.initial_state[prefix + x.first] = x.second;
+        for (auto& x : field.parameters) scenario.parameters[prefix + x.first] = x.second;
+        for (auto& x : field.drivers) scenario.drivers[prefix + x.first] = x.second;
+        for (auto creator : field.direct_mcs) {
+            creators.emplace_back(new Namespaced_module_creator(creator, field.name, shared));
+            scenario.direct_mcs.push_back(creators.back().get());
+        }
+        for (auto creator : field.differential_mcs) {
+            creators.emplace_back(new Namespaced_module_creator(creator, field.name, shared));
+            scenario.differential_mcs.push_back(creators.back().get());
+        }
+        field_names.push_back(field.name);
+    }
+
+    // Adds modules working on the namespaced quantities of several
+    // fields.
+    void add_exchange_modules(Module_set const& direct_mcs, Module_set const& differential_mcs)
+    {
+        scenario.direct_mcs.insert(scenario.direct_mcs.end(), direct_mcs.begin(), direct_mcs.end());
+        scenario.differential_mcs.insert(scenario.differential_mcs.end(),
+                                         differential_mcs.begin(), differential_mcs.end());
+    }
+
+    Variable_names const& get_field_names() const { return field_names; }
+
+    Scenario const& get_scenario() const { return scenario; }
+
+    Simulation_result run_simulation() const
+    {
+        return make_simulator(scenario).run_simulation();
+    }
+
+    // Gets the columns of one field from the result of the combined
+    // system, under their original names, together with the shared
+    // drivers.
+    Simulation_result get_field_result(Simulation_result const& result,
+                                       std::string const& field) const
+    {
+        std::string prefix = field + ".";
+        Simulation_result field_result;
+        for (auto& column : result) {
+            if (column.first.compare(0, prefix.size(), prefix) == 0) {
+                field_result[column.first.substr(prefix.size())] = column.second;
+            } else if (scenario.drivers.count(column.first) &&
+                       column.first.find('.') == std::string::npos) {
+                field_result.insert(column);
+            }
+        }
+        return field_result;
+    }
+
+   private:
+    Scenario scenario;
+    Variable_names field_names;
+    std::vector<std::unique_ptr<Namespaced_module_creator>> creators;
+};
+
+}
+
+#endif
@@ -0,0 +1,112 @@
+// Generated by BioCro::generate_quantity_structs from the modules
+// harmonic_energy, harmonic_oscillator.
+// Regenerate rather than editing by hand.
+
+#ifndef HARMONIC_QUANTITIES_H
+#define HARMONIC_QUANTITIES_H
+
+#include "BioCro_Extended.h"
+
+struct Harmonic_parameters {
+    double mass;
+    double spring_constant;
+    double timestep;
+
+    // Gets the names of the fields, in order.
+    static BioCro::Variable_names const& names()
+    {
+        static const BioCro::Variable_names quantity_names {"mass", "spring_constant", "timestep"};
+        return quantity_names;
+    }
+
+    BioCro::Parameter_set to_map() const
+    {
+        return BioCro::Parameter_set {
+            {"mass", mass},
+            {"spring_constant", spring_constant},
+            {"timestep", timestep}};
+    }
+
+    static Harmonic_parameters from_map(BioCro::Parameter_set const& quantities)
+    {
+        return Harmonic_parameters {
+            quantities.at("mass"),
+            quantities.at("spring_constant"),
+            quantities.at("timestep")};
+    }
+};
+
+// Binds the fields of Harmonic_parameters to the values in a map, so
+// that they are read and written in place with no lookups.
+struct Harmonic_parameters_ref {
+    double& mass;
+    double& spring_constant;
+    double& timestep;
+
+    explicit Harmonic_parameters_ref(BioCro::Parameter_set& quantities)
+        : mass{quantities.at("mass")},
+          spring_constant{quantities.at("spring_constant")},
+          timestep{quantities.at("timestep")} {}
+
+    void assign(Harmonic_parameters const& values)
+    {
+        mass = values.mass;
+        spring_constant = values.spring_constant;
+        timestep = values.timestep;
+    }
+
+    Harmonic_parameters get() const
+    {
+        return Harmonic_parameters {mass, spring_constant, timestep};
+    }
+};
+
+struct Harmonic_state {
+    double position;
+    double velocity;
+
+    // Gets the names of the fields, in order.
+    static BioCro::Variable_names const& names()
+    {
+        static const BioCro::Variable_names quantity_names {"position", "velocity"};
+        return quantity_names;
+    }
+
+    BioCro::State to_map() const
+    {
+        return BioCro::State {
+            {"position", position},
+            {"velocity", velocity}};
+    }
+
+    static Harmonic_state from_map(BioCro::State const& quantities)
+    {
+        return Harmonic_state {
+            quantities.at("position"),
+            quantities.at("velocity")};
+    }
+};
+
+// Binds the fields of Harmonic_state to the values in a map, so
+// that they are read and written in place with no lookups.
+struct Harmonic_state_ref {
+    double& position;
+    double& velocity;
+
+    explicit Harmonic_state_ref(BioCro::State& quantities)
+        : position{quantities.at("position")},
+          velocity{quantities.at("velocity")} {}
+
+    void assign(Harmonic_state const& values)
+    {
+        position = values.position;
+        velocity = values.velocity;
+    }
+
+    Harmonic_state get() const
+    {
+        return Harmonic_state {position, velocity};
+    }
+};
+
+#endif
@@ -0,0 +1,360 @@
+#ifndef PARALLEL_DIRECT_MODULES_H
+#define PARALLEL_DIRECT_MODULES_H
+
+#include <algorithm>  // for std::stable_sort, std::min_element
+#include <chrono>
+#include <mutex>
+#include <numeric>    // for std::iota, std::accumulate
+
+#include "BioCro_Extended.h"
+#include "thread_pool.h"
+
+namespace BioCro {
+
+/**
+ * Settings controlling when a Parallel_direct_module_creator's modules
+ * evaluate a level in parallel.  Costs are in seconds per evaluation.
+ */
+struct Parallel_settings {
+    // The total number of threads used for a parallel level, counting
+    // the thread running the simulation.
+    size_t number_of_threads {std::max(2u, std::min(4u, std::thread::hardware_concurrency()))};
+
+    // A level is evaluated in parallel only if its modules together
+    // take at least this long; cheaper levels would lose more to
+    // waking the worker threads than they gain.
+    double minimum_level_cost {20e-6};
+
+    // Each parallel task (a group of modules run by one thread) should
+    // take at least this long.
+    double minimum_task_cost {5e-6};
+
+    // The number of evaluations, run sequentially and timed, used to
+    // estimate the cost of each module.
+    size_t calibration_runs {20};
+};
+
+/*
+ * Sorts direct modules into levels: a module's level is one more than
+ * the highest level of any module supplying one of its inputs, so the
+ * modules within a level depend only on earlier levels and can run in
+ * any order.  Throws if two modules have an output in common or if
+ * the modules depend on each other cyclically; `name` identifies the
+ * modules in the error message.
+ */
+inline std::vector<Module_set> get_direct_module_levels(Module_set const& direct_modules,
+                                                        std::string const& name)
+{
+    std::unordered_map<std::string, size_t> producer;
+    for (size_t m = 0; m < direct_modules.size(); ++m) {
+        for (auto& output : direct_modules[m]->get_outputs()) {
+            if (!producer.emplace(output, m).second) {
+                throw std::invalid_argument("The quantity \"" + output +
+                                            "\" is an output of more than "
+                                            "one direct module.");
+            }
+        }
+    }
+
+    // Assign levels by repeated relaxation; a system without cycles
+    // settles within one pass per module.
+    std::vector<size_t> level(direct_modules.size(), 0);
+    bool changed {true};
+    for (size_t pass = 0; changed; ++pass) {
+        if (pass > direct_modules.size()) {
+            throw std::invalid_argument("The direct modules of " + name +
+                                        " depend on each other cyclically.");
+        }
+        changed = false;
+        for (size_t m = 0; m < direct_modules.size(); ++m) {
+            for (auto& input : direct_modules[m]->get_inputs()) {
+                auto p = producer.find(input);
+                if (p != producer.end() && level[m] < level[p->second] + 1) {
+                    level[m] = level[p->second] + 1;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    std::vector<Module_set> levels;
+    for (size_t m = 0; m < direct_modules.size(); ++m) {
+        if (levels.size() <= level[m]) levels.resize(level[m] + 1);
+        levels[level[m]].push_back(direct_modules[m]);
+    }
+    return levels;
+}
+
+/**
+ * A Parallel_direct_module_creator combines a set of direct modules
+ * into a single direct module that evaluates independent modules
+ * concurrently.
+ *
+ * The modules are sorted into levels (see get_direct_module_levels),
+ * and the modules within a level may run in any order.  Each module
+ * made by the creator first runs and times its modules sequentially
+ * for a few evaluations (see Parallel_settings::calibration_runs).
+ * It then decides, once and for all, which levels are expensive
+ * enough to be worth running in parallel, and divides each such level
+ * into tasks of roughly equal cost.  All other levels continue to
+ * run sequentially, so adding the creator to a system with only cheap
+ * modules costs little.
+ *
+ * For example,
+ *
+ *     BioCro::Parallel_direct_module_creator canopy {
+ *         "parallel_canopy", {leaf_a, leaf_b, leaf_c, canopy_total}};
+ *     BioCro::Module_set direct_modules {&canopy};
+ *
+ * All modules made by the creator share one Thread_pool, of
+ * Parallel_settings::number_of_threads threads, so simulations using
+ * the creator don't each start threads of their own.  Only one module
+ * at a time runs its levels on the pool; a module whose creator's pool
+ * is busy, or which is itself running as a task of some Thread_pool
+ * (for example, in a member of an Ensemble_simulator run on several
+ * threads), evaluates every level sequentially on the calling thread
+ * instead of oversubscribing the machine.
+ *
+ * The creator must outlive any Module_set (and any simulator) using
+ * it.  Modules run concurrently must not modify shared state other
+ * than their own outputs.
+ */
+class Parallel_direct_module_creator : public ::module_creator
+{
+   public:
+    Parallel_direct_module_creator(std::string const& name,
+                                   Module_set const& direct_modules,
+                                   Parallel_settings const& settings = {})
+        : name{name}, settings{settings}
+    {
+        find_levels(direct_modules);
+    }
+
+    Module create_module(Variable_settings const& input_quantities,
+                         Variable_settings* output_quantities) override;
+
+    Variable_names get_inputs() override { return inputs; }
+    Variable_names get_outputs() override { return outputs; }
+    std::string get_name() override { return name; }
+
+    // Gets the modules of each level, in evaluation order.
+    std::vector<Module_set> const& get_levels() const { return levels; }
+    Parallel_settings const& get_settings() const { return settings; }
+
+   private:
+    friend class Parallel_direct_module;
+
+    std::string name;
+    Parallel_settings settings;
+    std::vector<Module_set> levels;
+    Variable_names inputs;
+    Variable_names outputs;
+
+    // The pool shared by the creator's modules, made when a module
+    // first plans a parallel level.  A module runs tasks on the pool
+    // only while it holds pool_mutex.
+    std::unique_ptr<Thread_pool> pool;
+    std::mutex pool_mutex;
+
+    void find_levels(Module_set const& direct_modules)
+    {
+        levels = get_direct_module_levels(direct_modules, name);
+
+        Variable_set produced;
+        for (auto creator : direct_modules) {
+            for (auto& output : creator->get_outputs()) {
+                produced.insert(output);
+                outputs.push_back(output);
+            }
+        }
+        Variable_set seen;
+        for (auto creator : direct_modules) {
+            for (auto& input : creator->get_inputs()) {
+                if (produced.count(input) == 0 && seen.insert(input).second) {
+                    inputs.push_back(input);
+                }
+            }
+        }
+    }
+};
+
+/**
+ * The module made by a Parallel_direct_module_creator.  Its component
+ * modules are created on a private map of quantities, so that they
+ * see each other's outputs regardless of how the enclosing system
+ * arranges its own maps.
+ */
+class Parallel_direct_module : public ::direct_module
+{
+   public:
+    Parallel_direct_module(Parallel_direct_module_creator& creator,
+                           Variable_settings const& input_quantities,
+                           Variable_settings* output_quantities)
+        : ::direct_module{}, creator(creator), settings{creator.get_settings()}
+    {
+        Variable_set outputs;
+        for (auto& level : creator.get_levels()) {
+            for (auto component : level) {
+                for (auto& name : component->get_inputs()) {
+                    quantities.emplace(name, 0.0);
+                }
+                for (auto& name : component->get_outputs()) {
+                    quantities.emplace(name, 0.0);
+                    outputs.insert(name);
+                }
+            }
+        }
+        for (auto& item : quantities) {
+            if (outputs.count(item.first)) {
+                output_ptrs.push_back({&item.second, &lookup(*output_quantities, item.first)});
+            } else {
+                input_ptrs.push_back({&lookup(input_quantities, item.first), &item.second});
+            }
+        }
+
+        for (auto& level : creator.get_levels()) {
+            levels.emplace_back();
+            for (auto component : level) {
+                levels.back().modules.push_back(component->create_module(quantities, &quantities));
+            }
+        }
+        costs.resize(levels.size());
+        for (size_t l = 0; l < levels.size(); ++l) {
+            costs[l].assign(levels[l].modules.size(), 0.0);
+        }
+    }
+
+    // Gets the number of levels that are evaluated in parallel.  This
+    // is zero until the calibration runs have finished.
+    size_t get_number_of_parallel_levels() const
+    {
+        size_t count {0};
+        for (auto& level : levels) {
+            if (!level.tasks.empty()) ++count;
+        }
+        return count;
+    }
+
+   private:
+    struct Level {
+        std::vector<Module> modules;
+        // When the level is evaluated in parallel, the indices of the
+        // modules run by each task; otherwise empty.
+        std::vector<std::vector<size_t>> tasks;
+    };
+
+    // A pair of pointers between which a value is copied.
+    struct Link {
+        double const* from;
+        double* to;
+    };
+
+    Parallel_direct_module_creator& creator;
+    Parallel_settings settings;
+    Variable_settings quantities;
+    std::vector<Link> input_ptrs;
+    std::vector<Link> output_ptrs;
+
+    // Mutable because modules are run through a const member function
+    // and the level plan is made on the fly.
+    mutable std::vector<Level> levels;
+    mutable std::vector<std::vector<double>> costs;
+    mutable size_t runs {0};
+
+    template <typename Map>
+    static auto lookup(Map& map, std::string const& name) -> decltype(map.at(name))
+    {
+        auto item = map.find(name);
+        if (item == map.end()) {
+            throw std::out_of_range("A parallel direct module requires the "
+                                    "quantity \"" + name + "\", which is not "
+                                    "defined.");
+        }
+        return item->second;
+    }
+
+    void do_operation() const override
+    {
+        for (auto& link : input_ptrs) *link.to = *link.from;
+
+        if (runs < settings.calibration_runs) {
+            run_timed();
+            if (++runs == settings.calibration_runs) plan();
+        } else {
+            std::unique_lock<std::mutex> lock {creator.pool_mutex, std::defer_lock};
+            bool parallel = !Thread_pool::is_running_task() && lock.try_lock();
+            for (auto& level : levels) {
+                if (level.tasks.empty() || !parallel) {
+                    for (auto& m : level.modules) m->run();
+                } else {
+                    creator.pool->run(level.tasks.size(), [&level](size_t task) {
+                        for (size_t m : level.tasks[task]) level.modules[m]->run();
+                    });
+                }
+            }
+        }
+
+        for (auto& link : output_ptrs) update(link.to, *link.from);
+    }
+
+    void run_timed() const
+    {
+        using clock = std::chrono::steady_clock;
+        for (size_t l = 0; l < levels.size(); ++l) {
+            for (size_t m = 0; m < levels[l].modules.size(); ++m) {
+                auto start = clock::now();
+                levels[l].modules[m]->run();
+                costs[l][m] += std::chrono::duration<double>(clock::now() - start).count();
+            }
+        }
+    }
+
+    // Divides each sufficiently expensive level into tasks, assigning
+    // modules, most expensive first, to the task with the least work
+    // so far.
+    void plan() const
+    {
+        for (size_t l = 0; l < levels.size(); ++l) {
+            auto& cost = costs[l];
+            for (auto& c : cost) c /= settings.calibration_runs;
+            double total = std::accumulate(cost.begin(), cost.end(), 0.0);
+            size_t modules = cost.size();
+            if (settings.number_of_threads < 2 || modules < 2 ||
+                total < settings.minimum_level_cost) {
+                continue;
+            }
+            size_t number_of_tasks = std::min(settings.number_of_threads, modules);
+            if (settings.minimum_task_cost > 0) {
+                number_of_tasks = std::min<size_t>(
+                    number_of_tasks, total / settings.minimum_task_cost);
+            }
+            if (number_of_tasks < 2) continue;
+
+            std::vector<size_t> order(modules);
+            std::iota(order.begin(), order.end(), 0);
+            std::stable_sort(order.begin(), order.end(),
+                             [&](size_t a, size_t b) { return cost[a] > cost[b]; });
+            std::vector<double> load(number_of_tasks, 0.0);
+            auto& tasks = levels[l].tasks;
+            tasks.assign(number_of_tasks, {});
+            for (size_t m : order) {
+                size_t lightest = std::min_element(load.begin(), load.end()) - load.begin();
+                tasks[lightest].push_back(m);
+                load[lightest] += cost[m];
+            }
+            std::lock_guard<std::mutex> lock(creator.pool_mutex);
+            if (!creator.pool) creator.pool.reset(new Thread_pool(settings.number_of_threads));
+        }
+    }
+};
+
+inline Module Parallel_direct_module_creator::create_module(
+    Variable_settings const& input_quantities,
+    Variable_settings* output_quantities)
+{
+    return Module(new Parallel_direct_module(*this, input_quantities, output_quantities));
+}
+
+}
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef PARAREAL_H
+#define PARAREAL_H
+
+#include <algorithm>  // for std::max, std::min
+#include <cmath>      // for std::fabs
+
+#include "scenario.h"
+#include "thread_pool.h"
+
+namespace BioCro {
+
+struct Parareal_settings {
+    // The number of threads running the fine solver.
+    size_t number_of_threads {1};
+
+    // The number of time windows; zero means one per thread.  More
+    // windows than threads can help when the coarse solver is very
+    // cheap, since each iteration makes one more window exact.
+    size_t number_of_windows {0};
+
+    // The cheap solver propagating corrections from window to window.
+    // The scenario's own solver settings are used as the fine solver.
+    Solver_settings coarse_solver {"homemade_euler", 1, 0.0001, 0.0001, 200};
+
+    // Iteration stops once no window start value changes by more than
+    // tolerance * max(1, |value|).
+    double tolerance {1e-8};
+
+    // Iteration also stops after this many fine sweeps; zero means the
+    // number of windows, after which the result is exactly the serial
+    // one.
+    size_t maximum_iterations {0};
+};
+
+/**
+ * A Parareal_integrator simulates a long scenario on several cores by
+ * dividing its driver rows into consecutive time windows and using the
+ * parareal algorithm of Lions, Maday, and Turinici (2001).
+ *
+ * A cheap coarse solver is first run serially across the windows to
+ * guess the state at the start of each one.  Each iteration then runs
+ * the scenario's own (fine) solver over every window at once, in
+ * parallel, from the current guesses, and sweeps serially through the
+ * windows again correcting each guess by
+ *
+ *     U[w + 1] = G(U[w]) + F(U_old[w]) - G(U_old[w]),
+ *
+ * where F and G are the fine and coarse solutions over window w.  The
+ * first w windows are exact after w iterations, and iteration usually
+ * converges in far fewer when the coarse solver captures the slow
+ * dynamics.  A window whose starting state didn't change isn't solved
+ * again.
+ *
+ * The speedup is at most (number of windows) / (number of iterations),
+ * less the serial coarse sweeps, so a coarse solver much cheaper than
+ * the fine one is essential.  The result is assembled from the fine
+ * solutions of the last iteration; at the window boundaries it agrees
+ * with the serial simulation to within the tolerance.
+ */
+class Parareal_integrator
+{
+   public:
+    explicit Parareal_integrator(Parareal_settings const& settings = {})
+        : settings{settings} {}
+
+    Simulation_result integrate(Scenario const& scenario)
+    {
+        changes.clear();
+        iterations = 0;
+        size_t rows = get_number_of_rows(scenario);
+        if (rows < 2) {
+            State final_state;
+            return run_scenario_rows(scenario, scenario.initial_state, 0, rows - 1, final_state);
+        }
+        size_t windows = settings.number_of_windows > 0 ? settings.number_of_windows
+                                                        : std::max<size_t>(settings.number_of_threads, 1);
+        windows = std::min(windows, rows - 1);
+
+        std::vector<size_t> boundaries(windows + 1);
+        for (size_t w = 0; w <= windows; ++w) boundaries[w] = w * (rows - 1) / windows;
+
+        Scenario coarse = scenario;
+        coarse.solver_settings = settings.coarse_solver;
+        auto run_coarse = [&](size_t w, State const& start) {
+            State end;
+            run_scenario_rows(coarse, start, boundaries[w], boundaries[w + 1], end);
+            return end;
+        };
+
+        // starts[w] is the current guess at the state at boundaries[w].
+        std::vector<State> starts(windows + 1);
+        std::vector<State> coarse_ends(windows);
+        starts[0] = scenario.initial_state;
+        for (size_t w = 0; w < windows; ++w) {
+            starts[w + 1] = coarse_ends[w] = run_coarse(w, starts[w]);
+        }
+
+        size_t maximum_iterations = settings.maximum_iterations > 0
+                                        ? std::min(settings.maximum_iterations, windows)
+                                        : windows;
+        std::vector<Simulation_result> fine_results(windows);
+        std::vector<State> fine_ends(windows);
+        std::vector<bool> solved(windows, false);
+        Thread_pool pool {settings.number_of_threads};
+        while (true) {
+            pool.run(windows, [&](size_t w) {
+                if (solved[w]) return;
+                fine_results[w] = run_scenario_rows(scenario, starts[w], boundaries[w],
+                                                    boundaries[w + 1], fine_ends[w]);
+            });
+            std::fill(solved.begin(), solved.end(), true);
+            if (++iterations >= maximum_iterations) break;
+
+            double largest_change {0.0};
+            for (size_t w = 0; w < windows; ++w) {
+                State coarse_end = run_coarse(w, starts[w]);
+                State guess = coarse_end;
+                for (auto& x : guess) {
+                    x.second += fine_ends[w].at(x.first) - coarse_ends[w].at(x.first);
+                }
+                coarse_ends[w] = coarse_end;
+                if (w + 1 < windows && guess != starts[w + 1]) solved[w + 1] = false;
+                for (auto& x : guess) {
+                    double old = starts[w + 1].at(x.first);
+                    double change = std::fabs(x.second - old) / std::max(1.0, std::fabs(old));
+                    if (!(change <= largest_change)) largest_change = change;  // NaN wins
+                }
+                starts[w + 1] = guess;
+            }
+            changes.push_back(largest_change);
+            if (largest_change <= settings.tolerance) break;
+        }
+
+        Simulation_result result = fine_results[0];
+        for (size_t w = 1; w < windows; ++w) {
+            drop_first_row(fine_results[w]);
+            for (auto& column : result) {
+                auto& piece = fine_results[w].at(column.first);
+                column.second.insert(column.second.end(), piece.begin(), piece.end());
+            }
+        }
+        return result;
+    }
+
+    // Gets the number of fine sweeps made by the last integration.
+    size_t get_number_of_iterations() const { return iterations; }
+
+    // Gets the largest relative change in any window's starting state
+    // at each correction sweep of the last integration.
+    std::vector<double> const& get_changes() const { return changes; }
+
+   private:
+    Parareal_settings settings;
+    size_t iterations {0};
+    std::vector<double> changes;
+};
+
+}
+
+#endif
@@ -0,0 +1,256 @@
+#ifndef QUANTITY_STRUCTS_H
+#define QUANTITY_STRUCTS_H
+
+#include <algorithm>  // for std::sort
+#include <cctype>     // for std::isalnum, std::isdigit, std::isupper
+#include <set>
+#include <sstream>
+
+#include "BioCro_Extended.h"
+
+namespace BioCro {
+
+struct Quantity_struct_settings {
+    // The include guard of the generated header.
+    std::string header_guard {"GENERATED_QUANTITIES_H"};
+
+    std::string parameter_struct {"Parameters"};
+    std::string state_struct {"State_values"};
+
+    // Module inputs that will be supplied as drivers, and so are left
+    // out of the parameter struct.
+    Variable_names drivers;
+
+    // Parameters that no module reads but the system needs anyway,
+    // such as "timestep".
+    Variable_names extra_parameters;
+};
+
+/**
+ * The quantities of a module set, as laid out in generated structs:
+ * the differential quantities (the outputs of the differential
+ * modules) and the parameters (the module inputs that are neither
+ * differential quantities, outputs of direct modules, nor drivers),
+ * each sorted by name.
+ */
+struct Quantity_layout {
+    Variable_names parameters;
+    Variable_names state;
+};
+
+inline Quantity_layout get_quantity_layout(Module_set const& direct_mcs,
+                                           Module_set const& differential_mcs,
+                                           Quantity_struct_settings const& settings = {})
+{
+    Variable_set state, computed(settings.drivers.begin(), settings.drivers.end());
+    for (auto creator : differential_mcs) {
+        for (auto& name : creator->get_outputs()) state.insert(name);
+    }
+    for (auto creator : direct_mcs) {
+        for (auto& name : creator->get_outputs()) computed.insert(name);
+    }
+    Variable_set parameters(settings.extra_parameters.begin(), settings.extra_parameters.end());
+    for (auto const* set : {&direct_mcs, &differential_mcs}) {
+        for (auto creator : *set) {
+            for (auto& name : creator->get_inputs()) {
+                if (!state.count(name) && !computed.count(name)) parameters.insert(name);
+            }
+        }
+    }
+    // Variable_set is ordered, so the names come out sorted.
+    return Quantity_layout{Variable_names(parameters.begin(), parameters.end()),
+                           Variable_names(state.begin(), state.end())};
+}
+
+namespace detail {
+
+// The keywords and alternative tokens of C++14, which can't be used as
+// identifiers.
+inline bool is_keyword(std::string const& name)
+{
+    static const std::set<std::string> keywords {
+        "alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand", "bitor", "bool",
+        "break", "case", "catch", "char", "char16_t", "char32_t", "class", "compl", "const",
+        "const_cast", "constexpr", "continue", "decltype", "default", "delete", "do",
+        "double", "dynamic_cast", "else", "enum", "explicit", "export", "extern", "false",
+        "float", "for", "friend", "goto", "if", "inline", "int", "long", "mutable",
+        "namespace", "new", "noexcept", "not", "not_eq", "nullptr", "operator", "or",
+        "or_eq", "private", "protected", "public", "register", "reinterpret_cast", "return",
+        "short", "signed", "sizeof", "static", "static_assert", "static_cast", "struct",
+        "switch", "template", "this", "thread_local", "throw", "true", "try", "typedef",
+        "typeid", "typename", "union", "unsigned", "using", "virtual", "void", "volatile",
+        "wchar_t", "while", "xor", "xor_eq"};
+    return keywords.count(name) > 0;
+}
+
+// Checks that `name` can be used as an identifier in the generated
+// code and isn't one of `reserved`.  Names beginning with an
+// underscore and an uppercase letter, or containing a double
+// underscore, are reserved to the implementation and rejected too.
+inline void check_identifier(std::string const& name, Variable_set const& reserved = {})
+{
+    bool valid = !name.empty() && !std::isdigit(static_cast<unsigned char>(name[0])) &&
+                 !is_keyword(name) && !reserved.count(name) &&
+                 !(name.size() > 1 && name[0] == '_' &&
+                   std::isupper(static_cast<unsigned char>(name[1]))) &&
+                 name.find("__") == std::string::npos;
+    for (char c : name) {
+        valid = valid && (std::isalnum(static_cast<unsigned char>(c)) || c == '_');
+    }
+    if (!valid) {
+        throw std::invalid_argument("\"" + name + "\" can't be used as the name of a "
+                                    "generated struct, field, or header guard.");
+    }
+}
+
+// Writes a struct holding the values of the named quantities, and a
+// struct of references binding them in a map of type `map_type`.
+inline void write_quantity_struct(std::ostringstream& code,
+                                  std::string const& name,
+                                  std::string const& map_type,
+                                  Variable_names const& fields)
+{
+    // Fields can't share a name with the generated member functions or
+    // with the structs themselves.
+    Variable_set const reserved {"names", "to_map", "from_map", "assign", "get",
+                                 name, name + "_ref"};
+    check_identifier(name);
+    for (auto& field : fields) check_identifier(field, reserved);
+
+    code << "struct " << name << " {\n";
+    for (auto& field : fields) code << "    double " << field << ";\n";
+    code << "\n"
+         << "    // Gets the names of the fields, in order.\n"
+         << "    static BioCro::Variable_names const& names()\n"
+         << "    {\n"
+         << "        static const BioCro::Variable_names quantity_names {";
+    for (size_t i = 0; i < fields.size(); ++i) {
+        code << (i ? ", " : "") << '"' << fields[i] << '"';
+    }
+    code << "};\n"
+         << "        return quantity_names;\n"
+         << "    }\n"
+         << "\n"
+         << "    " << map_type << " to_map() const\n"
+         << "    {\n"
+         << "        return " << map_type << " {";
+    for (size_t i = 0; i < fields.size(); ++i) {
+        code << (i ? ",\n            " : "\n            ") << "{\"" << fields[i] << "\", "
+             << fields[i] << "}";
+    }
+    code << "};\n"
+         << "    }\n"
+         << "\n"
+         << "    static " << name << " from_map(" << map_type << " const& quantities)\n"
+         << "    {\n"
+         << "        return " << name << " {";
+    for (size_t i = 0; i < fields.size(); ++i) {
+        code << (i ? ",\n            " : "\n            ") << "quantities.at(\"" << fields[i]
+             << "\")";
+    }
+    code << "};\n"
+         << "    }\n"
+         << "};\n"
+         << "\n";
+
+    code << "// Binds the fields of " << name << " to the values in a map, so\n"
+         << "// that they are read and written in place with no lookups.\n"
+         << "struct " << name << "_ref {\n";
+    for (auto& field : fields) code << "    double& " << field << ";\n";
+    code << "\n"
+         << "    explicit " << name << "_ref(" << map_type << "& quantities)";
+    for (size_t i = 0; i < fields.size(); ++i) {
+        code << (i ? ",\n          " : "\n        : ") << fields[i] << "{quantities.at(\""
+             << fields[i] << "\")}";
+    }
+    code << " {}\n"
+         << "\n"
+         << "    void assign(" << name << " const& values)\n"
+         << "    {\n";
+    for (auto& field : fields) code << "        " << field << " = values." << field << ";\n";
+    code << "    }\n"
+         << "\n"
+         << "    " << name << " get() const\n"
+         << "    {\n"
+         << "        return " << name << " {";
+    for (size_t i = 0; i < fields.size(); ++i) code << (i ? ", " : "") << fields[i];
+    code << "};\n"
+         << "    }\n"
+         << "};\n";
+}
+
+}  // namespace detail
+
+/**
+ * Generates a header declaring typed structs for the parameters and
+ * differential quantities of a module set (see get_quantity_layout),
+ * so that code setting up simulations can use member access in place
+ * of string keys, and misspelled names fail to compile.  For example,
+ * with the default settings, the structs for a harmonic oscillator
+ * would be used as
+ *
+ *     Parameters parameters;
+ *     parameters.mass = 10;
+ *     parameters.spring_constant = 0.1;
+ *     parameters.timestep = 1;
+ *     BioCro::Parameter_set parameter_set = parameters.to_map();
+ *
+ * Each struct holds only doubles, one per quantity in sorted order, so
+ * every field is at a fixed offset.  A Parameter_set stores its values
+ * in its own nodes, so converting a struct to one (to_map) or back
+ * (from_map) copies the values.  For loops that change values
+ * repeatedly, such as the setup of ensemble members, each struct has a
+ * companion struct of references, named with the suffix "_ref", bound
+ * to the values inside a map once:
+ *
+ *     Parameters_ref bound {parameter_set};
+ *     bound.mass = 20;  // changes parameter_set itself
+ *
+ * Generated headers include BioCro_Extended.h.
+ */
+inline std::string generate_quantity_structs(Module_set const& direct_mcs,
+                                             Module_set const& differential_mcs,
+                                             Quantity_struct_settings const& settings = {})
+{
+    std::string const& parameter_struct = settings.parameter_struct;
+    std::string const& state_struct = settings.state_struct;
+    if (parameter_struct == state_struct || parameter_struct == state_struct + "_ref" ||
+        state_struct == parameter_struct + "_ref") {
+        throw std::invalid_argument("The generated structs \"" + parameter_struct +
+                                    "\" and \"" + state_struct + "\" would clash.");
+    }
+    detail::check_identifier(settings.header_guard);
+
+    Quantity_layout layout = get_quantity_layout(direct_mcs, differential_mcs, settings);
+    Variable_names module_names;
+    for (auto const* set : {&direct_mcs, &differential_mcs}) {
+        for (auto creator : *set) module_names.push_back(creator->get_name());
+    }
+    std::sort(module_names.begin(), module_names.end());
+
+    std::ostringstream code;
+    code << "// Generated by BioCro::generate_quantity_structs from the modules\n"
+         << "//";
+    for (size_t i = 0; i < module_names.size(); ++i) {
+        code << ' ' << module_names[i] << (i + 1 < module_names.size() ? "," : ".");
+    }
+    code << "\n"
+         << "// Regenerate rather than editing by hand.\n"
+         << "\n"
+         << "#ifndef " << settings.header_guard << "\n"
+         << "#define " << settings.header_guard << "\n"
+         << "\n"
+         << "#include \"BioCro_Extended.h\"\n"
+         << "\n";
+    detail::write_quantity_struct(code, settings.parameter_struct, "BioCro::Parameter_set",
+                                  layout.parameters);
+    code << "\n";
+    detail::write_quantity_struct(code, settings.state_struct, "BioCro::State", layout.state);
+    code << "\n"
+         << "#endif\n";
+    return code.str();
+}
+
+}
+
+#endif
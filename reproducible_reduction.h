@@ -0,0 +1,224 @@
+#ifndef REPRODUCIBLE_REDUCTION_H
+#define REPRODUCIBLE_REDUCTION_H
+
+#include <algorithm>  // for std::min, std::max
+#include <cmath>      // for std::fabs, std::isfinite, std::isinf
+
+#include "adaptive_ensemble.h"
+#include "thread_pool.h"
+
+namespace BioCro {
+
+/**
+ * An Exact_sum adds floating-point numbers without rounding error.  It
+ * keeps the running total as a short list of non-overlapping partial
+ * sums (Shewchuk's algorithm, as used by Python's math.fsum), and
+ * value() rounds the exact total to the nearest double.  Since the
+ * total is exact, the value doesn't depend on the order in which
+ * numbers (or other Exact_sums) are added, so sums computed in pieces
+ * on any number of threads agree to the last bit.
+ *
+ * Infinities and NaNs are summed separately, in ordinary arithmetic.
+ * If a partial sum overflows, the sum becomes that infinity from then
+ * on, as if it had been added; since later numbers might have brought
+ * the exact total back within range, only such an overflowed result
+ * can depend on the order of the numbers.
+ */
+class Exact_sum
+{
+   public:
+    void add(double x)
+    {
+        if (!std::isfinite(x)) {
+            special_sum += x;
+            return;
+        }
+        size_t i {0};
+        for (size_t j = 0; j < partials.size(); ++j) {
+            double y = partials[j];
+            if (std::fabs(x) < std::fabs(y)) std::swap(x, y);
+            double hi = x + y;
+            if (std::isinf(hi)) {
+                special_sum += hi;
+                partials.clear();
+                return;
+            }
+            double lo = y - (hi - x);
+            if (lo != 0.0) partials[i++] = lo;
+            x = hi;
+        }
+        partials.resize(i);
+        partials.push_back(x);
+    }
+
+    void add(Exact_sum const& other)
+    {
+        for (double partial : other.partials) add(partial);
+        special_sum += other.special_sum;
+    }
+
+    // Gets the exact sum, correctly rounded.
+    double value() const
+    {
+        if (special_sum != 0.0 || std::isnan(special_sum)) return special_sum;
+
+        size_t n = partials.size();
+        if (n == 0) return 0.0;
+        double hi = partials[--n];
+        double lo {0.0};
+        while (n > 0) {
+            double x = hi;
+            double y = partials[--n];
+            hi = x + y;
+            lo = y - (hi - x);
+            if (lo != 0.0) break;
+        }
+        // Correct for double rounding: if the remaining partials push
+        // the total the same way as lo, round away from hi instead of
+        // to even.
+        if (n > 0 && ((lo < 0 && partials[n - 1] < 0) ||
+                      (lo > 0 && partials[n - 1] > 0))) {
+            double y = lo * 2;
+            double x = hi + y;
+            if (y == x - hi) hi = x;
+        }
+        return hi;
+    }
+
+   private:
+    std::vector<double> partials;
+    double special_sum {0.0};
+};
+
+/**
+ * Combines `items` into items[0] by a pairwise tree whose shape depends
+ * only on the number of items: at each level, item i absorbs item
+ * i + width for every i that is a multiple of 2 * width.  Since the
+ * tree is fixed, the result is the same however the work is divided
+ * among threads; if `pool` is given, the pairs of each level are
+ * combined in parallel.
+ *
+ * `combine(a, b)` must add b into a.
+ */
+template <typename T, typename Combine>
+void tree_reduce(std::vector<T>& items, Combine combine, Thread_pool* pool = nullptr)
+{
+    for (size_t width = 1; width < items.size(); width *= 2) {
+        size_t pairs = (items.size() - width + 2 * width - 1) / (2 * width);
+        auto combine_pair = [&](size_t pair) {
+            size_t i = 2 * width * pair;
+            combine(items[i], items[i + width]);
+        };
+        if (pool && pairs > 1) {
+            pool->run(pairs, combine_pair);
+        } else {
+            for (size_t pair = 0; pair < pairs; ++pair) combine_pair(pair);
+        }
+    }
+}
+
+/**
+ * The summary of one statistic over the members of an ensemble.  The
+ * sum and mean are computed from an Exact_sum and so are correctly
+ * rounded; the variance comes from per-member Running_statistics
+ * combined in a fixed tree order.  Either way, every value is the
+ * same, bit for bit, whatever the number of threads.
+ */
+struct Statistic_summary {
+    size_t count {0};
+    double sum {0.0};
+    double mean {0.0};
+    double variance {0.0};
+    double minimum {0.0};
+    double maximum {0.0};
+};
+
+using Ensemble_summary = std::unordered_map<std::string, Statistic_summary>;
+
+/**
+ * Summarizes each statistic over the results of an ensemble (indexed
+ * by member, as returned by Ensemble_simulator::run_simulation or
+ * run_simulation_in_parallel).  The statistics are evaluated, and the
+ * exact sums accumulated, in parallel on `number_of_threads` threads
+ * (so the statistic functions must be safe to call concurrently); the
+ * result doesn't depend on the number of threads.
+ */
+inline Ensemble_summary summarize_ensemble(std::vector<Simulation_result> const& results,
+                                           Ensemble_statistics const& statistics,
+                                           size_t number_of_threads = 1)
+{
+    Thread_pool pool {number_of_threads};
+    size_t n = results.size();
+    // Each task handles a contiguous block of members.
+    size_t number_of_blocks = std::min(n, 4 * pool.size());
+    auto block_begin = [&](size_t block) { return block * n / number_of_blocks; };
+
+    Ensemble_summary summary;
+    for (auto& statistic : statistics) {
+        std::vector<double> values(n);
+        std::vector<Exact_sum> block_sums(number_of_blocks);
+        pool.run(number_of_blocks, [&](size_t block) {
+            for (size_t member = block_begin(block); member < block_begin(block + 1); ++member) {
+                values[member] = statistic.second(results[member]);
+                block_sums[block].add(values[member]);
+            }
+        });
+
+        Exact_sum sum;
+        for (auto& block_sum : block_sums) sum.add(block_sum);
+
+        std::vector<Running_statistics> moments(n);
+        for (size_t member = 0; member < n; ++member) moments[member].add(values[member]);
+        tree_reduce(moments,
+                    [](Running_statistics& a, Running_statistics const& b) { a.add(b); },
+                    &pool);
+
+        Statistic_summary& s = summary[statistic.first];
+        s.count = n;
+        if (n == 0) continue;
+        s.sum = sum.value();
+        s.mean = s.sum / n;
+        s.variance = moments[0].variance();
+        s.minimum = *std::min_element(values.begin(), values.end());
+        s.maximum = *std::max_element(values.begin(), values.end());
+    }
+    return summary;
+}
+
+/**
+ * Gets the ensemble mean of a quantity at every row, each computed as
+ * a correctly rounded exact sum divided by the number of members.
+ * Rows are divided among `number_of_threads` threads.
+ */
+inline std::vector<double> get_ensemble_mean(std::vector<Simulation_result> const& results,
+                                             std::string const& quantity,
+                                             size_t number_of_threads = 1)
+{
+    if (results.empty()) return {};
+    size_t rows = results[0].at(quantity).size();
+    std::vector<double const*> columns;
+    for (auto& result : results) {
+        auto& column = result.at(quantity);
+        if (column.size() != rows) {
+            throw std::invalid_argument("Ensemble members have results of different lengths.");
+        }
+        columns.push_back(column.data());
+    }
+
+    std::vector<double> mean(rows);
+    Thread_pool pool {number_of_threads};
+    size_t number_of_blocks = std::min(rows, 4 * pool.size());
+    pool.run(number_of_blocks, [&](size_t block) {
+        for (size_t row = block * rows / number_of_blocks;
+             row < (block + 1) * rows / number_of_blocks; ++row) {
+            Exact_sum sum;
+            for (auto column : columns) sum.add(column[row]);
+            mean[row] = sum.value() / results.size();
+        }
+    });
+    return mean;
+}
+
+}
+
+#endif
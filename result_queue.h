@@ -0,0 +1,183 @@
+#ifndef RESULT_QUEUE_H
+#define RESULT_QUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>     // for std::ptrdiff_t
+#include <functional>  // for std::function
+#include <memory>      // for std::unique_ptr
+#include <thread>
+
+#include "BioCro_Extended.h"
+
+namespace BioCro {
+
+// Waits in progressively coarser steps: first by spinning, then by
+// yielding the processor, then by sleeping briefly.
+class Backoff
+{
+   public:
+    void wait()
+    {
+        if (count < 16) {
+            ++count;
+        } else if (count < 64) {
+            ++count;
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+
+    void reset() { count = 0; }
+
+   private:
+    unsigned count {0};
+};
+
+/**
+ * A Bounded_mpmc_queue is a fixed-capacity first-in, first-out queue
+ * that any number of threads can push to and pop from at once without
+ * taking a lock.  It is Dmitry Vyukov's bounded MPMC queue: every cell
+ * carries a sequence number that tells a producer whether the cell is
+ * free and a consumer whether it is full, so each operation needs just
+ * one compare-and-swap on a shared position plus its own cell's
+ * sequence number.
+ *
+ * try_push and try_pop never wait.  push waits (with backoff) while the
+ * queue is full, which is how a slow consumer holds back producers; pop
+ * waits while the queue is empty and returns false once the queue has
+ * been closed and drained.
+ */
+template <typename T>
+class Bounded_mpmc_queue
+{
+   public:
+    // The capacity is rounded up to a power of two.
+    explicit Bounded_mpmc_queue(size_t minimum_capacity)
+    {
+        while (capacity < minimum_capacity) capacity *= 2;
+        mask = capacity - 1;
+        cells.reset(new Cell[capacity]);
+        for (size_t i = 0; i < capacity; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    Bounded_mpmc_queue(Bounded_mpmc_queue const&) = delete;
+    Bounded_mpmc_queue& operator=(Bounded_mpmc_queue const&) = delete;
+
+    size_t get_capacity() const { return capacity; }
+
+    // Adds a value if there is room, moving from it only if it was
+    // added.
+    bool try_push(T& value)
+    {
+        size_t position = enqueue_position.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[position & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence - position);
+            if (difference == 0) {
+                if (enqueue_position.compare_exchange_weak(
+                        position, position + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;  // full
+            } else {
+                position = enqueue_position.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(T& value)
+    {
+        size_t position = dequeue_position.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[position & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t difference = static_cast<std::ptrdiff_t>(sequence - (position + 1));
+            if (difference == 0) {
+                if (dequeue_position.compare_exchange_weak(
+                        position, position + 1, std::memory_order_relaxed)) {
+                    value = std::move(cell.value);
+                    cell.value = T();  // release what the cell held
+                    cell.sequence.store(position + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;  // empty
+            } else {
+                position = dequeue_position.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void push(T value)
+    {
+        if (closed.load(std::memory_order_relaxed)) {
+            throw std::logic_error("A value was pushed to a closed queue.");
+        }
+        Backoff backoff;
+        while (!try_push(value)) backoff.wait();
+    }
+
+    bool pop(T& value)
+    {
+        Backoff backoff;
+        while (!try_pop(value)) {
+            if (closed.load(std::memory_order_acquire)) {
+                // Values pushed before the queue was closed are still
+                // visible.
+                return try_pop(value);
+            }
+            backoff.wait();
+        }
+        return true;
+    }
+
+    // Marks the end of the values; call once every producer has
+    // finished pushing.
+    void close() { closed.store(true, std::memory_order_release); }
+
+   private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    static constexpr size_t cache_line {64};
+
+    size_t capacity {2};
+    size_t mask {1};
+    std::unique_ptr<Cell[]> cells;
+    std::atomic<bool> closed {false};
+
+    // The two positions are kept on separate cache lines so that
+    // producers and consumers don't slow each other down.
+    char padding_0[cache_line];
+    std::atomic<size_t> enqueue_position {0};
+    char padding_1[cache_line];
+    std::atomic<size_t> dequeue_position {0};
+    char padding_2[cache_line];
+};
+
+/**
+ * A Result_chunk carries a finished simulation result from the thread
+ * that produced it to a thread that writes it out.
+ */
+struct Result_chunk {
+    size_t member;
+    Simulation_result result;
+};
+
+// A Result_writer is called on a writer thread for each finished
+// result.
+using Result_writer = std::function<void(Result_chunk&)>;
+
+}
+
+#endif
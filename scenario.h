@@ -0,0 +1,122 @@
+#ifndef SCENARIO_H
+#define SCENARIO_H
+
+#include "BioCro_Extended.h"
+
+namespace BioCro {
+
+/**
+ * A Scenario holds everything needed to construct a Simulator: the
+ * five system-related arguments together with the solver settings.
+ * It lets a simulation be stored, queued, or rebuilt piecemeal (see
+ * run_scenario_rows) rather than constructed on the spot.
+ */
+struct Scenario {
+    BioCro::State initial_state;
+    BioCro::Parameter_set parameters;
+    BioCro::System_drivers drivers;
+    BioCro::Module_set direct_mcs;
+    BioCro::Module_set differential_mcs;
+    Solver_settings solver_settings;
+};
+
+inline Simulator make_simulator(Scenario const& scenario)
+{
+    return Simulator {
+        scenario.initial_state,
+        scenario.parameters,
+        scenario.drivers,
+        scenario.direct_mcs,
+        scenario.differential_mcs,
+        scenario.solver_settings.ode_solver_name,
+        scenario.solver_settings.output_step_size,
+        scenario.solver_settings.adaptive_rel_error_tol,
+        scenario.solver_settings.adaptive_abs_error_tol,
+        scenario.solver_settings.adaptive_max_steps
+    };
+}
+
+// Gets the number of driver rows (time points) of a scenario.
+inline size_t get_number_of_rows(Scenario const& scenario)
+{
+    if (scenario.drivers.empty()) {
+        throw std::invalid_argument("A scenario must have at least one driver.");
+    }
+    return scenario.drivers.begin()->second.size();
+}
+
+// Gets rows first_row through last_row (inclusive) of a set of
+// drivers.
+inline System_drivers get_driver_rows(System_drivers const& drivers,
+                                      size_t first_row, size_t last_row)
+{
+    System_drivers rows;
+    for (auto& column : drivers) {
+        auto& values = column.second;
+        if (last_row >= values.size()) {
+            throw std::out_of_range("Driver row " + std::to_string(last_row) +
+                                    " does not exist.");
+        }
+        rows[column.first] = std::vector<double>(values.begin() + first_row,
+                                                 values.begin() + last_row + 1);
+    }
+    return rows;
+}
+
+// Removes the first row of every column of a result.
+inline void drop_first_row(Simulation_result& result)
+{
+    for (auto& column : result) {
+        column.second.erase(column.second.begin());
+    }
+}
+
+/**
+ * Simulates a scenario over `driver_rows` (a piece of its drivers, or
+ * drivers supplied separately) rather than over scenario.drivers,
+ * starting from `start_state` rather than from the scenario's initial
+ * state.  On return, `final_state` holds the values of the
+ * differential quantities at the last row.
+ */
+inline Simulation_result run_scenario_segment(Scenario const& scenario,
+                                              State const& start_state,
+                                              System_drivers const& driver_rows,
+                                              State& final_state)
+{
+    Dynamical_system sys = make_dynamical_system(
+        start_state,
+        scenario.parameters,
+        driver_rows,
+        scenario.direct_mcs,
+        scenario.differential_mcs);
+    Solver solver = make_ode_solver(scenario.solver_settings);
+    Simulation_result result = solver->integrate(sys);
+    final_state = get_current_state(sys);
+    return result;
+}
+
+/**
+ * Simulates only rows first_row through last_row (inclusive) of a
+ * scenario, starting from `start_state` rather than from the
+ * scenario's initial state.  On return, `final_state` holds the values
+ * of the differential quantities at last_row.
+ *
+ * Running a scenario in consecutive pieces this way, passing the
+ * final state of each piece as the start state of the next, lets a
+ * long run be checkpointed or interleaved with other work.  Note that
+ * consecutive pieces share their boundary row.
+ */
+inline Simulation_result run_scenario_rows(Scenario const& scenario,
+                                           State const& start_state,
+                                           size_t first_row, size_t last_row,
+                                           State& final_state)
+{
+    return run_scenario_segment(
+        scenario, start_state,
+        get_driver_rows(scenario.drivers, first_row, last_row),
+        final_state);
+}
+
+}
+
+#endif
@@ -0,0 +1,429 @@
+#ifndef SCENARIO_FILE_H
+#define SCENARIO_FILE_H
+
+#include <cstdint>  // for std::uint32_t, std::uint64_t
+#include <cstring>  // for std::memcpy
+#include <fstream>
+
+#include "scenario.h"
+
+namespace BioCro {
+
+/*
+ * Binary scenario files
+ *
+ * A scenario file stores a collection of Scenarios compactly.  Every
+ * name (of a quantity, a module, or a solver) is stored once, in a
+ * string table, and referred to elsewhere by its index in that table.
+ * Driver tables are stored once each, however many scenarios use
+ * them, as columns of raw doubles.  The layout is
+ *
+ *     header:         "BCSC"  u32 version  u32 byte-order mark
+ *     string table:   u32 count, then for each string: u32 length, bytes
+ *     driver tables:  u32 count, then for each table:
+ *                         u32 columns  u64 rows,
+ *                         then for each column: u32 name, rows × f64
+ *     scenarios:      u64 count, then for each scenario:
+ *                         u32 n, n × (u32 name, f64 value)    initial state
+ *                         u32 n, n × (u32 name, f64 value)    parameters
+ *                         u32 driver table
+ *                         u32 n, n × u32 module name          direct modules
+ *                         u32 n, n × u32 module name          differential modules
+ *                         u32 solver name  f64 output step size
+ *                         f64 rel. tol.  f64 abs. tol.  i32 max steps
+ *
+ * Numbers are written in the byte order of the machine writing the
+ * file; the byte-order mark lets a reader on a machine with a
+ * different byte order reject the file rather than misread it.
+ *
+ * Modules are stored by name and looked up again when scenarios are
+ * built, using the module factory given as the template argument of
+ * Scenario_file.
+ */
+namespace scenario_file_format {
+    constexpr char magic[4] {'B', 'C', 'S', 'C'};
+    constexpr std::uint32_t version {1};
+    constexpr std::uint32_t byte_order_mark {0x01020304};
+}
+
+// Writes scenarios to a binary scenario file.
+class Scenario_file_writer
+{
+   public:
+    void write(std::string const& path, std::vector<Scenario> const& scenarios)
+    {
+        names.clear();
+        name_indices.clear();
+        tables.clear();
+        tables_of_hash.clear();
+        buffer.clear();
+
+        // Collect the distinct driver tables first, since they are
+        // written before the scenarios that refer to them.
+        std::vector<std::uint32_t> table_of_scenario;
+        table_of_scenario.reserve(scenarios.size());
+        for (auto& scenario : scenarios) {
+            table_of_scenario.push_back(driver_table_index(scenario.drivers));
+        }
+
+        std::string scenario_section;
+        std::swap(buffer, scenario_section);
+        put<std::uint64_t>(scenarios.size());
+        for (size_t i = 0; i < scenarios.size(); ++i) {
+            auto& scenario = scenarios[i];
+            put_settings(scenario.initial_state);
+            put_settings(scenario.parameters);
+            put<std::uint32_t>(table_of_scenario[i]);
+            put_modules(scenario.direct_mcs);
+            put_modules(scenario.differential_mcs);
+            put<std::uint32_t>(name_index(scenario.solver_settings.ode_solver_name));
+            put<double>(scenario.solver_settings.output_step_size);
+            put<double>(scenario.solver_settings.adaptive_rel_error_tol);
+            put<double>(scenario.solver_settings.adaptive_abs_error_tol);
+            put<std::int32_t>(scenario.solver_settings.adaptive_max_steps);
+        }
+        std::swap(buffer, scenario_section);
+
+        // The string table is complete only now.
+        buffer.append(scenario_file_format::magic, 4);
+        put<std::uint32_t>(scenario_file_format::version);
+        put<std::uint32_t>(scenario_file_format::byte_order_mark);
+        put<std::uint32_t>(names.size());
+        for (auto& name : names) {
+            put<std::uint32_t>(name.size());
+            buffer.append(name);
+        }
+        put<std::uint32_t>(tables.size());
+        for (auto table : tables) {
+            put<std::uint32_t>(table->size());
+            put<std::uint64_t>(table->empty() ? 0 : table->begin()->second.size());
+            for (auto& column : *table) {
+                put<std::uint32_t>(name_index(column.first));
+                buffer.append(reinterpret_cast<char const*>(column.second.data()),
+                              column.second.size() * sizeof(double));
+            }
+        }
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(buffer.data(), buffer.size());
+        file.write(scenario_section.data(), scenario_section.size());
+        if (!file) {
+            throw std::runtime_error("Unable to write the scenario file " + path + ".");
+        }
+    }
+
+   private:
+    std::vector<std::string> names;
+    std::unordered_map<std::string, std::uint32_t> name_indices;
+    std::vector<System_drivers const*> tables;
+    std::unordered_multimap<size_t, std::uint32_t> tables_of_hash;  // see get_hash
+    std::string buffer;
+
+    template <typename T>
+    void put(T value)
+    {
+        buffer.append(reinterpret_cast<char const*>(&value), sizeof value);
+    }
+
+    std::uint32_t name_index(std::string const& name)
+    {
+        auto entry = name_indices.emplace(name, names.size());
+        if (entry.second) names.push_back(name);
+        return entry.first->second;
+    }
+
+    // Hashes the names and the bit patterns of the values of a driver
+    // table.
+    static size_t get_hash(System_drivers const& drivers)
+    {
+        size_t seed {0};
+        auto combine = [&seed](size_t value) {
+            seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+        };
+        for (auto& column : drivers) {
+            combine(std::hash<std::string>{}(column.first));
+            for (double value : column.second) {
+                std::uint64_t bits;
+                std::memcpy(&bits, &value, sizeof bits);
+                combine(std::hash<std::uint64_t>{}(bits));
+            }
+        }
+        return seed;
+    }
+
+    // Tables are compared in full only when their hashes match, so
+    // writing n distinct tables takes O(n) time rather than O(n^2).
+    std::uint32_t driver_table_index(System_drivers const& drivers)
+    {
+        size_t hash = get_hash(drivers);
+        auto candidates = tables_of_hash.equal_range(hash);
+        for (auto it = candidates.first; it != candidates.second; ++it) {
+            if (*tables[it->second] == drivers) return it->second;
+        }
+        size_t rows = drivers.empty() ? 0 : drivers.begin()->second.size();
+        for (auto& column : drivers) {
+            if (column.second.size() != rows) {
+                throw std::invalid_argument("All driver columns of a scenario "
+                                            "must have the same length.");
+            }
+        }
+        // Intern the column names now, since the string table is
+        // written before the driver tables.
+        for (auto& column : drivers) {
+            name_index(column.first);
+        }
+        tables.push_back(&drivers);
+        tables_of_hash.emplace(hash, tables.size() - 1);
+        return tables.size() - 1;
+    }
+
+    void put_settings(Variable_settings const& settings)
+    {
+        put<std::uint32_t>(settings.size());
+        for (auto& item : settings) {
+            put<std::uint32_t>(name_index(item.first));
+            put<double>(item.second);
+        }
+    }
+
+    void put_modules(Module_set const& modules)
+    {
+        put<std::uint32_t>(modules.size());
+        for (auto creator : modules) {
+            put<std::uint32_t>(name_index(creator->get_name()));
+        }
+    }
+};
+
+/**
+ * A Scenario_file holds the contents of a binary scenario file in
+ * compact form.  Loading a file is a single read followed by a linear
+ * scan; no per-scenario maps are built until a scenario or simulator
+ * is requested with get_scenario or make_simulator.  Each module name
+ * is looked up in the module factory once, when the file is loaded, so
+ * a loaded file is never modified and may be used from several threads
+ * at once.
+ */
+template <typename Module_factory = Standard_BioCro_library_module_factory>
+class Scenario_file
+{
+   public:
+    explicit Scenario_file(std::string const& path)
+    {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file) {
+            throw std::runtime_error("Unable to open the scenario file " + path + ".");
+        }
+        std::streamoff size = file.tellg();
+        if (size < 0) {
+            throw std::runtime_error("Unable to read the scenario file " + path + ".");
+        }
+        buffer.resize(size);
+        file.seekg(0);
+        file.read(&buffer[0], buffer.size());
+        if (!file || static_cast<size_t>(file.gcount()) != buffer.size()) {
+            throw std::runtime_error("Unable to read the scenario file " + path + ".");
+        }
+        parse();
+    }
+
+    size_t size() const { return records.size(); }
+
+    size_t number_of_driver_tables() const { return driver_tables.size(); }
+
+    Scenario get_scenario(size_t i) const
+    {
+        Record const& record = records.at(i);
+        return Scenario {
+            get_settings(record.state),
+            get_settings(record.parameters),
+            driver_tables[record.driver_table],
+            get_modules(record.direct_modules),
+            get_modules(record.differential_modules),
+            record.solver_settings
+        };
+    }
+
+    // Builds the simulator for scenario i directly from the compact
+    // representation.
+    Simulator make_simulator(size_t i) const
+    {
+        Record const& record = records.at(i);
+        return Simulator {
+            get_settings(record.state),
+            get_settings(record.parameters),
+            driver_tables[record.driver_table],
+            get_modules(record.direct_modules),
+            get_modules(record.differential_modules),
+            record.solver_settings.ode_solver_name,
+            record.solver_settings.output_step_size,
+            record.solver_settings.adaptive_rel_error_tol,
+            record.solver_settings.adaptive_abs_error_tol,
+            record.solver_settings.adaptive_max_steps
+        };
+    }
+
+   private:
+    // A range of entries in setting_names/setting_values or in
+    // module_names.
+    struct Span {
+        size_t begin;
+        size_t count;
+    };
+
+    struct Record {
+        Span state;
+        Span parameters;
+        size_t driver_table;
+        Span direct_modules;
+        Span differential_modules;
+        Solver_settings solver_settings;
+    };
+
+    std::string buffer;
+    size_t position {0};
+
+    std::vector<std::string> names;
+    std::vector<System_drivers> driver_tables;
+    std::vector<std::uint32_t> setting_names;
+    std::vector<double> setting_values;
+    std::vector<std::uint32_t> module_names;
+    std::vector<Record> records;
+    std::vector<Module_creator> module_creators;  // indexed like names
+
+    [[noreturn]] static void bad_file(std::string const& problem)
+    {
+        throw std::runtime_error("Invalid scenario file: " + problem + ".");
+    }
+
+    template <typename T>
+    T get()
+    {
+        if (buffer.size() - position < sizeof(T)) bad_file("unexpected end of file");
+        T value;
+        std::memcpy(&value, buffer.data() + position, sizeof value);
+        position += sizeof value;
+        return value;
+    }
+
+    // Reads a count of items that each take at least `item_size` bytes
+    // of the file, and checks that the rest of the file could hold
+    // them before anything is allocated for them.
+    template <typename T>
+    size_t get_count(size_t item_size)
+    {
+        T count = get<T>();
+        if ((buffer.size() - position) / item_size < count) bad_file("count exceeds file size");
+        return count;
+    }
+
+    std::uint32_t get_name_index()
+    {
+        std::uint32_t index = get<std::uint32_t>();
+        if (index >= names.size()) bad_file("name index out of range");
+        return index;
+    }
+
+    void parse()
+    {
+        if (buffer.size() < 4 || buffer.compare(0, 4, scenario_file_format::magic, 4) != 0) {
+            bad_file("missing header");
+        }
+        position = 4;
+        if (get<std::uint32_t>() != scenario_file_format::version) bad_file("unsupported version");
+        if (get<std::uint32_t>() != scenario_file_format::byte_order_mark) bad_file("wrong byte order");
+
+        names.resize(get_count<std::uint32_t>(sizeof(std::uint32_t)));
+        for (auto& name : names) {
+            std::uint32_t length = get<std::uint32_t>();
+            if (buffer.size() - position < length) bad_file("unexpected end of file");
+            name.assign(buffer, position, length);
+            position += length;
+        }
+
+        driver_tables.resize(
+            get_count<std::uint32_t>(sizeof(std::uint32_t) + sizeof(std::uint64_t)));
+        for (auto& table : driver_tables) {
+            std::uint32_t columns = get<std::uint32_t>();
+            std::uint64_t rows = get<std::uint64_t>();
+            for (std::uint32_t c = 0; c < columns; ++c) {
+                std::string const& name = names[get_name_index()];
+                if ((buffer.size() - position) / sizeof(double) < rows) {
+                    bad_file("unexpected end of file");
+                }
+                std::vector<double>& column = table[name];
+                column.resize(rows);
+                std::memcpy(column.data(), buffer.data() + position, rows * sizeof(double));
+                position += rows * sizeof(double);
+            }
+        }
+
+        // The smallest record has no settings and no modules.
+        constexpr size_t record_size {6 * sizeof(std::uint32_t) + 3 * sizeof(double) +
+                                      sizeof(std::int32_t)};
+        records.resize(get_count<std::uint64_t>(record_size));
+        for (auto& record : records) {
+            record.state = get_setting_span();
+            record.parameters = get_setting_span();
+            record.driver_table = get<std::uint32_t>();
+            if (record.driver_table >= driver_tables.size()) bad_file("driver table index out of range");
+            record.direct_modules = get_module_span();
+            record.differential_modules = get_module_span();
+            record.solver_settings.ode_solver_name = names[get_name_index()];
+            record.solver_settings.output_step_size = get<double>();
+            record.solver_settings.adaptive_rel_error_tol = get<double>();
+            record.solver_settings.adaptive_abs_error_tol = get<double>();
+            record.solver_settings.adaptive_max_steps = get<std::int32_t>();
+        }
+
+        // Everything has been copied out of the buffer.
+        std::string().swap(buffer);
+
+        module_creators.assign(names.size(), nullptr);
+        for (std::uint32_t name : module_names) {
+            if (!module_creators[name]) module_creators[name] = Module_factory::retrieve(names[name]);
+        }
+    }
+
+    Span get_setting_span()
+    {
+        Span span {setting_names.size(), get<std::uint32_t>()};
+        for (size_t i = 0; i < span.count; ++i) {
+            setting_names.push_back(get_name_index());
+            setting_values.push_back(get<double>());
+        }
+        return span;
+    }
+
+    Span get_module_span()
+    {
+        Span span {module_names.size(), get<std::uint32_t>()};
+        for (size_t i = 0; i < span.count; ++i) {
+            module_names.push_back(get_name_index());
+        }
+        return span;
+    }
+
+    Variable_settings get_settings(Span span) const
+    {
+        Variable_settings settings(span.count);
+        for (size_t i = span.begin; i < span.begin + span.count; ++i) {
+            settings.emplace(names[setting_names[i]], setting_values[i]);
+        }
+        return settings;
+    }
+
+    Module_set get_modules(Span span) const
+    {
+        Module_set modules;
+        modules.reserve(span.count);
+        for (size_t i = span.begin; i < span.begin + span.count; ++i) {
+            modules.push_back(module_creators[module_names[i]]);
+        }
+        return modules;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef SCREENING_H
+#define SCREENING_H
+
+#include <algorithm>  // for std::stable_sort, std::max
+#include <cmath>      // for std::ceil, std::isnan
+#include <functional> // for std::function
+#include <numeric>    // for std::iota
+
+#include "ensemble.h"
+
+namespace BioCro {
+
+/**
+ * A Candidate_score rates the result of simulating one candidate.
+ * Higher scores are better.  For example, to prefer candidates whose
+ * final position is close to 1, we could use
+ *
+ *     [](BioCro::Simulation_result const& result) {
+ *         return -std::abs(result.at("position").back() - 1);
+ *     }
+ *
+ * Since the same score is applied to both coarse and fine results, it
+ * shouldn't depend on the number of rows in a result.
+ */
+using Candidate_score = std::function<double(Simulation_result const&)>;
+
+struct Screening_result {
+    // The low-fidelity score of every candidate, indexed by
+    // candidate.
+    std::vector<double> coarse_scores;
+    // The candidates that were rerun at full fidelity, best coarse
+    // score first.
+    std::vector<size_t> finalists;
+    // The full-fidelity scores and results of the finalists, in the
+    // same order as `finalists`.
+    std::vector<double> fine_scores;
+    std::vector<Simulation_result> fine_results;
+};
+
+/**
+ * Screens the members of an ensemble in two stages.  First every
+ * candidate is simulated cheaply using `coarse` solver settings
+ * (typically a larger output_step_size, looser tolerances, and a
+ * cheaper solver); then only the best `keep_fraction` of the
+ * candidates, ranked by their coarse scores, are rerun using `fine`
+ * solver settings.  At least one candidate is always rerun.
+ *
+ * For example,
+ *
+ *     BioCro::Screening_result screening = BioCro::screen_candidates(
+ *         candidates, score, 0.1,
+ *         {"boost_euler", 4, 1e-2, 1e-2, 200},
+ *         candidates.get_solver_settings());
+ *
+ * reruns the top tenth of the candidates with the ensemble's own
+ * solver settings.
+ */
+inline Screening_result screen_candidates(
+    Ensemble_simulator& candidates,
+    Candidate_score score,
+    double keep_fraction,
+    Solver_settings const& coarse,
+    Solver_settings const& fine)
+{
+    if (!(keep_fraction > 0 && keep_fraction <= 1)) {
+        throw std::invalid_argument("The fraction of candidates to keep "
+                                    "must be in (0, 1].");
+    }
+
+    Screening_result screening;
+    size_t n = candidates.size();
+    if (n == 0) return screening;
+
+    screening.coarse_scores.reserve(n);
+    for (size_t candidate = 0; candidate < n; ++candidate) {
+        screening.coarse_scores.push_back(score(candidates.run_member(candidate, coarse)));
+    }
+
+    std::vector<size_t> ranking(n);
+    std::iota(ranking.begin(), ranking.end(), 0);
+    // A stable sort keeps ties in candidate order so that the
+    // selection is deterministic.  NaN scores rank below all others.
+    std::stable_sort(ranking.begin(), ranking.end(),
+                     [&](size_t a, size_t b) {
+                         double sa = screening.coarse_scores[a];
+                         double sb = screening.coarse_scores[b];
+                         return !std::isnan(sa) && (std::isnan(sb) || sa > sb);
+                     });
+
+    size_t number_to_keep = std::max<size_t>(1, std::ceil(keep_fraction * n));
+    screening.finalists.assign(ranking.begin(), ranking.begin() + number_to_keep);
+
+    for (size_t candidate : screening.finalists) {
+        screening.fine_results.push_back(candidates.run_member(candidate, fine));
+        screening.fine_scores.push_back(score(screening.fine_results.back()));
+    }
+
+    return screening;
+}
+
+}
+
+#endif
@@ -0,0 +1,440 @@
+#ifndef SOLAR_TABLE_H
+#define SOLAR_TABLE_H
+
+#include <algorithm>      // for std::find_if, std::is_sorted, std::lower_bound
+#include <cstdint>        // for std::uint64_t
+#include <cstring>        // for std::memcpy
+#include <memory>         // for std::shared_ptr, std::unique_ptr
+#include <mutex>
+#include <unordered_map>
+
+#include "direct_evaluation.h"
+#include "fast_solar_position.h"
+#include "scenario.h"
+
+namespace BioCro {
+
+/**
+ * A Solar_site holds the quantities other than time that solar
+ * position depends on.
+ */
+struct Solar_site {
+    double lat;
+    double longitude;
+    double time_zone_offset;
+
+    bool operator==(Solar_site const& other) const
+    {
+        return lat == other.lat && longitude == other.longitude &&
+               time_zone_offset == other.time_zone_offset;
+    }
+};
+
+/**
+ * A Solar_table holds the outputs of a solar position module at one
+ * site for every row of a driver grid, given by its time and year
+ * columns.  The module is made by `calculation`, which is normally the
+ * library's solar_position_michalsky creator; passing
+ * get_fast_solar_position_creator() instead tabulates the fast
+ * approximation.  The whole series is computed at construction by a
+ * Direct_evaluator, with the module created only once.
+ */
+class Solar_table
+{
+   public:
+    Solar_table(Solar_site const& site,
+                std::vector<double> const& times,
+                std::vector<double> const& years,
+                Module_creator calculation)
+        : site{site},
+          times{times},
+          years{years},
+          calculation{calculation}
+    {
+        if (years.size() != times.size()) {
+            throw std::invalid_argument("A solar table needs one year for every time.");
+        }
+        check_solar_position_interface(calculation);
+        Simulation_result columns = evaluate_direct_modules(
+            { {"lat", site.lat}, {"longitude", site.longitude},
+              {"time_zone_offset", site.time_zone_offset} },
+            { {"time", times}, {"year", years} },
+            {calculation});
+        cosine_zenith_angle = columns.at("cosine_zenith_angle");
+        solar_declination = columns.at("solar_declination");
+        hour_angle = columns.at("hour_angle");
+        sorted = std::is_sorted(times.begin(), times.end());
+    }
+
+    size_t size() const { return times.size(); }
+
+    Solar_site const& get_site() const { return site; }
+
+    std::vector<double> const& get_times() const { return times; }
+    std::vector<double> const& get_years() const { return years; }
+
+    // Gets the creator of the module whose outputs were tabulated.
+    Module_creator get_calculation() const { return calculation; }
+
+    // Finds the row for a time and year, if the table has one.  The
+    // search starts at `row`, which on success is set to the row
+    // found; since simulations mostly move forward one row at a time,
+    // the row found last time is the best place to start.
+    bool find(double time, double year, size_t& row) const
+    {
+        size_t n = times.size();
+        for (size_t i : {row, row + 1}) {
+            if (i < n && times[i] == time && years[i] == year) {
+                row = i;
+                return true;
+            }
+        }
+        if (sorted) {
+            auto first = std::lower_bound(times.begin(), times.end(), time);
+            for (size_t i = first - times.begin(); i < n && times[i] == time; ++i) {
+                if (years[i] == year) {
+                    row = i;
+                    return true;
+                }
+            }
+            return false;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            if (times[i] == time && years[i] == year) {
+                row = i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    double get_cosine_zenith_angle(size_t row) const { return cosine_zenith_angle[row]; }
+    double get_solar_declination(size_t row) const { return solar_declination[row]; }
+    double get_hour_angle(size_t row) const { return hour_angle[row]; }
+
+   private:
+    Solar_site site;
+    std::vector<double> times;
+    std::vector<double> years;
+    Module_creator calculation;
+    std::vector<double> cosine_zenith_angle;
+    std::vector<double> solar_declination;
+    std::vector<double> hour_angle;
+    bool sorted;  // whether times can be searched by bisection
+};
+
+/**
+ * A module with the inputs and outputs of solar_position_michalsky
+ * that looks its outputs up in a Solar_table.  When it is evaluated at
+ * a time the table doesn't have (as happens at the intermediate times
+ * of an adaptive ODE solver), or at a different site, it runs its own
+ * module made by the table's calculation; since the table was made by
+ * the same module, the results are identical either way.
+ */
+class Solar_table_lookup : public ::direct_module
+{
+   public:
+    Solar_table_lookup(std::shared_ptr<const Solar_table> table,
+                       Variable_settings const& input_quantities,
+                       Variable_settings* output_quantities)
+        : ::direct_module{},
+          table{table},
+          fallback{new Fallback},
+          lat{input_quantities.at("lat")},
+          longitude{input_quantities.at("longitude")},
+          time{input_quantities.at("time")},
+          time_zone_offset{input_quantities.at("time_zone_offset")},
+          year{input_quantities.at("year")},
+          cosine_zenith_angle_op{&output_quantities->at("cosine_zenith_angle")},
+          solar_declination_op{&output_quantities->at("solar_declination")},
+          hour_angle_op{&output_quantities->at("hour_angle")}
+    {
+        Module_creator calculation = table->get_calculation();
+        for (auto& name : calculation->get_inputs()) fallback->inputs[name] = 0;
+        for (auto& name : calculation->get_outputs()) fallback->outputs[name] = 0;
+        fallback->module = calculation->create_module(fallback->inputs, &fallback->outputs);
+    }
+
+   private:
+    // The module run off the table, with the maps of quantities it was
+    // created on.  They live together on the heap so that the module's
+    // references into the maps stay valid.
+    struct Fallback {
+        Variable_settings inputs;
+        Variable_settings outputs;
+        Module module;
+    };
+
+    std::shared_ptr<const Solar_table> table;
+    std::unique_ptr<Fallback> fallback;
+    double const& lat;
+    double const& longitude;
+    double const& time;
+    double const& time_zone_offset;
+    double const& year;
+    double* cosine_zenith_angle_op;
+    double* solar_declination_op;
+    double* hour_angle_op;
+
+    mutable size_t row {0};
+
+    void do_operation() const override
+    {
+        if (table->get_site() == Solar_site{lat, longitude, time_zone_offset} &&
+            table->find(time, year, row)) {
+            update(cosine_zenith_angle_op, table->get_cosine_zenith_angle(row));
+            update(solar_declination_op, table->get_solar_declination(row));
+            update(hour_angle_op, table->get_hour_angle(row));
+            return;
+        }
+
+        fallback->inputs.at("lat") = lat;
+        fallback->inputs.at("longitude") = longitude;
+        fallback->inputs.at("time") = time;
+        fallback->inputs.at("time_zone_offset") = time_zone_offset;
+        fallback->inputs.at("year") = year;
+        fallback->module->run();
+        update(cosine_zenith_angle_op, fallback->outputs.at("cosine_zenith_angle"));
+        update(solar_declination_op, fallback->outputs.at("solar_declination"));
+        update(hour_angle_op, fallback->outputs.at("hour_angle"));
+    }
+};
+
+// Creates Solar_table_lookup modules that share one table.
+class Solar_table_module_creator : public ::module_creator
+{
+   public:
+    explicit Solar_table_module_creator(std::shared_ptr<const Solar_table> table)
+        : table{table} {}
+
+    Module create_module(Variable_settings const& input_quantities,
+                         Variable_settings* output_quantities) override
+    {
+        return Module(new Solar_table_lookup(table, input_quantities, output_quantities));
+    }
+
+    Variable_names get_inputs() override { return Fast_solar_position::get_inputs(); }
+    Variable_names get_outputs() override { return Fast_solar_position::get_outputs(); }
+    std::string get_name() override { return "solar_position_table"; }
+
+    std::shared_ptr<const Solar_table> get_table() const { return table; }
+
+   private:
+    std::shared_ptr<const Solar_table> table;
+};
+
+/**
+ * A Solar_table_cache keeps the solar tables computed so far, keyed by
+ * site, driver grid, and calculation, so that every simulation at a
+ * site over the same drivers (the members of an ensemble, or a
+ * scenario run repeatedly) shares a single table.  Tables are found by
+ * a hash of the key and then compared with it, so a lookup copies
+ * nothing.  It also owns the module creators
+ * that serve the tables, which remain valid as long as the cache.
+ *
+ * A cache may be used from several threads at once.  Tables are
+ * computed outside the lock, so two threads asking for the same new
+ * table may both compute it; only the first is kept.
+ */
+class Solar_table_cache
+{
+   public:
+    std::shared_ptr<const Solar_table> get_table(Solar_site const& site,
+                                                 std::vector<double> const& times,
+                                                 std::vector<double> const& years,
+                                                 Module_creator calculation)
+    {
+        return get_entry(site, times, years, calculation).table;
+    }
+
+    Module_creator get_creator(Solar_site const& site,
+                               std::vector<double> const& times,
+                               std::vector<double> const& years,
+                               Module_creator calculation)
+    {
+        return get_entry(site, times, years, calculation).creator.get();
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return entries.size();
+    }
+
+    // Gets the number of requests answered from the cache.
+    size_t get_number_of_hits() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return hits;
+    }
+
+    // Removes every table.  Module creators obtained earlier become
+    // invalid.
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+    }
+
+   private:
+    struct Entry {
+        std::shared_ptr<const Solar_table> table;
+        std::unique_ptr<Solar_table_module_creator> creator;
+    };
+
+    mutable std::mutex mutex;
+    std::unordered_multimap<size_t, Entry> entries;  // keyed by get_hash
+    size_t hits {0};
+
+    static size_t get_hash(Solar_site const& site,
+                           std::vector<double> const& times,
+                           std::vector<double> const& years,
+                           Module_creator calculation)
+    {
+        size_t seed = std::hash<Module_creator>{}(calculation);
+        auto combine = [&seed](double value) {
+            std::uint64_t bits;
+            std::memcpy(&bits, &value, sizeof bits);
+            seed ^= std::hash<std::uint64_t>{}(bits) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+        };
+        combine(site.lat);
+        combine(site.longitude);
+        combine(site.time_zone_offset);
+        for (double time : times) combine(time);
+        for (double year : years) combine(year);
+        return seed;
+    }
+
+    // Finds the entry for a key among those with its hash; the mutex
+    // must be held.
+    Entry const* find(size_t hash,
+                      Solar_site const& site,
+                      std::vector<double> const& times,
+                      std::vector<double> const& years,
+                      Module_creator calculation) const
+    {
+        auto range = entries.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            Solar_table const& table = *it->second.table;
+            if (table.get_calculation() == calculation && table.get_site() == site &&
+                table.get_times() == times && table.get_years() == years) {
+                return &it->second;
+            }
+        }
+        return nullptr;
+    }
+
+    Entry const& get_entry(Solar_site const& site,
+                           std::vector<double> const& times,
+                           std::vector<double> const& years,
+                           Module_creator calculation)
+    {
+        size_t hash = get_hash(site, times, years, calculation);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (Entry const* entry = find(hash, site, times, years, calculation)) {
+                ++hits;
+                return *entry;
+            }
+        }
+
+        Entry entry;
+        entry.table = std::make_shared<const Solar_table>(site, times, years, calculation);
+        entry.creator.reset(new Solar_table_module_creator(entry.table));
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (Entry const* existing = find(hash, site, times, years, calculation)) {
+            return *existing;
+        }
+        return entries.emplace(hash, std::move(entry))->second;
+    }
+};
+
+// Gets the value of a site quantity from the parameters or, failing
+// that, from the drivers.  A driver qualifies only if it is the same
+// in every row.  Returns false if there is no single value.
+inline bool get_fixed_quantity(std::string const& name,
+                               Parameter_set const& parameters,
+                               System_drivers const& drivers,
+                               double& value)
+{
+    if (parameters.count(name)) {
+        value = parameters.at(name);
+        return true;
+    }
+    if (!drivers.count(name)) return false;
+    auto& column = drivers.at(name);
+    if (column.empty()) return false;
+    for (double x : column) {
+        if (x != column[0]) return false;
+    }
+    value = column[0];
+    return true;
+}
+
+/**
+ * Returns a copy of a module set in which any solar_position_michalsky
+ * creator is replaced by one serving a table from `cache` for the site
+ * and drivers given.  The table holds the outputs of the library
+ * module being replaced, so results are unchanged; if `fast` is true,
+ * it holds those of the fast approximation instead (see
+ * fast_solar_position.h).  The site (lat, longitude, and time_zone_offset)
+ * must be fixed: given as parameters, or as drivers with the same
+ * value in every row.  The year may be a parameter or a driver.  If
+ * any of these is missing, or the site varies, the module set is
+ * returned unchanged.
+ *
+ * The table is made for the rows of `drivers`; pass the same drivers
+ * to the simulation.  To share a table among the members of an
+ * ensemble at one site, make the substitution once using the base
+ * parameters; members whose site differs still get correct results,
+ * computed without the table.
+ */
+inline Module_set use_solar_table(Module_set modules,
+                                  Parameter_set const& parameters,
+                                  System_drivers const& drivers,
+                                  Solar_table_cache& cache,
+                                  bool fast = false)
+{
+    auto uses_library_module = [](Module_creator creator) {
+        return creator->get_name() == "solar_position_michalsky";
+    };
+    auto library_module = std::find_if(modules.begin(), modules.end(), uses_library_module);
+    if (library_module == modules.end()) return modules;
+
+    Solar_site site;
+    if (!get_fixed_quantity("lat", parameters, drivers, site.lat) ||
+        !get_fixed_quantity("longitude", parameters, drivers, site.longitude) ||
+        !get_fixed_quantity("time_zone_offset", parameters, drivers, site.time_zone_offset) ||
+        !drivers.count("time")) {
+        return modules;
+    }
+
+    std::vector<double> const& times = drivers.at("time");
+    std::vector<double> years;
+    if (parameters.count("year")) {
+        years.assign(times.size(), parameters.at("year"));
+    } else if (drivers.count("year")) {
+        years = drivers.at("year");
+    } else {
+        return modules;
+    }
+
+    Module_creator calculation = fast ? get_fast_solar_position_creator() : *library_module;
+    Module_creator table_creator = cache.get_creator(site, times, years, calculation);
+    for (auto& creator : modules) {
+        if (uses_library_module(creator)) creator = table_creator;
+    }
+    return modules;
+}
+
+// Makes the same substitution in a scenario's direct modules.
+inline void use_solar_table(Scenario& scenario, Solar_table_cache& cache, bool fast = false)
+{
+    scenario.direct_mcs = use_solar_table(
+        scenario.direct_mcs, scenario.parameters, scenario.drivers, cache, fast);
+}
+
+}
+
+#endif
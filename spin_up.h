@@ -0,0 +1,300 @@
+#ifndef SPIN_UP_H
+#define SPIN_UP_H
+
+#include <algorithm>  // for std::max, std::min, std::sort
+#include <cmath>      // for std::fabs, std::sqrt
+
+#include "scenario.h"
+
+namespace BioCro {
+
+enum class Spin_up_method {
+    newton_krylov,  // Newton's method on the cycle map, with GMRES
+    extrapolation   // Aitken extrapolation over pairs of cycles
+};
+
+struct Spin_up_settings {
+    Spin_up_method method {Spin_up_method::newton_krylov};
+
+    // The differential quantities to solve for; empty means all of
+    // them.  Fast quantities can be left out, since they settle within
+    // a cycle or two of the slow ones anyway.
+    Variable_names quantities;
+
+    // Spin-up has converged when no selected quantity changes over a
+    // cycle by more than tolerance * max(1, |value|).
+    double tolerance {1e-8};
+
+    // Spin-up stops, unconverged, after this many simulated cycles.
+    size_t maximum_cycles {500};
+
+    // The relative size of the perturbations used to estimate
+    // derivatives of the cycle map.
+    double perturbation {1e-6};
+};
+
+/**
+ * The outcome of a spin-up.  `state` holds every differential quantity
+ * and can be used as the initial state of a simulation; `residual` is
+ * the largest scaled change of a selected quantity over the last
+ * cycle simulated from it.
+ */
+struct Spin_up_result {
+    State state;
+    size_t cycles;
+    double residual;
+    bool converged;
+};
+
+/**
+ * A Spin_up_solver finds the periodic steady state of a scenario whose
+ * drivers span one cycle (typically a year of weather): the state that
+ * is unchanged after simulating the cycle.  This is what a brute-force
+ * spin-up approaches by simulating the cycle over and over, but slow
+ * pools can need hundreds of repetitions to get there.
+ *
+ * Writing P(x) for the state after one cycle from x, the periodic
+ * state solves F(x) = P(x) - x = 0 for the selected quantities.  The
+ * default method applies Newton's method to F, solving for each step
+ * with GMRES; the products of the Jacobian of F with vectors that
+ * GMRES needs are estimated by simulating the cycle from perturbed
+ * states, so each costs one cycle and no Jacobian is formed.  For a
+ * system that is linear in its slow pools, this converges in one or
+ * two Newton steps.  The alternative method simulates two cycles at a
+ * time and extrapolates each quantity's geometric approach to its
+ * limit, which works well when each pool decays at its own rate.
+ *
+ * Each cycle is simulated with run_scenario_rows, using the scenario's
+ * solver settings.  Quantities that are not selected are carried along
+ * from cycle to cycle.
+ */
+class Spin_up_solver
+{
+   public:
+    Spin_up_solver(Scenario const& cycle, Spin_up_settings const& settings = {})
+        : cycle{cycle}, settings{settings}
+    {
+        Variable_names& names = this->settings.quantities;
+        if (names.empty()) {
+            for (auto& x : cycle.initial_state) names.push_back(x.first);
+            std::sort(names.begin(), names.end());
+        }
+        for (auto& name : names) {
+            if (!cycle.initial_state.count(name)) {
+                throw std::invalid_argument("\"" + name + "\" is not a differential quantity.");
+            }
+        }
+    }
+
+    Spin_up_result solve()
+    {
+        cycles = 0;
+        State state = cycle.initial_state;
+        State next = run_cycle(state);
+        return settings.method == Spin_up_method::newton_krylov ? solve_by_newton(state, next)
+                                                                : extrapolate(state, next);
+    }
+
+   private:
+    Scenario cycle;
+    Spin_up_settings settings;
+    size_t cycles {0};
+
+    State run_cycle(State const& start)
+    {
+        ++cycles;
+        State end;
+        run_scenario_rows(cycle, start, 0, get_number_of_rows(cycle) - 1, end);
+        return end;
+    }
+
+    std::vector<double> get_selected(State const& state) const
+    {
+        std::vector<double> x;
+        for (auto& name : settings.quantities) x.push_back(state.at(name));
+        return x;
+    }
+
+    void set_selected(State& state, std::vector<double> const& x) const
+    {
+        for (size_t i = 0; i < x.size(); ++i) state[settings.quantities[i]] = x[i];
+    }
+
+    double residual(State const& state, State const& next) const
+    {
+        double largest {0.0};
+        for (auto& name : settings.quantities) {
+            double x = state.at(name);
+            double change = std::fabs(next.at(name) - x) / std::max(1.0, std::fabs(x));
+            if (!(change <= largest)) largest = change;  // NaN wins
+        }
+        return largest;
+    }
+
+    Spin_up_result finish(State const& state, double r) const
+    {
+        return Spin_up_result{state, cycles, r, r <= settings.tolerance};
+    }
+
+    static double norm(std::vector<double> const& v)
+    {
+        double sum {0.0};
+        for (double x : v) sum += x * x;
+        return std::sqrt(sum);
+    }
+
+    // `next` is the state one cycle after `state`.
+    Spin_up_result solve_by_newton(State state, State next)
+    {
+        size_t n = settings.quantities.size();
+        while (true) {
+            double r = residual(state, next);
+            if (r <= settings.tolerance || cycles + n + 1 > settings.maximum_cycles) {
+                return finish(state, r);
+            }
+
+            // Unselected quantities move on a cycle, as in a brute-force
+            // spin-up, and the selected ones are linearized about there.
+            State base = next;
+            set_selected(base, get_selected(state));
+            if (base != state) {
+                state = base;
+                next = run_cycle(state);
+            }
+            std::vector<double> x = get_selected(state);
+            std::vector<double> f = get_selected(next);
+            for (size_t i = 0; i < n; ++i) f[i] -= x[i];
+
+            double scale = settings.perturbation * std::max(1.0, norm(x));
+            auto jacobian_times = [&](std::vector<double> const& v) {
+                State perturbed = state;
+                std::vector<double> y = x;
+                for (size_t i = 0; i < n; ++i) y[i] += scale * v[i];
+                set_selected(perturbed, y);
+                std::vector<double> p = get_selected(run_cycle(perturbed));
+                std::vector<double> jv(n);
+                for (size_t i = 0; i < n; ++i) jv[i] = (p[i] - x[i] - f[i]) / scale - v[i];
+                return jv;
+            };
+            std::vector<double> minus_f(n);
+            for (size_t i = 0; i < n; ++i) minus_f[i] = -f[i];
+            size_t budget = settings.maximum_cycles - cycles - 1;
+            std::vector<double> step = gmres(jacobian_times, minus_f, std::min(n, budget));
+
+            // Take the Newton step, halving it until the residual falls.
+            double old_norm = norm(f);
+            for (int halving = 0; halving < 4; ++halving) {
+                if (cycles >= settings.maximum_cycles) return finish(state, r);
+                State trial = state;
+                std::vector<double> y = x;
+                for (size_t i = 0; i < n; ++i) y[i] += step[i];
+                set_selected(trial, y);
+                State trial_next = run_cycle(trial);
+                std::vector<double> trial_f = get_selected(trial_next);
+                for (size_t i = 0; i < n; ++i) trial_f[i] -= y[i];
+                if (norm(trial_f) < old_norm || halving == 3) {
+                    state = trial;
+                    next = trial_next;
+                    break;
+                }
+                for (double& s : step) s /= 2;
+            }
+        }
+    }
+
+    // Solves A x = b by GMRES from x = 0 with at most `iterations`
+    // products with A, stopping early once the residual is 1e-10 of
+    // |b|.
+    template <typename Product>
+    static std::vector<double> gmres(Product const& a, std::vector<double> const& b,
+                                     size_t iterations)
+    {
+        size_t n = b.size();
+        std::vector<double> x(n, 0.0);
+        double beta = norm(b);
+        if (beta == 0 || iterations == 0) return x;
+
+        std::vector<std::vector<double>> basis {b};
+        for (double& v : basis[0]) v /= beta;
+        std::vector<std::vector<double>> h;  // h[j] is column j of the Hessenberg matrix
+        std::vector<double> cs, sn, g {beta};
+        size_t k {0};
+        while (k < iterations) {
+            std::vector<double> w = a(basis[k]);
+            std::vector<double> column(k + 2, 0.0);
+            for (size_t i = 0; i <= k; ++i) {  // modified Gram-Schmidt
+                double dot {0.0};
+                for (size_t m = 0; m < n; ++m) dot += w[m] * basis[i][m];
+                column[i] = dot;
+                for (size_t m = 0; m < n; ++m) w[m] -= dot * basis[i][m];
+            }
+            double subdiagonal = norm(w);
+            column[k + 1] = subdiagonal;
+
+            // Apply the earlier rotations, then one to zero the new
+            // subdiagonal entry.
+            for (size_t i = 0; i < k; ++i) {
+                double t = cs[i] * column[i] + sn[i] * column[i + 1];
+                column[i + 1] = -sn[i] * column[i] + cs[i] * column[i + 1];
+                column[i] = t;
+            }
+            double d = std::sqrt(column[k] * column[k] + column[k + 1] * column[k + 1]);
+            cs.push_back(d > 0 ? column[k] / d : 1.0);
+            sn.push_back(d > 0 ? column[k + 1] / d : 0.0);
+            column[k] = d;
+            column[k + 1] = 0;
+            g.push_back(-sn[k] * g[k]);
+            g[k] *= cs[k];
+            h.push_back(column);
+            ++k;
+
+            if (std::fabs(g[k]) <= 1e-10 * beta || subdiagonal == 0) break;
+            for (double& e : w) e /= subdiagonal;
+            basis.push_back(w);
+        }
+
+        // Back-substitute for the coefficients of the basis vectors.
+        std::vector<double> y(k);
+        for (size_t i = k; i-- > 0;) {
+            double sum = g[i];
+            for (size_t j = i + 1; j < k; ++j) sum -= h[j][i] * y[j];
+            y[i] = h[i][i] != 0 ? sum / h[i][i] : 0.0;
+        }
+        for (size_t j = 0; j < k; ++j) {
+            for (size_t m = 0; m < n; ++m) x[m] += y[j] * basis[j][m];
+        }
+        return x;
+    }
+
+    // `next` is the state one cycle after `state`.
+    Spin_up_result extrapolate(State state, State next)
+    {
+        while (true) {
+            double r = residual(state, next);
+            if (r <= settings.tolerance || cycles + 2 > settings.maximum_cycles) {
+                return finish(state, r);
+            }
+            State after = run_cycle(next);
+
+            // Each quantity approaching its limit geometrically changes
+            // by a constant ratio from cycle to cycle.
+            std::vector<double> x0 = get_selected(state), x1 = get_selected(next),
+                                x2 = get_selected(after);
+            std::vector<double> limit = x2;
+            for (size_t i = 0; i < x0.size(); ++i) {
+                double d1 = x1[i] - x0[i];
+                double d2 = x2[i] - x1[i];
+                if (d1 == 0) continue;
+                double ratio = d2 / d1;
+                if (ratio > 0 && ratio < 1) limit[i] = x2[i] + d2 * ratio / (1 - ratio);
+            }
+            state = after;
+            set_selected(state, limit);
+            next = run_cycle(state);
+        }
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,412 @@
+#ifndef STIFFNESS_SWITCHING_H
+#define STIFFNESS_SWITCHING_H
+
+#include <algorithm>  // for std::max, std::min
+#include <cmath>      // for std::fabs, std::pow, std::sqrt
+#include <limits>     // for std::numeric_limits
+
+#include "direct_evaluation.h"
+#include "scenario.h"
+
+namespace BioCro {
+
+enum class Integration_method {
+    automatic,      // switch between the two as stiffness comes and goes
+    explicit_only,  // Dormand-Prince 5(4) throughout
+    implicit_only   // Rosenbrock ROS2 throughout
+};
+
+struct Switching_settings {
+    Integration_method method {Integration_method::automatic};
+
+    double relative_tolerance {1e-4};
+    double absolute_tolerance {1e-4};
+
+    // The first trial step, in driver rows.
+    double initial_step {0.1};
+
+    // Integration fails with an exception after this many steps.
+    size_t maximum_steps {1000000};
+
+    // The explicit method switches to the implicit one after this
+    // many consecutive steps limited by stability rather than
+    // accuracy, and back after this many consecutive steps at which
+    // the explicit method would be stable.
+    size_t steps_before_switching {10};
+
+    // The implicit method's Jacobian is reused for this many steps
+    // (or until a step is rejected).  Reuse saves derivative
+    // evaluations when the Jacobian changes slowly, but a stale
+    // Jacobian from a stiffer stretch damps the solution too much.
+    size_t jacobian_reuse {1};
+};
+
+/**
+ * A Switching_report says how a Stiffness_switching_integrator spent
+ * its effort.
+ */
+struct Switching_report {
+    size_t explicit_steps {0};
+    size_t implicit_steps {0};
+    size_t rejected_steps {0};
+    size_t derivative_evaluations {0};
+    size_t jacobian_evaluations {0};
+
+    // The times (in driver rows) at which the method changed, and
+    // whether the new method is the implicit one.
+    std::vector<std::pair<double, bool>> switches;
+};
+
+/**
+ * A Stiffness_switching_integrator solves a scenario with an adaptive
+ * explicit method (Dormand-Prince 5(4)) while the system is non-stiff
+ * and a linearly implicit one (the Rosenbrock method ROS2, with a
+ * finite-difference Jacobian) while it is stiff, switching mid-run as
+ * the stiffness changes.
+ *
+ * Stiffness is detected the way Hairer and Wanner's DOPRI5 does it:
+ * each accepted explicit step estimates the dominant eigenvalue of the
+ * Jacobian, rho, from its last two stages, and a step for which
+ * h * rho approaches the edge of the method's stability region (about
+ * 3.3) is one whose size was set by stability rather than accuracy.
+ * During implicit integration, rho is estimated by power iteration
+ * whenever the Jacobian is recomputed, and once the steps chosen for
+ * accuracy would be stable for the explicit method, integration
+ * switches back, since explicit steps need no Jacobian or linear
+ * solves.  Drivers make the system non-autonomous, so along with the
+ * Jacobian, ROS2 uses the derivative with respect to time, also found
+ * by a finite difference.
+ *
+ * The integrator uses its own settings rather than the scenario's
+ * solver settings, and produces results at every driver row.  Direct
+ * module outputs are computed afterward for each row with a
+ * Direct_evaluator, so the results have the same columns as a
+ * Simulator's.
+ */
+class Stiffness_switching_integrator
+{
+   public:
+    explicit Stiffness_switching_integrator(Switching_settings const& settings = {})
+        : settings{settings} {}
+
+    Simulation_result integrate(Scenario const& scenario)
+    {
+        report = Switching_report{};
+        system = make_dynamical_system(
+            scenario.initial_state, scenario.parameters, scenario.drivers,
+            scenario.direct_mcs, scenario.differential_mcs);
+        if (system->requires_euler_ode_solver()) {
+            throw std::invalid_argument("The scenario's modules require an Euler solver.");
+        }
+
+        Variable_names names = system->get_differential_quantity_names();
+        n = names.size();
+        std::vector<double> y(n);
+        system->get_differential_quantities(y);
+
+        size_t rows = get_number_of_rows(scenario);
+        std::vector<std::vector<double>> states(n, std::vector<double>(rows));
+        for (size_t i = 0; i < n; ++i) states[i][0] = y[i];
+
+        stiff = settings.method == Integration_method::implicit_only;
+        counter = 0;
+        jacobian_age = settings.jacobian_reuse;  // force a new Jacobian
+        double t {0.0};
+        double h {settings.initial_step};
+        size_t steps {0};
+        for (size_t row = 1; row < rows; ++row) {
+            while (t < row) {
+                if (++steps > settings.maximum_steps) {
+                    throw std::runtime_error("The switching integrator exceeded its "
+                                             "maximum number of steps.");
+                }
+                double h_try = std::min(h, row - t);
+                bool clipped = h_try < h;
+                double h_next;
+                if (step(t, h_try, y, h_next)) {
+                    t = clipped && t + h_try >= row ? row : t + h_try;
+                    h = clipped ? std::max(h, h_next) : h_next;
+                } else {
+                    h = h_next;
+                }
+            }
+            for (size_t i = 0; i < n; ++i) states[i][row] = y[i];
+        }
+
+        System_drivers columns = scenario.drivers;
+        for (size_t i = 0; i < n; ++i) columns[names[i]] = states[i];
+        return Direct_evaluator{scenario.parameters, scenario.direct_mcs}.evaluate(columns);
+    }
+
+    Switching_report const& get_report() const { return report; }
+
+   private:
+    Switching_settings settings;
+    Switching_report report;
+    Dynamical_system system;
+    size_t n {0};
+
+    bool stiff {false};
+    size_t counter {0};  // consecutive steps suggesting a switch
+
+    // Implicit method state.
+    std::vector<double> jacobian;  // row-major
+    std::vector<double> time_derivative;  // of the derivative, holding y fixed
+    size_t jacobian_age {0};
+    double spectral_radius {0.0};
+    std::vector<double> lu;
+    std::vector<size_t> pivots;
+    double lu_step {0.0};  // the step size lu was factored for
+
+    // The edge of Dormand-Prince's stability region on the negative
+    // real axis.
+    static constexpr double stability_boundary {3.3};
+
+    // ROS2's gamma, 1 + 1 / sqrt(2).
+    static constexpr double gamma {1.7071067811865475};
+
+    void derivative(double t, std::vector<double> const& y, std::vector<double>& dydt)
+    {
+        ++report.derivative_evaluations;
+        system->calculate_derivative(y, dydt, t);
+    }
+
+    double error_norm(std::vector<double> const& error,
+                      std::vector<double> const& y0,
+                      std::vector<double> const& y1) const
+    {
+        if (n == 0) return 0.0;
+        double sum {0.0};
+        for (size_t i = 0; i < n; ++i) {
+            double scale = settings.absolute_tolerance +
+                           settings.relative_tolerance * std::max(std::fabs(y0[i]), std::fabs(y1[i]));
+            double e = error[i] / scale;
+            sum += e * e;
+        }
+        return std::sqrt(sum / n);
+    }
+
+    // Proposes the next step size from the error of one of order q.
+    static double next_step(double h, double error, double q)
+    {
+        double factor = error > 0 ? 0.9 * std::pow(error, -1 / (q + 1)) : 5.0;
+        return h * std::min(5.0, std::max(0.2, factor));
+    }
+
+    void switch_method(double t, bool to_implicit)
+    {
+        stiff = to_implicit;
+        counter = 0;
+        jacobian_age = settings.jacobian_reuse;
+        report.switches.push_back({t, to_implicit});
+    }
+
+    // Takes one step from t, returning whether it was accepted.  On
+    // acceptance, y is advanced.  Either way, h_next is the size to
+    // try next.
+    bool step(double t, double h, std::vector<double>& y, double& h_next)
+    {
+        bool accepted = stiff ? implicit_step(t, h, y, h_next) : explicit_step(t, h, y, h_next);
+        if (!accepted) ++report.rejected_steps;
+        return accepted;
+    }
+
+    bool explicit_step(double t, double h, std::vector<double>& y, double& h_next)
+    {
+        // Dormand-Prince 5(4) coefficients.
+        static const double a21 {1.0 / 5};
+        static const double a31 {3.0 / 40}, a32 {9.0 / 40};
+        static const double a41 {44.0 / 45}, a42 {-56.0 / 15}, a43 {32.0 / 9};
+        static const double a51 {19372.0 / 6561}, a52 {-25360.0 / 2187},
+            a53 {64448.0 / 6561}, a54 {-212.0 / 729};
+        static const double a61 {9017.0 / 3168}, a62 {-355.0 / 33}, a63 {46732.0 / 5247},
+            a64 {49.0 / 176}, a65 {-5103.0 / 18656};
+        static const double b1 {35.0 / 384}, b3 {500.0 / 1113}, b4 {125.0 / 192},
+            b5 {-2187.0 / 6784}, b6 {11.0 / 84};
+        static const double e1 {71.0 / 57600}, e3 {-71.0 / 16695}, e4 {71.0 / 1920},
+            e5 {-17253.0 / 339200}, e6 {22.0 / 525}, e7 {-1.0 / 40};
+
+        std::vector<double> k1(n), k2(n), k3(n), k4(n), k5(n), k6(n), k7(n), w(n), y6(n), y1(n), error(n);
+        derivative(t, y, k1);
+        for (size_t i = 0; i < n; ++i) w[i] = y[i] + h * a21 * k1[i];
+        derivative(t + h / 5, w, k2);
+        for (size_t i = 0; i < n; ++i) w[i] = y[i] + h * (a31 * k1[i] + a32 * k2[i]);
+        derivative(t + 3 * h / 10, w, k3);
+        for (size_t i = 0; i < n; ++i) w[i] = y[i] + h * (a41 * k1[i] + a42 * k2[i] + a43 * k3[i]);
+        derivative(t + 4 * h / 5, w, k4);
+        for (size_t i = 0; i < n; ++i) {
+            w[i] = y[i] + h * (a51 * k1[i] + a52 * k2[i] + a53 * k3[i] + a54 * k4[i]);
+        }
+        derivative(t + 8 * h / 9, w, k5);
+        for (size_t i = 0; i < n; ++i) {
+            y6[i] = y[i] + h * (a61 * k1[i] + a62 * k2[i] + a63 * k3[i] + a64 * k4[i] +
+                                a65 * k5[i]);
+        }
+        derivative(t + h, y6, k6);
+        for (size_t i = 0; i < n; ++i) {
+            y1[i] = y[i] + h * (b1 * k1[i] + b3 * k3[i] + b4 * k4[i] + b5 * k5[i] + b6 * k6[i]);
+        }
+        derivative(t + h, y1, k7);
+        for (size_t i = 0; i < n; ++i) {
+            error[i] = h * (e1 * k1[i] + e3 * k3[i] + e4 * k4[i] + e5 * k5[i] + e6 * k6[i] +
+                            e7 * k7[i]);
+        }
+
+        double err = error_norm(error, y, y1);
+        h_next = next_step(h, err, 4);
+        if (!(err <= 1)) return false;
+
+        // rho ~ |k7 - k6| / |y1 - y6|, both stages being at t + h.
+        double numerator {0.0}, denominator {0.0};
+        for (size_t i = 0; i < n; ++i) {
+            numerator += (k7[i] - k6[i]) * (k7[i] - k6[i]);
+            denominator += (y1[i] - y6[i]) * (y1[i] - y6[i]);
+        }
+        y = y1;
+        ++report.explicit_steps;
+
+        if (settings.method == Integration_method::automatic && denominator > 0) {
+            double h_rho = h * std::sqrt(numerator / denominator);
+            counter = h_rho > 0.9 * stability_boundary ? counter + 1 : 0;
+            if (counter >= settings.steps_before_switching) switch_method(t + h, true);
+        }
+        return true;
+    }
+
+    bool implicit_step(double t, double h, std::vector<double>& y, double& h_next)
+    {
+        std::vector<double> f0(n);
+        derivative(t, y, f0);
+        if (jacobian_age >= settings.jacobian_reuse) {
+            compute_jacobian(t, y, f0);
+            lu_step = 0;
+        }
+        if (lu_step != h) factor(h);
+        ++jacobian_age;
+
+        // With f_t the derivative of f with respect to time,
+        // (I - gamma h J) k1 = f(t, y) + gamma h f_t
+        // (I - gamma h J) k2 = f(t + h, y + h k1) - 2 k1 - gamma h f_t
+        // y1 = y + 1.5 h k1 + 0.5 h k2, with error h (k1 + k2) / 2.
+        std::vector<double> k1(n);
+        for (size_t i = 0; i < n; ++i) k1[i] = f0[i] + gamma * h * time_derivative[i];
+        solve(k1);
+        std::vector<double> w(n), k2(n);
+        for (size_t i = 0; i < n; ++i) w[i] = y[i] + h * k1[i];
+        derivative(t + h, w, k2);
+        for (size_t i = 0; i < n; ++i) k2[i] -= 2 * k1[i] + gamma * h * time_derivative[i];
+        solve(k2);
+
+        std::vector<double> y1(n), error(n);
+        for (size_t i = 0; i < n; ++i) {
+            y1[i] = y[i] + h * (1.5 * k1[i] + 0.5 * k2[i]);
+            error[i] = 0.5 * h * (k1[i] + k2[i]);
+        }
+        double err = error_norm(error, y, y1);
+        h_next = next_step(h, err, 1);
+        if (!(err <= 1)) {
+            jacobian_age = settings.jacobian_reuse;
+            return false;
+        }
+        y = y1;
+        ++report.implicit_steps;
+
+        if (settings.method == Integration_method::automatic) {
+            // Would the explicit method be stable at the step the
+            // implicit one chooses for accuracy?  Steps never cross a
+            // row, so no step need be longer than one.
+            double h_accurate = std::min(h_next, 1.0);
+            counter = h_accurate * spectral_radius < 0.5 * stability_boundary ? counter + 1 : 0;
+            if (counter >= settings.steps_before_switching) switch_method(t + h, false);
+        }
+        return true;
+    }
+
+    void compute_jacobian(double t, std::vector<double> const& y, std::vector<double> const& f0)
+    {
+        ++report.jacobian_evaluations;
+        jacobian.assign(n * n, 0.0);
+        std::vector<double> w = y, f(n);
+        for (size_t j = 0; j < n; ++j) {
+            double delta = std::sqrt(std::numeric_limits<double>::epsilon()) *
+                           std::max(1.0, std::fabs(y[j]));
+            w[j] = y[j] + delta;
+            derivative(t, w, f);
+            w[j] = y[j];
+            for (size_t i = 0; i < n; ++i) jacobian[i * n + j] = (f[i] - f0[i]) / delta;
+        }
+
+        // Steps never cross a row, so the drivers are differentiated
+        // forward, within the rows the step covers.
+        time_derivative.resize(n);
+        double dt = std::sqrt(std::numeric_limits<double>::epsilon()) * std::max(1.0, t);
+        derivative(t + dt, y, f);
+        for (size_t i = 0; i < n; ++i) time_derivative[i] = (f[i] - f0[i]) / dt;
+        jacobian_age = 0;
+
+        // Estimate the spectral radius by power iteration.
+        std::vector<double> v(n, 1.0), Jv(n);
+        spectral_radius = 0;
+        for (int iteration = 0; iteration < 30; ++iteration) {
+            double norm {0.0};
+            for (size_t i = 0; i < n; ++i) {
+                Jv[i] = 0;
+                for (size_t j = 0; j < n; ++j) Jv[i] += jacobian[i * n + j] * v[j];
+                norm += Jv[i] * Jv[i];
+            }
+            norm = std::sqrt(norm);
+            if (!(norm > 0)) break;
+            double v_norm {0.0};
+            for (double vi : v) v_norm += vi * vi;
+            spectral_radius = norm / std::sqrt(v_norm);
+            for (size_t i = 0; i < n; ++i) v[i] = Jv[i] / norm;
+        }
+    }
+
+    // Factors I - gamma h J, for steps of size h, by Gaussian
+    // elimination with partial pivoting.
+    void factor(double h)
+    {
+        lu.assign(n * n, 0.0);
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t j = 0; j < n; ++j) {
+                lu[i * n + j] = (i == j ? 1.0 : 0.0) - gamma * h * jacobian[i * n + j];
+            }
+        }
+        pivots.resize(n);
+        for (size_t k = 0; k < n; ++k) {
+            size_t pivot = k;
+            for (size_t i = k + 1; i < n; ++i) {
+                if (std::fabs(lu[i * n + k]) > std::fabs(lu[pivot * n + k])) pivot = i;
+            }
+            pivots[k] = pivot;
+            if (pivot != k) {
+                for (size_t j = 0; j < n; ++j) std::swap(lu[k * n + j], lu[pivot * n + j]);
+            }
+            if (lu[k * n + k] == 0) {
+                throw std::runtime_error("The switching integrator met a singular iteration matrix.");
+            }
+            for (size_t i = k + 1; i < n; ++i) {
+                double m = lu[i * n + k] /= lu[k * n + k];
+                for (size_t j = k + 1; j < n; ++j) lu[i * n + j] -= m * lu[k * n + j];
+            }
+        }
+        lu_step = h;
+    }
+
+    void solve(std::vector<double>& b) const
+    {
+        for (size_t k = 0; k < n; ++k) std::swap(b[k], b[pivots[k]]);
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t j = 0; j < i; ++j) b[i] -= lu[i * n + j] * b[j];
+        }
+        for (size_t i = n; i-- > 0;) {
+            for (size_t j = i + 1; j < n; ++j) b[i] -= lu[i * n + j] * b[j];
+            b[i] /= lu[i * n + i];
+        }
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,513 @@
+#ifndef SUBSYSTEM_SPLITTING_H
+#define SUBSYSTEM_SPLITTING_H
+
+#include <algorithm>   // for std::max, std::min, std::sort
+#include <cmath>       // for std::fabs
+#include <limits>      // for std::numeric_limits
+#include <functional>  // for std::function
+#include <map>
+#include <memory>      // for std::unique_ptr
+#include <set>
+
+#include "direct_evaluation.h"
+#include "field_composition.h"  // for Namespaced_module
+#include "stiffness_switching.h"
+
+namespace BioCro {
+
+/**
+ * A Module_dependencies object records, for a set of modules, which
+ * differential quantities each differential quantity's derivative
+ * reads, directly or through the outputs of direct modules.  It is
+ * found from the modules' declared inputs and outputs alone, so no
+ * module is run.
+ */
+class Module_dependencies
+{
+   public:
+    Module_dependencies(Variable_names const& differential_quantities,
+                        Module_set const& direct_mcs,
+                        Module_set const& differential_mcs)
+        : quantities{differential_quantities}
+    {
+        for (auto& name : quantities) {
+            state.insert(name);
+            reads[name];
+        }
+        for (auto creator : direct_mcs) {
+            for (auto& name : creator->get_outputs()) producer[name] = creator;
+        }
+        for (auto creator : differential_mcs) {
+            Variable_set read = get_quantities_read(creator->get_inputs());
+            for (auto& name : creator->get_outputs()) {
+                if (!state.count(name)) {
+                    throw std::invalid_argument("The quantity \"" + name + "\" is an output of a "
+                                                "differential module but not differential.");
+                }
+                reads[name].insert(read.begin(), read.end());
+            }
+        }
+    }
+
+    Variable_names const& get_quantities() const { return quantities; }
+
+    // Gets the differential quantities that the derivative of
+    // `quantity` reads.
+    Variable_set const& get_reads(std::string const& quantity) const
+    {
+        return reads.at(quantity);
+    }
+
+    // Gets the differential quantities that the given quantities
+    // depend on when they are evaluated.
+    Variable_set get_quantities_read(Variable_names const& names) const
+    {
+        Variable_set read, visited;
+        for (auto& name : names) add_quantities_read(name, read, visited);
+        return read;
+    }
+
+    // Gets the direct modules needed to evaluate the given quantities,
+    // in no particular order.
+    Module_set get_direct_modules_needed(Variable_names const& names) const
+    {
+        Module_set needed;
+        std::set<Module_creator> visited;
+        std::vector<std::string> pending(names.begin(), names.end());
+        while (!pending.empty()) {
+            std::string name = pending.back();
+            pending.pop_back();
+            auto p = producer.find(name);
+            if (p == producer.end() || !visited.insert(p->second).second) continue;
+            needed.push_back(p->second);
+            for (auto& input : p->second->get_inputs()) pending.push_back(input);
+        }
+        return needed;
+    }
+
+    /**
+     * Partitions the differential quantities into blocks of mutually
+     * dependent quantities: the strongly connected components of the
+     * graph with an edge from each quantity to every quantity its
+     * derivative reads.  The blocks are listed so that each block
+     * reads only itself and earlier blocks, and the quantities of each
+     * block are sorted.
+     */
+    std::vector<Variable_names> find_coupled_blocks() const
+    {
+        Variable_names sorted = quantities;
+        std::sort(sorted.begin(), sorted.end());
+
+        // Tarjan's algorithm, which finishes a component only after
+        // every component it reads.
+        std::map<std::string, size_t> index, lowlink;
+        size_t next_index {0};
+        Variable_set on_stack;
+        Variable_names stack;
+        std::vector<Variable_names> blocks;
+        std::function<void(std::string const&)> visit = [&](std::string const& v) {
+            index[v] = lowlink[v] = next_index++;
+            stack.push_back(v);
+            on_stack.insert(v);
+            for (auto& w : reads.at(v)) {
+                if (!index.count(w)) {
+                    visit(w);
+                    lowlink[v] = std::min(lowlink[v], lowlink[w]);
+                } else if (on_stack.count(w)) {
+                    lowlink[v] = std::min(lowlink[v], index[w]);
+                }
+            }
+            if (lowlink[v] == index[v]) {
+                Variable_names block;
+                std::string w;
+                do {
+                    w = stack.back();
+                    stack.pop_back();
+                    on_stack.erase(w);
+                    block.push_back(w);
+                } while (w != v);
+                std::sort(block.begin(), block.end());
+                blocks.push_back(block);
+            }
+        };
+        for (auto& v : sorted) {
+            if (!index.count(v)) visit(v);
+        }
+        return blocks;
+    }
+
+   private:
+    Variable_names quantities;
+    Variable_set state;
+    std::unordered_map<std::string, Variable_set> reads;
+    std::unordered_map<std::string, Module_creator> producer;
+
+    void add_quantities_read(std::string const& name, Variable_set& read,
+                             Variable_set& visited) const
+    {
+        if (!visited.insert(name).second) return;
+        if (state.count(name)) {
+            read.insert(name);
+            return;
+        }
+        auto p = producer.find(name);
+        if (p == producer.end()) return;  // a parameter or driver
+        for (auto& input : p->second->get_inputs()) add_quantities_read(input, read, visited);
+    }
+};
+
+/**
+ * An Output_subset_module_creator makes modules that run another
+ * module but only report some of its outputs; the rest are computed
+ * and discarded.  This lets a differential module that contributes to
+ * quantities in several blocks of a split system be used in each
+ * block for that block's quantities alone.
+ */
+class Output_subset_module_creator : public ::module_creator
+{
+   public:
+    Output_subset_module_creator(Module_creator original, Variable_names const& outputs)
+        : original{original}, inputs{original->get_inputs()}, outputs{outputs} {}
+
+    Module create_module(Variable_settings const& input_quantities,
+                         Variable_settings* output_quantities) override
+    {
+        std::unique_ptr<Namespace_storage> storage {new Namespace_storage};
+        for (auto& name : inputs) storage->inputs[name] = 0;
+        for (auto& name : original->get_outputs()) storage->outputs[name] = 0;
+        storage->module = original->create_module(storage->inputs, &storage->outputs);
+        return Module(new Namespaced_module(std::move(storage), inputs, inputs, outputs,
+                                            outputs, input_quantities, output_quantities));
+    }
+
+    Variable_names get_inputs() override { return inputs; }
+    Variable_names get_outputs() override { return outputs; }
+    std::string get_name() override { return original->get_name(); }
+
+   private:
+    Module_creator original;
+    Variable_names inputs;
+    Variable_names outputs;
+};
+
+struct Splitting_settings {
+    // The blocks the differential quantities are split into, in the
+    // order they are solved; empty means the blocks found by
+    // Module_dependencies::find_coupled_blocks.
+    std::vector<Variable_names> blocks;
+
+    // Solver settings for particular blocks, keyed by any quantity of
+    // the block.  Other blocks are solved by a
+    // Stiffness_switching_integrator using `switching`, which chooses
+    // an explicit or implicit method and a step size for each block
+    // on its own.
+    std::map<std::string, Solver_settings> block_solvers;
+    Switching_settings switching;
+
+    // When blocks read later blocks, waveform relaxation sweeps over
+    // the blocks until no quantity changes by more than tolerance *
+    // max(1, |value|) at any row.
+    double tolerance {1e-6};
+    size_t maximum_iterations {50};
+
+    // Blocks see each other's trajectories at the points of a grid,
+    // interpolated linearly between them.  The grid starts at the
+    // scenario's rows and the number of points per row is doubled
+    // until the estimated interpolation error of every quantity is no
+    // more than interpolation_tolerance * max(1, |value|) at every
+    // row, or until there would be more than maximum_substeps points
+    // per row.
+    double interpolation_tolerance {1e-4};
+    size_t maximum_substeps {64};
+};
+
+/**
+ * A Subsystem_splitting_integrator simulates a system that consists of
+ * weakly coupled blocks (phenology, water balance, and carbon pools,
+ * say) by solving each block separately, with its own solver and step
+ * size, so that a stiff block doesn't force small or implicit steps
+ * on the rest.  While a block is solved, the quantities of the other
+ * blocks are drivers: their trajectories from the latest solution of
+ * their blocks, sampled on a grid of points and interpolated linearly
+ * between them.
+ *
+ * By default the blocks are the coupled blocks of the module
+ * dependency graph (see Module_dependencies::find_coupled_blocks),
+ * solved from upstream to downstream, and one sweep suffices.  If
+ * blocks are given that read later blocks, the sweeps are repeated
+ * (Gauss-Seidel waveform relaxation), each starting from the previous
+ * trajectories, until they stop changing; the first sweep starts from
+ * constant trajectories.
+ *
+ * Apart from the blocks' own solver tolerances, the only approximation
+ * is that interpolation, whose error at the scenario's rows can reach
+ * 1e-3 of a quantity's value when blocks are coupled strongly.  It is
+ * controlled by solving on finer grids: the blocks are solved with
+ * `substeps` points per row (the scenario's drivers interpolated onto
+ * them and its "timestep" parameter divided by `substeps`, as for a
+ * finer simulation), and `substeps` is doubled, starting from the
+ * trajectories found so far, until the error estimated by comparing
+ * the last two grids meets the interpolation tolerance.  The error
+ * falls with the square of the grid spacing, so the estimate is a
+ * third of the difference between the last two grids.  Direct
+ * quantities are evaluated afterward from the final trajectories at
+ * the scenario's rows by a Direct_evaluator, so the result has the
+ * columns a Simulator would give.
+ */
+class Subsystem_splitting_integrator
+{
+   public:
+    explicit Subsystem_splitting_integrator(Splitting_settings const& settings = {})
+        : settings{settings} {}
+
+    Simulation_result integrate(Scenario const& scenario)
+    {
+        Variable_names names;
+        for (auto& x : scenario.initial_state) names.push_back(x.first);
+        Module_dependencies dependencies {names, scenario.direct_mcs, scenario.differential_mcs};
+        blocks = settings.blocks.empty() ? dependencies.find_coupled_blocks() : settings.blocks;
+        std::map<std::string, size_t> block_of = check_blocks(names);
+
+        if (settings.maximum_substeps == 0) {
+            throw std::invalid_argument("The maximum number of substeps must be positive.");
+        }
+
+        // Each quantity's trajectory starts out constant.
+        size_t rows = get_number_of_rows(scenario);
+        System_drivers trajectories;
+        for (auto& x : scenario.initial_state) {
+            trajectories[x.first] = std::vector<double>(rows, x.second);
+        }
+
+        std::vector<Scenario> block_scenarios;
+        std::vector<Variable_names> block_drivers;
+        bool coupled {false};
+        bool feedback {false};
+        wrappers.clear();
+        for (size_t b = 0; b < blocks.size(); ++b) {
+            Scenario block {{}, scenario.parameters, scenario.drivers, {}, {},
+                            scenario.solver_settings};
+            Variable_set in_block(blocks[b].begin(), blocks[b].end());
+            for (auto& name : blocks[b]) block.initial_state[name] = scenario.initial_state.at(name);
+
+            Variable_names inputs;
+            for (auto creator : scenario.differential_mcs) {
+                Variable_names outputs;
+                for (auto& name : creator->get_outputs()) {
+                    if (in_block.count(name)) outputs.push_back(name);
+                }
+                if (outputs.empty()) continue;
+                if (outputs.size() == creator->get_outputs().size()) {
+                    block.differential_mcs.push_back(creator);
+                } else {
+                    wrappers.emplace_back(new Output_subset_module_creator(creator, outputs));
+                    block.differential_mcs.push_back(wrappers.back().get());
+                }
+                for (auto& name : creator->get_inputs()) inputs.push_back(name);
+            }
+            block.direct_mcs = dependencies.get_direct_modules_needed(inputs);
+
+            // The quantities of other blocks that this block reads
+            // become its drivers.
+            Variable_names drivers;
+            for (auto& name : dependencies.get_quantities_read(inputs)) {
+                if (in_block.count(name)) continue;
+                drivers.push_back(name);
+                coupled = true;
+                if (block_of.at(name) > b) feedback = true;
+            }
+            block_scenarios.push_back(block);
+            block_drivers.push_back(drivers);
+        }
+
+        substeps = 1;
+        interpolation_error = coupled ? std::numeric_limits<double>::infinity() : 0.0;
+        System_drivers previous;  // the trajectories at the rows on the previous grid
+        while (true) {
+            Parameter_set parameters = scenario.parameters;
+            if (substeps > 1) {
+                auto timestep = parameters.find("timestep");
+                double row_length = timestep == parameters.end() ? 1.0 : timestep->second;
+                parameters["timestep"] = row_length / substeps;
+            }
+            System_drivers drivers = refine(scenario.drivers, substeps);
+            for (auto& block : block_scenarios) {
+                block.parameters = parameters;
+                block.drivers = drivers;
+            }
+            bool relaxed = relax(block_scenarios, block_drivers, trajectories, feedback);
+
+            System_drivers at_rows = sample_rows(trajectories, substeps);
+            if (substeps > 1) interpolation_error = largest_difference(previous, at_rows) / 3;
+            converged = relaxed && interpolation_error <= settings.interpolation_tolerance;
+            if (!coupled || converged || !relaxed || 2 * substeps > settings.maximum_substeps) {
+                trajectories = at_rows;
+                break;
+            }
+            previous = at_rows;
+            trajectories = refine(trajectories, 2);
+            substeps *= 2;
+        }
+
+        System_drivers columns = scenario.drivers;
+        columns.insert(trajectories.begin(), trajectories.end());
+        return Direct_evaluator{scenario.parameters, scenario.direct_mcs}.evaluate(columns);
+    }
+
+    // Gets the blocks used by the last call to integrate, in the order
+    // they were solved.
+    std::vector<Variable_names> const& get_blocks() const { return blocks; }
+
+    // Gets the number of sweeps over the blocks on the finest grid of
+    // the last call to integrate.
+    size_t get_number_of_iterations() const { return changes.size(); }
+
+    // Gets the largest scaled change of a trajectory in each sweep on
+    // the finest grid of the last call to integrate.
+    std::vector<double> const& get_changes() const { return changes; }
+
+    // Gets the number of grid points per row of the finest grid, and
+    // the estimated scaled interpolation error there (zero if no block
+    // reads another, and infinite if only one grid was used).
+    size_t get_substeps() const { return substeps; }
+    double get_interpolation_error() const { return interpolation_error; }
+
+    // Tells whether the sweeps of the last call to integrate settled on
+    // the finest grid and the interpolation error met its tolerance.
+    bool has_converged() const { return converged; }
+
+   private:
+    Splitting_settings settings;
+    std::vector<Variable_names> blocks;
+    std::vector<double> changes;
+    size_t substeps {1};
+    double interpolation_error {0.0};
+    bool converged {false};
+    std::vector<std::unique_ptr<Output_subset_module_creator>> wrappers;
+
+    // Checks that every differential quantity is in exactly one block,
+    // and maps each quantity to its block.
+    std::map<std::string, size_t> check_blocks(Variable_names const& names) const
+    {
+        std::map<std::string, size_t> block_of;
+        for (size_t b = 0; b < blocks.size(); ++b) {
+            for (auto& name : blocks[b]) {
+                if (!block_of.emplace(name, b).second) {
+                    throw std::invalid_argument("The quantity \"" + name +
+                                                "\" is in more than one block.");
+                }
+            }
+        }
+        for (auto& name : names) {
+            if (!block_of.count(name)) {
+                throw std::invalid_argument("The differential quantity \"" + name +
+                                            "\" is not in any block.");
+            }
+        }
+        if (block_of.size() != names.size()) {
+            throw std::invalid_argument("A block contains a quantity that is not differential.");
+        }
+        return block_of;
+    }
+
+    // Sweeps over the blocks on one grid until the trajectories settle,
+    // or just once if no block reads a later one.  Returns whether
+    // they settled.
+    bool relax(std::vector<Scenario>& block_scenarios,
+               std::vector<Variable_names> const& block_drivers,
+               System_drivers& trajectories,
+               bool feedback)
+    {
+        changes.clear();
+        do {
+            double largest {0.0};
+            for (size_t b = 0; b < blocks.size(); ++b) {
+                Scenario& block = block_scenarios[b];
+                for (auto& name : block_drivers[b]) block.drivers[name] = trajectories.at(name);
+                Simulation_result result = solve_block(block);
+                for (auto& name : blocks[b]) {
+                    std::vector<double>& old = trajectories.at(name);
+                    std::vector<double> const& now = result.at(name);
+                    for (size_t row = 0; row < old.size(); ++row) {
+                        double change = std::fabs(now[row] - old[row]) /
+                                        std::max(1.0, std::fabs(old[row]));
+                        if (!(change <= largest)) largest = change;  // NaN wins
+                    }
+                    old = now;
+                }
+            }
+            changes.push_back(largest);
+        } while (feedback && !(changes.back() <= settings.tolerance) &&
+                 changes.size() < settings.maximum_iterations);
+        return !feedback || changes.back() <= settings.tolerance;
+    }
+
+    // Gets the largest difference between two sets of trajectories,
+    // scaled by max(1, |value|).
+    static double largest_difference(System_drivers const& old, System_drivers const& now)
+    {
+        double largest {0.0};
+        for (auto& column : now) {
+            std::vector<double> const& before = old.at(column.first);
+            for (size_t row = 0; row < before.size(); ++row) {
+                double difference = std::fabs(column.second[row] - before[row]) /
+                                    std::max(1.0, std::fabs(column.second[row]));
+                if (!(difference <= largest)) largest = difference;  // NaN wins
+            }
+        }
+        return largest;
+    }
+
+    // Samples columns given at the rows of a grid at `factor` points
+    // per row, interpolating linearly as solvers do between rows.
+    static System_drivers refine(System_drivers const& columns, size_t factor)
+    {
+        if (factor == 1) return columns;
+        System_drivers fine;
+        for (auto& column : columns) {
+            std::vector<double> const& values = column.second;
+            std::vector<double>& refined = fine[column.first];
+            if (values.empty()) continue;
+            refined.resize((values.size() - 1) * factor + 1);
+            for (size_t row = 0; row + 1 < values.size(); ++row) {
+                for (size_t k = 0; k < factor; ++k) {
+                    double fraction = double(k) / factor;
+                    refined[row * factor + k] =
+                        values[row] * (1 - fraction) + values[row + 1] * fraction;
+                }
+            }
+            refined.back() = values.back();
+        }
+        return fine;
+    }
+
+    // Picks out every `substeps`th point of columns on a finer grid.
+    static System_drivers sample_rows(System_drivers const& columns, size_t substeps)
+    {
+        System_drivers coarse;
+        for (auto& column : columns) {
+            std::vector<double>& values = coarse[column.first];
+            for (size_t row = 0; row < column.second.size(); row += substeps) {
+                values.push_back(column.second[row]);
+            }
+        }
+        return coarse;
+    }
+
+    Simulation_result solve_block(Scenario const& block) const
+    {
+        for (auto& x : block.initial_state) {
+            auto solver = settings.block_solvers.find(x.first);
+            if (solver != settings.block_solvers.end()) {
+                Scenario with_solver = block;
+                with_solver.solver_settings = solver->second;
+                return make_simulator(with_solver).run_simulation();
+            }
+        }
+        return Stiffness_switching_integrator{settings.switching}.integrate(block);
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,367 @@
+#ifndef TABULATED_MODULE_H
+#define TABULATED_MODULE_H
+
+#include <algorithm>  // for std::find
+#include <cmath>      // for std::floor, std::fabs
+#include <limits>     // for std::numeric_limits
+#include <memory>     // for std::shared_ptr
+
+#include "direct_evaluation.h"
+
+namespace BioCro {
+
+/**
+ * A Table_axis gives the values of one input of a tabulated module:
+ * `points` equally spaced values from `minimum` to `maximum`.
+ */
+struct Table_axis {
+    std::string name;
+    double minimum;
+    double maximum;
+    size_t points;
+};
+
+/**
+ * Settings controlling how finely a Module_table is made.
+ */
+struct Tabulation_settings {
+    // The largest acceptable estimated interpolation error in any
+    // output.  While the estimate is larger, the number of intervals
+    // along every axis is doubled.  The default accepts the grid given.
+    double tolerance {std::numeric_limits<double>::infinity()};
+
+    // No grid the module is evaluated on, including the finer grid
+    // that checks the table, has more than this many points in all.
+    size_t maximum_points {1000000};
+
+    // The number of threads evaluating the module at the grid points.
+    size_t number_of_threads {1};
+};
+
+/**
+ * A Module_table holds the outputs of a direct module at every point
+ * of a regular grid over some of its inputs, and evaluates them
+ * elsewhere by multilinear interpolation.  The module's other inputs
+ * are held at fixed values.
+ *
+ * The table is filled by evaluating the module at all of the grid
+ * points in one batch with a Direct_evaluator.  The interpolation
+ * error is then estimated by evaluating the module on a grid with
+ * twice as many intervals along every axis, which includes the
+ * midpoint of every cell and of every cell edge and face; the
+ * estimate is the largest error at those points, not a strict bound.
+ * If it is too large, the finer grid becomes the table, so no
+ * evaluation is wasted.  Checking the final table costs up to 2^axes
+ * times as many evaluations as filling it, so the number of points is
+ * limited by the grid that checks it: the table is refined only while
+ * the next check fits within maximum_points, and the constructor
+ * throws, before evaluating anything, if the first one wouldn't.
+ */
+class Module_table
+{
+   public:
+    // Interpolation looks at 2^dimensions grid points, so a table is
+    // practical only over a few inputs.
+    static constexpr size_t maximum_dimensions {6};
+
+    Module_table(Module_creator module,
+                 std::vector<Table_axis> const& axes,
+                 Parameter_set const& fixed_inputs = {},
+                 Tabulation_settings const& settings = {})
+        : module{module}, fixed_inputs{fixed_inputs}, outputs{module->get_outputs()}
+    {
+        if (axes.empty() || axes.size() > maximum_dimensions) {
+            throw std::invalid_argument("A module table must have between one and " +
+                                        std::to_string(maximum_dimensions) + " axes.");
+        }
+        Variable_names inputs = module->get_inputs();
+        for (auto& axis : axes) {
+            if (std::find(inputs.begin(), inputs.end(), axis.name) == inputs.end()) {
+                throw std::invalid_argument("The axis \"" + axis.name + "\" is not an input of " +
+                                            module->get_name() + ".");
+            }
+            if (axis.points < 2 || !(axis.minimum < axis.maximum)) {
+                throw std::invalid_argument("The axis \"" + axis.name + "\" must have at least "
+                                            "two points and a positive length.");
+            }
+        }
+
+        if (count_points(refine(axes)) > settings.maximum_points) {
+            throw std::invalid_argument("The grid checking a table over these axes would "
+                                        "have more than " +
+                                        std::to_string(settings.maximum_points) + " points.");
+        }
+
+        Direct_evaluator evaluator {fixed_inputs, {module}, settings.number_of_threads};
+        set_grid(axes);
+        fill(evaluator.evaluate(get_grid_points(axes)));
+        while (true) {
+            std::vector<Table_axis> finer = refine(get_axes());
+            Simulation_result exact = evaluator.evaluate(get_grid_points(finer));
+            estimate_error(exact);
+            if (get_maximum_error() <= settings.tolerance ||
+                count_points(refine(finer)) > settings.maximum_points) {
+                break;
+            }
+            // The evaluations used to check this grid make the next.
+            set_grid(finer);
+            fill(exact);
+        }
+    }
+
+    std::vector<Table_axis> const& get_axes() const { return axes; }
+    Parameter_set const& get_fixed_inputs() const { return fixed_inputs; }
+    Variable_names const& get_outputs() const { return outputs; }
+    size_t get_number_of_points() const { return values.size() / outputs.size(); }
+
+    // Gets the estimated interpolation error of each output.
+    Variable_settings const& get_error_estimate() const { return error_estimate; }
+
+    double get_maximum_error() const
+    {
+        double maximum {0.0};
+        for (auto& error : error_estimate) {
+            if (!(error.second <= maximum)) maximum = error.second;  // NaN wins
+        }
+        return maximum;
+    }
+
+    // Interpolates the outputs at a point given by one value per axis.
+    // Returns false, leaving `result` unchanged, if the point is
+    // outside the table.
+    bool interpolate(double const* x, double* result) const
+    {
+        size_t dimensions = axes.size();
+        size_t base {0};
+        double fraction[maximum_dimensions];
+        for (size_t k = 0; k < dimensions; ++k) {
+            double position = (x[k] - axes[k].minimum) * inverse_steps[k];
+            double last = axes[k].points - 1;
+            if (!(position >= 0 && position <= last)) return false;
+            double cell = std::floor(position);
+            if (cell == last) cell = last - 1;
+            fraction[k] = position - cell;
+            base += static_cast<size_t>(cell) * strides[k];
+        }
+
+        size_t n = outputs.size();
+        for (size_t o = 0; o < n; ++o) result[o] = 0.0;
+        for (size_t corner = 0; corner < (size_t(1) << dimensions); ++corner) {
+            double weight {1.0};
+            size_t point = base;
+            for (size_t k = 0; k < dimensions; ++k) {
+                if (corner & (size_t(1) << k)) {
+                    weight *= fraction[k];
+                    point += strides[k];
+                } else {
+                    weight *= 1 - fraction[k];
+                }
+            }
+            double const* corner_values = &values[point * n];
+            for (size_t o = 0; o < n; ++o) result[o] += weight * corner_values[o];
+        }
+        return true;
+    }
+
+   private:
+    Module_creator module;
+    Parameter_set fixed_inputs;
+    Variable_names outputs;
+    std::vector<Table_axis> axes;
+    std::vector<double> inverse_steps;
+    std::vector<size_t> strides;     // in grid points; the first axis varies slowest
+    std::vector<double> values;      // the outputs at each grid point, together
+    Variable_settings error_estimate;
+
+    void set_grid(std::vector<Table_axis> const& grid)
+    {
+        axes = grid;
+        inverse_steps.resize(axes.size());
+        strides.resize(axes.size());
+        size_t stride {1};
+        for (size_t k = axes.size(); k-- > 0;) {
+            inverse_steps[k] = (axes[k].points - 1) / (axes[k].maximum - axes[k].minimum);
+            strides[k] = stride;
+            stride *= axes[k].points;
+        }
+    }
+
+    // Gets a grid with twice as many intervals along every axis.
+    static std::vector<Table_axis> refine(std::vector<Table_axis> grid)
+    {
+        for (auto& axis : grid) axis.points = 2 * axis.points - 1;
+        return grid;
+    }
+
+    // Counts the points of a grid, saturating rather than overflowing.
+    static size_t count_points(std::vector<Table_axis> const& grid)
+    {
+        size_t count {1};
+        for (auto& axis : grid) {
+            if (count > std::numeric_limits<size_t>::max() / axis.points) {
+                return std::numeric_limits<size_t>::max();
+            }
+            count *= axis.points;
+        }
+        return count;
+    }
+
+    // Makes driver columns holding every point of a grid.
+    static System_drivers get_grid_points(std::vector<Table_axis> const& grid)
+    {
+        size_t count {1};
+        for (auto& axis : grid) count *= axis.points;
+        System_drivers points;
+        size_t inner {count};
+        for (auto& axis : grid) {
+            auto& column = points[axis.name];
+            column.resize(count);
+            inner /= axis.points;
+            double step = (axis.maximum - axis.minimum) / (axis.points - 1);
+            for (size_t p = 0; p < count; ++p) {
+                size_t i = (p / inner) % axis.points;
+                column[p] = i + 1 == axis.points ? axis.maximum : axis.minimum + i * step;
+            }
+        }
+        return points;
+    }
+
+    void fill(Simulation_result const& result)
+    {
+        size_t count = result.at(outputs[0]).size();
+        size_t n = outputs.size();
+        values.resize(count * n);
+        for (size_t o = 0; o < n; ++o) {
+            auto& column = result.at(outputs[o]);
+            for (size_t p = 0; p < count; ++p) values[p * n + o] = column[p];
+        }
+    }
+
+    // Compares the table with exact values at the points of a finer
+    // grid.
+    void estimate_error(Simulation_result const& exact)
+    {
+        size_t n = outputs.size();
+        for (auto& name : outputs) error_estimate[name] = 0.0;
+
+        std::vector<double> x(axes.size());
+        std::vector<double> interpolated(n);
+        size_t count = exact.at(outputs[0]).size();
+        for (size_t p = 0; p < count; ++p) {
+            for (size_t k = 0; k < axes.size(); ++k) x[k] = exact.at(axes[k].name)[p];
+            interpolate(x.data(), interpolated.data());
+            for (size_t o = 0; o < n; ++o) {
+                double error = std::fabs(interpolated[o] - exact.at(outputs[o])[p]);
+                double& maximum = error_estimate[outputs[o]];
+                if (!(error <= maximum)) maximum = error;
+            }
+        }
+    }
+};
+
+/**
+ * A module that interpolates its outputs from a Module_table.  At
+ * points outside the table, or when an input the table holds fixed has
+ * a different value, it runs the original module instead, so its
+ * results are always either interpolated or exact.
+ */
+class Tabulated_module : public ::direct_module
+{
+   public:
+    Tabulated_module(std::shared_ptr<const Module_table> table,
+                     Module_creator original,
+                     Variable_settings const& input_quantities,
+                     Variable_settings* output_quantities)
+        : ::direct_module{},
+          table{table},
+          fallback{original->create_module(input_quantities, output_quantities)},
+          x(table->get_axes().size()),
+          interpolated(table->get_outputs().size())
+    {
+        for (auto& axis : table->get_axes()) {
+            axis_inputs.push_back(&input_quantities.at(axis.name));
+        }
+        for (auto& fixed : table->get_fixed_inputs()) {
+            fixed_inputs.push_back({&input_quantities.at(fixed.first), fixed.second});
+        }
+        for (auto& name : table->get_outputs()) {
+            output_ptrs.push_back(&output_quantities->at(name));
+        }
+    }
+
+   private:
+    std::shared_ptr<const Module_table> table;
+    Module fallback;
+    std::vector<double const*> axis_inputs;
+    std::vector<std::pair<double const*, double>> fixed_inputs;
+    std::vector<double*> output_ptrs;
+    mutable std::vector<double> x;
+    mutable std::vector<double> interpolated;
+
+    void do_operation() const override
+    {
+        bool in_table {true};
+        for (auto& fixed : fixed_inputs) {
+            if (*fixed.first != fixed.second) in_table = false;
+        }
+        for (size_t k = 0; k < axis_inputs.size(); ++k) x[k] = *axis_inputs[k];
+
+        if (in_table && table->interpolate(x.data(), interpolated.data())) {
+            for (size_t o = 0; o < output_ptrs.size(); ++o) {
+                update(output_ptrs[o], interpolated[o]);
+            }
+        } else {
+            fallback->run();
+        }
+    }
+};
+
+/**
+ * A Tabulated_module_creator replaces a direct module with a surrogate
+ * that interpolates its outputs from a table made when the creator is
+ * constructed.  For example, to tabulate an expensive module over two
+ * of its inputs, holding a third fixed,
+ *
+ *     BioCro::Tabulated_module_creator surrogate {
+ *         expensive,
+ *         {{"temperature", -10, 50, 61}, {"light", 0, 2000, 41}},
+ *         {{"co2", 400}},
+ *         {1e-4}};  // refine the grid until the estimated error is below 1e-4
+ *
+ * and use `&surrogate` in place of `expensive` in a module set.  The
+ * module's remaining inputs must be tabulated or fixed.  The estimated
+ * interpolation error is available from get_table()->get_error_estimate().
+ *
+ * The creator must outlive any Module_set (and any simulator) using
+ * it.
+ */
+class Tabulated_module_creator : public ::module_creator
+{
+   public:
+    Tabulated_module_creator(Module_creator original,
+                             std::vector<Table_axis> const& axes,
+                             Parameter_set const& fixed_inputs = {},
+                             Tabulation_settings const& settings = {})
+        : original{original},
+          table{std::make_shared<const Module_table>(original, axes, fixed_inputs, settings)} {}
+
+    Module create_module(Variable_settings const& input_quantities,
+                         Variable_settings* output_quantities) override
+    {
+        return Module(new Tabulated_module(table, original, input_quantities, output_quantities));
+    }
+
+    Variable_names get_inputs() override { return original->get_inputs(); }
+    Variable_names get_outputs() override { return original->get_outputs(); }
+    std::string get_name() override { return "tabulated_" + original->get_name(); }
+
+    std::shared_ptr<const Module_table> get_table() const { return table; }
+
+   private:
+    Module_creator original;
+    std::shared_ptr<const Module_table> table;
+};
+
+}
+
+#endif
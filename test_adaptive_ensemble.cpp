@@ -0,0 +1,140 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <iostream>
+#include <random>
+
+#include "adaptive_ensemble.h"
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+// Running_statistics should agree with the usual two-pass formulas.
+TEST(RunningStatisticsTest, MatchesTwoPassFormulas) {
+    std::vector<double> values {2.5, -1, 7, 3.25, 0, 11, 4};
+
+    BioCro::Running_statistics statistics;
+    for (double value : values) {
+        statistics.add(value);
+    }
+
+    double mean = std::accumulate(values.begin(), values.end(), 0.0) / values.size();
+    double sum_of_squares {0};
+    for (double value : values) {
+        sum_of_squares += (value - mean) * (value - mean);
+    }
+    double variance = sum_of_squares / (values.size() - 1);
+
+    EXPECT_EQ(statistics.count(), values.size());
+    EXPECT_NEAR(statistics.mean(), mean, 1e-12);
+    EXPECT_NEAR(statistics.variance(), variance, 1e-12);
+    EXPECT_NEAR(statistics.confidence_interval_width(),
+                2 * 1.96 * sqrt(variance / values.size()), 1e-12);
+}
+
+/*
+ * The members of the adaptive ensemble are harmonic oscillators whose
+ * masses are drawn uniformly from [5, 15].  Each member's mass is
+ * drawn from a generator seeded with the member's index so that the
+ * ensemble is reproducible.
+ */
+class AdaptiveEnsembleTest : public ::testing::Test {
+   protected:
+    BioCro::Adaptive_ensemble_simulator get_simulator() {
+        return BioCro::Adaptive_ensemble_simulator {
+            { {"position", 0}, {"velocity", 1} },
+            { {"mass", 10}, {"spring_constant", 0.1}, {"timestep", 1} },
+            {"mass"},
+            [](size_t member) {
+                std::default_random_engine engine(member);
+                std::uniform_real_distribution<double> mass(5, 15);
+                return std::vector<double>{mass(engine)};
+            },
+            { {"time",  { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 }} },
+            {},
+            { Module_factory::retrieve("harmonic_oscillator") },
+            "boost_rk4",
+            1,
+            0.0001,
+            0.0001,
+            200
+        };
+    }
+
+    BioCro::Ensemble_statistics statistics {
+        {"final_position", [](BioCro::Simulation_result const& result) {
+                return result.at("position").back();
+            }}
+    };
+};
+
+// With an attainable target, the run stops once the confidence
+// interval is narrow enough, well before the maximum member count.
+TEST_F(AdaptiveEnsembleTest, StopsAtConvergence) {
+    BioCro::Adaptive_ensemble_settings settings;
+    settings.wave_size = 20;
+    settings.minimum_members = 40;
+    settings.maximum_members = 5000;
+    settings.target_width = 0.05;
+
+    BioCro::Adaptive_ensemble_simulator simulator = get_simulator();
+    BioCro::Adaptive_ensemble_result result = simulator.run_simulation(statistics, settings);
+
+    auto final_position = result.statistics.at("final_position");
+    if (VERBOSE) {
+        std::cout << "members: " << result.members.size()
+                  << ", mean: " << final_position.mean()
+                  << ", width: " << final_position.confidence_interval_width()
+                  << std::endl;
+    }
+
+    EXPECT_TRUE(result.converged);
+    EXPECT_LE(final_position.confidence_interval_width(), settings.target_width);
+    EXPECT_LT(result.members.size(), settings.maximum_members);
+    EXPECT_GE(result.members.size(), settings.minimum_members);
+    EXPECT_EQ(result.members.size(), result.number_of_waves * settings.wave_size);
+    EXPECT_EQ(final_position.count(), result.members.size());
+}
+
+// With an unattainable target, the run stops at the maximum member
+// count and reports that it did not converge.
+TEST_F(AdaptiveEnsembleTest, StopsAtMaximum) {
+    BioCro::Adaptive_ensemble_settings settings;
+    settings.wave_size = 30;
+    settings.minimum_members = 30;
+    settings.maximum_members = 100;
+    settings.target_width = 0;
+
+    BioCro::Adaptive_ensemble_simulator simulator = get_simulator();
+    BioCro::Adaptive_ensemble_result result = simulator.run_simulation(statistics, settings);
+
+    EXPECT_FALSE(result.converged);
+    EXPECT_EQ(result.members.size(), settings.maximum_members);
+    EXPECT_EQ(result.number_of_waves, 4);
+}
+
+// Each run starts a new ensemble, and running the waves on several
+// threads changes nothing but the time taken.
+TEST_F(AdaptiveEnsembleTest, RunsAreIndependent) {
+    BioCro::Adaptive_ensemble_settings settings;
+    settings.wave_size = 25;
+    settings.minimum_members = 25;
+    settings.maximum_members = 75;
+    settings.target_width = 0;
+
+    BioCro::Adaptive_ensemble_simulator simulator = get_simulator();
+    BioCro::Adaptive_ensemble_result first = simulator.run_simulation(statistics, settings);
+    settings.number_of_threads = 4;
+    BioCro::Adaptive_ensemble_result second = simulator.run_simulation(statistics, settings);
+
+    EXPECT_EQ(second.members.size(), settings.maximum_members);
+    EXPECT_EQ(second.number_of_waves, 3);
+    auto& first_position = first.statistics.at("final_position");
+    auto& second_position = second.statistics.at("final_position");
+    EXPECT_EQ(second_position.count(), settings.maximum_members);
+    EXPECT_EQ(second_position.mean(), first_position.mean());
+    EXPECT_EQ(second_position.variance(), first_position.variance());
+}
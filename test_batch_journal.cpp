@@ -0,0 +1,180 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <cstdio>   // for std::remove
+#include <iostream>
+#include <map>
+
+#include "batch_journal.h"
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+// Returns an increasing sequence (a vector of doubles) of the given
+// length, starting at 0.
+static std::vector<double> row_numbers(size_t length) {
+    auto v = std::vector<double>(length);
+    std::iota(v.begin(), v.end(), 0);
+    return v;
+}
+
+// Used to simulate a crash part way through a batch.
+struct Simulated_crash : std::runtime_error {
+    Simulated_crash() : std::runtime_error("simulated crash") {}
+};
+
+/*
+ * The batch consists of three harmonic-oscillator jobs of 25 rows
+ * each.  The sink reassembles each job's result, keyed by row, from
+ * the segments it receives.
+ */
+class BatchJournalTest : public ::testing::Test {
+   protected:
+    BatchJournalTest() {
+        std::remove(journal_path.c_str());
+        for (double mass : {5.0, 10.0, 20.0}) {
+            jobs.push_back(BioCro::Batch_job {
+                "mass_" + std::to_string(int(mass)),
+                BioCro::Scenario {
+                    { {"position", 0}, {"velocity", 1} },
+                    { {"mass", mass}, {"spring_constant", 0.1}, {"timestep", 1} },
+                    { {"time", row_numbers(number_of_rows)} },
+                    {},
+                    { Module_factory::retrieve("harmonic_oscillator") },
+                    {"boost_rk4", 1, 0.0001, 0.0001, 200}
+                }
+            });
+        }
+    }
+
+    ~BatchJournalTest() {
+        std::remove(journal_path.c_str());
+    }
+
+    const size_t number_of_rows {25};
+    const std::string journal_path {::testing::TempDir() + "test_batch_journal.txt"};
+    std::vector<BioCro::Batch_job> jobs;
+
+    // positions[job id][row]
+    std::map<std::string, std::map<size_t, double>> positions;
+    size_t segments_received {0};
+    size_t crash_after {0}; // 0 means never crash
+
+    BioCro::Segment_sink sink {
+        [this](BioCro::Batch_job const& job, size_t first_row,
+               BioCro::Simulation_result const& segment) {
+            if (crash_after > 0 && segments_received == crash_after) {
+                throw Simulated_crash{};
+            }
+            ++segments_received;
+            auto& column = segment.at("position");
+            for (size_t i = 0; i < column.size(); ++i) {
+                positions[job.id][first_row + i] = column[i];
+            }
+            if (VERBOSE) {
+                std::cout << job.id << ": rows " << first_row << " to "
+                          << first_row + column.size() - 1 << std::endl;
+            }
+        }
+    };
+};
+
+TEST_F(BatchJournalTest, SegmentsReassembleToFullRun) {
+    BioCro::Batch_journal journal {journal_path};
+    EXPECT_EQ(BioCro::run_batch(jobs, journal, 10, sink), jobs.size());
+
+    for (auto& job : jobs) {
+        EXPECT_TRUE(journal.is_finished(job.id));
+        BioCro::Simulation_result full =
+            BioCro::make_simulator(job.scenario).run_simulation();
+        ASSERT_EQ(positions[job.id].size(), number_of_rows);
+        for (size_t row = 0; row < number_of_rows; ++row) {
+            EXPECT_NEAR(positions[job.id][row], full.at("position")[row], 1e-12);
+        }
+    }
+}
+
+// After a crash in the middle of the second job, a restarted batch
+// skips the first job, resumes the second from its last checkpoint,
+// and produces the same results as an uninterrupted batch.
+TEST_F(BatchJournalTest, RestartedBatchResumes) {
+    crash_after = 4; // segments 1-3 belong to job 0; segment 4 to job 1
+    {
+        BioCro::Batch_journal journal {journal_path};
+        EXPECT_THROW(BioCro::run_batch(jobs, journal, 10, sink), Simulated_crash);
+    }
+
+    crash_after = 0;
+    segments_received = 0;
+    BioCro::Batch_journal reopened {journal_path};
+    EXPECT_TRUE(reopened.is_finished(jobs[0].id));
+    ASSERT_TRUE(reopened.has_checkpoint(jobs[1].id));
+    EXPECT_EQ(reopened.get_checkpoint(jobs[1].id).row, 10);
+    EXPECT_FALSE(reopened.has_checkpoint(jobs[2].id));
+
+    EXPECT_EQ(BioCro::run_batch(jobs, reopened, 10, sink), 2);
+    // Job 1 needs only its last two segments; job 2 needs all three.
+    EXPECT_EQ(segments_received, 5);
+
+    for (auto& job : jobs) {
+        BioCro::Simulation_result full =
+            BioCro::make_simulator(job.scenario).run_simulation();
+        ASSERT_EQ(positions[job.id].size(), number_of_rows);
+        for (size_t row = 0; row < number_of_rows; ++row) {
+            EXPECT_NEAR(positions[job.id][row], full.at("position")[row], 1e-12);
+        }
+    }
+}
+
+// A truncated final record, as might be left by a crash during a
+// write, is ignored, even if what remains of it looks complete.
+TEST_F(BatchJournalTest, TruncatedRecordIsIgnored) {
+    {
+        BioCro::Batch_journal journal {journal_path};
+        journal.record_checkpoint("job", 10, { {"position", 0.25}, {"velocity", -1} });
+    }
+    {
+        std::ofstream file(journal_path, std::ios::app);
+        file << "checkpoint job 20 2 position 0.5 velocity -0.7";
+    }
+    BioCro::Batch_journal journal {journal_path};
+    ASSERT_TRUE(journal.has_checkpoint("job"));
+    EXPECT_EQ(journal.get_checkpoint("job").row, 10);
+    EXPECT_EQ(journal.get_checkpoint("job").state.at("position"), 0.25);
+}
+
+// Records written after a truncated record don't run into it.
+TEST_F(BatchJournalTest, RecordsAfterTruncatedRecordAreKept) {
+    {
+        BioCro::Batch_journal journal {journal_path};
+        journal.record_finished("first");
+    }
+    {
+        std::ofstream file(journal_path, std::ios::app);
+        file << "checkpoint second 20 2 posi";
+    }
+    {
+        BioCro::Batch_journal journal {journal_path};
+
+        // The partial record has been cut off in place.
+        std::ifstream file(journal_path);
+        std::ostringstream contents;
+        contents << file.rdbuf();
+        EXPECT_EQ(contents.str(), "done first\n");
+
+        journal.record_finished("second");
+    }
+    BioCro::Batch_journal journal {journal_path};
+    EXPECT_TRUE(journal.is_finished("first"));
+    EXPECT_TRUE(journal.is_finished("second"));
+    EXPECT_FALSE(journal.has_checkpoint("second"));
+}
+
+TEST_F(BatchJournalTest, BadJobIdIsRejected) {
+    BioCro::Batch_journal journal {journal_path};
+    EXPECT_THROW(journal.record_finished("two words"), std::invalid_argument);
+    EXPECT_THROW(journal.record_finished(""), std::invalid_argument);
+}
@@ -0,0 +1,127 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <iostream>
+
+#include "batch_planner.h"
+#include "expression_module.h"
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+/*
+ * A mixed batch: oscillators differing in mass, solved with two
+ * different fixed-step solver settings, and pools differing in their
+ * inputs, solved with an adaptive solver.
+ */
+class BatchPlannerTest : public ::testing::Test {
+   protected:
+    BioCro::Expression_module_creator pools {
+        "pools", "fast = input - 0.5 * fast\nslow = 0.1 * fast - 0.01 * slow", true};
+
+    std::vector<BioCro::Batch_job> get_jobs() {
+        std::vector<BioCro::Batch_job> jobs;
+        for (size_t j = 0; j < 30; ++j) {
+            std::string id = "job" + std::to_string(j);
+            if (j % 3 == 2) {
+                jobs.push_back({id,
+                                {{{"fast", 0}, {"slow", 1.0 * j}},
+                                 {{"timestep", 1}},
+                                 {{"input", std::vector<double>(100, 0.1 * j)}},
+                                 {},
+                                 {&pools},
+                                 {"boost_rosenbrock", 1, 1e-6, 1e-6, 200}}});
+            } else {
+                jobs.push_back({id,
+                                {{{"position", 0}, {"velocity", 1}},
+                                 {{"timestep", 1}, {"mass", 5.0 + j}, {"spring_constant", 0.1}},
+                                 {{"time", std::vector<double>(100, 0)}},
+                                 {Module_factory::retrieve("harmonic_energy")},
+                                 {Module_factory::retrieve("harmonic_oscillator")},
+                                 {j % 3 == 0 ? "boost_rk4" : "boost_euler", 1, 1e-4, 1e-4, 200}}});
+            }
+        }
+        return jobs;
+    }
+};
+
+TEST_F(BatchPlannerTest, GroupsJobsBySignature) {
+    std::vector<BioCro::Batch_job> jobs = get_jobs();
+    BioCro::Batch_planner_settings settings;
+    settings.lockstep_size = 4;
+    BioCro::Batch_planner planner {jobs, settings};
+
+    auto& groups = planner.get_groups();
+    ASSERT_EQ(groups.size(), 3);
+    EXPECT_EQ(groups[0].jobs, (std::vector<size_t> {0, 3, 6, 9, 12, 15, 18, 21, 24, 27}));
+    EXPECT_TRUE(groups[0].lockstep);   // boost_rk4
+    EXPECT_TRUE(groups[1].lockstep);   // boost_euler
+    EXPECT_FALSE(groups[2].lockstep);  // adaptive
+    // Two groups of ten in chunks of four, and ten separate jobs.
+    EXPECT_EQ(planner.get_number_of_tasks(), 3 + 3 + 10);
+
+    EXPECT_EQ(BioCro::get_system_signature(jobs[0].scenario),
+              BioCro::get_system_signature(jobs[3].scenario));
+    jobs[3].scenario.parameters["timestep"] = 2;
+    EXPECT_NE(BioCro::get_system_signature(jobs[0].scenario),
+              BioCro::get_system_signature(jobs[3].scenario));
+}
+
+TEST_F(BatchPlannerTest, MatchesSeparateSimulations) {
+    std::vector<BioCro::Batch_job> jobs = get_jobs();
+    BioCro::Batch_planner_settings settings;
+    settings.number_of_threads = 4;
+    settings.lockstep_size = 4;
+    std::vector<BioCro::Simulation_result> results = BioCro::Batch_planner{jobs, settings}.run();
+
+    ASSERT_EQ(results.size(), jobs.size());
+    for (size_t j = 0; j < jobs.size(); ++j) {
+        BioCro::Simulation_result expected = BioCro::make_simulator(jobs[j].scenario).run_simulation();
+        ASSERT_EQ(results[j].size(), expected.size()) << jobs[j].id;
+        for (auto& column : expected) {
+            auto& values = results[j].at(column.first);
+            ASSERT_EQ(values.size(), column.second.size());
+            for (size_t row = 0; row < values.size(); ++row) {
+                EXPECT_NEAR(values[row], column.second[row], 1e-12)
+                    << column.first << " of " << jobs[j].id << " at row " << row;
+            }
+        }
+    }
+}
+
+TEST_F(BatchPlannerTest, ValidatesEachGroupOnce) {
+    std::vector<BioCro::Batch_job> jobs = get_jobs();
+    jobs[4].scenario.parameters.erase("mass");
+    jobs[7].scenario.parameters.erase("mass");
+    try {
+        BioCro::Batch_planner planner {jobs};
+        FAIL() << "An invalid job was accepted.";
+    } catch (std::invalid_argument const& e) {
+        EXPECT_NE(std::string(e.what()).find("\"job4\" and 1 others"), std::string::npos)
+            << e.what();
+    }
+}
+
+TEST_F(BatchPlannerTest, TimesLockstepSizes) {
+    if (!VERBOSE) return;
+
+    std::vector<BioCro::Batch_job> jobs;
+    for (auto& job : get_jobs()) {
+        if (job.scenario.solver_settings.ode_solver_name == "boost_rk4") {
+            for (size_t copy = 0; copy < 50; ++copy) jobs.push_back(job);
+        }
+    }
+    for (size_t lockstep_size : {1, 4, 16, 64}) {
+        BioCro::Batch_planner_settings settings;
+        settings.lockstep_size = lockstep_size;
+        auto start = std::chrono::steady_clock::now();
+        BioCro::Batch_planner{jobs, settings}.run();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << jobs.size() << " jobs in lockstep groups of " << lockstep_size << ": "
+                  << elapsed.count() << " s" << std::endl;
+    }
+}
@@ -0,0 +1,143 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "cooperative_simulation.h"
+#include "print_result.h"
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+/*
+ * Here many harmonic oscillators, differing in mass, are run
+ * cooperatively on one thread, and the pieces of each result are
+ * reassembled and compared with an uninterrupted run.
+ */
+class CooperativeSimulationTest : public ::testing::Test {
+   protected:
+    const size_t number_of_rows {50};
+
+    BioCro::Scenario get_scenario(double mass) {
+        return BioCro::Scenario {
+            { {"position", 0}, {"velocity", 1} },
+            { {"mass", mass}, {"spring_constant", 0.1}, {"timestep", 1} },
+            { {"time", get_times(0, number_of_rows)} },
+            {Module_factory::retrieve("harmonic_energy")},
+            {Module_factory::retrieve("harmonic_oscillator")},
+            {"boost_rk4", 1, 0.0001, 0.0001, 200}
+        };
+    }
+
+    static std::vector<double> get_times(size_t first, size_t count) {
+        std::vector<double> times(count);
+        for (size_t i = 0; i < count; ++i) times[i] = first + i;
+        return times;
+    }
+
+    // Makes a consumer that appends each segment to `result` and
+    // checks that segments arrive in order.
+    BioCro::Segment_consumer append_to(BioCro::Simulation_result& result) {
+        return [&result](size_t first_row, BioCro::Simulation_result const& segment) {
+            size_t rows = result.empty() ? 0 : result.begin()->second.size();
+            EXPECT_EQ(first_row, rows);
+            for (auto& column : segment) {
+                auto& values = result[column.first];
+                values.insert(values.end(), column.second.begin(), column.second.end());
+            }
+            return true;
+        };
+    }
+
+    void expect_same(BioCro::Simulation_result const& result,
+                     BioCro::Simulation_result const& expected) {
+        ASSERT_EQ(BioCro::keys(result), BioCro::keys(expected));
+        for (auto& item : expected) {
+            ASSERT_EQ(result.at(item.first).size(), item.second.size()) << item.first;
+            for (size_t i = 0; i < item.second.size(); ++i) {
+                EXPECT_NEAR(result.at(item.first)[i], item.second[i], 1e-12)
+                    << "Quantity " << item.first << " differs at row " << i;
+            }
+        }
+    }
+};
+
+TEST_F(CooperativeSimulationTest, InterleavedRunsMatchUninterruptedRuns) {
+    const size_t number_of_simulations {200};
+    std::vector<BioCro::Simulation_result> results(number_of_simulations);
+    BioCro::Cooperative_scheduler scheduler;
+    for (size_t i = 0; i < number_of_simulations; ++i) {
+        scheduler.add(std::unique_ptr<BioCro::Cooperative_simulation>(
+            new BioCro::Cooperative_simulation(get_scenario(5 + i), 7, append_to(results[i]))));
+    }
+
+    size_t finished {0};
+    scheduler.run([&finished](BioCro::Cooperative_simulation& simulation) {
+        EXPECT_TRUE(simulation.is_finished());
+        ++finished;
+    });
+    EXPECT_EQ(finished, number_of_simulations);
+
+    for (size_t i = 0; i < number_of_simulations; i += 37) {
+        expect_same(results[i], make_simulator(get_scenario(5 + i)).run_simulation());
+    }
+    if (VERBOSE) print_result(results[0]);
+}
+
+// Simulations wait for driver rows that haven't arrived yet.
+TEST_F(CooperativeSimulationTest, WaitsForStreamedDrivers) {
+    BioCro::Cooperative_scheduler scheduler;
+    auto drivers = std::make_shared<BioCro::Streamed_drivers>(
+        BioCro::Variable_names{"time"}, &scheduler.get_wakeup());
+
+    BioCro::Scenario scenario = get_scenario(10);
+    BioCro::Simulation_result expected = make_simulator(scenario).run_simulation();
+    scenario.drivers.clear();
+
+    std::vector<BioCro::Simulation_result> results(3);
+    for (auto& result : results) {
+        scheduler.add(std::unique_ptr<BioCro::Cooperative_simulation>(
+            new BioCro::Cooperative_simulation(scenario, drivers, 5, append_to(result))));
+    }
+
+    // Nothing can be done before any drivers arrive.
+    EXPECT_FALSE(scheduler.run_pass());
+
+    std::thread producer([&] {
+        for (size_t first = 0; first < number_of_rows; first += 3) {
+            size_t count = std::min<size_t>(3, number_of_rows - first);
+            drivers->append({ {"time", get_times(first, count)} });
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        drivers->close();
+    });
+    scheduler.run();
+    producer.join();
+
+    for (auto& result : results) expect_same(result, expected);
+}
+
+// A consumer that can't keep up makes its simulation wait, and no
+// segment is lost or repeated.
+TEST_F(CooperativeSimulationTest, ConsumerBackpressure) {
+    BioCro::Simulation_result result;
+    BioCro::Segment_consumer store = append_to(result);
+    size_t offers {0};
+    BioCro::Segment_consumer reluctant =
+        [&](size_t first_row, BioCro::Simulation_result const& segment) {
+            // Take only every third offer.
+            if (++offers % 3 != 0) return false;
+            return store(first_row, segment);
+        };
+
+    BioCro::Cooperative_simulation simulation {get_scenario(10), 10, reluctant};
+    size_t waits {0};
+    while (!simulation.is_finished()) {
+        if (simulation.resume() == BioCro::Step_status::waiting) ++waits;
+    }
+    EXPECT_GT(waits, 0);
+    expect_same(result, make_simulator(get_scenario(10)).run_simulation());
+}
@@ -0,0 +1,99 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include "direct_evaluation.h"
+#include "expression_module.h"
+#include "print_result.h"
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+// The direct outputs of a simulation can be recomputed from its
+// differential quantities alone.
+TEST(DirectEvaluationTest, MatchesSimulatorOutputs) {
+    BioCro::Parameter_set parameters {{"mass", 10}, {"spring_constant", 0.1}, {"timestep", 1}};
+    BioCro::Module_set direct_modules {Module_factory::retrieve("harmonic_energy")};
+    BioCro::Simulator simulator {
+        { {"position", 0}, {"velocity", 1} },
+        parameters,
+        { {"time", std::vector<double>(100, 0)} },
+        direct_modules,
+        {Module_factory::retrieve("harmonic_oscillator")},
+        "boost_rk4",
+        1,
+        0.0001,
+        0.0001,
+        200
+    };
+    BioCro::Simulation_result expected = simulator.run_simulation();
+
+    BioCro::System_drivers drivers {
+        {"position", expected.at("position")},
+        {"velocity", expected.at("velocity")}
+    };
+    BioCro::Simulation_result result =
+        BioCro::evaluate_direct_modules(parameters, drivers, direct_modules);
+
+    if (VERBOSE) print_result(result);
+    for (auto& name : {"kinetic_energy", "spring_energy", "total_energy", "position"}) {
+        EXPECT_EQ(result.at(name), expected.at(name)) << name;
+    }
+    EXPECT_EQ(result.size(), 5);
+}
+
+TEST(DirectEvaluationTest, EvaluatesSolarPositionOverDrivers) {
+    BioCro::Parameter_set site {{"lat", 40.0932}, {"longitude", -88.20175},
+                                {"time_zone_offset", -6}, {"year", 2023}};
+    std::vector<double> times;
+    for (int hour = 0; hour < 365 * 24; ++hour) times.push_back(1 + hour / 24.0);
+
+    BioCro::Module_creator solar = Module_factory::retrieve("solar_position_michalsky");
+    BioCro::Direct_evaluator evaluator {site, {solar}};
+    EXPECT_EQ(evaluator.get_required_drivers(), BioCro::Variable_names({"time"}));
+    BioCro::Simulation_result result = evaluator.evaluate({{"time", times}});
+
+    BioCro::Variable_settings quantities = site;
+    quantities["time"] = 0;
+    for (auto& name : solar->get_outputs()) quantities[name] = 0;
+    BioCro::Module module = solar->create_module(quantities, &quantities);
+    for (size_t row = 0; row < times.size(); row += 97) {
+        quantities["time"] = times[row];
+        module->run();
+        for (auto& name : solar->get_outputs()) {
+            ASSERT_EQ(result.at(name)[row], quantities.at(name)) << name << " at row " << row;
+        }
+    }
+
+    // Dividing the rows among threads changes nothing.
+    BioCro::Direct_evaluator parallel_evaluator {site, {solar}, 4};
+    EXPECT_EQ(parallel_evaluator.evaluate({{"time", times}}), result);
+}
+
+// Modules are evaluated in dependency order, whatever order they are
+// given in.
+TEST(DirectEvaluationTest, OrdersModules) {
+    BioCro::Expression_module_creator doubled {"doubled", "b = 2 * a"};
+    BioCro::Expression_module_creator shifted {"shifted", "c = b + offset"};
+    BioCro::Simulation_result result = BioCro::evaluate_direct_modules(
+        {{"offset", 1}}, {{"a", {1, 2, 3}}}, {&shifted, &doubled}, 2);
+    EXPECT_EQ(result.at("b"), std::vector<double>({2, 4, 6}));
+    EXPECT_EQ(result.at("c"), std::vector<double>({3, 5, 7}));
+}
+
+TEST(DirectEvaluationTest, ChecksQuantities) {
+    BioCro::Expression_module_creator doubled {"doubled", "b = 2 * a"};
+    BioCro::Direct_evaluator evaluator {{{"offset", 1}}, {&doubled}};
+
+    EXPECT_THROW(evaluator.evaluate({{"time", {0, 1}}}), std::invalid_argument);
+    EXPECT_THROW(evaluator.evaluate({{"a", {0, 1}}, {"offset", {0, 1}}}), std::invalid_argument);
+    EXPECT_THROW(evaluator.evaluate({{"a", {0, 1}}, {"b", {0, 1}}}), std::invalid_argument);
+    EXPECT_THROW(evaluator.evaluate({{"a", {0, 1}}, {"time", {0}}}), std::invalid_argument);
+    EXPECT_THROW(evaluator.evaluate({}), std::invalid_argument);
+    EXPECT_THROW(BioCro::Direct_evaluator({{"b", 1}}, {&doubled}), std::invalid_argument);
+
+    // No rows, no results.
+    EXPECT_EQ(evaluator.evaluate({{"a", {}}}).at("b").size(), 0);
+}
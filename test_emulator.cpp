@@ -0,0 +1,183 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include "emulator.h"
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+TEST(GaussianProcessTest, InterpolatesSmoothFunctions) {
+    std::vector<double> inputs;
+    std::vector<double> values;
+    for (int i = 0; i <= 10; ++i) {
+        inputs.push_back(i / 10.0);
+        values.push_back(std::sin(3 * i / 10.0));
+    }
+    BioCro::Gaussian_process process {inputs, 1, values};
+
+    double mean, standard_deviation;
+    for (int i = 0; i <= 10; ++i) {
+        double x = i / 10.0;
+        process.predict(&x, mean, standard_deviation);
+        EXPECT_NEAR(mean, values[i], 1e-4);
+        EXPECT_LT(standard_deviation, 1e-3);
+    }
+    for (double x = 0.05; x < 1; x += 0.1) {
+        process.predict(&x, mean, standard_deviation);
+        EXPECT_NEAR(mean, std::sin(3 * x), 1e-3);
+        EXPECT_NEAR(mean, std::sin(3 * x), 3 * standard_deviation + 1e-6);
+    }
+
+    // Far from the data, the prediction reverts to the mean with the
+    // full uncertainty.
+    double far {5.0};
+    double sd_near;
+    double near {0.55};
+    process.predict(&near, mean, sd_near);
+    process.predict(&far, mean, standard_deviation);
+    EXPECT_GT(standard_deviation, 100 * sd_near);
+}
+
+TEST(GaussianProcessTest, HandlesConstantValues) {
+    BioCro::Gaussian_process process {{0, 0.5, 1}, 1, {2, 2, 2}};
+    double x {0.3}, mean, standard_deviation;
+    process.predict(&x, mean, standard_deviation);
+    EXPECT_DOUBLE_EQ(mean, 2);
+    EXPECT_EQ(standard_deviation, 0);
+
+    EXPECT_THROW(BioCro::Gaussian_process({0, 1}, 1, {1}), std::invalid_argument);
+}
+
+/*
+ * An emulator of the final position and peak kinetic energy of a
+ * harmonic oscillator, as functions of its mass and spring constant.
+ */
+class EmulatorTest : public ::testing::Test {
+   protected:
+    BioCro::Ensemble_simulator get_training_ensemble() {
+        BioCro::Ensemble_parameters parameters {
+            { {"mass", 10}, {"spring_constant", 0.1}, {"timestep", 1} },
+            {"mass", "spring_constant"}
+        };
+        for (int i = 0; i < 7; ++i) {
+            for (int j = 0; j < 7; ++j) {
+                parameters.add_member({5 + 10 * i / 6.0, 0.05 + 0.15 * j / 6.0});
+            }
+        }
+        return BioCro::Ensemble_simulator {
+            { {"position", 0}, {"velocity", 1} },
+            parameters,
+            { {"time", std::vector<double>(20, 0)} },
+            {Module_factory::retrieve("harmonic_energy")},
+            {Module_factory::retrieve("harmonic_oscillator")},
+            "boost_rk4",
+            1,
+            0.0001,
+            0.0001,
+            200
+        };
+    }
+
+    BioCro::Ensemble_statistics statistics {
+        {"final_position",
+         [](BioCro::Simulation_result const& r) { return r.at("position").back(); }},
+        {"peak_kinetic_energy",
+         [](BioCro::Simulation_result const& r) {
+             auto& energy = r.at("kinetic_energy");
+             return *std::max_element(energy.begin(), energy.end());
+         }}
+    };
+
+    // Simulates one point directly.
+    BioCro::Emulated_statistics simulate(double mass, double spring_constant) {
+        BioCro::Ensemble_simulator ensemble = get_training_ensemble();
+        size_t member = ensemble.size();
+        ensemble.add_member({mass, spring_constant});
+        BioCro::Simulation_result result = ensemble.run_member(member);
+        BioCro::Emulated_statistics answers;
+        for (auto& statistic : statistics) {
+            answers[statistic.first] = {statistic.second(result), 0, false};
+        }
+        return answers;
+    }
+};
+
+TEST_F(EmulatorTest, PredictsWithinUncertainty) {
+    BioCro::Emulator_settings settings;
+    settings.number_of_threads = 2;
+    BioCro::Simulation_emulator emulator {get_training_ensemble(), statistics, settings};
+    EXPECT_EQ(emulator.get_number_of_training_members(), 49);
+
+    for (double mass : {6.1, 9.3, 13.7}) {
+        for (double spring_constant : {0.06, 0.111, 0.19}) {
+            ASSERT_TRUE(emulator.in_domain({mass, spring_constant}));
+            BioCro::Emulated_statistics predicted = emulator.query({mass, spring_constant});
+            BioCro::Emulated_statistics actual = simulate(mass, spring_constant);
+            for (auto& p : predicted) {
+                EXPECT_TRUE(p.second.emulated);
+                double truth = actual.at(p.first).mean;
+                EXPECT_NEAR(p.second.mean, truth, 0.02 * std::fabs(truth) + 1e-3)
+                    << p.first << " at mass " << mass << ", k " << spring_constant;
+                EXPECT_NEAR(p.second.mean, truth, 4 * p.second.standard_deviation + 1e-4)
+                    << p.first << " at mass " << mass << ", k " << spring_constant;
+            }
+        }
+    }
+
+    if (VERBOSE) {
+        using clock = std::chrono::steady_clock;
+        const int queries {10000};
+        auto start = clock::now();
+        for (int i = 0; i < queries; ++i) emulator.query({6 + (i % 90) * 0.1, 0.1});
+        double seconds = std::chrono::duration<double>(clock::now() - start).count();
+        std::cout << 1e6 * seconds / queries << " microseconds per query" << std::endl;
+    }
+}
+
+TEST_F(EmulatorTest, FallsBackToSimulation) {
+    BioCro::Simulation_emulator emulator {get_training_ensemble(), statistics};
+
+    // Outside the trained domain.
+    EXPECT_FALSE(emulator.in_domain({20, 0.1}));
+    BioCro::Emulated_statistics answer = emulator.query({20, 0.1});
+    BioCro::Emulated_statistics actual = simulate(20, 0.1);
+    for (auto& a : answer) {
+        EXPECT_FALSE(a.second.emulated);
+        EXPECT_EQ(a.second.standard_deviation, 0);
+        EXPECT_EQ(a.second.mean, actual.at(a.first).mean);
+    }
+    // The emulator alone still predicts, with greater uncertainty.
+    EXPECT_TRUE(emulator.predict({20, 0.1}).at("final_position").emulated);
+
+    // Too uncertain.
+    BioCro::Emulator_settings strict;
+    strict.maximum_standard_deviation = 0;
+    BioCro::Simulation_emulator strict_emulator {get_training_ensemble(), statistics, strict};
+    EXPECT_FALSE(strict_emulator.query({9.3, 0.111}).at("final_position").emulated);
+
+    EXPECT_THROW(emulator.query({9.3}), std::invalid_argument);
+}
+
+TEST_F(EmulatorTest, LearnsFromSimulations) {
+    BioCro::Emulator_settings settings;
+    settings.learn_from_simulations = true;
+    BioCro::Simulation_emulator emulator {get_training_ensemble(), statistics, settings};
+
+    emulator.query({20, 0.1});
+    EXPECT_EQ(emulator.get_number_of_training_members(), 50);
+    EXPECT_TRUE(emulator.in_domain({18, 0.1}));
+
+    // The new member is now reproduced by the emulator.
+    BioCro::Emulated_statistics answer = emulator.query({20, 0.1});
+    EXPECT_TRUE(answer.at("final_position").emulated);
+    EXPECT_NEAR(answer.at("final_position").mean, simulate(20, 0.1).at("final_position").mean,
+                1e-4);
+}
@@ -0,0 +1,161 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <limits>
+
+#include "ensemble.h"
+#include "print_result.h"
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+/*
+ * Here we test Ensemble_parameters and Ensemble_simulator.  The
+ * members of the ensemble are harmonic oscillators that share a base
+ * parameter set but differ in mass and spring constant.
+ */
+class EnsembleTest : public ::testing::Test {
+   protected:
+    EnsembleTest() {
+        ensemble_parameters.add_member({10, 0.1});
+        ensemble_parameters.add_member({20, 0.1});
+        ensemble_parameters.add_member({20, 0.4});
+    }
+
+    BioCro::State initial_state { {"position", 0}, {"velocity", 1} };
+    BioCro::Parameter_set base_parameters
+        { {"mass", 10}, {"spring_constant", 0.1}, {"timestep", 1} };
+    BioCro::Ensemble_parameters ensemble_parameters
+        { base_parameters, {"mass", "spring_constant"} };
+    BioCro::System_drivers drivers
+        { {"time",  { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 }} };
+    BioCro::Module_set direct_modules {};
+    BioCro::Module_set differential_modules
+        { Module_factory::retrieve("harmonic_oscillator") };
+
+    BioCro::Ensemble_simulator get_ensemble_simulator() {
+        return BioCro::Ensemble_simulator {
+            initial_state,
+            ensemble_parameters,
+            drivers,
+            direct_modules,
+            differential_modules,
+            "boost_rk4",
+            1,
+            0.0001,
+            0.0001,
+            200
+        };
+    }
+};
+
+TEST_F(EnsembleTest, MemberParametersAreResolved) {
+    ASSERT_EQ(ensemble_parameters.size(), 3);
+
+    BioCro::Parameter_set member_2 = ensemble_parameters.get_member_parameters(2);
+    EXPECT_EQ(member_2.size(), base_parameters.size());
+    EXPECT_DOUBLE_EQ(member_2.at("mass"), 20);
+    EXPECT_DOUBLE_EQ(member_2.at("spring_constant"), 0.4);
+    EXPECT_DOUBLE_EQ(member_2.at("timestep"), 1);
+
+    // Resolving one member after another into the same scratch
+    // parameter set leaves no trace of the earlier member.
+    BioCro::Parameter_set scratch {ensemble_parameters.get_base()};
+    ensemble_parameters.resolve(2, scratch);
+    ensemble_parameters.resolve(0, scratch);
+    EXPECT_EQ(scratch, ensemble_parameters.get_member_parameters(0));
+}
+
+TEST_F(EnsembleTest, CopiesShareTheBase) {
+    BioCro::Ensemble_parameters copy {ensemble_parameters};
+    EXPECT_EQ(&copy.get_base(), &ensemble_parameters.get_base());
+}
+
+TEST_F(EnsembleTest, BadOverridesAreRejected) {
+    EXPECT_THROW(ensemble_parameters.add_member({1}), std::invalid_argument);
+    EXPECT_THROW(BioCro::Ensemble_parameters(base_parameters, {"mass", "mass"}),
+                 std::invalid_argument);
+    EXPECT_THROW(ensemble_parameters.get_member_parameters(3), std::out_of_range);
+
+    // A column past the last override name would otherwise read the
+    // next member's first override.
+    EXPECT_DOUBLE_EQ(ensemble_parameters.get_override(1, 1), 0.1);
+    EXPECT_THROW(ensemble_parameters.get_override(0, 2), std::out_of_range);
+    EXPECT_THROW(ensemble_parameters.get_override(3, 0), std::out_of_range);
+}
+
+// Each member's result should be identical to the result of a
+// Simulator constructed from that member's full parameter set.
+TEST_F(EnsembleTest, MembersMatchIndividualSimulations) {
+    BioCro::Ensemble_simulator ensemble = get_ensemble_simulator();
+    std::vector<BioCro::Simulation_result> results = ensemble.run_simulation();
+
+    ASSERT_EQ(results.size(), ensemble_parameters.size());
+
+    for (size_t member = 0; member < results.size(); ++member) {
+        BioCro::Simulator sim {
+            initial_state,
+            ensemble_parameters.get_member_parameters(member),
+            drivers,
+            direct_modules,
+            differential_modules,
+            "boost_rk4",
+            1,
+            0.0001,
+            0.0001,
+            200
+        };
+        BioCro::Simulation_result expected = sim.run_simulation();
+
+        if (VERBOSE) print_result(results[member]);
+
+        for (auto& item : expected) {
+            EXPECT_EQ(results[member].at(item.first), item.second)
+                << "Quantity " << item.first << " differs for member " << member;
+        }
+    }
+}
+
+// Rerunning a member gives the same result as the first run.
+TEST_F(EnsembleTest, RunsAreIdempotent) {
+    BioCro::Ensemble_simulator ensemble = get_ensemble_simulator();
+    BioCro::Simulation_result first = ensemble.run_member(1);
+    ensemble.run_member(2);
+    BioCro::Simulation_result second = ensemble.run_member(1);
+    EXPECT_EQ(first, second);
+}
+
+// Members with identical override values are recognized as
+// duplicates.  Values that compare equal but may behave differently,
+// such as 0.0 and -0.0, are not merged.
+TEST_F(EnsembleTest, DuplicateMembersAreFound) {
+    double const nan = std::numeric_limits<double>::quiet_NaN();
+    ensemble_parameters.add_member({20, 0.1});  // same as member 1
+    ensemble_parameters.add_member({10, 0.1});  // same as member 0
+    ensemble_parameters.add_member({5, 0.0});
+    ensemble_parameters.add_member({5, -0.0});
+    ensemble_parameters.add_member({nan, 0.1});
+    ensemble_parameters.add_member({nan, 0.1});  // same as member 7
+
+    std::vector<size_t> expected {0, 1, 2, 1, 0, 5, 6, 7, 7};
+    EXPECT_EQ(ensemble_parameters.get_representatives(), expected);
+}
+
+// Duplicate members share a single result object, and every member's
+// result matches the result of running that member on its own.
+TEST_F(EnsembleTest, DuplicateMembersShareResults) {
+    ensemble_parameters.add_member({20, 0.1});  // same as member 1
+    BioCro::Ensemble_simulator ensemble = get_ensemble_simulator();
+
+    BioCro::Ensemble_result results = ensemble.run_unique_simulations();
+
+    ASSERT_EQ(results.size(), 4);
+    EXPECT_EQ(results[3], results[1]);
+    EXPECT_NE(results[2], results[1]);
+    for (size_t member = 0; member < results.size(); ++member) {
+        EXPECT_EQ(*results[member], ensemble.run_member(member));
+    }
+}
@@ -0,0 +1,140 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "exponential_propagation.h"
+#include "expression_module.h"
+#include "stiffness_switching.h"
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+TEST(MatrixExponentialTest, MatchesKnownExponentials) {
+    // exp([[0, t], [-t, 0]]) is a rotation.
+    double t {7.5};
+    std::vector<double> rotation = BioCro::matrix_exponential({0, t, -t, 0}, 2);
+    EXPECT_NEAR(rotation[0], std::cos(t), 1e-13);
+    EXPECT_NEAR(rotation[1], std::sin(t), 1e-13);
+    EXPECT_NEAR(rotation[2], -std::sin(t), 1e-13);
+    EXPECT_NEAR(rotation[3], std::cos(t), 1e-13);
+
+    // exp([[a, 1], [0, a]]) = exp(a) [[1, 1], [0, 1]].
+    std::vector<double> jordan = BioCro::matrix_exponential({-3, 1, 0, -3}, 2);
+    EXPECT_NEAR(jordan[0], std::exp(-3), 1e-15);
+    EXPECT_NEAR(jordan[1], std::exp(-3), 1e-15);
+    EXPECT_EQ(jordan[2], 0);
+
+    EXPECT_EQ(BioCro::matrix_exponential({0}, 1)[0], 1);
+}
+
+// A harmonic oscillator is linear, so it is solved exactly at one step
+// per row, where the classical Runge-Kutta method is not.
+TEST(ExponentialIntegratorTest, SolvesLinearSystemsExactly) {
+    BioCro::Scenario oscillator {
+        { {"position", 0}, {"velocity", 1} },
+        { {"mass", 10}, {"spring_constant", 0.4}, {"timestep", 1} },
+        { {"time", std::vector<double>(1000, 0)} },
+        {Module_factory::retrieve("harmonic_energy")},
+        {Module_factory::retrieve("harmonic_oscillator")},
+        {"boost_rk4", 1, 0.0001, 0.0001, 200}
+    };
+    BioCro::Exponential_integrator integrator;
+    BioCro::Simulation_result result = integrator.integrate(oscillator);
+
+    auto& subsystem = integrator.get_linear_subsystem();
+    EXPECT_EQ(subsystem.names.size(), 2);
+    EXPECT_EQ(integrator.get_cache_size(), 1);
+
+    // position = sin(w t) / w and velocity = cos(w t), with w = 0.2.
+    BioCro::Simulation_result rk4 = BioCro::make_simulator(oscillator).run_simulation();
+    double rk4_error {0.0};
+    for (size_t row = 0; row < 1000; ++row) {
+        ASSERT_NEAR(result.at("position")[row], 5 * std::sin(0.2 * row), 1e-9);
+        ASSERT_NEAR(result.at("velocity")[row], std::cos(0.2 * row), 1e-10);
+        rk4_error = std::max(rk4_error,
+                             std::fabs(rk4.at("position")[row] - 5 * std::sin(0.2 * row)));
+    }
+    EXPECT_NEAR(result.at("total_energy")[999], 5, 1e-9);
+    if (VERBOSE) std::cout << "largest RK4 position error: " << rk4_error << std::endl;
+    EXPECT_GT(rk4_error, 1e-4);
+
+    // Zero steps per row would leave the state where it started.
+    BioCro::Exponential_settings settings;
+    settings.steps_per_row = 0;
+    EXPECT_THROW(BioCro::Exponential_integrator{settings}.integrate(oscillator),
+                 std::invalid_argument);
+}
+
+/*
+ * x and y are a damped linear pair with constant forcing; z depends
+ * nonlinearly on x, and w has a driver as its coefficient, so neither
+ * belongs to the linear subsystem.
+ */
+class MixedSystemTest : public ::testing::Test {
+   protected:
+    BioCro::Expression_module_creator mixed {
+        "mixed",
+        "x = -0.5 * x + y\n"
+        "y = -0.2 * y + 0.1\n"
+        "z = x * x - z\n"
+        "w = -rate * w",
+        true};
+
+    BioCro::Scenario get_scenario() {
+        std::vector<double> rate(41);
+        for (size_t row = 0; row < rate.size(); ++row) rate[row] = 0.1 + 0.01 * row;
+        return BioCro::Scenario {
+            { {"x", 1}, {"y", 2}, {"z", 0}, {"w", 1} },
+            { {"timestep", 1} },
+            { {"rate", rate} },
+            {},
+            {&mixed},
+            {}
+        };
+    }
+};
+
+TEST_F(MixedSystemTest, FindsLinearSubsystem) {
+    BioCro::Scenario scenario = get_scenario();
+    BioCro::Linear_subsystem subsystem = BioCro::find_linear_subsystem(
+        BioCro::make_dynamical_system(scenario.initial_state, scenario.parameters,
+                                      scenario.drivers, scenario.direct_mcs,
+                                      scenario.differential_mcs));
+    ASSERT_EQ(subsystem.names.size(), 2);
+    size_t x = subsystem.names[0] == "x" ? 0 : 1;
+    size_t y = 1 - x;
+    EXPECT_EQ(subsystem.names[y], "y");
+    EXPECT_NEAR(subsystem.matrix[x * 2 + x], -0.5, 1e-9);
+    EXPECT_NEAR(subsystem.matrix[x * 2 + y], 1, 1e-9);
+    EXPECT_NEAR(subsystem.matrix[y * 2 + x], 0, 1e-9);
+    EXPECT_NEAR(subsystem.matrix[y * 2 + y], -0.2, 1e-9);
+    EXPECT_NEAR(subsystem.offset[x], 0, 1e-9);
+    EXPECT_NEAR(subsystem.offset[y], 0.1, 1e-9);
+}
+
+TEST_F(MixedSystemTest, AgreesWithAccurateSolution) {
+    BioCro::Exponential_settings settings;
+    settings.steps_per_row = 8;
+    BioCro::Exponential_integrator integrator {settings};
+    BioCro::Simulation_result result = integrator.integrate(get_scenario());
+    EXPECT_EQ(integrator.get_cache_size(), 2);  // steps of 1/8 and 1/16
+
+    BioCro::Switching_settings reference_settings;
+    reference_settings.relative_tolerance = reference_settings.absolute_tolerance = 1e-11;
+    BioCro::Simulation_result reference =
+        BioCro::Stiffness_switching_integrator{reference_settings}.integrate(get_scenario());
+
+    for (size_t row = 0; row <= 40; ++row) {
+        // y = 0.5 + 1.5 exp(-0.2 t)
+        EXPECT_NEAR(result.at("y")[row], 0.5 + 1.5 * std::exp(-0.2 * row), 1e-12);
+        EXPECT_NEAR(result.at("x")[row], reference.at("x")[row], 1e-9) << "row " << row;
+        EXPECT_NEAR(result.at("z")[row], reference.at("z")[row], 1e-5) << "row " << row;
+        EXPECT_NEAR(result.at("w")[row], reference.at("w")[row], 1e-5) << "row " << row;
+    }
+}
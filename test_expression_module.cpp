@@ -0,0 +1,191 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <clocale>
+#include <cmath>
+
+#include "expression_module.h"
+#include "print_result.h"
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+// Gets a list of names as a set, so that lists can be compared
+// without regard to order.
+BioCro::Variable_set as_set(BioCro::Variable_names const& names) {
+    return BioCro::Variable_set(names.begin(), names.end());
+}
+
+// Evaluates a direct program on a single row of named inputs.
+double evaluate_single(std::string const& source, BioCro::Variable_settings const& inputs) {
+    BioCro::Expression_program program {source};
+    std::vector<double const*> input_columns;
+    for (auto& name : program.get_inputs()) {
+        input_columns.push_back(&inputs.at(name));
+    }
+    double output;
+    double* output_columns[] {&output};
+    program.evaluate(input_columns.data(), output_columns, 1);
+    return output;
+}
+
+TEST(ExpressionProgramTest, PrecedenceAndAssociativity) {
+    EXPECT_DOUBLE_EQ(evaluate_single("y = 2 + 3 * 4 ^ 2", {}), 50);
+    EXPECT_DOUBLE_EQ(evaluate_single("y = 2 ^ 3 ^ 2", {}), 512);
+    EXPECT_DOUBLE_EQ(evaluate_single("y = -2 ^ 2", {}), -4);
+    EXPECT_DOUBLE_EQ(evaluate_single("y = 2 ^ -1", {}), 0.5);
+    EXPECT_DOUBLE_EQ(evaluate_single("y = (1 - 2) - 3", {}), -4);
+    EXPECT_DOUBLE_EQ(evaluate_single("y = 12 / 3 / 2", {}), 2);
+    EXPECT_DOUBLE_EQ(evaluate_single("y = max(x, 1e-3) + min(sqrt(4), abs(-3))",
+                                     { {"x", -1} }), 2.001);
+}
+
+TEST(ExpressionProgramTest, InputsAndOutputs) {
+    BioCro::Expression_program program {
+        "# energy of a harmonic oscillator\n"
+        "kinetic_energy = 0.5 * mass * velocity^2\n"
+        "spring_energy = 0.5 * spring_constant * position^2\n"
+        "total_energy = kinetic_energy + spring_energy"
+    };
+    EXPECT_EQ(as_set(program.get_inputs()),
+              BioCro::Variable_set({"mass", "velocity", "spring_constant", "position"}));
+    EXPECT_EQ(as_set(program.get_outputs()),
+              BioCro::Variable_set({"kinetic_energy", "spring_energy", "total_energy"}));
+}
+
+TEST(ExpressionProgramTest, SyntaxErrorsAreReported) {
+    EXPECT_THROW(BioCro::Expression_program("y = (x + 1"), std::invalid_argument);
+    EXPECT_THROW(BioCro::Expression_program("y = x +"), std::invalid_argument);
+    EXPECT_THROW(BioCro::Expression_program("y = foo(x)"), std::invalid_argument);
+    EXPECT_THROW(BioCro::Expression_program("y = x; y = 2"), std::invalid_argument);
+    EXPECT_THROW(BioCro::Expression_program("y = z; z = 1"), std::invalid_argument);
+    EXPECT_THROW(BioCro::Expression_program(""), std::invalid_argument);
+
+    // A '.' that doesn't start a number is a bad token like any other.
+    for (std::string source : {"y = .", "y = x * .", "y = .e5"}) {
+        try {
+            BioCro::Expression_program program {source};
+            ADD_FAILURE() << "no error for \"" << source << "\"";
+        } catch (std::invalid_argument const& e) {
+            EXPECT_NE(std::string(e.what()).find("expected a number, a name, or '('"),
+                      std::string::npos)
+                << e.what();
+        }
+    }
+    EXPECT_NO_THROW(BioCro::Expression_program("y = .5 + 2."));
+}
+
+// Numbers are read the same way whatever the C locale, even one whose
+// decimal point is a comma.
+TEST(ExpressionProgramTest, NumbersIgnoreTheLocale) {
+    std::string previous {std::setlocale(LC_NUMERIC, nullptr)};
+    bool found {false};
+    for (char const* name : {"de_DE.UTF-8", "de_DE.utf8", "de_DE",
+                             "fr_FR.UTF-8", "fr_FR.utf8", "fr_FR"}) {
+        if (std::setlocale(LC_NUMERIC, name)) {
+            found = true;
+            break;
+        }
+    }
+    if (!found) GTEST_SKIP() << "no locale with a decimal comma is installed";
+
+    double y = evaluate_single("y = 2.5 * x + 1e-1", { {"x", 2} });
+    std::setlocale(LC_NUMERIC, previous.c_str());
+    EXPECT_DOUBLE_EQ(y, 5.1);
+}
+
+// Evaluating many rows at once (across several blocks) gives the same
+// values as evaluating them one at a time.
+TEST(ExpressionProgramTest, BatchMatchesRowByRow) {
+    std::string source {"y = exp(-a * t) * cos(b * t) + log(1 + t^2)"};
+    BioCro::Expression_program program {source};
+
+    const size_t rows {1000};
+    std::vector<std::vector<double>> columns(program.get_inputs().size(),
+                                             std::vector<double>(rows));
+    for (size_t i = 0; i < program.get_inputs().size(); ++i) {
+        for (size_t row = 0; row < rows; ++row) {
+            columns[i][row] = 0.01 * row + i;
+        }
+    }
+    std::vector<double const*> input_columns;
+    for (auto& column : columns) input_columns.push_back(column.data());
+    std::vector<double> y(rows);
+    double* output_columns[] {y.data()};
+
+    program.evaluate(input_columns.data(), output_columns, rows);
+
+    for (size_t row = 0; row < rows; ++row) {
+        BioCro::Variable_settings inputs;
+        for (size_t i = 0; i < program.get_inputs().size(); ++i) {
+            inputs[program.get_inputs()[i]] = columns[i][row];
+        }
+        ASSERT_DOUBLE_EQ(y[row], evaluate_single(source, inputs)) << "at row " << row;
+    }
+}
+
+/*
+ * Expression modules defined at run time should reproduce the
+ * harmonic_oscillator and harmonic_energy modules of the standard
+ * module library when used in a simulation.
+ */
+class ExpressionModuleTest : public ::testing::Test {
+   protected:
+    BioCro::Expression_module_creator oscillator {
+        "expression_oscillator",
+        "position = velocity\n"
+        "velocity = -spring_constant * position / mass",
+        true
+    };
+    BioCro::Expression_module_creator energy {
+        "expression_energy",
+        "kinetic_energy = 0.5 * mass * velocity^2\n"
+        "spring_energy = 0.5 * spring_constant * position^2\n"
+        "total_energy = kinetic_energy + spring_energy"
+    };
+
+    BioCro::Simulation_result simulate(BioCro::Module_set direct_modules,
+                                       BioCro::Module_set differential_modules) {
+        BioCro::Simulator sim {
+            { {"position", 2}, {"velocity", 1} },
+            { {"mass", 10}, {"spring_constant", 0.1}, {"timestep", 1} },
+            { {"time",  { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 }} },
+            direct_modules,
+            differential_modules,
+            "boost_rk4",
+            1,
+            0.0001,
+            0.0001,
+            200
+        };
+        return sim.run_simulation();
+    }
+};
+
+TEST_F(ExpressionModuleTest, CreatorDescribesModule) {
+    EXPECT_EQ(oscillator.get_name(), "expression_oscillator");
+    EXPECT_EQ(as_set(oscillator.get_inputs()),
+              BioCro::Variable_set({"velocity", "spring_constant", "position", "mass"}));
+    EXPECT_EQ(as_set(oscillator.get_outputs()),
+              BioCro::Variable_set({"position", "velocity"}));
+}
+
+TEST_F(ExpressionModuleTest, MatchesLibraryModules) {
+    BioCro::Simulation_result expected = simulate(
+        {Module_factory::retrieve("harmonic_energy")},
+        {Module_factory::retrieve("harmonic_oscillator")});
+    BioCro::Simulation_result result = simulate({&energy}, {&oscillator});
+
+    if (VERBOSE) print_result(result);
+
+    for (auto& item : expected) {
+        ASSERT_EQ(result.at(item.first).size(), item.second.size());
+        for (size_t i = 0; i < item.second.size(); ++i) {
+            EXPECT_NEAR(result.at(item.first)[i], item.second[i], 1e-12)
+                << "Quantity " << item.first << " differs at row " << i;
+        }
+    }
+}
@@ -0,0 +1,137 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include "expression_module.h"
+#include "fast_solar_position.h"
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+TEST(FastTrigTest, SineAndCosine) {
+    for (double x = -1000; x <= 1000; x += 0.37) {
+        double s, c;
+        BioCro::fast_trig::sin_cos_degrees(x, s, c);
+        double r = x * BioCro::fast_trig::radians_per_degree;
+        ASSERT_NEAR(s, std::sin(r), 1e-14) << "at " << x << " degrees";
+        ASSERT_NEAR(c, std::cos(r), 1e-14) << "at " << x << " degrees";
+    }
+}
+
+TEST(FastTrigTest, Arctangent) {
+    const double degrees_per_radian {1 / BioCro::fast_trig::radians_per_degree};
+    for (double y = -3; y <= 3; y += 0.013) {
+        for (double x : {-2.5, -1.0, -0.3, -1e-3, 0.0, 1e-3, 0.3, 1.0, 2.5}) {
+            ASSERT_NEAR(BioCro::fast_trig::atan2_degrees(y, x),
+                        std::atan2(y, x) * degrees_per_radian, 1e-8)
+                << "at y = " << y << ", x = " << x;
+        }
+    }
+}
+
+/*
+ * The fast module is compared with the library's
+ * solar_position_michalsky module hourly over a year at several
+ * sites.
+ */
+class FastSolarPositionTest : public ::testing::Test {
+   protected:
+    BioCro::Variable_settings inputs {
+        {"lat", 0}, {"longitude", 0}, {"time", 0},
+        {"time_zone_offset", 0}, {"year", 2023}
+    };
+    BioCro::Variable_settings library_outputs;
+    BioCro::Variable_settings fast_outputs;
+    BioCro::Module library_module;
+    BioCro::Module fast_module;
+
+    FastSolarPositionTest() {
+        BioCro::Module_creator library = Module_factory::retrieve("solar_position_michalsky");
+        BioCro::Module_creator fast = BioCro::get_fast_solar_position_creator();
+        for (auto& name : library->get_outputs()) library_outputs[name] = 0;
+        for (auto& name : fast->get_outputs()) fast_outputs[name] = 0;
+        library_module = library->create_module(inputs, &library_outputs);
+        fast_module = fast->create_module(inputs, &fast_outputs);
+    }
+
+    // The difference between two angles in degrees, taking account of
+    // wrapping at ±180 degrees.
+    static double angle_difference(double a, double b) {
+        return std::remainder(a - b, 360.0);
+    }
+};
+
+TEST_F(FastSolarPositionTest, MatchesLibraryModule) {
+    for (double lat : {-60.0, 0.0, 40.0932, 70.0}) {
+        for (double longitude : {-120.0, -88.20175, 0.0, 135.0}) {
+            inputs["lat"] = lat;
+            inputs["longitude"] = longitude;
+            inputs["time_zone_offset"] = std::round(longitude / 15);
+            for (int hour = 0; hour < 365 * 24; ++hour) {
+                inputs["time"] = 1 + hour / 24.0;
+                library_module->run();
+                fast_module->run();
+                ASSERT_NEAR(fast_outputs.at("cosine_zenith_angle"),
+                            library_outputs.at("cosine_zenith_angle"), 1e-9)
+                    << "lat " << lat << ", longitude " << longitude << ", hour " << hour;
+                ASSERT_NEAR(fast_outputs.at("solar_declination"),
+                            library_outputs.at("solar_declination"), 1e-6);
+                ASSERT_NEAR(angle_difference(fast_outputs.at("hour_angle"),
+                                             library_outputs.at("hour_angle")), 0, 1e-6);
+            }
+        }
+    }
+}
+
+// The sunrise check of test_module_evaluation.cpp passes for the fast
+// module too.
+TEST_F(FastSolarPositionTest, Sunrise) {
+    inputs["lat"] = 40.0932;
+    inputs["longitude"] = -88.20175;
+    inputs["time"] = 200 + (5.0 + 48.0 / 60) / 24;
+    inputs["time_zone_offset"] = -5;
+    fast_module->run();
+
+    double zenith_angle_in_degrees {
+        std::acos(fast_outputs.at("cosine_zenith_angle")) / BioCro::fast_trig::radians_per_degree};
+    EXPECT_NEAR(zenith_angle_in_degrees, 90, 0.621);
+}
+
+TEST_F(FastSolarPositionTest, CanBeSelectedPerSimulation) {
+    BioCro::Module_set modules {
+        Module_factory::retrieve("solar_position_michalsky"),
+        Module_factory::retrieve("harmonic_energy")
+    };
+    BioCro::Module_set fast = BioCro::use_fast_solar_position(modules);
+    EXPECT_EQ(fast[0], BioCro::get_fast_solar_position_creator());
+    EXPECT_EQ(fast[1], modules[1]);
+    EXPECT_EQ(modules[0]->get_name(), "solar_position_michalsky");
+
+    // A module of the same name with other outputs isn't replaced.
+    BioCro::Expression_module_creator impostor {
+        "solar_position_michalsky", "cosine_zenith_angle = cos(time)", false};
+    EXPECT_THROW(BioCro::use_fast_solar_position({&impostor}), std::invalid_argument);
+}
+
+TEST_F(FastSolarPositionTest, Timing) {
+    if (!VERBOSE) return;
+    using clock = std::chrono::steady_clock;
+    const int evaluations {1000000};
+    double& time = inputs.at("time");
+    for (auto* module : {&library_module, &fast_module}) {
+        auto start = clock::now();
+        for (int i = 0; i < evaluations; ++i) {
+            time = 1 + (i % 8760) / 24.0;
+            (*module)->run();
+        }
+        double seconds = std::chrono::duration<double>(clock::now() - start).count();
+        std::cout << (module == &fast_module ? "fast" : "library") << " module: "
+                  << 1e9 * seconds / evaluations << " ns per evaluation" << std::endl;
+    }
+}
@@ -0,0 +1,116 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <iostream>
+
+#include "expression_module.h"
+#include "field_composition.h"
+#include "print_result.h"
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+static const BioCro::Solver_settings rk4 {"boost_rk4", 1, 0.0001, 0.0001, 200};
+
+// Fields composed without exchange behave exactly as they do alone.
+TEST(FieldCompositionTest, MatchesSeparateSimulations) {
+    BioCro::Module_set direct {Module_factory::retrieve("harmonic_energy")};
+    BioCro::Module_set differential {Module_factory::retrieve("harmonic_oscillator")};
+    BioCro::System_drivers drivers { {"time", std::vector<double>(50, 0)} };
+
+    BioCro::Field_composition composition { {{"timestep", 1}, {"spring_constant", 0.1}},
+                                            drivers,
+                                            rk4 };
+    std::vector<double> masses {5, 10, 20};
+    for (size_t f = 0; f < masses.size(); ++f) {
+        composition.add_field({"field" + std::to_string(f),
+                               { {"position", 0}, {"velocity", 1.0 + f} },
+                               { {"mass", masses[f]} },
+                               {},
+                               direct,
+                               differential});
+    }
+    EXPECT_EQ(composition.get_scenario().direct_mcs.size(), 3);
+    EXPECT_EQ(composition.get_scenario().drivers.size(), 1);
+
+    BioCro::Simulation_result combined = composition.run_simulation();
+    if (VERBOSE) print_result(combined);
+    EXPECT_TRUE(combined.count("field1.kinetic_energy"));
+
+    for (size_t f = 0; f < masses.size(); ++f) {
+        BioCro::Simulator alone {
+            { {"position", 0}, {"velocity", 1.0 + f} },
+            { {"timestep", 1}, {"spring_constant", 0.1}, {"mass", masses[f]} },
+            drivers,
+            direct,
+            differential,
+            "boost_rk4",
+            1,
+            0.0001,
+            0.0001,
+            200
+        };
+        BioCro::Simulation_result expected = alone.run_simulation();
+        BioCro::Simulation_result result =
+            composition.get_field_result(combined, "field" + std::to_string(f));
+        ASSERT_EQ(result.size(), expected.size());
+        for (auto& column : expected) {
+            auto& values = result.at(column.first);
+            for (size_t row = 0; row < values.size(); ++row) {
+                EXPECT_NEAR(values[row], column.second[row], 1e-12)
+                    << column.first << " of field " << f << " at row " << row;
+            }
+        }
+    }
+}
+
+/*
+ * Two fields with their own rainfall exchange water through an
+ * exchange module; the exchange conserves the total.
+ */
+TEST(FieldCompositionTest, ExchangesQuantities) {
+    BioCro::Expression_module_creator bucket {"bucket", "water = rain - drainage * water", true};
+    BioCro::Expression_module_creator flow {
+        "flow",
+        "north.water = 0.2 * (south.water - north.water)\n"
+        "south.water = 0.2 * (north.water - south.water)",
+        true};
+
+    auto make = [&](bool exchange) {
+        std::unique_ptr<BioCro::Field_composition> composition {new BioCro::Field_composition {
+            {{"timestep", 1}, {"drainage", 0.05}},
+            {{"time", std::vector<double>(100, 0)}},
+            rk4}};
+        composition->add_field(
+            {"north", {{"water", 10}}, {}, {{"rain", std::vector<double>(100, 1)}}, {}, {&bucket}});
+        composition->add_field(
+            {"south", {{"water", 0}}, {}, {{"rain", std::vector<double>(100, 0)}}, {}, {&bucket}});
+        if (exchange) composition->add_exchange_modules({}, {&flow});
+        return composition;
+    };
+    auto separate = make(false);
+    auto exchanging = make(true);
+    BioCro::Simulation_result apart = separate->run_simulation();
+    BioCro::Simulation_result together = exchanging->run_simulation();
+
+    for (size_t row = 0; row < 100; ++row) {
+        EXPECT_NEAR(together.at("north.water")[row] + together.at("south.water")[row],
+                    apart.at("north.water")[row] + apart.at("south.water")[row], 1e-9);
+    }
+    // The difference settles where rain balances drainage and flow.
+    EXPECT_NEAR(together.at("north.water")[99] - together.at("south.water")[99], 1 / 0.45, 1e-3);
+    EXPECT_GT(apart.at("north.water")[99] - apart.at("south.water")[99], 19);
+}
+
+TEST(FieldCompositionTest, ChecksFieldNames) {
+    BioCro::Field_composition composition {{{"timestep", 1}}, {{"time", {0, 1}}}, rk4};
+    composition.add_field({"east", {}, {}, {}, {}, {}});
+    EXPECT_THROW(composition.add_field({"east", {}, {}, {}, {}, {}}), std::invalid_argument);
+    EXPECT_THROW(composition.add_field({"", {}, {}, {}, {}, {}}), std::invalid_argument);
+    EXPECT_THROW(composition.add_field({"a.b", {}, {}, {}, {}, {}}), std::invalid_argument);
+    EXPECT_EQ(composition.get_field_names(), BioCro::Variable_names {"east"});
+}
@@ -0,0 +1,210 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+
+#include "parallel_direct_modules.h"
+#include "expression_module.h"
+#include "print_result.h"
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+TEST(ThreadPoolTest, RunsEveryTaskOnce) {
+    BioCro::Thread_pool pool {4};
+    EXPECT_EQ(pool.size(), 4);
+
+    const size_t number_of_tasks {1000};
+    for (int batch = 0; batch < 50; ++batch) {
+        std::vector<std::atomic<int>> counts(number_of_tasks);
+        for (auto& count : counts) count = 0;
+        pool.run(number_of_tasks, [&counts](size_t task) { ++counts[task]; });
+        for (size_t task = 0; task < number_of_tasks; ++task) {
+            ASSERT_EQ(counts[task], 1) << "task " << task << " of batch " << batch;
+        }
+    }
+}
+
+TEST(ThreadPoolTest, RethrowsTaskExceptions) {
+    BioCro::Thread_pool pool {3};
+    std::atomic<int> finished {0};
+    EXPECT_THROW(pool.run(100, [&finished](size_t task) {
+                     if (task == 17) throw std::runtime_error("task failed");
+                     ++finished;
+                 }),
+                 std::runtime_error);
+    EXPECT_EQ(finished, 99);
+
+    // The pool is still usable afterwards.
+    finished = 0;
+    pool.run(10, [&finished](size_t) { ++finished; });
+    EXPECT_EQ(finished, 10);
+}
+
+TEST(ThreadPoolTest, KnowsWhenRunningTask) {
+    BioCro::Thread_pool pool {3};
+    EXPECT_FALSE(BioCro::Thread_pool::is_running_task());
+    std::atomic<int> in_task {0};
+    pool.run(20, [&in_task](size_t) {
+        if (BioCro::Thread_pool::is_running_task()) ++in_task;
+    });
+    EXPECT_EQ(in_task, 20);
+    EXPECT_FALSE(BioCro::Thread_pool::is_running_task());
+}
+
+/*
+ * A set of direct modules for the harmonic oscillator with two levels
+ * of three and two independent modules.
+ */
+class ParallelDirectModulesTest : public ::testing::Test {
+   protected:
+    BioCro::Expression_module_creator momentum {
+        "momentum", "momentum = mass * velocity"
+    };
+    BioCro::Expression_module_creator force {
+        "force", "force = -spring_constant * position"
+    };
+    BioCro::Expression_module_creator power {
+        "power", "power = force * velocity"
+    };
+    BioCro::Expression_module_creator energy_check {
+        "energy_check", "energy_error = total_energy - 0.5 * momentum^2 / mass "
+                        "- 0.5 * spring_constant * position^2"
+    };
+
+    BioCro::Module_set direct_modules {
+        Module_factory::retrieve("harmonic_energy"), &momentum, &force,
+        &power, &energy_check
+    };
+
+    BioCro::Parallel_settings always_parallel() {
+        BioCro::Parallel_settings settings;
+        settings.number_of_threads = 3;
+        settings.minimum_level_cost = 0;
+        settings.minimum_task_cost = 0;
+        settings.calibration_runs = 3;
+        return settings;
+    }
+
+    BioCro::Simulation_result simulate(BioCro::Module_set direct_modules) {
+        BioCro::Simulator sim {
+            { {"position", 2}, {"velocity", 1} },
+            { {"mass", 10}, {"spring_constant", 0.1}, {"timestep", 1} },
+            { {"time",  std::vector<double>(100, 0)} },
+            direct_modules,
+            {Module_factory::retrieve("harmonic_oscillator")},
+            "boost_rk4",
+            1,
+            0.0001,
+            0.0001,
+            200
+        };
+        return sim.run_simulation();
+    }
+};
+
+TEST_F(ParallelDirectModulesTest, FindsLevels) {
+    BioCro::Parallel_direct_module_creator parallel {"parallel", direct_modules};
+
+    auto& levels = parallel.get_levels();
+    ASSERT_EQ(levels.size(), 2);
+    EXPECT_EQ(levels[0].size(), 3); // harmonic_energy, momentum, force
+    EXPECT_EQ(levels[1].size(), 2); // power, energy_check
+
+    BioCro::Variable_names inputs = parallel.get_inputs();
+    EXPECT_EQ(BioCro::Variable_set(inputs.begin(), inputs.end()),
+              BioCro::Variable_set({"position", "velocity", "mass", "spring_constant"}));
+    EXPECT_EQ(parallel.get_outputs().size(), 7);
+}
+
+TEST_F(ParallelDirectModulesTest, RejectsInvalidModuleSets) {
+    BioCro::Expression_module_creator a {"a", "a = b + 1"};
+    BioCro::Expression_module_creator b {"b", "b = a + 1"};
+    BioCro::Expression_module_creator other_force {"other_force", "force = 0"};
+
+    EXPECT_THROW(BioCro::Parallel_direct_module_creator("cycle", {&a, &b}),
+                 std::invalid_argument);
+    EXPECT_THROW(BioCro::Parallel_direct_module_creator("duplicate", {&force, &other_force}),
+                 std::invalid_argument);
+}
+
+// Only levels whose measured cost exceeds the threshold, and which
+// have more than one module, are run in parallel.
+TEST_F(ParallelDirectModulesTest, PlansOnlyExpensiveLevels) {
+    BioCro::Parallel_settings cheap = always_parallel();
+    BioCro::Parallel_settings expensive = always_parallel();
+    expensive.minimum_level_cost = 1;  // one second per evaluation
+
+    for (auto settings : {cheap, expensive}) {
+        BioCro::Parallel_direct_module_creator parallel {"parallel", direct_modules, settings};
+        BioCro::Variable_settings quantities {
+            {"position", 2}, {"velocity", 1}, {"mass", 10}, {"spring_constant", 0.1}
+        };
+        for (auto& name : parallel.get_outputs()) quantities[name] = 0;
+
+        BioCro::Module module = parallel.create_module(quantities, &quantities);
+        auto& parallel_module = dynamic_cast<BioCro::Parallel_direct_module&>(*module);
+        for (size_t i = 0; i < settings.calibration_runs; ++i) {
+            EXPECT_EQ(parallel_module.get_number_of_parallel_levels(), 0);
+            module->run();
+        }
+        EXPECT_EQ(parallel_module.get_number_of_parallel_levels(),
+                  settings.minimum_level_cost > 0 ? 0 : 2);
+
+        module->run();
+        EXPECT_DOUBLE_EQ(quantities.at("momentum"), 10);
+        EXPECT_DOUBLE_EQ(quantities.at("power"), -0.2);
+        EXPECT_NEAR(quantities.at("energy_error"), 0, 1e-12);
+    }
+}
+
+// Evaluating levels in parallel gives exactly the same results as
+// evaluating the modules one after another.
+TEST_F(ParallelDirectModulesTest, MatchesSequentialSimulation) {
+    BioCro::Parallel_direct_module_creator parallel {
+        "parallel", direct_modules, always_parallel()
+    };
+
+    BioCro::Simulation_result expected = simulate(direct_modules);
+    BioCro::Simulation_result result = simulate({&parallel});
+
+    if (VERBOSE) print_result(result);
+
+    ASSERT_EQ(BioCro::keys(result), BioCro::keys(expected));
+    for (auto& item : expected) {
+        EXPECT_EQ(result.at(item.first), item.second)
+            << "Quantity " << item.first << " differs.";
+    }
+}
+
+// Simulations sharing one creator, whether run on threads of their own
+// or as the tasks of a pool, give the same results as a sequential
+// simulation; modules that can't have the creator's pool fall back to
+// evaluating their levels on the calling thread.
+TEST_F(ParallelDirectModulesTest, ConcurrentSimulationsShareThePool) {
+    BioCro::Parallel_direct_module_creator parallel {
+        "parallel", direct_modules, always_parallel()
+    };
+    BioCro::Simulation_result expected = simulate(direct_modules);
+
+    std::vector<BioCro::Simulation_result> results(8);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < 4; ++i) {
+        threads.emplace_back([&, i] { results[i] = simulate({&parallel}); });
+    }
+    for (auto& thread : threads) thread.join();
+
+    BioCro::Thread_pool pool {4};
+    pool.run(4, [&](size_t i) { results[4 + i] = simulate({&parallel}); });
+
+    for (auto& result : results) {
+        for (auto& item : expected) {
+            EXPECT_EQ(result.at(item.first), item.second)
+                << "Quantity " << item.first << " differs.";
+        }
+    }
+}
@@ -0,0 +1,156 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include "expression_module.h"
+#include "parareal.h"
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+/*
+ * Two scenarios solved finely with a fourth-order Runge-Kutta method:
+ * ten years of daily rows of two carbon pools fed by a seasonal input,
+ * for which parareal converges quickly, and a harmonic oscillator, for
+ * which it famously doesn't.
+ */
+class PararealTest : public ::testing::Test {
+   protected:
+    BioCro::Expression_module_creator pools {
+        "pools",
+        "litter = 0.05 * (1 + sin(season)) - 0.1 * litter\n"
+        "soil = 0.1 * litter - 0.002 * soil",
+        true};
+
+    BioCro::Scenario get_pools(size_t rows = 3651) {
+        std::vector<double> season(rows);
+        for (size_t row = 0; row < rows; ++row) season[row] = 2 * std::acos(-1.0) * row / 365;
+        return BioCro::Scenario {
+            { {"litter", 0}, {"soil", 10} },
+            { {"timestep", 1} },
+            { {"season", season} },
+            {},
+            {&pools},
+            {"boost_rk4", 1, 0.0001, 0.0001, 200}
+        };
+    }
+
+    BioCro::Scenario get_oscillator(size_t rows) {
+        return BioCro::Scenario {
+            { {"position", 0}, {"velocity", 1} },
+            { {"mass", 10}, {"spring_constant", 0.1}, {"timestep", 1} },
+            { {"time", std::vector<double>(rows, 0)} },
+            {Module_factory::retrieve("harmonic_energy")},
+            {Module_factory::retrieve("harmonic_oscillator")},
+            {"boost_rk4", 1, 0.0001, 0.0001, 200}
+        };
+    }
+
+    BioCro::Simulation_result run_serially(BioCro::Scenario const& scenario) {
+        return BioCro::make_simulator(scenario).run_simulation();
+    }
+};
+
+TEST_F(PararealTest, ConvergesToSerialResult) {
+    BioCro::Scenario scenario = get_pools();
+    BioCro::Simulation_result expected = run_serially(scenario);
+
+    BioCro::Parareal_settings settings;
+    settings.number_of_threads = 4;
+    settings.number_of_windows = 16;
+    settings.tolerance = 1e-10;
+    BioCro::Parareal_integrator integrator {settings};
+    BioCro::Simulation_result result = integrator.integrate(scenario);
+
+    if (VERBOSE) {
+        std::cout << integrator.get_number_of_iterations() << " iterations; changes:";
+        for (double change : integrator.get_changes()) std::cout << " " << change;
+        std::cout << std::endl;
+    }
+    EXPECT_LT(integrator.get_number_of_iterations(), 8);
+    ASSERT_EQ(result.size(), expected.size());
+    for (auto& column : expected) {
+        auto& values = result.at(column.first);
+        ASSERT_EQ(values.size(), column.second.size()) << column.first;
+        for (size_t row = 0; row < values.size(); ++row) {
+            ASSERT_NEAR(values[row], column.second[row], 1e-8)
+                << column.first << " at row " << row;
+        }
+    }
+
+    // The changes shrink from one iteration to the next.
+    auto& changes = integrator.get_changes();
+    for (size_t i = 1; i < changes.size(); ++i) EXPECT_LT(changes[i], changes[i - 1]);
+}
+
+// After as many iterations as windows, every window has started from
+// the fine solution, even when the iteration doesn't converge.
+TEST_F(PararealTest, IsExactAfterOneIterationPerWindow) {
+    BioCro::Scenario scenario = get_oscillator(101);
+    BioCro::Simulation_result expected = run_serially(scenario);
+
+    BioCro::Parareal_settings settings;
+    settings.number_of_threads = 3;
+    settings.tolerance = 0;
+    BioCro::Parareal_integrator integrator {settings};
+    BioCro::Simulation_result result = integrator.integrate(scenario);
+    EXPECT_EQ(integrator.get_number_of_iterations(), 3);
+    for (size_t row = 0; row < 101; ++row) {
+        EXPECT_NEAR(result.at("position")[row], expected.at("position")[row], 1e-12);
+    }
+
+    // A single iteration is only as good as the coarse guesses.
+    settings.maximum_iterations = 1;
+    BioCro::Parareal_integrator single {settings};
+    result = single.integrate(scenario);
+    EXPECT_EQ(single.get_number_of_iterations(), 1);
+    EXPECT_TRUE(single.get_changes().empty());
+    EXPECT_GT(std::fabs(result.at("position")[100] - expected.at("position")[100]), 1e-6);
+
+    // The first window is always exact.
+    for (size_t row = 0; row <= 33; ++row) {
+        EXPECT_NEAR(result.at("position")[row], expected.at("position")[row], 1e-12);
+    }
+}
+
+TEST_F(PararealTest, HandlesShortScenarios) {
+    BioCro::Parareal_settings settings;
+    settings.number_of_windows = 10;
+    BioCro::Parareal_integrator integrator {settings};
+
+    BioCro::Scenario scenario = get_oscillator(4);
+    BioCro::Simulation_result expected = run_serially(scenario);
+    BioCro::Simulation_result result = integrator.integrate(scenario);
+    for (size_t row = 0; row < 4; ++row) {
+        EXPECT_NEAR(result.at("position")[row], expected.at("position")[row], 1e-12);
+    }
+
+    EXPECT_EQ(integrator.integrate(get_oscillator(1)).at("position").size(), 1);
+}
+
+TEST_F(PararealTest, TimesLongRuns) {
+    if (!VERBOSE) return;
+    using clock = std::chrono::steady_clock;
+    BioCro::Scenario scenario = get_pools(365 * 200 + 1);
+
+    auto start = clock::now();
+    run_serially(scenario);
+    double serial = std::chrono::duration<double>(clock::now() - start).count();
+
+    BioCro::Parareal_settings settings;
+    settings.number_of_threads = 8;
+    settings.tolerance = 1e-6;
+    BioCro::Parareal_integrator integrator {settings};
+    start = clock::now();
+    integrator.integrate(scenario);
+    double parallel = std::chrono::duration<double>(clock::now() - start).count();
+
+    std::cout << "serial " << serial << " s; parareal " << parallel << " s with "
+              << integrator.get_number_of_iterations() << " iterations" << std::endl;
+}
@@ -0,0 +1,153 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "expression_module.h"
+#include "harmonic_quantities.h"
+#include "quantity_structs.h"
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+static BioCro::Quantity_struct_settings get_harmonic_settings()
+{
+    BioCro::Quantity_struct_settings settings;
+    settings.header_guard = "HARMONIC_QUANTITIES_H";
+    settings.parameter_struct = "Harmonic_parameters";
+    settings.state_struct = "Harmonic_state";
+    settings.extra_parameters = {"timestep"};
+    return settings;
+}
+
+// harmonic_quantities.h was generated from the harmonic oscillator
+// modules, so it must still match the generator's output.
+TEST(QuantityStructsTest, GeneratedHeaderIsCurrent) {
+    std::ifstream file("harmonic_quantities.h");
+    ASSERT_TRUE(file.is_open());
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    EXPECT_EQ(contents.str(),
+              BioCro::generate_quantity_structs({Module_factory::retrieve("harmonic_energy")},
+                                                {Module_factory::retrieve("harmonic_oscillator")},
+                                                get_harmonic_settings()));
+}
+
+TEST(QuantityStructsTest, LaysOutQuantities) {
+    BioCro::Expression_module_creator index {"index", "growth_index = dev * water", false};
+    BioCro::Expression_module_creator growth {
+        "growth", "leaf = rate * growth_index * temp\ndev = 0.01 * temp", true};
+    BioCro::Quantity_struct_settings settings;
+    settings.drivers = {"temp"};
+    BioCro::Quantity_layout layout = BioCro::get_quantity_layout({&index}, {&growth}, settings);
+    EXPECT_EQ(layout.parameters, (BioCro::Variable_names {"rate", "water"}));
+    EXPECT_EQ(layout.state, (BioCro::Variable_names {"dev", "leaf"}));
+
+    BioCro::Expression_module_creator dotted {"dotted", "north.water = -north.water", true};
+    EXPECT_THROW(BioCro::generate_quantity_structs({}, {&dotted}), std::invalid_argument);
+}
+
+// Names that would not compile as fields, or that would clash with the
+// generated members, are rejected.
+TEST(QuantityStructsTest, RejectsUnusableNames) {
+    for (std::string name : {"class", "double", "new", "and", "names", "to_map", "from_map",
+                             "assign", "get", "Parameters", "Parameters_ref", "_Rate",
+                             "leaf__area"}) {
+        BioCro::Expression_module_creator clash {"clash", "x = " + name, true};
+        EXPECT_THROW(BioCro::generate_quantity_structs({}, {&clash}), std::invalid_argument)
+            << name;
+    }
+    BioCro::Expression_module_creator fine {"fine", "x = getter + new_rate", true};
+    EXPECT_NO_THROW(BioCro::generate_quantity_structs({}, {&fine}));
+
+    BioCro::Quantity_struct_settings settings;
+    settings.state_struct = "struct";
+    EXPECT_THROW(BioCro::generate_quantity_structs({}, {&fine}, settings),
+                 std::invalid_argument);
+
+    // The two structs, and their "_ref" companions, need distinct names.
+    for (std::string state_struct : {"Parameters", "Parameters_ref"}) {
+        settings.state_struct = state_struct;
+        EXPECT_THROW(BioCro::generate_quantity_structs({}, {&fine}, settings),
+                     std::invalid_argument)
+            << state_struct;
+    }
+    settings.state_struct = "State";
+    settings.parameter_struct = "State_ref";
+    EXPECT_THROW(BioCro::generate_quantity_structs({}, {&fine}, settings),
+                 std::invalid_argument);
+
+    settings = BioCro::Quantity_struct_settings {};
+    for (std::string header_guard : {"", "MY-QUANTITIES_H", "__QUANTITIES_H", "_QUANTITIES_H"}) {
+        settings.header_guard = header_guard;
+        EXPECT_THROW(BioCro::generate_quantity_structs({}, {&fine}, settings),
+                     std::invalid_argument)
+            << header_guard;
+    }
+}
+
+TEST(QuantityStructsTest, ConvertsToMaps) {
+    Harmonic_parameters parameters;
+    parameters.mass = 10;
+    parameters.spring_constant = 0.1;
+    parameters.timestep = 1;
+    Harmonic_state state {0, 1};
+
+    BioCro::Parameter_set parameter_set = parameters.to_map();
+    EXPECT_EQ(parameter_set.size(), Harmonic_parameters::names().size());
+    EXPECT_EQ(parameter_set.at("spring_constant"), 0.1);
+    EXPECT_EQ(Harmonic_parameters::from_map(parameter_set).mass, 10);
+
+    BioCro::Simulator typed {
+        state.to_map(), parameter_set, {{"time", std::vector<double>(20, 0)}},
+        {Module_factory::retrieve("harmonic_energy")},
+        {Module_factory::retrieve("harmonic_oscillator")},
+        "boost_rk4", 1, 0.0001, 0.0001, 200};
+    BioCro::Simulator keyed {
+        {{"position", 0}, {"velocity", 1}},
+        {{"mass", 10}, {"spring_constant", 0.1}, {"timestep", 1}},
+        {{"time", std::vector<double>(20, 0)}},
+        {Module_factory::retrieve("harmonic_energy")},
+        {Module_factory::retrieve("harmonic_oscillator")},
+        "boost_rk4", 1, 0.0001, 0.0001, 200};
+    EXPECT_EQ(typed.run_simulation(), keyed.run_simulation());
+}
+
+// The _ref structs read and write the map's own values.
+TEST(QuantityStructsTest, BindsToMaps) {
+    BioCro::Parameter_set parameter_set {{"mass", 10}, {"spring_constant", 0.1}, {"timestep", 1}};
+    Harmonic_parameters_ref bound {parameter_set};
+    EXPECT_EQ(&bound.mass, &parameter_set.at("mass"));
+    bound.mass = 20;
+    EXPECT_EQ(parameter_set.at("mass"), 20);
+    bound.assign({5, 0.4, 2});
+    EXPECT_EQ(parameter_set.at("spring_constant"), 0.4);
+    EXPECT_EQ(bound.get().timestep, 2);
+
+    BioCro::Parameter_set incomplete {{"mass", 10}};
+    EXPECT_THROW(Harmonic_parameters_ref{incomplete}, std::out_of_range);
+
+    if (VERBOSE) {
+        size_t n {1000000};
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < n; ++i) {
+            parameter_set["mass"] = i;
+            parameter_set["spring_constant"] = 0.1 * i;
+        }
+        std::chrono::duration<double> keyed = std::chrono::steady_clock::now() - start;
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < n; ++i) {
+            bound.mass = i;
+            bound.spring_constant = 0.1 * i;
+        }
+        std::chrono::duration<double> typed = std::chrono::steady_clock::now() - start;
+        std::cout << n << " updates: keyed " << keyed.count() << " s; bound "
+                  << typed.count() << " s (mass " << parameter_set.at("mass") << ")" << std::endl;
+    }
+}
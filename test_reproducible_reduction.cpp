@@ -0,0 +1,172 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <random>
+
+#include "reproducible_reduction.h"
+
+TEST(ExactSumTest, HasNoRoundingError) {
+    BioCro::Exact_sum sum;
+    for (double x : {1e100, 1.0, -1e100}) sum.add(x);
+    EXPECT_EQ(sum.value(), 1.0);
+
+    BioCro::Exact_sum tenths;
+    for (int i = 0; i < 10; ++i) tenths.add(0.1);
+    EXPECT_EQ(tenths.value(), 1.0);
+
+    BioCro::Exact_sum empty;
+    EXPECT_EQ(empty.value(), 0.0);
+
+    BioCro::Exact_sum infinite;
+    infinite.add(1.0);
+    infinite.add(std::numeric_limits<double>::infinity());
+    EXPECT_EQ(infinite.value(), std::numeric_limits<double>::infinity());
+}
+
+// A partial sum beyond the range of double overflows to an infinity of
+// the right sign, which stays put, rather than to a NaN.
+TEST(ExactSumTest, OverflowIsSticky) {
+    double const largest = std::numeric_limits<double>::max();
+    double const infinity = std::numeric_limits<double>::infinity();
+
+    BioCro::Exact_sum positive;
+    for (double x : {largest, largest}) positive.add(x);
+    EXPECT_EQ(positive.value(), infinity);
+    positive.add(-largest);
+    EXPECT_EQ(positive.value(), infinity);
+
+    BioCro::Exact_sum negative;
+    for (double x : {-largest, -0.5 * largest, -largest}) negative.add(x);
+    EXPECT_EQ(negative.value(), -infinity);
+
+    positive.add(negative);
+    EXPECT_TRUE(std::isnan(positive.value()));
+}
+
+// The sum of values spanning many orders of magnitude is the same in
+// any order and however it is split into pieces.
+TEST(ExactSumTest, IsIndependentOfOrder) {
+    std::mt19937 generator {42};
+    std::uniform_real_distribution<double> mantissa {-1, 1};
+    std::uniform_int_distribution<int> exponent {-30, 30};
+    std::vector<double> values(1000);
+    for (auto& x : values) x = std::ldexp(mantissa(generator), exponent(generator));
+
+    BioCro::Exact_sum reference;
+    for (double x : values) reference.add(x);
+
+    for (int trial = 0; trial < 10; ++trial) {
+        std::shuffle(values.begin(), values.end(), generator);
+        BioCro::Exact_sum first_half, second_half;
+        for (size_t i = 0; i < values.size(); ++i) {
+            (i < values.size() / 2 ? first_half : second_half).add(values[i]);
+        }
+        second_half.add(first_half);
+        EXPECT_EQ(second_half.value(), reference.value());
+    }
+}
+
+TEST(TreeReduceTest, SameWithAnyNumberOfThreads) {
+    std::mt19937 generator {7};
+    std::uniform_real_distribution<double> distribution {0, 1};
+    std::vector<double> values(1001);
+    for (auto& x : values) x = distribution(generator);
+
+    auto add = [](double& a, double b) { a += b; };
+    std::vector<double> sequential {values};
+    BioCro::tree_reduce(sequential, add);
+
+    for (size_t threads : {2, 3, 8}) {
+        BioCro::Thread_pool pool {threads};
+        std::vector<double> parallel {values};
+        BioCro::tree_reduce(parallel, add, &pool);
+        EXPECT_EQ(parallel[0], sequential[0]) << threads << " threads";
+    }
+}
+
+TEST(RunningStatisticsTest, CombinedStatisticsMatch) {
+    BioCro::Running_statistics all, first, second;
+    for (int i = 0; i < 100; ++i) {
+        double x = std::sin(i) * 10 + i;
+        all.add(x);
+        (i < 30 ? first : second).add(x);
+    }
+    first.add(second);
+    EXPECT_EQ(first.count(), all.count());
+    EXPECT_NEAR(first.mean(), all.mean(), 1e-12);
+    EXPECT_NEAR(first.variance(), all.variance(), 1e-9);
+}
+
+/*
+ * Ensemble summaries are identical, bit for bit, at every thread
+ * count.
+ */
+class ReproducibleReductionTest : public ::testing::Test {
+   protected:
+    ReproducibleReductionTest() {
+        std::mt19937 generator {2024};
+        std::lognormal_distribution<double> distribution {0, 3};
+        for (int member = 0; member < 257; ++member) {
+            std::vector<double> x(20);
+            for (auto& value : x) value = distribution(generator);
+            results.push_back({ {"x", x} });
+        }
+    }
+
+    std::vector<BioCro::Simulation_result> results;
+
+    BioCro::Ensemble_statistics statistics {
+        {"final_x", [](BioCro::Simulation_result const& result) {
+             return result.at("x").back();
+         }},
+        {"total_x", [](BioCro::Simulation_result const& result) {
+             double total {0};
+             for (double x : result.at("x")) total += x;
+             return total;
+         }}
+    };
+};
+
+TEST_F(ReproducibleReductionTest, SummaryIsIndependentOfThreadCount) {
+    BioCro::Ensemble_summary reference = BioCro::summarize_ensemble(results, statistics, 1);
+
+    BioCro::Running_statistics naive;
+    for (auto& result : results) naive.add(result.at("x").back());
+    EXPECT_NEAR(reference.at("final_x").mean, naive.mean(), 1e-9 * naive.mean());
+    EXPECT_NEAR(reference.at("final_x").variance, naive.variance(), 1e-9 * naive.variance());
+
+    for (size_t threads : {2, 3, 5, 16}) {
+        BioCro::Ensemble_summary summary = BioCro::summarize_ensemble(results, statistics, threads);
+        for (auto& item : reference) {
+            auto& s = summary.at(item.first);
+            EXPECT_EQ(s.count, item.second.count);
+            EXPECT_EQ(s.sum, item.second.sum) << item.first << ", " << threads << " threads";
+            EXPECT_EQ(s.mean, item.second.mean) << item.first << ", " << threads << " threads";
+            EXPECT_EQ(s.variance, item.second.variance) << item.first << ", " << threads << " threads";
+            EXPECT_EQ(s.minimum, item.second.minimum);
+            EXPECT_EQ(s.maximum, item.second.maximum);
+        }
+    }
+    if (VERBOSE) {
+        for (auto& item : reference) {
+            std::cout << item.first << ": mean " << item.second.mean
+                      << ", variance " << item.second.variance << std::endl;
+        }
+    }
+}
+
+TEST_F(ReproducibleReductionTest, MeanTrajectoryIsIndependentOfThreadCount) {
+    std::vector<double> reference = BioCro::get_ensemble_mean(results, "x", 1);
+    ASSERT_EQ(reference.size(), 20);
+    for (size_t threads : {2, 4, 7}) {
+        EXPECT_EQ(BioCro::get_ensemble_mean(results, "x", threads), reference);
+    }
+}
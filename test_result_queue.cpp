@@ -0,0 +1,142 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "ensemble.h"
+#include "result_queue.h"
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+TEST(BoundedMpmcQueueTest, IsFirstInFirstOut) {
+    BioCro::Bounded_mpmc_queue<int> queue {5};
+    EXPECT_EQ(queue.get_capacity(), 8);
+
+    int value;
+    EXPECT_FALSE(queue.try_pop(value));
+    for (int i = 0; i < 8; ++i) {
+        ASSERT_TRUE(queue.try_push(i));
+    }
+    int extra {8};
+    EXPECT_FALSE(queue.try_push(extra));  // full
+
+    // Wrap around the end of the buffer a few times.
+    for (int i = 0; i < 20; ++i) {
+        ASSERT_TRUE(queue.try_pop(value));
+        EXPECT_EQ(value, i);
+        int next {i + 8};
+        ASSERT_TRUE(queue.try_push(next));
+    }
+}
+
+// Every value pushed by several producers is popped exactly once by
+// several consumers, even through a small queue.
+TEST(BoundedMpmcQueueTest, ManyProducersAndConsumers) {
+    const int number_of_producers {4};
+    const int number_of_consumers {3};
+    const int values_per_producer {20000};
+
+    BioCro::Bounded_mpmc_queue<int> queue {16};
+    std::vector<std::atomic<int>> seen(number_of_producers * values_per_producer);
+    for (auto& count : seen) count = 0;
+
+    std::vector<std::thread> consumers;
+    for (int c = 0; c < number_of_consumers; ++c) {
+        consumers.emplace_back([&] {
+            int value;
+            while (queue.pop(value)) ++seen[value];
+        });
+    }
+    std::vector<std::thread> producers;
+    for (int p = 0; p < number_of_producers; ++p) {
+        producers.emplace_back([&, p] {
+            for (int i = 0; i < values_per_producer; ++i) {
+                queue.push(p * values_per_producer + i);
+            }
+        });
+    }
+    for (auto& thread : producers) thread.join();
+    queue.close();
+    for (auto& thread : consumers) thread.join();
+
+    for (size_t value = 0; value < seen.size(); ++value) {
+        ASSERT_EQ(seen[value], 1) << "value " << value;
+    }
+    EXPECT_THROW(queue.push(0), std::logic_error);
+}
+
+/*
+ * Streaming the results of a parallel ensemble to writer threads
+ * delivers every member's result exactly once.
+ */
+class ResultHandoffTest : public ::testing::Test {
+   protected:
+    ResultHandoffTest() {
+        for (int i = 0; i < 40; ++i) {
+            ensemble_parameters.add_member({10.0 + i, 0.1 * (1 + i % 3)});
+        }
+    }
+
+    BioCro::Ensemble_parameters ensemble_parameters {
+        { {"mass", 10}, {"spring_constant", 0.1}, {"timestep", 1} },
+        {"mass", "spring_constant"}
+    };
+
+    BioCro::Ensemble_simulator get_ensemble_simulator() {
+        return BioCro::Ensemble_simulator {
+            { {"position", 0}, {"velocity", 1} },
+            ensemble_parameters,
+            { {"time", std::vector<double>(100, 0)} },
+            {Module_factory::retrieve("harmonic_energy")},
+            {Module_factory::retrieve("harmonic_oscillator")},
+            "boost_rk4",
+            1,
+            0.0001,
+            0.0001,
+            200
+        };
+    }
+};
+
+TEST_F(ResultHandoffTest, WritersReceiveEveryResult) {
+    BioCro::Ensemble_simulator ensemble = get_ensemble_simulator();
+    std::vector<BioCro::Simulation_result> expected = ensemble.run_simulation();
+
+    std::mutex written_mutex;
+    std::vector<BioCro::Simulation_result> written(ensemble.size());
+    std::vector<int> times_written(ensemble.size(), 0);
+
+    // A small queue and slow writers make the simulation threads wait
+    // for room.
+    ensemble.run_simulation_in_parallel(
+        4,
+        [&](BioCro::Result_chunk& chunk) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            std::lock_guard<std::mutex> lock(written_mutex);
+            written[chunk.member] = std::move(chunk.result);
+            ++times_written[chunk.member];
+        },
+        2,
+        2);
+
+    for (size_t member = 0; member < ensemble.size(); ++member) {
+        EXPECT_EQ(times_written[member], 1) << "member " << member;
+        EXPECT_EQ(written[member], expected[member]) << "member " << member;
+    }
+}
+
+TEST_F(ResultHandoffTest, WriterExceptionsAreRethrown) {
+    BioCro::Ensemble_simulator ensemble = get_ensemble_simulator();
+    EXPECT_THROW(ensemble.run_simulation_in_parallel(
+                     3,
+                     [](BioCro::Result_chunk& chunk) {
+                         if (chunk.member == 5) throw std::runtime_error("disk full");
+                     }),
+                 std::runtime_error);
+}
@@ -0,0 +1,172 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>   // for std::remove
+#include <cstring>  // for std::memcpy
+#include <iostream>
+
+#include "scenario_file.h"
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+class ScenarioFileTest : public ::testing::Test {
+   protected:
+    ScenarioFileTest() {
+        for (double mass : {5.0, 10.0}) {
+            scenarios.push_back(BioCro::Scenario {
+                { {"position", 0}, {"velocity", 1} },
+                { {"mass", mass}, {"spring_constant", 0.1}, {"timestep", 1} },
+                oscillator_drivers,
+                { Module_factory::retrieve("harmonic_energy") },
+                { Module_factory::retrieve("harmonic_oscillator") },
+                {"boost_rk4", 1, 0.0001, 0.0001, 200}
+            });
+        }
+        scenarios.push_back(BioCro::Scenario {
+            { {"TTc", 0} },
+            { {"sowing_time", 0}, {"tbase", 5}, {"timestep", 1} },
+            { {"time",  { 0, 1, 2, 3, 4, 5 }},
+              {"temp", { 5, 8, 10, 15, 20, 20 }} },
+            {},
+            { Module_factory::retrieve("thermal_time_linear") },
+            {"homemade_euler", 1, 0.001, 0.002, 100}
+        });
+    }
+
+    ~ScenarioFileTest() {
+        std::remove(path.c_str());
+    }
+
+    const std::string path {::testing::TempDir() + "test_scenarios.bcsc"};
+    BioCro::System_drivers oscillator_drivers
+        { {"time",  { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 }} };
+    std::vector<BioCro::Scenario> scenarios;
+};
+
+// Reading a written file gives back the original scenarios.
+TEST_F(ScenarioFileTest, RoundTrip) {
+    BioCro::Scenario_file_writer{}.write(path, scenarios);
+    BioCro::Scenario_file<Module_factory> file {path};
+
+    ASSERT_EQ(file.size(), scenarios.size());
+    // The two oscillator scenarios share a driver table.
+    EXPECT_EQ(file.number_of_driver_tables(), 2);
+
+    for (size_t i = 0; i < scenarios.size(); ++i) {
+        BioCro::Scenario original = scenarios[i];
+        BioCro::Scenario loaded = file.get_scenario(i);
+        EXPECT_EQ(loaded.initial_state, original.initial_state);
+        EXPECT_EQ(loaded.parameters, original.parameters);
+        EXPECT_EQ(loaded.drivers, original.drivers);
+        EXPECT_EQ(loaded.direct_mcs, original.direct_mcs);
+        EXPECT_EQ(loaded.differential_mcs, original.differential_mcs);
+        EXPECT_EQ(loaded.solver_settings.ode_solver_name,
+                  original.solver_settings.ode_solver_name);
+        EXPECT_EQ(loaded.solver_settings.adaptive_abs_error_tol,
+                  original.solver_settings.adaptive_abs_error_tol);
+        EXPECT_EQ(loaded.solver_settings.adaptive_max_steps,
+                  original.solver_settings.adaptive_max_steps);
+
+        EXPECT_EQ(file.make_simulator(i).run_simulation(),
+                  BioCro::make_simulator(original).run_simulation());
+    }
+}
+
+// Many scenarios load quickly.
+TEST_F(ScenarioFileTest, ManyScenarios) {
+    std::vector<BioCro::Scenario> many;
+    for (size_t i = 0; i < 100000; ++i) {
+        BioCro::Scenario scenario = scenarios[0];
+        scenario.parameters["mass"] = 1 + i;
+        many.push_back(scenario);
+    }
+    BioCro::Scenario_file_writer{}.write(path, many);
+
+    auto start = std::chrono::steady_clock::now();
+    BioCro::Scenario_file<Module_factory> file {path};
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+
+    if (VERBOSE) std::cout << "loaded " << file.size() << " scenarios in "
+                           << elapsed.count() << " s" << std::endl;
+
+    ASSERT_EQ(file.size(), many.size());
+    EXPECT_EQ(file.number_of_driver_tables(), 1);
+    EXPECT_EQ(file.get_scenario(12345).parameters.at("mass"), 12346);
+}
+
+// Distinct driver tables are each stored, and identical ones shared,
+// without comparing every table with every other.
+TEST_F(ScenarioFileTest, ManyDriverTables) {
+    std::vector<BioCro::Scenario> many;
+    for (size_t i = 0; i < 20000; ++i) {
+        BioCro::Scenario scenario = scenarios[0];
+        scenario.drivers.at("time")[9] = i % 10000;
+        many.push_back(scenario);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    BioCro::Scenario_file_writer{}.write(path, many);
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+    if (VERBOSE) std::cout << "wrote " << many.size() << " scenarios in "
+                           << elapsed.count() << " s" << std::endl;
+
+    BioCro::Scenario_file<Module_factory> file {path};
+    EXPECT_EQ(file.number_of_driver_tables(), 10000);
+    EXPECT_EQ(file.get_scenario(12345).drivers, many[2345].drivers);
+}
+
+TEST_F(ScenarioFileTest, BadFilesAreRejected) {
+    BioCro::Scenario_file_writer{}.write(path, scenarios);
+
+    // Truncate the file.
+    std::string contents;
+    {
+        std::ifstream file(path, std::ios::binary);
+        contents.assign(std::istreambuf_iterator<char>(file), {});
+    }
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(contents.data(), contents.size() - 3);
+    }
+    EXPECT_THROW(BioCro::Scenario_file<Module_factory>{path}, std::runtime_error);
+
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file << "not a scenario file";
+    }
+    EXPECT_THROW(BioCro::Scenario_file<Module_factory>{path}, std::runtime_error);
+}
+
+// Counts larger than the file could hold are rejected before anything
+// is allocated for them.
+TEST_F(ScenarioFileTest, ImpossibleCountsAreRejected) {
+    BioCro::Scenario_file_writer{}.write(path, {});
+    std::string contents;
+    {
+        std::ifstream file(path, std::ios::binary);
+        contents.assign(std::istreambuf_iterator<char>(file), {});
+    }
+
+    // The string table's count follows the 12-byte header, and the
+    // scenario count ends the file.
+    for (size_t offset : {size_t{12}, contents.size() - sizeof(std::uint64_t)}) {
+        std::string corrupted = contents;
+        std::uint64_t huge {0xFFFFFFFF};
+        std::memcpy(&corrupted[offset], &huge, offset == 12 ? 4 : 8);
+        {
+            std::ofstream file(path, std::ios::binary | std::ios::trunc);
+            file.write(corrupted.data(), corrupted.size());
+        }
+        try {
+            BioCro::Scenario_file<Module_factory> file {path};
+            ADD_FAILURE() << "no exception for the count at byte " << offset;
+        } catch (std::runtime_error const& e) {
+            EXPECT_EQ(std::string(e.what()), "Invalid scenario file: count exceeds file size.");
+        }
+    }
+}
@@ -0,0 +1,129 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <iostream>
+
+#include "screening.h"
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+/*
+ * The candidates are harmonic oscillators with various spring
+ * constants.  A candidate scores well if its final position is close
+ * to a target value.
+ */
+class ScreeningTest : public ::testing::Test {
+   protected:
+    ScreeningTest() {
+        for (int i = 1; i <= 20; ++i) {
+            candidates.add_member({0.02 * i});
+        }
+    }
+
+    BioCro::Ensemble_simulator candidates {
+        { {"position", 0}, {"velocity", 1} },
+        BioCro::Ensemble_parameters {
+            { {"mass", 10}, {"spring_constant", 0.1}, {"timestep", 1} },
+            {"spring_constant"}
+        },
+        { {"time",  { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 }} },
+        {},
+        { Module_factory::retrieve("harmonic_oscillator") },
+        "boost_rk4",
+        1,
+        0.0001,
+        0.0001,
+        200
+    };
+
+    BioCro::Candidate_score score {
+        [](BioCro::Simulation_result const& result) {
+            return -std::abs(result.at("position").back() - 2);
+        }
+    };
+
+    const BioCro::Solver_settings coarse {"boost_euler", 1, 1e-2, 1e-2, 200};
+};
+
+TEST_F(ScreeningTest, FinalistsAreTheBestCoarseCandidates) {
+    BioCro::Screening_result screening =
+        BioCro::screen_candidates(candidates, score, 0.2, coarse,
+                                  candidates.get_solver_settings());
+
+    ASSERT_EQ(screening.coarse_scores.size(), candidates.size());
+    ASSERT_EQ(screening.finalists.size(), 4);
+    ASSERT_EQ(screening.fine_scores.size(), 4);
+    ASSERT_EQ(screening.fine_results.size(), 4);
+
+    // Every finalist scored at least as well as every other candidate
+    // in the coarse stage.
+    double worst_finalist_score = screening.coarse_scores[screening.finalists.back()];
+    for (size_t candidate = 0; candidate < candidates.size(); ++candidate) {
+        bool is_finalist = std::find(screening.finalists.begin(),
+                                     screening.finalists.end(),
+                                     candidate) != screening.finalists.end();
+        if (!is_finalist) {
+            EXPECT_LE(screening.coarse_scores[candidate], worst_finalist_score);
+        }
+    }
+
+    // The fine results are full-fidelity runs of the finalists.
+    for (size_t i = 0; i < screening.finalists.size(); ++i) {
+        size_t candidate = screening.finalists[i];
+        if (VERBOSE) {
+            std::cout << "candidate " << candidate
+                      << ": coarse score " << screening.coarse_scores[candidate]
+                      << ", fine score " << screening.fine_scores[i] << std::endl;
+        }
+        EXPECT_EQ(screening.fine_results[i], candidates.run_member(candidate));
+        EXPECT_DOUBLE_EQ(screening.fine_scores[i], score(screening.fine_results[i]));
+    }
+}
+
+// At least one candidate always survives screening.
+TEST_F(ScreeningTest, AtLeastOneFinalist) {
+    BioCro::Screening_result screening =
+        BioCro::screen_candidates(candidates, score, 0.001, coarse,
+                                  candidates.get_solver_settings());
+    EXPECT_EQ(screening.finalists.size(), 1);
+}
+
+TEST_F(ScreeningTest, BadFractionIsRejected) {
+    EXPECT_THROW(BioCro::screen_candidates(candidates, score, 0, coarse,
+                                           candidates.get_solver_settings()),
+                 std::invalid_argument);
+    EXPECT_THROW(BioCro::screen_candidates(candidates, score, 1.5, coarse,
+                                           candidates.get_solver_settings()),
+                 std::invalid_argument);
+}
+
+// A candidate whose coarse score is NaN, for example because its
+// coarse run diverged, ranks below every candidate with a score.
+TEST_F(ScreeningTest, NanScoresRankLast) {
+    // The coarse stage scores the candidates in order, so this makes
+    // the coarse score of every even-numbered candidate NaN.
+    size_t calls {0};
+    BioCro::Candidate_score unreliable_score {
+        [&](BioCro::Simulation_result const& result) {
+            return calls++ % 2 == 0 ? std::nan("") : score(result);
+        }
+    };
+
+    BioCro::Screening_result screening =
+        BioCro::screen_candidates(candidates, unreliable_score, 0.5, coarse,
+                                  candidates.get_solver_settings());
+
+    ASSERT_EQ(screening.finalists.size(), 10);
+    for (size_t i = 0; i < screening.finalists.size(); ++i) {
+        EXPECT_EQ(screening.finalists[i] % 2, 1);
+        if (i > 0) {
+            EXPECT_GE(screening.coarse_scores[screening.finalists[i - 1]],
+                      screening.coarse_scores[screening.finalists[i]]);
+        }
+    }
+}
@@ -0,0 +1,185 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include "solar_table.h"
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+/*
+ * Solar tables are compared with the modules they tabulate, run one
+ * row at a time.
+ */
+class SolarTableTest : public ::testing::Test {
+   protected:
+    const BioCro::Solar_site site {40.0932, -88.20175, -6};
+    std::vector<double> times;
+    std::vector<double> years;
+    BioCro::Module_creator library = Module_factory::retrieve("solar_position_michalsky");
+    BioCro::Module_creator fast = BioCro::get_fast_solar_position_creator();
+
+    SolarTableTest() {
+        for (int hour = 0; hour < 30 * 24; ++hour) {
+            times.push_back(150 + hour / 24.0);
+            years.push_back(2023);
+        }
+    }
+
+    BioCro::Variable_settings inputs {
+        {"lat", 40.0932}, {"longitude", -88.20175}, {"time", 0},
+        {"time_zone_offset", -6}, {"year", 2023}
+    };
+
+    // Runs a module created by `creator` on the current inputs.
+    BioCro::Variable_settings evaluate(BioCro::Module_creator creator) {
+        BioCro::Variable_settings outputs;
+        for (auto& name : creator->get_outputs()) outputs[name] = 0;
+        creator->create_module(inputs, &outputs)->run();
+        return outputs;
+    }
+
+    BioCro::Scenario get_solar_scenario() {
+        return BioCro::Scenario {
+            { {"position", 0}, {"velocity", 1} },
+            { {"mass", 10}, {"spring_constant", 0.1}, {"timestep", 1},
+              {"lat", 40.0932}, {"longitude", -88.20175}, {"time_zone_offset", -6} },
+            { {"time", times}, {"year", years} },
+            {Module_factory::retrieve("solar_position_michalsky"),
+             Module_factory::retrieve("harmonic_energy")},
+            {Module_factory::retrieve("harmonic_oscillator")},
+            {"boost_rk4", 1, 0.0001, 0.0001, 200}
+        };
+    }
+};
+
+TEST_F(SolarTableTest, MatchesModules) {
+    for (BioCro::Module_creator calculation : {library, fast}) {
+        BioCro::Solar_table table {site, times, years, calculation};
+        ASSERT_EQ(table.size(), times.size());
+        EXPECT_EQ(table.get_calculation(), calculation);
+        for (size_t row = 0; row < times.size(); ++row) {
+            inputs["time"] = times[row];
+            BioCro::Variable_settings expected = evaluate(calculation);
+            ASSERT_EQ(table.get_cosine_zenith_angle(row), expected.at("cosine_zenith_angle"))
+                << "row " << row;
+            ASSERT_EQ(table.get_solar_declination(row), expected.at("solar_declination"));
+            ASSERT_EQ(table.get_hour_angle(row), expected.at("hour_angle"));
+        }
+    }
+
+    BioCro::Module_creator harmonic = Module_factory::retrieve("harmonic_energy");
+    EXPECT_THROW((BioCro::Solar_table {site, times, years, harmonic}), std::invalid_argument);
+}
+
+TEST_F(SolarTableTest, FindsRows) {
+    BioCro::Solar_table table {site, times, years, library};
+    size_t row {0};
+    EXPECT_TRUE(table.find(times[0], 2023, row));
+    EXPECT_EQ(row, 0);
+    EXPECT_TRUE(table.find(times[1], 2023, row));
+    EXPECT_EQ(row, 1);
+    EXPECT_TRUE(table.find(times[500], 2023, row));
+    EXPECT_EQ(row, 500);
+    EXPECT_TRUE(table.find(times[3], 2023, row));
+    EXPECT_EQ(row, 3);
+    EXPECT_FALSE(table.find(times[3] + 0.01, 2023, row));
+    EXPECT_FALSE(table.find(times[3], 2024, row));
+
+    // Unsorted times are searched too.
+    std::vector<double> reversed(times.rbegin(), times.rend());
+    BioCro::Solar_table reversed_table {site, reversed, years, library};
+    EXPECT_TRUE(reversed_table.find(times[0], 2023, row));
+    EXPECT_EQ(row, times.size() - 1);
+}
+
+TEST_F(SolarTableTest, CacheSharesTables) {
+    BioCro::Solar_table_cache cache;
+    auto table = cache.get_table(site, times, years, library);
+    EXPECT_EQ(cache.get_table(site, times, years, library), table);
+    EXPECT_EQ(cache.get_number_of_hits(), 1);
+    EXPECT_EQ(cache.size(), 1);
+
+    BioCro::Solar_site other_site {site.lat + 1, site.longitude, site.time_zone_offset};
+    EXPECT_NE(cache.get_table(other_site, times, years, library), table);
+    std::vector<double> other_times(times.begin(), times.begin() + 10);
+    std::vector<double> other_years(years.begin(), years.begin() + 10);
+    EXPECT_NE(cache.get_table(site, other_times, other_years, library), table);
+    std::vector<double> shifted_times = times;
+    shifted_times.back() += 1;
+    EXPECT_NE(cache.get_table(site, shifted_times, years, library), table);
+    EXPECT_NE(cache.get_table(site, times, years, fast), table);
+    EXPECT_EQ(cache.size(), 5);
+
+    BioCro::Module_creator creator = cache.get_creator(site, times, years, library);
+    EXPECT_EQ(creator, cache.get_creator(site, times, years, library));
+    EXPECT_EQ(creator->get_name(), "solar_position_table");
+}
+
+// Off the table's grid, or at a different site, the lookup module runs
+// the tabulated module instead, with the same results.
+TEST_F(SolarTableTest, LookupFallsBackToComputation) {
+    BioCro::Solar_table_cache cache;
+    for (BioCro::Module_creator calculation : {library, fast}) {
+        BioCro::Module_creator creator = cache.get_creator(site, times, years, calculation);
+        for (double time : {times[0], times[100], times[100] + 0.001, 400.0}) {
+            for (double lat : {site.lat, -10.0}) {
+                inputs["time"] = time;
+                inputs["lat"] = lat;
+                EXPECT_EQ(evaluate(creator), evaluate(calculation))
+                    << "time " << time << ", lat " << lat;
+            }
+        }
+    }
+}
+
+TEST_F(SolarTableTest, SimulationsShareTables) {
+    BioCro::Solar_table_cache cache;
+    BioCro::Scenario scenario = get_solar_scenario();
+    BioCro::Simulation_result expected = make_simulator(scenario).run_simulation();
+
+    for (int run = 0; run < 3; ++run) {
+        BioCro::Scenario tabulated = scenario;
+        BioCro::use_solar_table(tabulated, cache);
+        EXPECT_EQ(tabulated.direct_mcs[0]->get_name(), "solar_position_table");
+        EXPECT_EQ(tabulated.direct_mcs[1], scenario.direct_mcs[1]);
+        EXPECT_EQ(make_simulator(tabulated).run_simulation(), expected);
+    }
+    EXPECT_EQ(cache.size(), 1);
+    EXPECT_EQ(cache.get_number_of_hits(), 2);
+
+    // The fast approximation is tabulated only when asked for.
+    BioCro::Scenario fast_scenario = scenario;
+    fast_scenario.direct_mcs = BioCro::use_fast_solar_position(fast_scenario.direct_mcs);
+    BioCro::Scenario tabulated = scenario;
+    BioCro::use_solar_table(tabulated, cache, true);
+    EXPECT_EQ(make_simulator(tabulated).run_simulation(),
+              make_simulator(fast_scenario).run_simulation());
+    EXPECT_EQ(cache.size(), 2);
+}
+
+TEST_F(SolarTableTest, NeedsAFixedSite) {
+    BioCro::Solar_table_cache cache;
+    BioCro::Scenario scenario = get_solar_scenario();
+
+    // The site may be given by constant drivers.
+    BioCro::Scenario site_in_drivers = scenario;
+    site_in_drivers.parameters.erase("lat");
+    site_in_drivers.drivers["lat"] = std::vector<double>(times.size(), site.lat);
+    BioCro::use_solar_table(site_in_drivers, cache);
+    EXPECT_EQ(site_in_drivers.direct_mcs[0]->get_name(), "solar_position_table");
+
+    // But not by ones that vary.
+    BioCro::Scenario moving_site = site_in_drivers;
+    moving_site.direct_mcs = scenario.direct_mcs;
+    moving_site.drivers["lat"][5] += 1;
+    BioCro::use_solar_table(moving_site, cache);
+    EXPECT_EQ(moving_site.direct_mcs, scenario.direct_mcs);
+
+    BioCro::Scenario no_longitude = scenario;
+    no_longitude.parameters.erase("longitude");
+    BioCro::use_solar_table(no_longitude, cache);
+    EXPECT_EQ(no_longitude.direct_mcs, scenario.direct_mcs);
+}
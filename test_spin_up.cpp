@@ -0,0 +1,118 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "expression_module.h"
+#include "spin_up.h"
+
+/*
+ * A year of daily rows driving a fast litter pool with a seasonal
+ * input, which feeds a slow soil pool with a turnover time of about
+ * five years.  The soil pool settles at about 100, but a brute-force
+ * spin-up from 10 needs over a hundred years to get within 1e-8.
+ */
+class SpinUpTest : public ::testing::Test {
+   protected:
+    BioCro::Expression_module_creator pools {
+        "pools",
+        "litter = 0.05 * (1 + sin(season)) - 0.1 * litter\n"
+        "soil = 0.1 * litter - 0.0005 * soil",
+        true};
+
+    BioCro::Scenario get_year() {
+        std::vector<double> season(366);
+        for (size_t row = 0; row < season.size(); ++row) {
+            season[row] = 2 * std::acos(-1.0) * row / 365;
+        }
+        return BioCro::Scenario {
+            { {"litter", 0}, {"soil", 10} },
+            { {"timestep", 1} },
+            { {"season", season} },
+            {},
+            {&pools},
+            {"boost_rk4", 1, 0.0001, 0.0001, 200}
+        };
+    }
+
+    // Checks that a state is periodic: unchanged after a year.
+    void expect_periodic(BioCro::State const& state, double tolerance) {
+        BioCro::Scenario year = get_year();
+        BioCro::State end;
+        BioCro::run_scenario_rows(year, state, 0, 365, end);
+        for (auto& x : state) {
+            EXPECT_NEAR(end.at(x.first), x.second, tolerance * std::max(1.0, x.second))
+                << x.first;
+        }
+    }
+
+    void print_result(BioCro::Spin_up_result const& result) {
+        std::cout << result.cycles << " cycles, residual " << result.residual << ", soil "
+                  << result.state.at("soil") << ", litter " << result.state.at("litter")
+                  << std::endl;
+    }
+};
+
+TEST_F(SpinUpTest, NewtonKrylovFindsPeriodicState) {
+    BioCro::Spin_up_solver solver {get_year()};
+    BioCro::Spin_up_result result = solver.solve();
+    if (VERBOSE) print_result(result);
+
+    EXPECT_TRUE(result.converged);
+    EXPECT_LE(result.residual, 1e-8);
+    EXPECT_LT(result.cycles, 15);
+    EXPECT_NEAR(result.state.at("soil"), 100, 5);
+    expect_periodic(result.state, 1e-8);
+
+    // Brute force is still far off after as many cycles.
+    BioCro::State state = get_year().initial_state, end;
+    for (size_t year = 0; year < result.cycles; ++year) {
+        BioCro::run_scenario_rows(get_year(), state, 0, 365, end);
+        state = end;
+    }
+    EXPECT_GT(std::fabs(state.at("soil") - result.state.at("soil")), 10);
+}
+
+TEST_F(SpinUpTest, SolvesForSelectedQuantities) {
+    BioCro::Spin_up_settings settings;
+    settings.quantities = {"soil"};
+    BioCro::Spin_up_solver solver {get_year(), settings};
+    BioCro::Spin_up_result result = solver.solve();
+    if (VERBOSE) print_result(result);
+
+    // The litter pool settles within a cycle, so it comes along.
+    EXPECT_TRUE(result.converged);
+    EXPECT_LT(result.cycles, 10);
+    expect_periodic(result.state, 1e-8);
+}
+
+TEST_F(SpinUpTest, ExtrapolationFindsPeriodicState) {
+    BioCro::Spin_up_settings settings;
+    settings.method = BioCro::Spin_up_method::extrapolation;
+    BioCro::Spin_up_solver solver {get_year(), settings};
+    BioCro::Spin_up_result result = solver.solve();
+    if (VERBOSE) print_result(result);
+
+    EXPECT_TRUE(result.converged);
+    EXPECT_LT(result.cycles, 30);
+    expect_periodic(result.state, 1e-8);
+}
+
+TEST_F(SpinUpTest, StopsAtCycleLimit) {
+    BioCro::Spin_up_settings settings;
+    settings.method = BioCro::Spin_up_method::extrapolation;
+    settings.maximum_cycles = 3;
+    settings.tolerance = 0;
+    BioCro::Spin_up_result result = BioCro::Spin_up_solver{get_year(), settings}.solve();
+    EXPECT_FALSE(result.converged);
+    EXPECT_LE(result.cycles, 3);
+
+    settings.quantities = {"carbon"};
+    EXPECT_THROW(BioCro::Spin_up_solver(get_year(), settings), std::invalid_argument);
+}
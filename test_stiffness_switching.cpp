@@ -0,0 +1,160 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <iostream>
+
+#include "expression_module.h"
+#include "stiffness_switching.h"
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+static void print_report(BioCro::Switching_report const& report) {
+    std::cout << report.explicit_steps << " explicit steps, " << report.implicit_steps
+              << " implicit steps, " << report.rejected_steps << " rejected, "
+              << report.derivative_evaluations << " derivative evaluations" << std::endl;
+    for (auto& change : report.switches) {
+        std::cout << "  at " << change.first << " to "
+                  << (change.second ? "implicit" : "explicit") << std::endl;
+    }
+}
+
+// A non-stiff system is integrated explicitly throughout.
+TEST(StiffnessSwitchingTest, StaysExplicitWhenNotStiff) {
+    BioCro::Scenario oscillator {
+        { {"position", 0}, {"velocity", 1} },
+        { {"mass", 10}, {"spring_constant", 0.1}, {"timestep", 1} },
+        { {"time", std::vector<double>(100, 0)} },
+        {Module_factory::retrieve("harmonic_energy")},
+        {Module_factory::retrieve("harmonic_oscillator")},
+        {}
+    };
+    BioCro::Stiffness_switching_integrator integrator;
+    BioCro::Simulation_result result = integrator.integrate(oscillator);
+
+    // position = sin(w t) / w and velocity = cos(w t), with w = 0.1.
+    ASSERT_EQ(result.at("position").size(), 100);
+    for (size_t row = 0; row < 100; ++row) {
+        EXPECT_NEAR(result.at("position")[row], 10 * std::sin(0.1 * row), 1e-4);
+        EXPECT_NEAR(result.at("velocity")[row], std::cos(0.1 * row), 1e-5);
+    }
+    EXPECT_NEAR(result.at("total_energy")[99], 5, 1e-4);
+    EXPECT_EQ(result.at("time").size(), 100);
+
+    auto& report = integrator.get_report();
+    if (VERBOSE) print_report(report);
+    EXPECT_GT(report.explicit_steps, 0);
+    EXPECT_EQ(report.implicit_steps, 0);
+    EXPECT_TRUE(report.switches.empty());
+}
+
+/*
+ * x relaxes toward y, which oscillates slowly with z, at a rate that
+ * jumps from 1 to 1000 for rows 20 through 39, making the system stiff
+ * only then.
+ */
+class StiffEventTest : public ::testing::Test {
+   protected:
+    BioCro::Expression_module_creator relaxation {
+        "relaxation",
+        "x = -rate * (x - y)\n"
+        "y = -0.2 * z\n"
+        "z = 0.2 * y",
+        true};
+
+    BioCro::Scenario get_scenario() {
+        std::vector<double> rate(60, 1.0);
+        for (size_t row = 20; row < 40; ++row) rate[row] = 1000;
+        return BioCro::Scenario {
+            { {"x", 1}, {"y", 1}, {"z", 0} },
+            { {"timestep", 1} },
+            { {"rate", rate} },
+            {},
+            {&relaxation},
+            {}
+        };
+    }
+};
+
+TEST_F(StiffEventTest, SwitchesToImplicitAndBack) {
+    BioCro::Stiffness_switching_integrator automatic;
+    BioCro::Simulation_result result = automatic.integrate(get_scenario());
+    auto& report = automatic.get_report();
+    if (VERBOSE) print_report(report);
+
+    ASSERT_EQ(report.switches.size(), 2);
+    EXPECT_TRUE(report.switches[0].second);
+    EXPECT_GE(report.switches[0].first, 19);
+    EXPECT_LT(report.switches[0].first, 21);
+    EXPECT_FALSE(report.switches[1].second);
+    EXPECT_GE(report.switches[1].first, 39);
+    EXPECT_GT(report.implicit_steps, 0);
+
+    BioCro::Switching_settings settings;
+    settings.method = BioCro::Integration_method::explicit_only;
+    BioCro::Stiffness_switching_integrator explicit_only {settings};
+    BioCro::Simulation_result explicit_result = explicit_only.integrate(get_scenario());
+    if (VERBOSE) print_report(explicit_only.get_report());
+    EXPECT_TRUE(explicit_only.get_report().switches.empty());
+    EXPECT_LT(10 * report.derivative_evaluations,
+              explicit_only.get_report().derivative_evaluations);
+
+    // Both are about as accurate as the tolerances allow.
+    settings.relative_tolerance = settings.absolute_tolerance = 1e-9;
+    BioCro::Simulation_result reference =
+        BioCro::Stiffness_switching_integrator{settings}.integrate(get_scenario());
+    for (size_t row = 0; row < 60; ++row) {
+        EXPECT_NEAR(reference.at("y")[row], std::cos(0.2 * row), 1e-7);
+        EXPECT_NEAR(result.at("x")[row], reference.at("x")[row], 3e-3) << "row " << row;
+        EXPECT_NEAR(result.at("y")[row], reference.at("y")[row], 3e-3) << "row " << row;
+        EXPECT_NEAR(explicit_result.at("x")[row], reference.at("x")[row], 3e-3) << "row " << row;
+    }
+}
+
+TEST_F(StiffEventTest, ImplicitOnlyNeverSwitches) {
+    BioCro::Switching_settings settings;
+    settings.method = BioCro::Integration_method::implicit_only;
+    BioCro::Stiffness_switching_integrator integrator {settings};
+    BioCro::Simulation_result result = integrator.integrate(get_scenario());
+    auto& report = integrator.get_report();
+    EXPECT_EQ(report.explicit_steps, 0);
+    EXPECT_TRUE(report.switches.empty());
+    EXPECT_GT(report.jacobian_evaluations, 0);
+
+    // In the stiff stretch, x stays close to y = cos(0.2 t).
+    for (size_t row = 25; row < 40; ++row) {
+        EXPECT_NEAR(result.at("x")[row], std::cos(0.2 * row), 3e-3) << "row " << row;
+    }
+}
+
+// x tracks a driver that ramps up linearly, lagging it by
+// slope / rate once the start-up transient has died away.  Through the
+// time derivative of the drivers, the implicit method follows the ramp
+// even with steps far longer than 1 / rate.
+TEST(StiffnessSwitchingTest, ImplicitFollowsDrivers) {
+    BioCro::Expression_module_creator tracking {"tracking", "x = -1000 * (x - ramp)", true};
+    std::vector<double> ramp(30);
+    for (size_t row = 0; row < ramp.size(); ++row) ramp[row] = 0.5 * row;
+    BioCro::Scenario scenario {
+        { {"x", 0} },
+        { {"timestep", 1} },
+        { {"ramp", ramp} },
+        {},
+        {&tracking},
+        {}
+    };
+
+    BioCro::Switching_settings settings;
+    settings.method = BioCro::Integration_method::implicit_only;
+    BioCro::Stiffness_switching_integrator integrator {settings};
+    BioCro::Simulation_result result = integrator.integrate(scenario);
+    if (VERBOSE) print_report(integrator.get_report());
+
+    for (size_t row = 1; row < ramp.size(); ++row) {
+        EXPECT_NEAR(result.at("x")[row], ramp[row] - 0.5 / 1000, 1e-4) << "row " << row;
+    }
+}
@@ -0,0 +1,165 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include "expression_module.h"
+#include "subsystem_splitting.h"
+
+/*
+ * A crop in miniature: phenology driven by temperature, a stiff water
+ * balance that tracks rainfall closely, and coupled leaf and root
+ * pools that grow according to both through a direct growth index.
+ */
+class SubsystemSplittingTest : public ::testing::Test {
+   protected:
+    BioCro::Expression_module_creator phenology {"phenology", "dev = 0.01 * temp", true};
+    BioCro::Expression_module_creator water_balance {
+        "water_balance", "water = 40 * (rain - water)", true};
+    BioCro::Expression_module_creator growth_index {
+        "growth_index", "growth_index = dev * water", false};
+    BioCro::Expression_module_creator carbon {
+        "carbon",
+        "leaf = 0.05 * growth_index - 0.02 * leaf + 0.001 * root\n"
+        "root = 0.3 * leaf - 0.05 * root",
+        true};
+
+    BioCro::Scenario get_scenario() {
+        std::vector<double> temp(201), rain(201);
+        for (size_t row = 0; row < rain.size(); ++row) {
+            temp[row] = 20 + 5 * std::sin(2 * std::acos(-1.0) * row / 200);
+            rain[row] = 1 + 0.5 * std::sin(2 * std::acos(-1.0) * row / 50);
+        }
+        return BioCro::Scenario {
+            { {"dev", 0}, {"water", 1}, {"leaf", 0.1}, {"root", 0.1} },
+            { {"timestep", 1} },
+            { {"temp", temp}, {"rain", rain} },
+            {&growth_index},
+            {&phenology, &water_balance, &carbon},
+            {}
+        };
+    }
+
+    BioCro::Simulation_result get_reference() {
+        BioCro::Switching_settings settings;
+        settings.relative_tolerance = settings.absolute_tolerance = 1e-10;
+        return BioCro::Stiffness_switching_integrator{settings}.integrate(get_scenario());
+    }
+
+    static BioCro::Splitting_settings get_accurate_settings() {
+        BioCro::Splitting_settings settings;
+        settings.switching.relative_tolerance = settings.switching.absolute_tolerance = 1e-8;
+        return settings;
+    }
+
+    void expect_near(BioCro::Simulation_result const& result,
+                     BioCro::Simulation_result const& expected, double tolerance) {
+        ASSERT_EQ(result.size(), expected.size());
+        for (auto& column : expected) {
+            auto& values = result.at(column.first);
+            for (size_t row = 0; row < values.size(); ++row) {
+                ASSERT_NEAR(values[row], column.second[row],
+                            tolerance * std::max(1.0, std::fabs(column.second[row])))
+                    << column.first << " at row " << row;
+            }
+        }
+    }
+};
+
+TEST_F(SubsystemSplittingTest, FindsCoupledBlocks) {
+    BioCro::Scenario scenario = get_scenario();
+    BioCro::Module_dependencies dependencies {
+        {"dev", "water", "leaf", "root"}, scenario.direct_mcs, scenario.differential_mcs};
+    EXPECT_EQ(dependencies.get_reads("leaf"), (BioCro::Variable_set {"dev", "water", "leaf", "root"}));
+    EXPECT_EQ(dependencies.get_reads("dev"), BioCro::Variable_set {});
+
+    std::vector<BioCro::Variable_names> blocks = dependencies.find_coupled_blocks();
+    ASSERT_EQ(blocks.size(), 3);
+    EXPECT_EQ(blocks[0], BioCro::Variable_names {"dev"});
+    EXPECT_EQ(blocks[1], BioCro::Variable_names {"water"});
+    EXPECT_EQ(blocks[2], (BioCro::Variable_names {"leaf", "root"}));
+}
+
+TEST_F(SubsystemSplittingTest, AgreesWithWholeSystem) {
+    BioCro::Subsystem_splitting_integrator integrator {get_accurate_settings()};
+    auto start = std::chrono::steady_clock::now();
+    BioCro::Simulation_result result = integrator.integrate(get_scenario());
+    std::chrono::duration<double> split_time = std::chrono::steady_clock::now() - start;
+
+    EXPECT_EQ(integrator.get_blocks().size(), 3);
+    EXPECT_EQ(integrator.get_number_of_iterations(), 1);
+    EXPECT_TRUE(integrator.has_converged());
+    EXPECT_LE(integrator.get_interpolation_error(), 1e-4);
+
+    // Refining the grid keeps the interpolation of the driving
+    // trajectories within its tolerance.
+    BioCro::Simulation_result reference = get_reference();
+    expect_near(result, reference, 1e-4);
+
+    if (VERBOSE) {
+        BioCro::Switching_settings settings;
+        settings.relative_tolerance = settings.absolute_tolerance = 1e-8;
+        start = std::chrono::steady_clock::now();
+        BioCro::Stiffness_switching_integrator{settings}.integrate(get_scenario());
+        std::chrono::duration<double> whole_time = std::chrono::steady_clock::now() - start;
+        std::cout << "split: " << split_time.count() << " s; whole: " << whole_time.count()
+                  << " s" << std::endl;
+    }
+}
+
+// Splitting the leaf and root pools apart makes the leaf block read a
+// later block, so the sweeps are repeated until they settle.
+TEST_F(SubsystemSplittingTest, RelaxesFeedback) {
+    BioCro::Splitting_settings settings = get_accurate_settings();
+    settings.blocks = {{"dev"}, {"water"}, {"leaf"}, {"root"}};
+    settings.tolerance = 1e-9;
+    BioCro::Subsystem_splitting_integrator integrator {settings};
+    BioCro::Simulation_result result = integrator.integrate(get_scenario());
+
+    auto& changes = integrator.get_changes();
+    if (VERBOSE) {
+        for (double change : changes) std::cout << change << ' ';
+        std::cout << std::endl;
+    }
+    EXPECT_GT(changes.size(), 2);
+    EXPECT_TRUE(integrator.has_converged());
+    EXPECT_LT(changes.back(), changes[1]);
+
+    // Leaf and root now see each other's trajectories interpolated
+    // linearly, which at the scenario's rows alone would cost about
+    // 3e-3 of root's value; the refined grid brings the error within
+    // the interpolation tolerance.
+    EXPECT_GT(integrator.get_substeps(), 1);
+    EXPECT_LE(integrator.get_interpolation_error(), 1e-4);
+    expect_near(result, get_reference(), 1e-4);
+
+    settings.maximum_substeps = 1;
+    BioCro::Subsystem_splitting_integrator unrefined {settings};
+    BioCro::Simulation_result rough = unrefined.integrate(get_scenario());
+    EXPECT_FALSE(unrefined.has_converged());
+    EXPECT_GT(std::fabs(rough.at("root")[11] - result.at("root")[11]), 1e-3);
+}
+
+TEST_F(SubsystemSplittingTest, UsesBlockSolvers) {
+    BioCro::Splitting_settings settings = get_accurate_settings();
+    settings.block_solvers["dev"] = {"boost_rk4", 1, 1e-4, 1e-4, 200};
+    BioCro::Simulation_result result =
+        BioCro::Subsystem_splitting_integrator{settings}.integrate(get_scenario());
+    expect_near(result, get_reference(), 1e-4);
+}
+
+TEST_F(SubsystemSplittingTest, ChecksBlocks) {
+    BioCro::Splitting_settings settings;
+    settings.blocks = {{"dev"}, {"water"}, {"leaf"}};
+    EXPECT_THROW(BioCro::Subsystem_splitting_integrator{settings}.integrate(get_scenario()),
+                 std::invalid_argument);
+    settings.blocks = {{"dev", "water"}, {"water", "leaf", "root"}};
+    EXPECT_THROW(BioCro::Subsystem_splitting_integrator{settings}.integrate(get_scenario()),
+                 std::invalid_argument);
+}
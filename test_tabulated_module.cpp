@@ -0,0 +1,157 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <iostream>
+
+#include "expression_module.h"
+#include "tabulated_module.h"
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+// Runs a module made by `creator` at the given inputs.
+static BioCro::Variable_settings run_tabulation_module(BioCro::Module_creator creator,
+                                                       BioCro::Variable_settings inputs) {
+    for (auto& name : creator->get_outputs()) inputs[name] = 0;
+    creator->create_module(inputs, &inputs)->run();
+    return inputs;
+}
+
+// Multilinear interpolation reproduces a bilinear function exactly.
+TEST(TabulatedModuleTest, ReproducesBilinearFunctions) {
+    BioCro::Expression_module_creator bilinear {"bilinear", "z = 2 * a + 3 * b - a * b + 1"};
+    BioCro::Tabulated_module_creator surrogate {&bilinear, {{"a", -1, 1, 3}, {"b", 0, 10, 6}}};
+    EXPECT_EQ(surrogate.get_name(), "tabulated_bilinear");
+    EXPECT_EQ(surrogate.get_table()->get_number_of_points(), 18);
+    EXPECT_NEAR(surrogate.get_table()->get_maximum_error(), 0, 1e-13);
+
+    for (double a = -1; a <= 1; a += 0.07) {
+        for (double b = 0; b <= 10; b += 0.3) {
+            EXPECT_NEAR(run_tabulation_module(&surrogate, {{"a", a}, {"b", b}}).at("z"),
+                        2 * a + 3 * b - a * b + 1, 1e-12);
+        }
+    }
+}
+
+// The grid is refined until the estimated error meets the tolerance,
+// and the estimate reflects the actual error.
+TEST(TabulatedModuleTest, RefinesToTolerance) {
+    BioCro::Expression_module_creator wave {"wave", "y = sin(a) * exp(-b)"};
+    BioCro::Tabulation_settings settings;
+    settings.tolerance = 1e-4;
+    settings.number_of_threads = 2;
+    BioCro::Tabulated_module_creator surrogate {
+        &wave, {{"a", 0, 3, 4}, {"b", 0, 1, 2}}, {}, settings};
+
+    auto table = surrogate.get_table();
+    EXPECT_GT(table->get_axes()[0].points, 4);
+    EXPECT_LE(table->get_maximum_error(), 1e-4);
+    EXPECT_GT(table->get_maximum_error(), 0);
+
+    double actual_error {0.0};
+    for (double a = 0; a <= 3; a += 0.011) {
+        for (double b = 0; b <= 1; b += 0.013) {
+            double error = std::fabs(run_tabulation_module(&surrogate, {{"a", a}, {"b", b}}).at("y") -
+                                     std::sin(a) * std::exp(-b));
+            if (error > actual_error) actual_error = error;
+        }
+    }
+    if (VERBOSE) {
+        std::cout << table->get_number_of_points() << " points; estimated error "
+                  << table->get_maximum_error() << ", actual error " << actual_error
+                  << std::endl;
+    }
+    EXPECT_LE(actual_error, 1.5 * table->get_maximum_error());
+
+    // Refinement stops at the point limit, and the error is reported
+    // anyway.
+    settings.maximum_points = 100;
+    BioCro::Tabulated_module_creator coarse {
+        &wave, {{"a", 0, 3, 4}, {"b", 0, 1, 2}}, {}, settings};
+    EXPECT_LE(coarse.get_table()->get_number_of_points(), 100);
+    EXPECT_GT(coarse.get_table()->get_maximum_error(), 1e-4);
+
+    // A grid whose check alone would pass the limit is rejected before
+    // the module is ever run.
+    settings.maximum_points = 20;
+    EXPECT_THROW((BioCro::Tabulated_module_creator {
+                     &wave, {{"a", 0, 3, 4}, {"b", 0, 1, 2}}, {}, settings}),
+                 std::invalid_argument);
+    settings.maximum_points = 1000;
+    EXPECT_THROW((BioCro::Tabulated_module_creator {
+                     &wave, {{"a", 0, 3, 1u << 20}, {"b", 0, 1, 1u << 20}}, {}, settings}),
+                 std::invalid_argument);
+}
+
+// Outside the table, or with a fixed input changed, the original
+// module is run.
+TEST(TabulatedModuleTest, FallsBackToOriginalModule) {
+    BioCro::Expression_module_creator wave {"wave", "y = sin(a) * exp(-b)"};
+    BioCro::Tabulated_module_creator surrogate {&wave, {{"a", 0, 3, 4}}, {{"b", 0.5}}};
+
+    double inside = run_tabulation_module(&surrogate, {{"a", 1.3}, {"b", 0.5}}).at("y");
+    EXPECT_NE(inside, std::sin(1.3) * std::exp(-0.5));
+    EXPECT_EQ(run_tabulation_module(&surrogate, {{"a", 4}, {"b", 0.5}}).at("y"),
+              run_tabulation_module(&wave, {{"a", 4}, {"b", 0.5}}).at("y"));
+    EXPECT_EQ(run_tabulation_module(&surrogate, {{"a", 1}, {"b", 0.25}}).at("y"),
+              run_tabulation_module(&wave, {{"a", 1}, {"b", 0.25}}).at("y"));
+}
+
+TEST(TabulatedModuleTest, ChecksAxes) {
+    BioCro::Expression_module_creator wave {"wave", "y = sin(a) * exp(-b)"};
+    using BioCro::Tabulated_module_creator;
+    EXPECT_THROW(Tabulated_module_creator(&wave, {}), std::invalid_argument);
+    EXPECT_THROW(Tabulated_module_creator(&wave, {{"c", 0, 1, 3}, {"b", 0, 1, 3}}),
+                 std::invalid_argument);
+    EXPECT_THROW(Tabulated_module_creator(&wave, {{"a", 0, 1, 1}, {"b", 0, 1, 3}}),
+                 std::invalid_argument);
+    EXPECT_THROW(Tabulated_module_creator(&wave, {{"a", 1, 0, 3}, {"b", 0, 1, 3}}),
+                 std::invalid_argument);
+    // Every input must be tabulated or fixed.
+    EXPECT_THROW(Tabulated_module_creator(&wave, {{"a", 0, 1, 3}}), std::invalid_argument);
+}
+
+// A simulation using a surrogate for a direct module matches the
+// original within the reported error.
+TEST(TabulatedModuleTest, SimulatesWithSurrogate) {
+    BioCro::Module_creator energy = Module_factory::retrieve("harmonic_energy");
+    BioCro::Tabulation_settings settings;
+    settings.tolerance = 1e-3;
+    BioCro::Tabulated_module_creator surrogate {
+        energy,
+        {{"position", -11, 11, 5}, {"velocity", -1.1, 1.1, 5}},
+        {{"mass", 10}, {"spring_constant", 0.1}},
+        settings};
+
+    auto run = [](BioCro::Module_creator direct) {
+        BioCro::Simulator simulator {
+            { {"position", 0}, {"velocity", 1} },
+            { {"mass", 10}, {"spring_constant", 0.1}, {"timestep", 1} },
+            { {"time", std::vector<double>(100, 0)} },
+            {direct},
+            {Module_factory::retrieve("harmonic_oscillator")},
+            "boost_rk4",
+            1,
+            0.0001,
+            0.0001,
+            200
+        };
+        return simulator.run_simulation();
+    };
+    BioCro::Simulation_result expected = run(energy);
+    BioCro::Simulation_result result = run(&surrogate);
+
+    EXPECT_EQ(result.at("position"), expected.at("position"));
+    auto& error = surrogate.get_table()->get_error_estimate();
+    for (auto& name : {"kinetic_energy", "spring_energy", "total_energy"}) {
+        ASSERT_LE(error.at(name), 1e-3);
+        for (size_t row = 0; row < result.at(name).size(); ++row) {
+            ASSERT_NEAR(result.at(name)[row], expected.at(name)[row], 1.5 * error.at(name))
+                << name << " at row " << row;
+        }
+    }
+}
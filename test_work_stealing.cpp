@@ -0,0 +1,131 @@
+// Compile with the flag -DVERBOSE=true to get verbose output.
+#ifndef VERBOSE
+#define VERBOSE false
+#endif
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+
+#include "ensemble.h"
+#include "work_stealing.h"
+
+using Module_factory = BioCro::Standard_BioCro_library_module_factory;
+
+TEST(TimingHistoryTest, AveragesDurations) {
+    BioCro::Timing_history<std::string> history {0.5};
+
+    // With no history at all, every job is alike.
+    EXPECT_DOUBLE_EQ(history.get_expected_duration("a"), 1);
+
+    history.record("a", 4);
+    history.record("b", 2);
+    EXPECT_TRUE(history.has("a"));
+    EXPECT_FALSE(history.has("c"));
+    EXPECT_DOUBLE_EQ(history.get_expected_duration("a"), 4);
+
+    history.record("a", 2);
+    EXPECT_DOUBLE_EQ(history.get_expected_duration("a"), 3);
+
+    // An unknown job is expected to take the average time.
+    EXPECT_DOUBLE_EQ(history.get_expected_duration("c"), 2.5);
+}
+
+// With a single thread, jobs run strictly in order of decreasing
+// expected duration, ties in index order.
+TEST(WorkStealingExecutorTest, StartsLongestJobsFirst) {
+    BioCro::Work_stealing_executor executor {1};
+    std::vector<size_t> order;
+    executor.run({1, 5, 3, 5, 0.5},
+                 [&order](size_t job, size_t) { order.push_back(job); });
+    EXPECT_EQ(order, std::vector<size_t>({1, 3, 2, 0, 4}));
+}
+
+// Job 0 can finish only after every other job has finished.  Half of
+// the other jobs start out queued behind job 0, so the run completes
+// only if another thread steals them.
+TEST(WorkStealingExecutorTest, IdleThreadsStealWork) {
+    const size_t number_of_jobs {20};
+    BioCro::Work_stealing_executor executor {2};
+    std::atomic<size_t> finished {0};
+    bool timed_out {false};
+
+    executor.run(
+        std::vector<double>(number_of_jobs, 1.0),
+        [&](size_t job, size_t) {
+            if (job == 0) {
+                auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+                while (finished < number_of_jobs - 1) {
+                    if (std::chrono::steady_clock::now() > deadline) {
+                        timed_out = true;
+                        break;
+                    }
+                    std::this_thread::yield();
+                }
+            }
+            ++finished;
+        });
+
+    ASSERT_FALSE(timed_out);
+    EXPECT_EQ(finished, number_of_jobs);
+}
+
+TEST(WorkStealingExecutorTest, RethrowsJobExceptions) {
+    BioCro::Work_stealing_executor executor {3};
+    std::atomic<int> finished {0};
+    EXPECT_THROW(executor.run(std::vector<double>(30, 1.0),
+                              [&finished](size_t job, size_t) {
+                                  if (job == 7) throw std::runtime_error("job failed");
+                                  ++finished;
+                              }),
+                 std::runtime_error);
+    EXPECT_EQ(finished, 29);
+}
+
+/*
+ * Running an ensemble in parallel gives the same results as running it
+ * sequentially, and records how long each member took.
+ */
+class ParallelEnsembleTest : public ::testing::Test {
+   protected:
+    ParallelEnsembleTest() {
+        for (int i = 0; i < 24; ++i) {
+            ensemble_parameters.add_member({10.0 + i, 0.1 * (1 + i % 5)});
+        }
+    }
+
+    BioCro::Ensemble_parameters ensemble_parameters {
+        { {"mass", 10}, {"spring_constant", 0.1}, {"timestep", 1} },
+        {"mass", "spring_constant"}
+    };
+
+    BioCro::Ensemble_simulator get_ensemble_simulator() {
+        return BioCro::Ensemble_simulator {
+            { {"position", 0}, {"velocity", 1} },
+            ensemble_parameters,
+            { {"time", std::vector<double>(200, 0)} },
+            {Module_factory::retrieve("harmonic_energy")},
+            {Module_factory::retrieve("harmonic_oscillator")},
+            "boost_rkck54",
+            1,
+            0.0001,
+            0.0001,
+            200
+        };
+    }
+};
+
+TEST_F(ParallelEnsembleTest, MatchesSequentialRun) {
+    BioCro::Ensemble_simulator ensemble = get_ensemble_simulator();
+    std::vector<BioCro::Simulation_result> expected = ensemble.run_simulation();
+
+    EXPECT_EQ(ensemble.get_member_timings().size(), 0);
+    for (int repetition = 0; repetition < 2; ++repetition) {
+        std::vector<BioCro::Simulation_result> results = ensemble.run_simulation_in_parallel(4);
+        ASSERT_EQ(results.size(), expected.size());
+        for (size_t member = 0; member < results.size(); ++member) {
+            EXPECT_EQ(results[member], expected[member]) << "member " << member;
+        }
+        EXPECT_EQ(ensemble.get_member_timings().size(), ensemble.size());
+    }
+}
@@ -0,0 +1,146 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>           // for std::max
+#include <atomic>
+#include <condition_variable>
+#include <exception>           // for std::exception_ptr
+#include <functional>          // for std::function
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace BioCro {
+
+/**
+ * A Thread_pool is a small, fixed set of threads for running batches
+ * of independent tasks.  A call to run hands out the tasks of one
+ * batch to the pool's worker threads and to the calling thread, and
+ * returns once every task has finished.  The threads are started once,
+ * when the pool is constructed, so a batch costs only a wake-up rather
+ * than a thread launch.
+ *
+ * If a task throws, the remaining tasks of the batch still run and the
+ * first exception thrown is rethrown by run.
+ *
+ * Code that might itself be run as a task can call is_running_task to
+ * avoid starting more threads of its own.
+ */
+class Thread_pool
+{
+   public:
+    // Makes a pool that runs tasks on `number_of_threads` threads in
+    // all, counting the thread that calls run.
+    explicit Thread_pool(size_t number_of_threads)
+    {
+        for (size_t i = 1; i < std::max<size_t>(number_of_threads, 1); ++i) {
+            workers.emplace_back([this] { work(); });
+        }
+    }
+
+    Thread_pool(Thread_pool const&) = delete;
+    Thread_pool& operator=(Thread_pool const&) = delete;
+
+    ~Thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        work_available.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    size_t size() const { return workers.size() + 1; }
+
+    // Checks whether the calling thread is running a task for any
+    // Thread_pool.
+    static bool is_running_task() { return running_task(); }
+
+    // Runs task(0), ..., task(number_of_tasks - 1), in no particular
+    // order and possibly concurrently.
+    void run(size_t number_of_tasks, std::function<void(size_t)> const& task)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        current_task = &task;
+        batch_size = number_of_tasks;
+        next_task = 0;
+        busy_workers = workers.size();
+        ++generation;
+        lock.unlock();
+        work_available.notify_all();
+
+        do_tasks();
+
+        lock.lock();
+        work_done.wait(lock, [this] { return busy_workers == 0; });
+        current_task = nullptr;
+        if (error) {
+            std::exception_ptr e;
+            std::swap(e, error);
+            std::rethrow_exception(e);
+        }
+    }
+
+   private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::condition_variable work_done;
+
+    // The current batch.  These are set by run while it holds the
+    // mutex, before the generation is advanced.
+    std::function<void(size_t)> const* current_task {nullptr};
+    size_t batch_size {0};
+    std::atomic<size_t> next_task {0};
+    size_t busy_workers {0};
+    unsigned long generation {0};
+    bool stopping {false};
+    std::exception_ptr error;
+
+    void work()
+    {
+        unsigned long last_generation {0};
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                work_available.wait(lock, [&] {
+                    return stopping || generation != last_generation;
+                });
+                if (stopping) return;
+                last_generation = generation;
+            }
+            do_tasks();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--busy_workers == 0) work_done.notify_one();
+            }
+        }
+    }
+
+    static bool& running_task()
+    {
+        static thread_local bool flag {false};
+        return flag;
+    }
+
+    void do_tasks()
+    {
+        bool const was_running_task = running_task();
+        running_task() = true;
+        size_t i;
+        while ((i = next_task++) < batch_size) {
+            try {
+                (*current_task)(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error) error = std::current_exception();
+            }
+        }
+        running_task() = was_running_task;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef WORK_STEALING_H
+#define WORK_STEALING_H
+
+#include <algorithm>   // for std::stable_sort, std::max
+#include <chrono>
+#include <deque>
+#include <exception>   // for std::exception_ptr
+#include <functional>  // for std::function
+#include <map>
+#include <mutex>
+#include <numeric>     // for std::iota
+#include <thread>
+#include <vector>
+
+namespace BioCro {
+
+/**
+ * A Timing_history remembers how long jobs took, so that the next run
+ * of the same jobs can start the longest ones first.  Jobs are
+ * identified by a key of type Key: a member index for an ensemble, for
+ * example, or a job id for a batch.
+ *
+ * The expected duration of a job is an exponentially weighted average
+ * of its recorded durations.  A job with no history is expected to
+ * take as long as the average job that has one.
+ */
+template <typename Key>
+class Timing_history
+{
+   public:
+    // `weight` is the weight given to the newest duration.
+    explicit Timing_history(double weight = 0.5) : weight{weight} {}
+
+    void record(Key const& key, double seconds)
+    {
+        auto entry = expected.find(key);
+        if (entry == expected.end()) {
+            expected.emplace(key, seconds);
+            total += seconds;
+        } else {
+            double updated = weight * seconds + (1 - weight) * entry->second;
+            total += updated - entry->second;
+            entry->second = updated;
+        }
+    }
+
+    bool has(Key const& key) const { return expected.count(key) > 0; }
+
+    size_t size() const { return expected.size(); }
+
+    double get_expected_duration(Key const& key) const
+    {
+        auto entry = expected.find(key);
+        if (entry != expected.end()) return entry->second;
+        return expected.empty() ? 1.0 : total / expected.size();
+    }
+
+   private:
+    double weight;
+    std::map<Key, double> expected;
+    double total {0};
+};
+
+/**
+ * A Work_stealing_executor runs a set of independent jobs of very
+ * different lengths on a fixed number of threads.
+ *
+ * The jobs are sorted by expected duration, longest first, and dealt
+ * out in turn to per-thread queues.  Each thread takes jobs from the
+ * front of its own queue, so it works through its longest jobs first.
+ * A thread whose queue is empty steals a job from the back of another
+ * thread's queue, where the shortest remaining jobs are, so the short
+ * jobs fill the gaps left by long ones.  Starting long jobs early and
+ * balancing the rest dynamically means that the whole set finishes
+ * close to (total work) / (number of threads) after it starts, even if
+ * the expected durations are only rough.
+ *
+ * Each queue has its own lock, which is held only long enough to push
+ * or pop one job index, so threads rarely contend.
+ */
+class Work_stealing_executor
+{
+   public:
+    explicit Work_stealing_executor(size_t number_of_threads)
+        : number_of_threads{std::max<size_t>(number_of_threads, 1)} {}
+
+    size_t get_number_of_threads() const { return number_of_threads; }
+
+    /**
+     * Runs job(i, worker) for each i in [0, expected_durations.size()),
+     * where `worker` in [0, get_number_of_threads()) identifies the
+     * thread running the job (so that jobs can use per-thread scratch
+     * space).  Returns the measured duration of each job in seconds.
+     *
+     * If any job throws, the other jobs still run, and the first
+     * exception thrown is rethrown once all threads have finished.
+     */
+    std::vector<double> run(std::vector<double> const& expected_durations,
+                            std::function<void(size_t, size_t)> const& job)
+    {
+        size_t number_of_jobs = expected_durations.size();
+        std::vector<size_t> order(number_of_jobs);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return expected_durations[a] > expected_durations[b];
+        });
+
+        std::vector<Job_queue> queues(number_of_threads);
+        for (size_t i = 0; i < number_of_jobs; ++i) {
+            queues[i % number_of_threads].jobs.push_back(order[i]);
+        }
+
+        std::vector<double> durations(number_of_jobs, 0.0);
+        std::exception_ptr error;
+        std::mutex error_mutex;
+
+        auto work = [&](size_t worker) {
+            size_t i;
+            while (take(queues, worker, i)) {
+                auto start = std::chrono::steady_clock::now();
+                try {
+                    job(i, worker);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(error_mutex);
+                    if (!error) error = std::current_exception();
+                }
+                durations[i] = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - start).count();
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (size_t worker = 1; worker < number_of_threads; ++worker) {
+            threads.emplace_back(work, worker);
+        }
+        work(0);
+        for (auto& thread : threads) thread.join();
+
+        if (error) std::rethrow_exception(error);
+        return durations;
+    }
+
+   private:
+    struct Job_queue {
+        std::mutex mutex;
+        std::deque<size_t> jobs;
+    };
+
+    size_t number_of_threads;
+
+    // Takes the next job for `worker`: from the front of its own
+    // queue if possible, otherwise from the back of another queue.
+    // Returns false once every queue is empty; since no jobs are added
+    // during a run, the worker can then stop.
+    static bool take(std::vector<Job_queue>& queues, size_t worker, size_t& job)
+    {
+        {
+            Job_queue& own = queues[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.jobs.empty()) {
+                job = own.jobs.front();
+                own.jobs.pop_front();
+                return true;
+            }
+        }
+        for (size_t k = 1; k < queues.size(); ++k) {
+            Job_queue& victim = queues[(worker + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.jobs.empty()) {
+                job = victim.jobs.back();
+                victim.jobs.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+}
+
+#endif